@@ -0,0 +1,135 @@
+#include "CommandBuffer.h"
+
+// ---------------------------------------------------------------
+float GetViewDepth(const PVRTMat4& mxView, const PVRTVec3& vWorld)
+	{
+	const float* f = mxView.f;
+	return -(f[2] * vWorld.x + f[6] * vWorld.y + f[10] * vWorld.z + f[14]);
+	}
+
+// ---------------------------------------------------------------
+void RadixSort64(unsigned long long* pullKeys, unsigned long long* pullTemp, unsigned int uiCount)
+	{
+	if(uiCount < 2)
+		return;
+
+	unsigned long long* pullSrc = pullKeys;
+	unsigned long long* pullDst = pullTemp;
+	for(unsigned int uiShift = 0; uiShift < 64; uiShift += 8)
+		{
+		unsigned int auiOffset[256];
+		memset(auiOffset, 0, sizeof(auiOffset));
+		for(unsigned int i = 0; i < uiCount; ++i)
+			++auiOffset[(pullSrc[i] >> uiShift) & 0xFF];
+		if(auiOffset[(pullSrc[0] >> uiShift) & 0xFF] == uiCount)
+			continue;
+
+		unsigned int uiTotal = 0;
+		for(unsigned int b = 0; b < 256; ++b)
+			{
+			unsigned int uiBucket = auiOffset[b];
+			auiOffset[b] = uiTotal;
+			uiTotal += uiBucket;
+			}
+		for(unsigned int i = 0; i < uiCount; ++i)
+			pullDst[auiOffset[(pullSrc[i] >> uiShift) & 0xFF]++] = pullSrc[i];
+
+		unsigned long long* pullSwap = pullSrc;
+		pullSrc = pullDst;
+		pullDst = pullSwap;
+		}
+	if(pullSrc != pullKeys)
+		memcpy(pullKeys, pullSrc, uiCount * sizeof(unsigned long long));
+	}
+
+// ---------------------------------------------------------------
+unsigned int CCommandBuffer::GetTextureSetSlot(const unsigned int* puiTextures)
+	{
+	for(unsigned int i = 0; i < m_uiNumTextureSets; ++i)
+		{
+		if(!memcmp(m_aauiTextureSets[i], puiTextures, sizeof(m_aauiTextureSets[i])))
+			return i;
+		}
+	if(m_uiNumTextureSets == CMD_MAX_TEXTURE_SETS)
+		return CMD_MAX_TEXTURE_SETS - 1;
+	memcpy(m_aauiTextureSets[m_uiNumTextureSets], puiTextures, sizeof(m_aauiTextureSets[0]));
+	return m_uiNumTextureSets++;
+	}
+
+// ---------------------------------------------------------------
+void CCommandBuffer::Add(const DrawPacket& Packet, unsigned int uiLayer, float fDepth)
+	{
+	// Sized for every node and its reflection, so it shouldn't fill up
+	ASSERT(m_uiNumPackets < CMD_MAX_PACKETS);
+	if(m_uiNumPackets == CMD_MAX_PACKETS)
+		return;
+
+	// A positive float's bits sort the same way as its value. The top 24 are plenty to order the draws by.
+	float fClamped = PVRT_MAX(fDepth, 0.0f);
+	unsigned int uiBits;
+	memcpy(&uiBits, &fClamped, sizeof(uiBits));
+	unsigned long long ullDepth = uiBits >> 7;
+
+	unsigned long long ullProgram = Packet.uiEffect;
+	unsigned long long ullTextures = GetTextureSetSlot(Packet.auiTextures);
+	unsigned long long ullKey = (unsigned long long)uiLayer << 60;
+	if(uiLayer == enumCMDLAYER_Blended)
+		ullKey |= ((~ullDepth & 0xFFFFFF) << 36) | (ullProgram << 28) | (ullTextures << 20);		// Back to front first
+	else
+		ullKey |= (ullProgram << 52) | (ullTextures << 44) | (ullDepth << 20);					// Fewest changes first
+
+	m_aullKeys[m_uiNumPackets] = ullKey | m_uiNumPackets;
+	m_aPackets[m_uiNumPackets++] = Packet;
+	}
+
+// ---------------------------------------------------------------
+void CCommandBuffer::Sort(bool bSort)
+	{
+	if(bSort)
+		{
+		RadixSort64(m_aullKeys, m_aullTemp, m_uiNumPackets);
+		for(unsigned int i = 0; i < m_uiNumPackets; ++i)
+			m_auiOrder[i] = (unsigned int)(m_aullKeys[i] & 0xFFFFF);
+		}
+	else
+		{
+		for(unsigned int i = 0; i < m_uiNumPackets; ++i)
+			m_auiOrder[i] = i;				// As recorded
+		}
+	CountChanges();
+	}
+
+// ---------------------------------------------------------------
+void CCommandBuffer::CountChanges()
+	{
+	// What executing in this order asks for, against the packet before. The GL state cache's counters say what got through.
+	unsigned int auiStats[enumCMDSTAT_MAX];
+	memset(auiStats, 0, sizeof(auiStats));
+	unsigned int auiBound[CMD_TEXTURE_UNITS];
+	memset(auiBound, 0, sizeof(auiBound));
+	const DrawPacket* pPrev = NULL;
+	for(unsigned int i = 0; i < m_uiNumPackets; ++i)
+		{
+		const DrawPacket& Packet = GetPacket(i);
+		++auiStats[enumCMDSTAT_Draws];
+		if(!pPrev || Packet.uiEffect != pPrev->uiEffect)
+			++auiStats[enumCMDSTAT_Programs];
+		for(unsigned int u = 0; u < CMD_TEXTURE_UNITS; ++u)
+			{
+			if(Packet.auiTextures[u] && Packet.auiTextures[u] != auiBound[u])
+				{
+				auiBound[u] = Packet.auiTextures[u];
+				++auiStats[enumCMDSTAT_Textures];
+				}
+			}
+		if(pPrev && (Packet.eCullFace != pPrev->eCullFace || Packet.bBlend != pPrev->bBlend))
+			++auiStats[enumCMDSTAT_States];
+		pPrev = &Packet;
+		}
+
+	for(unsigned int i = 0; i < enumCMDSTAT_MAX; ++i)
+		{
+		m_auiFrame[i] += auiStats[i];
+		m_auiTotal[i] += auiStats[i];
+		}
+	}
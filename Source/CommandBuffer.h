@@ -0,0 +1,145 @@
+#ifndef _COMMANDBUFFER_H_
+#define _COMMANDBUFFER_H_
+
+#include "SceneGraph.h"
+
+// Passes record their draws as packets rather than issuing them, and a 64 bit key is made for each from what it sets:
+// its layer, effect, textures and distance. Executing in key order groups the draws that share a program and textures,
+// draws opaque ones front to back within those groups, and blended ones back to front after everything opaque.
+// Packets name their effect, textures and uniforms rather than holding GL objects, so the software rasterizer can run
+// them without a context.
+#define CMD_MAX_PACKETS			(2 * SCENE_MAX_NODES)	// Every node, and its reflection
+#define CMD_MAX_UNIFORMS		6						// Per packet
+#define CMD_TEXTURE_UNITS		4
+#define CMD_MAX_TEXTURE_SETS	256						// The key has 8 bits for these. Any past them share the last slot.
+#define CMD_MAX_EFFECTS			256						// And 8 for the effect
+
+// What a packet's texture unit is bound to
+enum enumCMDTEXTURE
+	{
+	enumCMDTEXTURE_None,				// Keep whatever the caller bound
+	enumCMDTEXTURE_ShadowMap,
+	enumCMDTEXTURE_Reflection,
+	enumCMDTEXTURE_File,				// enumTEXTURE from here on, see CMD_TEXTURE
+	};
+#define CMD_TEXTURE(uiTexture)	(enumCMDTEXTURE_File + (uiTexture))
+
+enum enumCMDLAYER
+	{
+	enumCMDLAYER_Opaque,
+	enumCMDLAYER_Blended,
+	enumCMDLAYER_MAX,
+	};
+
+enum enumCMDSTAT
+	{
+	enumCMDSTAT_Draws,
+	enumCMDSTAT_Programs,				// Program changes
+	enumCMDSTAT_Textures,				// Texture changes, per unit
+	enumCMDSTAT_States,					// Cull face and blend changes
+	enumCMDSTAT_MAX,
+	};
+
+const char* const c_pszCmdStats[enumCMDSTAT_MAX] =
+	{
+	"draws",
+	"program_changes",
+	"texture_changes",
+	"state_changes",
+	};
+
+struct CmdUniform
+	{
+	unsigned int		uiUniform;			// enumUNIFORM
+	unsigned int		uiFloats;			// 1, 3, 4 or 16 for a matrix
+	float				afValue[16];
+	};
+
+// A draw, with everything it sets
+struct DrawPacket
+	{
+	unsigned int			uiEffect;
+	unsigned int			auiTextures[CMD_TEXTURE_UNITS];		// enumCMDTEXTURE
+	GLenum					eCullFace;
+	bool					bBlend;
+	int						nNode;
+	GLuint					uiFlags;			// For DrawMesh
+	unsigned int			uiNumUniforms;
+	CmdUniform				aUniforms[CMD_MAX_UNIFORMS];
+
+	void Init(unsigned int uiEffectIn, GLenum eCullFaceIn, bool bBlendIn, GLuint uiFlagsIn)
+		{
+		uiEffect = uiEffectIn;
+		memset(auiTextures, 0, sizeof(auiTextures));
+		eCullFace = eCullFaceIn;
+		bBlend = bBlendIn;
+		nNode = -1;
+		uiFlags = uiFlagsIn;
+		uiNumUniforms = 0;
+		}
+
+	void Uniform(unsigned int uiUniform, const float* pfValue, unsigned int uiFloats)
+		{
+		ASSERT(uiNumUniforms < CMD_MAX_UNIFORMS);
+		CmdUniform& Uniform = aUniforms[uiNumUniforms++];
+		Uniform.uiUniform = uiUniform;
+		Uniform.uiFloats = uiFloats;
+		memcpy(Uniform.afValue, pfValue, uiFloats * sizeof(float));
+		}
+
+	void Uniform1f(unsigned int uiUniform, float fValue)	{ Uniform(uiUniform, &fValue, 1); }
+
+	// The value recorded for uiUniform, or NULL
+	const float* FindUniform(unsigned int uiUniform) const
+		{
+		for(unsigned int i = 0; i < uiNumUniforms; ++i)
+			{
+			if(aUniforms[i].uiUniform == uiUniform)
+				return aUniforms[i].afValue;
+			}
+		return NULL;
+		}
+	};
+
+// Distance in front of the camera, along its view direction
+float GetViewDepth(const PVRTMat4& mxView, const PVRTVec3& vWorld);
+
+// LSD radix sort, a byte at a time. Bytes every key shares are skipped, which is most of them with only a few programs
+// and textures in use. The sorted keys end up back in pullKeys.
+void RadixSort64(unsigned long long* pullKeys, unsigned long long* pullTemp, unsigned int uiCount);
+
+class CCommandBuffer
+	{
+	private:
+		DrawPacket				m_aPackets[CMD_MAX_PACKETS];
+		unsigned long long		m_aullKeys[CMD_MAX_PACKETS];		// Key, with the packet's index in the bottom bits
+		unsigned long long		m_aullTemp[CMD_MAX_PACKETS];
+		unsigned int			m_auiOrder[CMD_MAX_PACKETS];		// Packets in execution order, after Sort
+		unsigned int			m_uiNumPackets;
+
+		// The key's texture field. Kept from frame to frame, so the same textures sort the same way.
+		unsigned int			m_aauiTextureSets[CMD_MAX_TEXTURE_SETS][CMD_TEXTURE_UNITS];
+		unsigned int			m_uiNumTextureSets;
+
+		unsigned int			m_auiFrame[enumCMDSTAT_MAX];		// Since BeginFrame
+		unsigned int			m_auiTotal[enumCMDSTAT_MAX];		// Since ResetCounters
+
+		unsigned int GetTextureSetSlot(const unsigned int* puiTextures);
+		void CountChanges();
+
+	public:
+		CCommandBuffer() : m_uiNumPackets(0), m_uiNumTextureSets(0) { BeginFrame(); ResetCounters(); }
+
+		void Add(const DrawPacket& Packet, unsigned int uiLayer, float fDepth);
+		void Sort(bool bSort);
+		void Clear()								{ m_uiNumPackets = 0; }
+		void BeginFrame()							{ memset(m_auiFrame, 0, sizeof(m_auiFrame)); }
+		void ResetCounters()						{ memset(m_auiTotal, 0, sizeof(m_auiTotal)); }
+
+		unsigned int GetNumPackets() const					{ return m_uiNumPackets; }
+		const DrawPacket& GetPacket(unsigned int i) const	{ return m_aPackets[m_auiOrder[i]]; }
+		unsigned int GetFrameStat(unsigned int uiStat) const	{ return m_auiFrame[uiStat]; }
+		unsigned int GetTotalStat(unsigned int uiStat) const	{ return m_auiTotal[uiStat]; }
+	};
+
+#endif // _COMMANDBUFFER_H_
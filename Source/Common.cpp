@@ -0,0 +1,73 @@
+#include "Common.h"
+
+// ---------------------------------------------------------------
+const char* StripFolder(const char* c_pszFilename)
+	{
+#ifdef PLATFORM_IOS
+	const char* c_pSlash = strrchr(c_pszFilename, '/');
+	if(!c_pSlash)
+		return c_pszFilename;
+	else 
+		return c_pSlash + 1;
+#else
+	return c_pszFilename;
+#endif
+	}
+
+// ---------------------------------------------------------------
+double GetTimeMS()
+	{
+#if defined(_WIN32)
+	static LARGE_INTEGER s_Freq = { 0 };
+	if(!s_Freq.QuadPart)
+		QueryPerformanceFrequency(&s_Freq);
+	LARGE_INTEGER Now;
+	QueryPerformanceCounter(&Now);
+	return (double)Now.QuadPart * 1000.0 / (double)s_Freq.QuadPart;
+#elif defined(__APPLE__)
+	static mach_timebase_info_data_t s_Timebase = { 0, 0 };
+	if(!s_Timebase.denom)
+		mach_timebase_info(&s_Timebase);
+	return (double)mach_absolute_time() * s_Timebase.numer / s_Timebase.denom * 1.0e-6;
+#else
+	struct timespec Now;
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	return (double)Now.tv_sec * 1000.0 + (double)Now.tv_nsec * 1.0e-6;
+#endif
+	}
+
+// ---------------------------------------------------------------
+int CompareFloat(const void* pA, const void* pB)
+	{
+	float fA = *(const float*)pA;
+	float fB = *(const float*)pB;
+	return (fA < fB) ? -1 : (fA > fB ? 1 : 0);
+	}
+
+// ---------------------------------------------------------------
+float Percentile(const float* pfSorted, unsigned int uiCount, float fPercent)
+	{
+	if(!uiCount)
+		return 0.0f;
+
+	unsigned int uiRank = (unsigned int)ceil(fPercent * 0.01f * uiCount);
+	if(uiRank < 1)			uiRank = 1;
+	if(uiRank > uiCount)	uiRank = uiCount;
+	return pfSorted[uiRank - 1];
+	}
+
+// ---------------------------------------------------------------
+PixelRect NDCToPixels(const PVRTVec2& vMin, const PVRTVec2& vMax, int nWidth, int nHeight, int nPad)
+	{
+	int nX0 = (int)floor((vMin.x * 0.5f + 0.5f) * nWidth) - nPad;
+	int nY0 = (int)floor((vMin.y * 0.5f + 0.5f) * nHeight) - nPad;
+	int nX1 = (int)ceil((vMax.x * 0.5f + 0.5f) * nWidth) + nPad;
+	int nY1 = (int)ceil((vMax.y * 0.5f + 0.5f) * nHeight) + nPad;
+
+	PixelRect Rect;
+	Rect.nX			= PVRT_CLAMP(nX0, 0, nWidth);
+	Rect.nY			= PVRT_CLAMP(nY0, 0, nHeight);
+	Rect.nWidth		= PVRT_CLAMP(nX1, 0, nWidth) - Rect.nX;
+	Rect.nHeight	= PVRT_CLAMP(nY1, 0, nHeight) - Rect.nY;
+	return Rect;
+	}
@@ -0,0 +1,69 @@
+#ifndef _COMMON_H_
+#define _COMMON_H_
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+#endif
+
+#ifdef PLATFORM_IOS
+#define max(x, y) (x > y ? x : y)
+#endif
+
+#if defined(MATH_SCALAR)
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MATH_SSE
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define MATH_NEON
+#include <arm_neon.h>
+#endif
+
+
+#include "PVRShell.h"
+#include "OGLES2Tools.h"
+
+#define ELEMENTS_IN_ARRAY(x) (sizeof(x) / sizeof(x[0]))
+
+#define ASSERT(x) assert(x)
+
+// Utility function to strip the leading folders for iOS
+const char* StripFolder(const char* c_pszFilename);
+
+// Utility function to get a high resolution timestamp in milliseconds. PVRShellGetTime() only has ms granularity.
+double GetTimeMS();
+
+// Comparison function for qsort'ing floats in ascending order
+int CompareFloat(const void* pA, const void* pB);
+
+// Returns the nearest-rank percentile (0 - 100) from an array sorted in ascending order
+float Percentile(const float* pfSorted, unsigned int uiCount, float fPercent);
+
+// Pixel rectangle, as passed to glViewport and glScissor
+struct PixelRect
+	{
+	GLint		nX;
+	GLint		nY;
+	GLsizei		nWidth;
+	GLsizei		nHeight;
+	};
+
+// Converts an NDC rectangle to the pixels it covers in a nWidth x nHeight target, grown by nPad pixels and clipped to the target
+PixelRect NDCToPixels(const PVRTVec2& vMin, const PVRTVec2& vMax, int nWidth, int nHeight, int nPad);
+
+#endif // _COMMON_H_
@@ -0,0 +1,200 @@
+#include "CompactVertex.h"
+
+const float* PODVertexData(const SPODMesh& Mesh, const CPODData& Data, unsigned int uiVertex)
+	{
+	const unsigned char* pBase = Mesh.pInterleaved ? Mesh.pInterleaved + (size_t)Data.pData : Data.pData;
+	return (const float*)(pBase + uiVertex * Data.nStride);
+	}
+
+short QuantiseSNorm(float f)
+	{
+	f = PVRT_CLAMP(f, -1.0f, 1.0f);
+	return (short)PVRT_CLAMP(floor((f * 65535.0f - 1.0f) * 0.5f + 0.5f), -32768.0, 32767.0);
+	}
+
+unsigned short QuantiseUNorm(float f)
+	{
+	f = PVRT_CLAMP(f, 0.0f, 1.0f);
+	return (unsigned short)floor(f * 65535.0f + 0.5f);
+	}
+
+// Maps a unit vector onto the octahedron and unfolds it into [-1, 1]^2
+void OctEncode(const float* pfN, short* pnOut)
+	{
+	float fL1 = fabs(pfN[0]) + fabs(pfN[1]) + fabs(pfN[2]);
+	if(fL1 == 0.0f)
+		fL1 = 1.0f;
+
+	float fX = pfN[0] / fL1;
+	float fY = pfN[1] / fL1;
+	if(pfN[2] < 0.0f)
+		{
+		float fTmpX = (1.0f - fabs(fY)) * (fX >= 0.0f ? 1.0f : -1.0f);
+		float fTmpY = (1.0f - fabs(fX)) * (fY >= 0.0f ? 1.0f : -1.0f);
+		fX = fTmpX;
+		fY = fTmpY;
+		}
+
+	pnOut[0] = QuantiseSNorm(fX);
+	pnOut[1] = QuantiseSNorm(fY);
+	}
+
+void OctDecode(const short* pnIn, float* pfOut)
+	{
+	float fX = DecodeSNorm(pnIn[0]);
+	float fY = DecodeSNorm(pnIn[1]);
+	float fZ = 1.0f - fabs(fX) - fabs(fY);
+	float fT = PVRT_MAX(-fZ, 0.0f);
+	fX += (fX >= 0.0f) ? -fT : fT;
+	fY += (fY >= 0.0f) ? -fT : fT;
+
+	float fLen = sqrt(fX * fX + fY * fY + fZ * fZ);
+	pfOut[0] = fX / fLen;
+	pfOut[1] = fY / fLen;
+	pfOut[2] = fZ / fLen;
+	}
+
+// Angle in degrees between an encoded direction and the (not necessarily normalised) original
+float OctError(const float* pfOriginal, const short* pnEncoded)
+	{
+	float afDecoded[3];
+	OctDecode(pnEncoded, afDecoded);
+
+	float fLen = sqrt(pfOriginal[0] * pfOriginal[0] + pfOriginal[1] * pfOriginal[1] + pfOriginal[2] * pfOriginal[2]);
+	if(fLen == 0.0f)
+		return 0.0f;
+
+	float fDot = (pfOriginal[0] * afDecoded[0] + pfOriginal[1] * afDecoded[1] + pfOriginal[2] * afDecoded[2]) / fLen;
+	return acos(PVRT_CLAMP(fDot, -1.0f, 1.0f)) * 180.0f / PVRT_PI;
+	}
+
+unsigned char* CompressMesh(const SPODMesh& Mesh, CompactVertexFormat* pFormat, CompactVertexStats* pStats)
+	{
+	ASSERT(Mesh.sVertex.eType == EPODDataFloat);
+
+	// --- Work out the layout
+	CompactVertexFormat& Format = *pFormat;
+	int nOffset = 0;
+	Format.nPosOffset = nOffset;	nOffset += 4 * sizeof(short);
+	Format.nNrmOffset = -1;
+	Format.nTanOffset = -1;
+	if(Mesh.sNormals.n)		{ Format.nNrmOffset = nOffset;	nOffset += 2 * sizeof(short); }
+	if(Mesh.sTangents.n)	{ Format.nTanOffset = nOffset;	nOffset += 2 * sizeof(short); }
+	for(unsigned int i = 0; i < COMPACT_MAX_UVS; ++i)
+		{
+		Format.anUVOffset[i] = -1;
+		if(i < Mesh.nNumUVW)
+			{
+			Format.anUVOffset[i] = nOffset;
+			nOffset += 2 * sizeof(unsigned short);
+			}
+		}
+	Format.nStride = nOffset;
+
+	// --- Find the ranges used for the scale/bias decode
+	PVRTVec3 vMin( 1e30f,  1e30f,  1e30f);
+	PVRTVec3 vMax(-1e30f, -1e30f, -1e30f);
+	float afUVMin[COMPACT_MAX_UVS][2], afUVMax[COMPACT_MAX_UVS][2];
+	for(unsigned int i = 0; i < COMPACT_MAX_UVS; ++i)
+		{
+		afUVMin[i][0] = afUVMin[i][1] =  1e30f;
+		afUVMax[i][0] = afUVMax[i][1] = -1e30f;
+		}
+
+	for(unsigned int v = 0; v < Mesh.nNumVertex; ++v)
+		{
+		const float* pfPos = PODVertexData(Mesh, Mesh.sVertex, v);
+		vMin.x = PVRT_MIN(vMin.x, pfPos[0]);	vMax.x = PVRT_MAX(vMax.x, pfPos[0]);
+		vMin.y = PVRT_MIN(vMin.y, pfPos[1]);	vMax.y = PVRT_MAX(vMax.y, pfPos[1]);
+		vMin.z = PVRT_MIN(vMin.z, pfPos[2]);	vMax.z = PVRT_MAX(vMax.z, pfPos[2]);
+
+		for(unsigned int i = 0; i < COMPACT_MAX_UVS; ++i)
+			{
+			if(Format.anUVOffset[i] < 0)
+				continue;
+			const float* pfUV = PODVertexData(Mesh, Mesh.psUVW[i], v);
+			for(int c = 0; c < 2; ++c)
+				{
+				afUVMin[i][c] = PVRT_MIN(afUVMin[i][c], pfUV[c]);
+				afUVMax[i][c] = PVRT_MAX(afUVMax[i][c], pfUV[c]);
+				}
+			}
+		}
+
+	// Positions map onto [-1, 1], UVs onto [0, 1]. Guard against flat ranges.
+	Format.vPosBias		= PVRTVec3((vMax.x + vMin.x) * 0.5f, (vMax.y + vMin.y) * 0.5f, (vMax.z + vMin.z) * 0.5f);
+	Format.vPosScale	= PVRTVec3((vMax.x - vMin.x) * 0.5f, (vMax.y - vMin.y) * 0.5f, (vMax.z - vMin.z) * 0.5f);
+	if(Format.vPosScale.x <= 0.0f)	Format.vPosScale.x = 1.0f;
+	if(Format.vPosScale.y <= 0.0f)	Format.vPosScale.y = 1.0f;
+	if(Format.vPosScale.z <= 0.0f)	Format.vPosScale.z = 1.0f;
+
+	for(unsigned int i = 0; i < COMPACT_MAX_UVS; ++i)
+		{
+		Format.vUVScaleBias[i] = PVRTVec4(1.0f, 1.0f, 0.0f, 0.0f);
+		if(Format.anUVOffset[i] < 0)
+			continue;
+		float fScaleU = afUVMax[i][0] - afUVMin[i][0];
+		float fScaleV = afUVMax[i][1] - afUVMin[i][1];
+		Format.vUVScaleBias[i] = PVRTVec4(fScaleU > 0.0f ? fScaleU : 1.0f, fScaleV > 0.0f ? fScaleV : 1.0f, afUVMin[i][0], afUVMin[i][1]);
+		}
+
+	// --- Pack the vertices, measuring the error as we go
+	memset(pStats, 0, sizeof(*pStats));
+	pStats->uiOriginalBytes	= Mesh.nNumVertex * Mesh.sVertex.nStride;
+	pStats->uiCompactBytes	= Mesh.nNumVertex * Format.nStride;
+
+	unsigned char* pData = new unsigned char[pStats->uiCompactBytes];
+	memset(pData, 0, pStats->uiCompactBytes);
+
+	for(unsigned int v = 0; v < Mesh.nNumVertex; ++v)
+		{
+		unsigned char* pVertex = pData + v * Format.nStride;
+
+		const float* pfPos = PODVertexData(Mesh, Mesh.sVertex, v);
+		short* pnPos = (short*)(pVertex + Format.nPosOffset);
+		for(int c = 0; c < 3; ++c)
+			{
+			float fScale = Format.vPosScale.ptr()[c];
+			float fBias = Format.vPosBias.ptr()[c];
+			pnPos[c] = QuantiseSNorm((pfPos[c] - fBias) / fScale);
+
+			float fDecoded = DecodeSNorm(pnPos[c]) * fScale + fBias;
+			pStats->fMaxPosError = PVRT_MAX(pStats->fMaxPosError, (float)fabs(fDecoded - pfPos[c]));
+			}
+
+		if(Format.nNrmOffset >= 0)
+			{
+			const float* pfNrm = PODVertexData(Mesh, Mesh.sNormals, v);
+			short* pnNrm = (short*)(pVertex + Format.nNrmOffset);
+			OctEncode(pfNrm, pnNrm);
+			pStats->fMaxNrmError = PVRT_MAX(pStats->fMaxNrmError, OctError(pfNrm, pnNrm));
+			}
+
+		if(Format.nTanOffset >= 0)
+			{
+			const float* pfTan = PODVertexData(Mesh, Mesh.sTangents, v);
+			short* pnTan = (short*)(pVertex + Format.nTanOffset);
+			OctEncode(pfTan, pnTan);
+			pStats->fMaxTanError = PVRT_MAX(pStats->fMaxTanError, OctError(pfTan, pnTan));
+			}
+
+		for(unsigned int i = 0; i < COMPACT_MAX_UVS; ++i)
+			{
+			if(Format.anUVOffset[i] < 0)
+				continue;
+
+			const float* pfUV = PODVertexData(Mesh, Mesh.psUVW[i], v);
+			unsigned short* puUV = (unsigned short*)(pVertex + Format.anUVOffset[i]);
+			const float* pfScaleBias = Format.vUVScaleBias[i].ptr();
+			for(int c = 0; c < 2; ++c)
+				{
+				puUV[c] = QuantiseUNorm((pfUV[c] - pfScaleBias[c + 2]) / pfScaleBias[c]);
+
+				float fDecoded = puUV[c] / 65535.0f * pfScaleBias[c] + pfScaleBias[c + 2];
+				pStats->fMaxUVError = PVRT_MAX(pStats->fMaxUVError, (float)fabs(fDecoded - pfUV[c]));
+				}
+			}
+		}
+
+	return pData;
+	}
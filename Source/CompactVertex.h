@@ -0,0 +1,53 @@
+#ifndef _COMPACTVERTEX_H_
+#define _COMPACTVERTEX_H_
+
+#include "Common.h"
+
+// Meshes are re-packed at load time into a compact layout:
+//   Position		4 x GL_SHORT (normalised), decoded with a per-mesh scale and bias. The 4th component is padding.
+//   UVs			2 x GL_UNSIGNED_SHORT (normalised) per set, decoded with a per-mesh scale and bias.
+//   Normal/Tangent	2 x GL_SHORT (normalised), octahedral encoded. Binormals are rebuilt in the shader.
+// Every attribute stays 4 byte aligned.
+#define COMPACT_MAX_UVS		2
+
+struct CompactVertexFormat
+	{
+	GLsizei				nStride;
+	int					nPosOffset;
+	int					nNrmOffset;						// -1 if the mesh doesn't have the attribute
+	int					nTanOffset;
+	int					anUVOffset[COMPACT_MAX_UVS];
+	PVRTVec3			vPosScale;
+	PVRTVec3			vPosBias;
+	PVRTVec4			vUVScaleBias[COMPACT_MAX_UVS];	// xy = scale, zw = bias
+	};
+
+struct CompactVertexStats
+	{
+	unsigned int		uiOriginalBytes;
+	unsigned int		uiCompactBytes;
+	float				fMaxPosError;					// Model space units
+	float				fMaxNrmError;					// Degrees
+	float				fMaxTanError;					// Degrees
+	float				fMaxUVError;
+	};
+
+// Returns a pointer to vertex uiVertex of a POD attribute, whether or not the mesh is interleaved
+const float* PODVertexData(const SPODMesh& Mesh, const CPODData& Data, unsigned int uiVertex);
+
+// ES2 normalises GL_SHORT attributes to (2c + 1) / 65535, so -1 and 1 are exact and 0 isn't. These quantise and decode
+// to match, so the errors measured here and the software rasterizer's positions are what the shaders see.
+short QuantiseSNorm(float f);
+
+inline float DecodeSNorm(short n)
+	{
+	return (2.0f * n + 1.0f) / 65535.0f;
+	}
+
+// Inverse of OctEncode. Matches OctDecode() in the vertex shaders.
+void OctDecode(const short* pnIn, float* pfOut);
+
+// Re-packs a POD mesh into the compact layout. Returns the new vertex data, which the caller deletes.
+unsigned char* CompressMesh(const SPODMesh& Mesh, CompactVertexFormat* pFormat, CompactVertexStats* pStats);
+
+#endif // _COMPACTVERTEX_H_
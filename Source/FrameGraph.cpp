@@ -0,0 +1,554 @@
+#include "FrameGraph.h"
+
+const unsigned int c_auiFGFormatBytes[] = { 4, 2, 4 };		// Per pixel. 24 bit depth is padded out.
+
+// ---------------------------------------------------------------
+void CFrameGraph::Reset()
+	{
+	m_uiNumPasses = m_uiNumResources = m_uiNumAllocations = 0;
+	m_bAlias = true;
+	m_dFrameLoaded = m_dFrameStored = m_dFrameAll = m_dTotalAll = 0.0;
+	}
+
+// ---------------------------------------------------------------
+unsigned int CFrameGraph::AddResource(const char* pszName, unsigned int eFormat, int nWidth, int nHeight, unsigned int uiFlags, float fClearDepth)
+	{
+	ASSERT(m_uiNumResources < FG_MAX_RESOURCES);
+	FGResource& Resource = m_aResources[m_uiNumResources];
+	Resource.pszName		= pszName;
+	Resource.eFormat		= eFormat;
+	Resource.nWidth			= nWidth;
+	Resource.nHeight		= nHeight;
+	Resource.uiFlags		= uiFlags;
+	Resource.fClearDepth	= fClearDepth;
+	Resource.uiImported		= 0;
+	Resource.uiFirst		= Resource.uiLast = Resource.uiFirstWriter = Resource.uiAllocation = FG_NONE;
+	return m_uiNumResources++;
+	}
+
+// ---------------------------------------------------------------
+unsigned int CFrameGraph::ImportResource(const char* pszName, unsigned int eFormat, int nWidth, int nHeight, GLuint uiTexture)
+	{
+	unsigned int uiResource = AddResource(pszName, eFormat, nWidth, nHeight, FG_IMPORTED);
+	m_aResources[uiResource].uiImported = uiTexture;
+	return uiResource;
+	}
+
+// ---------------------------------------------------------------
+unsigned int CFrameGraph::AddPass(const char* pszName)
+	{
+	ASSERT(m_uiNumPasses < FG_MAX_PASSES);
+	FGPass& Pass = m_aPasses[m_uiNumPasses];
+	Pass.pszName		= pszName;
+	Pass.uiNumReads		= 0;
+	Pass.uiColour		= Pass.uiDepth = FG_NONE;
+	Pass.bCulled		= false;
+	Pass.uiClearMask	= 0;
+	Pass.uiFBO			= 0;
+	Pass.bOwnFBO		= false;
+	Pass.uiRuns			= 0;
+	Pass.dBytesLoaded	= Pass.dBytesStored = 0.0;
+	for(unsigned int a = 0; a < 2; ++a)
+		{
+		Pass.aeWantLoad[a] = Pass.aeLoad[a] = enumFGLOAD_Auto;
+		Pass.aeWantStore[a] = Pass.aeStore[a] = enumFGSTORE_Auto;
+		}
+	return m_uiNumPasses++;
+	}
+
+// ---------------------------------------------------------------
+void CFrameGraph::Read(unsigned int uiPass, unsigned int uiResource)
+	{
+	FGPass& Pass = m_aPasses[uiPass];
+	ASSERT(Pass.uiNumReads < FG_MAX_READS);
+	Pass.auiReads[Pass.uiNumReads++] = uiResource;
+	}
+
+// ---------------------------------------------------------------
+void CFrameGraph::Write(unsigned int uiPass, unsigned int uiResource)
+	{
+	// ES2 has the one colour attachment
+	unsigned int& uiAttachment = IsDepth(uiResource) ? m_aPasses[uiPass].uiDepth : m_aPasses[uiPass].uiColour;
+	ASSERT(uiAttachment == FG_NONE);
+	uiAttachment = uiResource;
+	}
+
+// ---------------------------------------------------------------
+void CFrameGraph::SetActions(unsigned int uiPass, unsigned int uiResource, unsigned int eLoad, unsigned int eStore)
+	{
+	// For something the pass writes
+	FGPass& Pass = m_aPasses[uiPass];
+	unsigned int a = IsDepth(uiResource) ? 1 : 0;
+	ASSERT((a ? Pass.uiDepth : Pass.uiColour) == uiResource);
+	Pass.aeWantLoad[a]	= eLoad;
+	Pass.aeWantStore[a]	= eStore;
+	}
+
+// ---------------------------------------------------------------
+void CFrameGraph::Cull()
+	{
+	// Walked backwards, so every reader has been decided before the passes that write what it reads.
+	// A pass that writes anything imported has an effect outside the graph, and is always kept.
+	bool abRead[FG_MAX_RESOURCES];
+	memset(abRead, 0, sizeof(abRead));
+	for(unsigned int p = m_uiNumPasses; p-- > 0;)
+		{
+		FGPass& Pass = m_aPasses[p];
+		bool bKeep = false;
+		unsigned int auiWrites[2] = { Pass.uiColour, Pass.uiDepth };
+		for(unsigned int w = 0; w < 2; ++w)
+			{
+			if(auiWrites[w] != FG_NONE && (abRead[auiWrites[w]] || (m_aResources[auiWrites[w]].uiFlags & FG_IMPORTED)))
+				bKeep = true;
+			}
+
+		Pass.bCulled = !bKeep;
+		if(Pass.bCulled)
+			continue;
+		for(unsigned int r = 0; r < Pass.uiNumReads; ++r)
+			abRead[Pass.auiReads[r]] = true;
+		}
+	}
+
+// ---------------------------------------------------------------
+void CFrameGraph::FindLifetimes()
+	{
+	for(unsigned int p = 0; p < m_uiNumPasses; ++p)
+		{
+		const FGPass& Pass = m_aPasses[p];
+		if(Pass.bCulled)
+			continue;
+
+		unsigned int auiUsed[FG_MAX_READS + 2];
+		unsigned int uiNumUsed = 0;
+		for(unsigned int r = 0; r < Pass.uiNumReads; ++r)
+			auiUsed[uiNumUsed++] = Pass.auiReads[r];
+		if(Pass.uiColour != FG_NONE)	auiUsed[uiNumUsed++] = Pass.uiColour;
+		if(Pass.uiDepth != FG_NONE)		auiUsed[uiNumUsed++] = Pass.uiDepth;
+
+		for(unsigned int i = 0; i < uiNumUsed; ++i)
+			{
+			FGResource& Resource = m_aResources[auiUsed[i]];
+			if(Resource.uiFirst == FG_NONE)
+				Resource.uiFirst = p;
+			Resource.uiLast = p;
+			}
+		if(Pass.uiColour != FG_NONE && m_aResources[Pass.uiColour].uiFirstWriter == FG_NONE)
+			m_aResources[Pass.uiColour].uiFirstWriter = p;
+		if(Pass.uiDepth != FG_NONE && m_aResources[Pass.uiDepth].uiFirstWriter == FG_NONE)
+			m_aResources[Pass.uiDepth].uiFirstWriter = p;
+		}
+	}
+
+// ---------------------------------------------------------------
+void CFrameGraph::Allocate(unsigned int uiResource, int nWidth, int nHeight)
+	{
+	// The smallest free allocation it fits, or a new one
+	FGResource& Resource = m_aResources[uiResource];
+	bool bCorner = (Resource.uiFlags & FG_CORNER) && !IsDepth(uiResource);
+	unsigned int uiBest = FG_NONE;
+	for(unsigned int a = 0; a < m_uiNumAllocations && m_bAlias; ++a)
+		{
+		const FGAllocation& Allocation = m_aAllocations[a];
+		if(Allocation.eFormat != Resource.eFormat || Allocation.uiLast >= Resource.uiFirst)
+			continue;
+		bool bFits = bCorner ? Allocation.nWidth >= nWidth && Allocation.nHeight >= nHeight : Allocation.nWidth == nWidth && Allocation.nHeight == nHeight;
+		if(bFits && (uiBest == FG_NONE || Allocation.nWidth * Allocation.nHeight < m_aAllocations[uiBest].nWidth * m_aAllocations[uiBest].nHeight))
+			uiBest = a;
+		}
+
+	if(uiBest == FG_NONE)
+		{
+		uiBest = m_uiNumAllocations++;
+		FGAllocation& Allocation = m_aAllocations[uiBest];
+		Allocation.eFormat	= Resource.eFormat;
+		Allocation.nWidth	= nWidth;
+		Allocation.nHeight	= nHeight;
+		Allocation.uiUsers	= 0;
+		Allocation.uiName	= 0;
+		}
+
+	FGAllocation& Allocation = m_aAllocations[uiBest];
+	Allocation.uiLast = Resource.uiLast;
+	++Allocation.uiUsers;
+	Resource.uiAllocation = uiBest;
+	}
+
+// ---------------------------------------------------------------
+bool CFrameGraph::Compile(bool bAlias, CPVRTString* pErrorStr)
+	{
+	m_bAlias = bAlias;
+	m_uiNumAllocations = 0;
+	for(unsigned int i = 0; i < m_uiNumResources; ++i)
+		m_aResources[i].uiFirst = m_aResources[i].uiLast = m_aResources[i].uiFirstWriter = m_aResources[i].uiAllocation = FG_NONE;
+
+	Cull();
+	FindLifetimes();
+
+	for(unsigned int i = 0; i < m_uiNumResources; ++i)
+		{
+		const FGResource& Resource = m_aResources[i];
+		if(Resource.uiFirst != FG_NONE && !(Resource.uiFlags & FG_IMPORTED) && Resource.uiFirstWriter != Resource.uiFirst)
+			{
+			*pErrorStr = CPVRTString("ERROR: The frame graph reads ") + Resource.pszName + " before anything writes it";
+			return false;
+			}
+		}
+
+	// Colour first, in the order they're first used, then depth at the size of the colour it's drawn with
+	for(unsigned int uiDepth = 0; uiDepth < 2; ++uiDepth)
+		{
+		for(unsigned int p = 0; p < m_uiNumPasses; ++p)
+			{
+			const FGPass& Pass = m_aPasses[p];
+			unsigned int uiResource = uiDepth ? Pass.uiDepth : Pass.uiColour;
+			if(Pass.bCulled || uiResource == FG_NONE || m_aResources[uiResource].uiFirstWriter != p || (m_aResources[uiResource].uiFlags & FG_IMPORTED))
+				continue;
+
+			int nWidth = m_aResources[uiResource].nWidth, nHeight = m_aResources[uiResource].nHeight;
+			if(uiDepth && Pass.uiColour != FG_NONE)
+				{
+				nWidth = GetWidth(Pass.uiColour);
+				nHeight = GetHeight(Pass.uiColour);
+				}
+			Allocate(uiResource, nWidth, nHeight);
+			}
+		}
+
+	// Work out what each pass loads and stores, and check nothing a later pass needs is thrown away
+	ResolveActions();
+	for(unsigned int p = 0; p < m_uiNumPasses; ++p)
+		{
+		const FGPass& Pass = m_aPasses[p];
+		unsigned int auiWrites[2] = { Pass.uiColour, Pass.uiDepth };
+		for(unsigned int w = 0; w < 2; ++w)
+			{
+			if(!Pass.bCulled && Pass.aeStore[w] == enumFGSTORE_Discard && NeedsContents(auiWrites[w], p))
+				{
+				*pErrorStr = CPVRTString("ERROR: The frame graph's ") + Pass.pszName + " pass discards " + m_aResources[auiWrites[w]].pszName + ", which a later pass uses";
+				return false;
+				}
+			}
+		}
+	return true;
+	}
+
+// ---------------------------------------------------------------
+void CFrameGraph::ResolveActions()
+	{
+	// The loads first, as the stores depend on whether the next pass along loads
+	for(unsigned int p = 0; p < m_uiNumPasses; ++p)
+		{
+		FGPass& Pass = m_aPasses[p];
+		unsigned int auiWrites[2] = { Pass.uiColour, Pass.uiDepth };
+		const GLbitfield c_auiBits[2] = { GL_COLOR_BUFFER_BIT, GL_DEPTH_BUFFER_BIT };
+		Pass.uiClearMask = 0;
+		for(unsigned int w = 0; w < 2; ++w)
+			{
+			Pass.aeLoad[w] = Pass.aeWantLoad[w];
+			if(auiWrites[w] == FG_NONE || Pass.bCulled)
+				continue;
+
+			// Whatever the first writer doesn't clear itself gets cleared for it, and so does anything sharing its
+			// allocation, which holds another target's leftovers.
+			const FGResource& Resource = m_aResources[auiWrites[w]];
+			bool bShared = Resource.uiAllocation != FG_NONE && m_aAllocations[Resource.uiAllocation].uiUsers > 1;
+			if(Pass.aeLoad[w] == enumFGLOAD_Auto)
+				Pass.aeLoad[w] = Resource.uiFirstWriter == p && ((Resource.uiFlags & FG_CLEAR) || bShared) ? enumFGLOAD_Clear : enumFGLOAD_Load;
+			if(Pass.aeLoad[w] == enumFGLOAD_Clear)
+				Pass.uiClearMask |= c_auiBits[w];
+			}
+		}
+
+	for(unsigned int p = 0; p < m_uiNumPasses; ++p)
+		{
+		FGPass& Pass = m_aPasses[p];
+		unsigned int auiWrites[2] = { Pass.uiColour, Pass.uiDepth };
+		for(unsigned int w = 0; w < 2; ++w)
+			{
+			Pass.aeStore[w] = Pass.aeWantStore[w];
+			if(auiWrites[w] == FG_NONE || Pass.bCulled || Pass.aeStore[w] != enumFGSTORE_Auto)
+				continue;
+			bool bKeep = (m_aResources[auiWrites[w]].uiFlags & FG_IMPORTED) || NeedsContents(auiWrites[w], p);
+			Pass.aeStore[w] = bKeep ? enumFGSTORE_Store : enumFGSTORE_Discard;
+			}
+		}
+	}
+
+// ---------------------------------------------------------------
+bool CFrameGraph::NeedsContents(unsigned int uiResource, unsigned int uiAfterPass) const
+	{
+	// Whether the next pass to use it reads it, or draws on top of what's there
+	for(unsigned int p = uiAfterPass + 1; p < m_uiNumPasses; ++p)
+		{
+		const FGPass& Pass = m_aPasses[p];
+		if(Pass.bCulled)
+			continue;
+		for(unsigned int r = 0; r < Pass.uiNumReads; ++r)
+			{
+			if(Pass.auiReads[r] == uiResource)
+				return true;
+			}
+		if(Pass.uiColour == uiResource)
+			return Pass.aeLoad[0] == enumFGLOAD_Load;
+		if(Pass.uiDepth == uiResource)
+			return Pass.aeLoad[1] == enumFGLOAD_Load;
+		}
+	return false;
+	}
+
+// ---------------------------------------------------------------
+bool CFrameGraph::Realise(GLuint uiScreenFBO, CPVRTString* pErrorStr)
+	{
+	for(unsigned int a = 0; a < m_uiNumAllocations; ++a)
+		{
+		FGAllocation& Allocation = m_aAllocations[a];
+		if(Allocation.eFormat == enumFGFORMAT_RGBA8)
+			{
+			glGenTextures(1, &Allocation.uiName);
+			glBindTexture(GL_TEXTURE_2D, Allocation.uiName);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, Allocation.nWidth, Allocation.nHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			}
+		else
+			{
+			glGenRenderbuffers(1, &Allocation.uiName);
+			glBindRenderbuffer(GL_RENDERBUFFER, Allocation.uiName);
+			glRenderbufferStorage(GL_RENDERBUFFER, Allocation.eFormat == enumFGFORMAT_Depth24 ? GL_DEPTH_COMPONENT24_OES : GL_DEPTH_COMPONENT16,
+								  Allocation.nWidth, Allocation.nHeight);
+			}
+		}
+
+	for(unsigned int p = 0; p < m_uiNumPasses; ++p)
+		{
+		FGPass& Pass = m_aPasses[p];
+		if(Pass.bCulled)
+			continue;
+
+		// Whatever draws to the screen brings its own depth
+		if((Pass.uiColour != FG_NONE && IsScreen(Pass.uiColour)) || (Pass.uiDepth != FG_NONE && IsScreen(Pass.uiDepth)))
+			{
+			Pass.uiFBO = uiScreenFBO;
+			continue;
+			}
+
+		glGenFramebuffers(1, &Pass.uiFBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, Pass.uiFBO);
+		Pass.bOwnFBO = true;
+		if(Pass.uiColour != FG_NONE)
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, GetTexture(Pass.uiColour), 0);
+		if(Pass.uiDepth != FG_NONE)
+			{
+			const FGResource& Depth = m_aResources[Pass.uiDepth];
+			if(Depth.uiFlags & FG_IMPORTED)
+				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, Depth.uiImported, 0);
+			else
+				glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_aAllocations[Depth.uiAllocation].uiName);
+			}
+		if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			{
+			*pErrorStr = CPVRTString("ERROR: Could not create framebuffer object for the ") + Pass.pszName + " pass";
+			return false;
+			}
+		}
+	glBindFramebuffer(GL_FRAMEBUFFER, uiScreenFBO);
+	return true;
+	}
+
+// ---------------------------------------------------------------
+void CFrameGraph::Release()
+	{
+	for(unsigned int p = 0; p < m_uiNumPasses; ++p)
+		{
+		if(m_aPasses[p].bOwnFBO)
+			glDeleteFramebuffers(1, &m_aPasses[p].uiFBO);
+		}
+	for(unsigned int a = 0; a < m_uiNumAllocations; ++a)
+		{
+		if(!m_aAllocations[a].uiName)
+			continue;
+		if(m_aAllocations[a].eFormat == enumFGFORMAT_RGBA8)
+			glDeleteTextures(1, &m_aAllocations[a].uiName);
+		else
+			glDeleteRenderbuffers(1, &m_aAllocations[a].uiName);
+		}
+	Reset();
+	}
+
+// ---------------------------------------------------------------
+void CFrameGraph::BeginPass(unsigned int uiPass, CGLStateCache& State)
+	{
+	FGPass& Pass = m_aPasses[uiPass];
+	ASSERT(!Pass.bCulled);
+	State.BindFramebuffer(Pass.uiFBO);
+
+	// Tell the driver not to bother loading what the pass is about to overwrite
+	GLenum aeAttachments[2];
+	GLsizei nDiscards = GetDiscards(Pass, Pass.aeLoad, enumFGLOAD_DontCare, aeAttachments);
+	if(nDiscards)
+		m_pfnDiscard(GL_FRAMEBUFFER, nDiscards, aeAttachments);
+
+	// Without the extension, not caring is a load
+	unsigned int auiWrites[2] = { Pass.uiColour, Pass.uiDepth };
+	for(unsigned int w = 0; w < 2; ++w)
+		{
+		if(auiWrites[w] == FG_NONE)
+			continue;
+		double dBytes = GetBytes(auiWrites[w]);
+		if(Pass.aeLoad[w] == enumFGLOAD_Load || (Pass.aeLoad[w] == enumFGLOAD_DontCare && !m_pfnDiscard))
+			{
+			Pass.dBytesLoaded += dBytes;
+			m_dFrameLoaded += dBytes;
+			}
+		m_dFrameAll += 2.0 * dBytes;
+		m_dTotalAll += 2.0 * dBytes;
+		}
+	++Pass.uiRuns;
+
+	if(!Pass.uiClearMask)
+		return;
+
+	// All of it, whatever the pass goes on to draw to
+	State.Disable(GL_SCISSOR_TEST);
+	if(Pass.uiClearMask & GL_COLOR_BUFFER_BIT)
+		{
+		State.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		State.ClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		}
+	float fClearDepth = 0.0f;
+	if(Pass.uiClearMask & GL_DEPTH_BUFFER_BIT)
+		{
+		State.DepthMask(GL_TRUE);
+		fClearDepth = m_aResources[Pass.uiDepth].fClearDepth;
+		}
+
+	// Everything else clears depth to 0, for the scene's reversed depth
+	if(fClearDepth != 0.0f)
+		glClearDepthf(fClearDepth);
+	glClear(Pass.uiClearMask);
+	if(fClearDepth != 0.0f)
+		glClearDepthf(0.0f);
+	}
+
+// ---------------------------------------------------------------
+void CFrameGraph::EndPass(unsigned int uiPass, CGLStateCache& State)
+	{
+	// Throw away what nothing needs before the driver writes it out
+	FGPass& Pass = m_aPasses[uiPass];
+	State.BindFramebuffer(Pass.uiFBO);
+	GLenum aeAttachments[2];
+	GLsizei nDiscards = GetDiscards(Pass, Pass.aeStore, enumFGSTORE_Discard, aeAttachments);
+	if(nDiscards)
+		m_pfnDiscard(GL_FRAMEBUFFER, nDiscards, aeAttachments);
+
+	unsigned int auiWrites[2] = { Pass.uiColour, Pass.uiDepth };
+	for(unsigned int w = 0; w < 2; ++w)
+		{
+		if(auiWrites[w] != FG_NONE && (Pass.aeStore[w] == enumFGSTORE_Store || !m_pfnDiscard))
+			{
+			double dBytes = GetBytes(auiWrites[w]);
+			Pass.dBytesStored += dBytes;
+			m_dFrameStored += dBytes;
+			}
+		}
+	}
+
+// ---------------------------------------------------------------
+GLsizei CFrameGraph::GetDiscards(const FGPass& Pass, const unsigned int* peActions, unsigned int eAction, GLenum* peAttachments) const
+	{
+	if(!m_pfnDiscard)
+		return 0;
+
+	// The default framebuffer names its buffers differently
+	GLsizei nDiscards = 0;
+	if(Pass.uiColour != FG_NONE && peActions[0] == eAction)
+		peAttachments[nDiscards++] = Pass.uiFBO ? GL_COLOR_ATTACHMENT0 : GL_COLOR_EXT;
+	if(Pass.uiDepth != FG_NONE && peActions[1] == eAction)
+		peAttachments[nDiscards++] = Pass.uiFBO ? GL_DEPTH_ATTACHMENT : GL_DEPTH_EXT;
+	return nDiscards;
+	}
+
+// ---------------------------------------------------------------
+unsigned int CFrameGraph::GetBytes(unsigned int uiResource) const
+	{
+	return GetWidth(uiResource) * GetHeight(uiResource) * c_auiFGFormatBytes[m_aResources[uiResource].eFormat];
+	}
+
+// ---------------------------------------------------------------
+GLuint CFrameGraph::GetTexture(unsigned int uiResource) const
+	{
+	const FGResource& Resource = m_aResources[uiResource];
+	if(Resource.uiFlags & FG_IMPORTED)
+		return Resource.uiImported;
+	if(Resource.uiAllocation == FG_NONE || IsDepth(uiResource))
+		return 0;					// Culled, or a renderbuffer
+	return m_aAllocations[Resource.uiAllocation].uiName;
+	}
+
+// ---------------------------------------------------------------
+int CFrameGraph::GetWidth(unsigned int uiResource) const
+	{
+	const FGResource& Resource = m_aResources[uiResource];
+	return Resource.uiAllocation == FG_NONE ? Resource.nWidth : m_aAllocations[Resource.uiAllocation].nWidth;
+	}
+
+// ---------------------------------------------------------------
+int CFrameGraph::GetHeight(unsigned int uiResource) const
+	{
+	const FGResource& Resource = m_aResources[uiResource];
+	return Resource.uiAllocation == FG_NONE ? Resource.nHeight : m_aAllocations[Resource.uiAllocation].nHeight;
+	}
+
+// ---------------------------------------------------------------
+unsigned int CFrameGraph::GetNumCulled() const
+	{
+	unsigned int uiCulled = 0;
+	for(unsigned int p = 0; p < m_uiNumPasses; ++p)
+		uiCulled += m_aPasses[p].bCulled ? 1 : 0;
+	return uiCulled;
+	}
+
+// ---------------------------------------------------------------
+unsigned int CFrameGraph::GetNumTargets() const
+	{
+	unsigned int uiTargets = 0;
+	for(unsigned int i = 0; i < m_uiNumResources; ++i)
+		uiTargets += m_aResources[i].uiAllocation != FG_NONE ? 1 : 0;
+	return uiTargets;
+	}
+
+// ---------------------------------------------------------------
+unsigned int CFrameGraph::GetUnaliasedBytes() const
+	{
+	unsigned int uiBytes = 0;
+	for(unsigned int i = 0; i < m_uiNumResources; ++i)
+		{
+		const FGResource& Resource = m_aResources[i];
+		if(Resource.uiAllocation != FG_NONE)
+			uiBytes += Resource.nWidth * Resource.nHeight * c_auiFGFormatBytes[Resource.eFormat];
+		}
+	return uiBytes;
+	}
+
+// ---------------------------------------------------------------
+unsigned int CFrameGraph::GetAliasedBytes() const
+	{
+	unsigned int uiBytes = 0;
+	for(unsigned int a = 0; a < m_uiNumAllocations; ++a)
+		uiBytes += m_aAllocations[a].nWidth * m_aAllocations[a].nHeight * c_auiFGFormatBytes[m_aAllocations[a].eFormat];
+	return uiBytes;
+	}
+
+// ---------------------------------------------------------------
+void CFrameGraph::ResetCounters()
+	{
+	for(unsigned int p = 0; p < m_uiNumPasses; ++p)
+		{
+		m_aPasses[p].uiRuns = 0;
+		m_aPasses[p].dBytesLoaded = m_aPasses[p].dBytesStored = 0.0;
+		}
+	m_dTotalAll = 0.0;
+	}
@@ -0,0 +1,192 @@
+#ifndef _FRAMEGRAPH_H_
+#define _FRAMEGRAPH_H_
+
+#include "GLStateCache.h"
+
+// The passes and the targets they read and write, declared up front in the order they run. Compiling culls the passes
+// whose output nothing uses, works out the span of passes each target is used over, and packs the targets into as few
+// allocations as it can: targets whose spans don't overlap can share one. Realising it makes the textures,
+// renderbuffers and framebuffers, and binding a pass through BeginPass clears whatever needs it.
+//
+// ES2 has no way to alias memory between different formats or sizes, so sharing is of a whole texture or renderbuffer.
+// A target whose passes only use the bottom left corner of what they're given (as the bloom levels do) can go in a
+// larger one; the others need the same size. Attachments have to match in size too, so a depth target takes the size
+// of the colour allocation it's drawn with.
+//
+// Each pass also says what it does with its attachments when it starts and finishes. On a tile based GPU, loading
+// copies a target from memory into tile memory and storing copies it back out; clearing, not caring and discarding
+// skip the copy, given EXT_discard_framebuffer to say so. BeginPass and EndPass apply them and count the bytes.
+#define FG_MAX_PASSES			32
+#define FG_MAX_RESOURCES		32
+#define FG_MAX_READS			4				// Per pass
+#define FG_NONE					0xFFFFFFFF
+
+// Resource flags
+#define FG_IMPORTED				0x1				// Made outside the graph, and kept between frames. Texture 0 is the screen.
+#define FG_CLEAR				0x2				// Cleared by the first pass to write it each frame, otherwise that pass clears it itself
+#define FG_CORNER				0x4				// Can go in a larger allocation; its passes use the bottom left corner
+
+enum enumFGFORMAT
+	{
+	enumFGFORMAT_RGBA8,
+	enumFGFORMAT_Depth16,
+	enumFGFORMAT_Depth24,
+	enumFGFORMAT_MAX,
+	};
+
+const char* const c_pszFGFormats[enumFGFORMAT_MAX] =
+	{
+	"rgba8",
+	"depth16",
+	"depth24",
+	};
+
+// What a pass does with an attachment's contents when it starts. Auto is decided by Compile: the first pass to write
+// a target clears it if it's FG_CLEAR or shares its allocation, and every other pass loads it.
+enum enumFGLOAD
+	{
+	enumFGLOAD_Auto,
+	enumFGLOAD_Load,
+	enumFGLOAD_Clear,
+	enumFGLOAD_DontCare,				// Overwritten, or the pass clears what it uses itself
+	enumFGLOAD_MAX,
+	};
+
+// And when it finishes. Auto stores imported targets, and any a later pass reads or loads.
+enum enumFGSTORE
+	{
+	enumFGSTORE_Auto,
+	enumFGSTORE_Store,
+	enumFGSTORE_Discard,
+	enumFGSTORE_MAX,
+	};
+
+const char* const c_pszFGLoads[enumFGLOAD_MAX]	= { "auto", "load", "clear", "dont_care" };
+const char* const c_pszFGStores[enumFGSTORE_MAX]	= { "auto", "store", "discard" };
+
+struct FGResource
+	{
+	const char*			pszName;
+	unsigned int		eFormat;				// enumFGFORMAT
+	int					nWidth;
+	int					nHeight;
+	unsigned int		uiFlags;
+	float				fClearDepth;
+	GLuint				uiImported;				// Texture, for imported ones
+
+	// From Compile
+	unsigned int		uiFirst;				// First and last passes to use it, FG_NONE if none do
+	unsigned int		uiLast;
+	unsigned int		uiFirstWriter;
+	unsigned int		uiAllocation;			// FG_NONE for imported ones
+	};
+
+struct FGAllocation
+	{
+	unsigned int		eFormat;
+	int					nWidth;
+	int					nHeight;
+	unsigned int		uiLast;					// Last pass to use any resource in it
+	unsigned int		uiUsers;				// Resources sharing it
+	GLuint				uiName;					// Texture for colour, renderbuffer for depth
+	};
+
+struct FGPass
+	{
+	const char*			pszName;
+	unsigned int		auiReads[FG_MAX_READS];
+	unsigned int		uiNumReads;
+	unsigned int		uiColour;				// Attachments written, or FG_NONE
+	unsigned int		uiDepth;
+	unsigned int		aeWantLoad[2];			// enumFGLOAD and enumFGSTORE for the colour and depth, from SetActions
+	unsigned int		aeWantStore[2];
+
+	// From Compile and Realise
+	bool				bCulled;
+	unsigned int		aeLoad[2];				// What the above came to
+	unsigned int		aeStore[2];
+	GLbitfield			uiClearMask;
+	GLuint				uiFBO;
+	bool				bOwnFBO;
+
+	// From BeginPass and EndPass
+	unsigned int		uiRuns;
+	double				dBytesLoaded;
+	double				dBytesStored;
+	};
+
+class CFrameGraph
+	{
+	private:
+		FGPass					m_aPasses[FG_MAX_PASSES];
+		unsigned int			m_uiNumPasses;
+		FGResource				m_aResources[FG_MAX_RESOURCES];
+		unsigned int			m_uiNumResources;
+		FGAllocation			m_aAllocations[FG_MAX_RESOURCES];
+		unsigned int			m_uiNumAllocations;
+		bool					m_bAlias;
+		PFNGLDISCARDFRAMEBUFFEREXTPROC	m_pfnDiscard;			// NULL if EXT_discard_framebuffer isn't in use
+		double					m_dFrameLoaded;
+		double					m_dFrameStored;
+		double					m_dFrameAll;			// What the passes run this frame would move if they loaded and stored everything
+		double					m_dTotalAll;
+
+		void Cull();
+		void FindLifetimes();
+		void Allocate(unsigned int uiResource, int nWidth, int nHeight);
+		void ResolveActions();
+		bool NeedsContents(unsigned int uiResource, unsigned int uiAfterPass) const;
+		GLsizei GetDiscards(const FGPass& Pass, const unsigned int* peActions, unsigned int eAction, GLenum* peAttachments) const;
+		unsigned int GetBytes(unsigned int uiResource) const;
+		bool IsDepth(unsigned int uiResource) const		{ return m_aResources[uiResource].eFormat != enumFGFORMAT_RGBA8; }
+		bool IsScreen(unsigned int uiResource) const	{ return (m_aResources[uiResource].uiFlags & FG_IMPORTED) && !m_aResources[uiResource].uiImported; }
+
+	public:
+		CFrameGraph() : m_pfnDiscard(NULL) { Reset(); }
+
+		void Reset();
+		unsigned int AddResource(const char* pszName, unsigned int eFormat, int nWidth, int nHeight, unsigned int uiFlags, float fClearDepth = 0.0f);
+		unsigned int ImportResource(const char* pszName, unsigned int eFormat, int nWidth, int nHeight, GLuint uiTexture);
+		unsigned int AddPass(const char* pszName);
+		void Read(unsigned int uiPass, unsigned int uiResource);
+		void Write(unsigned int uiPass, unsigned int uiResource);
+		void SetActions(unsigned int uiPass, unsigned int uiResource, unsigned int eLoad, unsigned int eStore);
+		void SetDiscardFunc(PFNGLDISCARDFRAMEBUFFEREXTPROC pfnDiscard)	{ m_pfnDiscard = pfnDiscard; }
+
+		bool Compile(bool bAlias, CPVRTString* pErrorStr);
+		bool Realise(GLuint uiScreenFBO, CPVRTString* pErrorStr);
+		void Release();
+
+		void BeginPass(unsigned int uiPass, CGLStateCache& State);
+		void EndPass(unsigned int uiPass, CGLStateCache& State);
+
+		bool IsCulled(unsigned int uiPass) const				{ return m_aPasses[uiPass].bCulled; }
+		GLuint GetFramebuffer(unsigned int uiPass) const		{ return m_aPasses[uiPass].uiFBO; }
+		GLuint GetTexture(unsigned int uiResource) const;
+		int GetWidth(unsigned int uiResource) const;			// Of its allocation
+		int GetHeight(unsigned int uiResource) const;
+
+		unsigned int GetNumPasses() const						{ return m_uiNumPasses; }
+		unsigned int GetNumCulled() const;
+		unsigned int GetNumResources() const					{ return m_uiNumResources; }
+		const FGResource& GetResource(unsigned int i) const		{ return m_aResources[i]; }
+		const FGPass& GetPass(unsigned int i) const				{ return m_aPasses[i]; }
+		unsigned int GetNumAllocations() const					{ return m_uiNumAllocations; }
+		unsigned int GetNumTargets() const;						// Resources the graph allocates for, after culling
+		unsigned int GetUnaliasedBytes() const;					// If each of those had its own allocation
+		unsigned int GetAliasedBytes() const;
+
+		// Bandwidth. An attachment's whole allocation is counted for each load and store.
+		void BeginFrame()										{ m_dFrameLoaded = m_dFrameStored = m_dFrameAll = 0.0; }
+		void ResetCounters();
+		bool HasDiscard() const									{ return m_pfnDiscard != NULL; }
+		unsigned int GetPassRuns(unsigned int uiPass) const		{ return m_aPasses[uiPass].uiRuns; }
+		double GetPassBytesLoaded(unsigned int uiPass) const	{ return m_aPasses[uiPass].dBytesLoaded; }
+		double GetPassBytesStored(unsigned int uiPass) const	{ return m_aPasses[uiPass].dBytesStored; }
+		double GetFrameBytesLoaded() const						{ return m_dFrameLoaded; }
+		double GetFrameBytesStored() const						{ return m_dFrameStored; }
+		double GetFrameBytesAll() const							{ return m_dFrameAll; }
+		double GetTotalBytesAll() const							{ return m_dTotalAll; }
+	};
+
+#endif // _FRAMEGRAPH_H_
@@ -0,0 +1,330 @@
+#include "GLStateCache.h"
+
+// ---------------------------------------------------------------
+void CGLStateCache::Invalidate()
+	{
+	m_uiProgram			= STATE_UNKNOWN;
+	m_uiFramebuffer		= STATE_UNKNOWN;
+	m_uiVertexArray		= STATE_UNKNOWN;
+	m_uiArrayBuffer		= STATE_UNKNOWN;
+	m_eActiveTexture	= STATE_UNKNOWN;
+	for(int i = 0; i < STATE_CACHE_TEXTURE_UNITS; ++i)
+		m_auiTexture[i] = STATE_UNKNOWN;
+
+	InvalidateVertexArrayState();
+
+	for(int i = 0; i < enumCAP_MAX; ++i)
+		m_auiCap[i] = STATE_UNKNOWN;
+
+	m_eBlendSrc = m_eBlendDst = STATE_UNKNOWN;
+	m_eCullFace			= STATE_UNKNOWN;
+	m_eDepthFunc		= STATE_UNKNOWN;
+	m_uiDepthMask		= STATE_UNKNOWN;
+	m_uiColourMask		= STATE_UNKNOWN;
+	m_anViewport[2]		= -1;
+	m_anScissor[2]		= -1;
+	m_bClearColourKnown	= false;
+
+	// Uniform values live in the program objects, so they stay valid until the programs are recreated (InvalidateUniforms).
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::InvalidateVertexArrayState()
+	{
+	// Everything here belongs to the bound vertex array object
+	m_uiElementBuffer	= STATE_UNKNOWN;
+	m_uiAttribMask		= 0;
+	m_bAttribMaskKnown	= false;
+	for(int i = 0; i < STATE_CACHE_ATTRIBS; ++i)
+		{
+		m_aAttrib[i].bKnown		= false;
+		m_aAttrib[i].uiBuffer	= STATE_UNKNOWN;
+		}
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::BindVertexArray(GLuint uiVertexArray)
+	{
+	if(!m_pfnBindVertexArray)
+		return;
+	if(Filter(m_uiVertexArray == uiVertexArray))
+		return;
+	m_pfnBindVertexArray(uiVertexArray);
+	m_uiVertexArray = uiVertexArray;
+	InvalidateVertexArrayState();
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::UseProgram(GLuint uiProgram)
+	{
+	if(Filter(m_uiProgram == uiProgram))
+		return;
+	glUseProgram(uiProgram);
+	m_uiProgram = uiProgram;
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::BindFramebuffer(GLuint uiFramebuffer)
+	{
+	if(Filter(m_uiFramebuffer == uiFramebuffer))
+		return;
+	glBindFramebuffer(GL_FRAMEBUFFER, uiFramebuffer);
+	m_uiFramebuffer = uiFramebuffer;
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::BindBuffer(GLenum eTarget, GLuint uiBuffer)
+	{
+	GLuint& uiCurrent = (eTarget == GL_ARRAY_BUFFER) ? m_uiArrayBuffer : m_uiElementBuffer;
+	if(Filter(uiCurrent == uiBuffer))
+		return;
+	glBindBuffer(eTarget, uiBuffer);
+	uiCurrent = uiBuffer;
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::BindTexture(GLenum eUnit, GLuint uiTexture)
+	{
+	unsigned int uiUnit = eUnit - GL_TEXTURE0;
+	ASSERT(uiUnit < STATE_CACHE_TEXTURE_UNITS);
+
+	// Already bound on that unit, so there's no need to switch units either.
+	if(Filter(m_auiTexture[uiUnit] == uiTexture))
+		return;
+
+	if(m_eActiveTexture != eUnit || !m_bFilter)
+		{
+		glActiveTexture(eUnit);
+		m_eActiveTexture = eUnit;
+		++m_uiIssued;
+		}
+	glBindTexture(GL_TEXTURE_2D, uiTexture);
+	m_auiTexture[uiUnit] = uiTexture;
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::SetCap(GLenum eCap, bool bEnable)
+	{
+	int nIdx;
+	switch(eCap)
+		{
+		case GL_BLEND:			nIdx = enumCAP_Blend;		break;
+		case GL_CULL_FACE:		nIdx = enumCAP_CullFace;	break;
+		case GL_DEPTH_TEST:		nIdx = enumCAP_DepthTest;	break;
+		case GL_SCISSOR_TEST:	nIdx = enumCAP_ScissorTest;	break;
+		default:
+			ASSERT(!"Unsupported capability");
+			return;
+		}
+
+	if(Filter(m_auiCap[nIdx] == (GLuint)bEnable))
+		return;
+	if(bEnable)
+		glEnable(eCap);
+	else
+		glDisable(eCap);
+	m_auiCap[nIdx] = bEnable;
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::BlendFunc(GLenum eSrc, GLenum eDst)
+	{
+	if(Filter(m_eBlendSrc == eSrc && m_eBlendDst == eDst))
+		return;
+	glBlendFunc(eSrc, eDst);
+	m_eBlendSrc = eSrc;
+	m_eBlendDst = eDst;
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::CullFace(GLenum eFace)
+	{
+	if(Filter(m_eCullFace == eFace))
+		return;
+	glCullFace(eFace);
+	m_eCullFace = eFace;
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::DepthFunc(GLenum eFunc)
+	{
+	if(Filter(m_eDepthFunc == eFunc))
+		return;
+	glDepthFunc(eFunc);
+	m_eDepthFunc = eFunc;
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::DepthMask(GLboolean bMask)
+	{
+	if(Filter(m_uiDepthMask == (GLuint)bMask))
+		return;
+	glDepthMask(bMask);
+	m_uiDepthMask = bMask;
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::ColorMask(GLboolean bR, GLboolean bG, GLboolean bB, GLboolean bA)
+	{
+	GLuint uiMask = (bR ? 1 : 0) | (bG ? 2 : 0) | (bB ? 4 : 0) | (bA ? 8 : 0);
+	if(Filter(m_uiColourMask == uiMask))
+		return;
+	glColorMask(bR, bG, bB, bA);
+	m_uiColourMask = uiMask;
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::Viewport(GLint nX, GLint nY, GLsizei nWidth, GLsizei nHeight)
+	{
+	if(Filter(m_anViewport[0] == nX && m_anViewport[1] == nY && m_anViewport[2] == nWidth && m_anViewport[3] == nHeight))
+		return;
+	glViewport(nX, nY, nWidth, nHeight);
+	m_anViewport[0] = nX;		m_anViewport[1] = nY;
+	m_anViewport[2] = nWidth;	m_anViewport[3] = nHeight;
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::Scissor(GLint nX, GLint nY, GLsizei nWidth, GLsizei nHeight)
+	{
+	if(Filter(m_anScissor[0] == nX && m_anScissor[1] == nY && m_anScissor[2] == nWidth && m_anScissor[3] == nHeight))
+		return;
+	glScissor(nX, nY, nWidth, nHeight);
+	m_anScissor[0] = nX;		m_anScissor[1] = nY;
+	m_anScissor[2] = nWidth;	m_anScissor[3] = nHeight;
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::ClearColor(float fR, float fG, float fB, float fA)
+	{
+	if(Filter(m_bClearColourKnown && m_afClearColour[0] == fR && m_afClearColour[1] == fG && m_afClearColour[2] == fB && m_afClearColour[3] == fA))
+		return;
+	glClearColor(fR, fG, fB, fA);
+	m_afClearColour[0] = fR;	m_afClearColour[1] = fG;
+	m_afClearColour[2] = fB;	m_afClearColour[3] = fA;
+	m_bClearColourKnown = true;
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::VertexAttribArrays(unsigned int uiMask)
+	{
+	// Enables exactly the attributes in uiMask, touching only the ones that differ.
+	for(unsigned int i = 0; i < STATE_CACHE_ATTRIBS; ++i)
+		{
+		unsigned int uiBit = 1 << i;
+		bool bWanted = (uiMask & uiBit) != 0;
+		bool bKnown = m_bAttribMaskKnown && m_bFilter;
+
+		if(bKnown && bWanted == ((m_uiAttribMask & uiBit) != 0))
+			{
+			if(bWanted)
+				++m_uiFiltered;
+			continue;
+			}
+		++m_uiIssued;
+		if(bWanted)
+			glEnableVertexAttribArray(i);
+		else
+			glDisableVertexAttribArray(i);
+		}
+	m_uiAttribMask = uiMask;
+	m_bAttribMaskKnown = true;
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::VertexAttribPointer(GLuint uiIndex, GLint nSize, GLenum eType, GLboolean bNormalised, GLsizei nStride, const void* pPointer)
+	{
+	ASSERT(uiIndex < STATE_CACHE_ATTRIBS);
+	CachedAttribPointer& Attrib = m_aAttrib[uiIndex];
+
+	// The pointer is an offset into whichever buffer was bound when it was set, so that is part of the state too.
+	// The array buffer can itself be STATE_UNKNOWN straight after an invalidate, so the buffers matching isn't enough.
+	if(Filter(Attrib.bKnown && Attrib.uiBuffer == m_uiArrayBuffer && Attrib.nSize == nSize && Attrib.eType == eType &&
+			  Attrib.bNormalised == bNormalised && Attrib.nStride == nStride && Attrib.pPointer == pPointer))
+		return;
+
+	glVertexAttribPointer(uiIndex, nSize, eType, bNormalised, nStride, pPointer);
+	Attrib.bKnown		= m_uiArrayBuffer != STATE_UNKNOWN;
+	Attrib.uiBuffer		= m_uiArrayBuffer;
+	Attrib.nSize		= nSize;
+	Attrib.eType		= eType;
+	Attrib.bNormalised	= bNormalised;
+	Attrib.nStride		= nStride;
+	Attrib.pPointer		= pPointer;
+	}
+
+// ---------------------------------------------------------------
+bool CGLStateCache::FilterUniform(GLint nLocation, const void* pData, unsigned int uiSize)
+	{
+	if(nLocation < 0)
+		return Filter(true);				// GL ignores these anyway
+	if(m_uiProgram == STATE_UNKNOWN)
+		return Filter(false);
+
+	// Open addressing on (program, location)
+	unsigned int uiHash = (m_uiProgram * 31 + (unsigned int)nLocation) & (STATE_CACHE_UNIFORMS - 1);
+	for(unsigned int uiProbe = 0; uiProbe < STATE_CACHE_UNIFORMS; ++uiProbe)
+		{
+		CachedUniform& Uniform = m_aUniform[(uiHash + uiProbe) & (STATE_CACHE_UNIFORMS - 1)];
+		if(Uniform.uiProgram == 0)
+			{
+			Uniform.uiProgram	= m_uiProgram;
+			Uniform.nLocation	= nLocation;
+			Uniform.uiSize		= uiSize;
+			memcpy(Uniform.aData, pData, uiSize);
+			return Filter(false);
+			}
+
+		if(Uniform.uiProgram == m_uiProgram && Uniform.nLocation == nLocation)
+			{
+			bool bSame = Uniform.uiSize == uiSize && memcmp(Uniform.aData, pData, uiSize) == 0;
+			Uniform.uiSize = uiSize;
+			memcpy(Uniform.aData, pData, uiSize);
+			return Filter(bSame);
+			}
+		}
+
+	return Filter(false);					// Table full. Just upload it.
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::Uniform1i(GLint nLocation, GLint nValue)
+	{
+	if(!FilterUniform(nLocation, &nValue, sizeof(nValue)))
+		glUniform1i(nLocation, nValue);
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::Uniform1f(GLint nLocation, float fValue)
+	{
+	if(!FilterUniform(nLocation, &fValue, sizeof(fValue)))
+		glUniform1f(nLocation, fValue);
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::Uniform2f(GLint nLocation, float fX, float fY)
+	{
+	float afValue[2] = { fX, fY };
+	if(!FilterUniform(nLocation, afValue, sizeof(afValue)))
+		glUniform2f(nLocation, fX, fY);
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::Uniform3fv(GLint nLocation, const float* pfValue)
+	{
+	if(!FilterUniform(nLocation, pfValue, sizeof(float) * 3))
+		glUniform3fv(nLocation, 1, pfValue);
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::Uniform4fv(GLint nLocation, const float* pfValue)
+	{
+	if(!FilterUniform(nLocation, pfValue, sizeof(float) * 4))
+		glUniform4fv(nLocation, 1, pfValue);
+	}
+
+// ---------------------------------------------------------------
+void CGLStateCache::UniformMatrix4fv(GLint nLocation, const float* pfValue)
+	{
+	if(!FilterUniform(nLocation, pfValue, sizeof(float) * 16))
+		glUniformMatrix4fv(nLocation, 1, GL_FALSE, pfValue);
+	}
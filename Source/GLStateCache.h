@@ -0,0 +1,126 @@
+#ifndef _GLSTATECACHE_H_
+#define _GLSTATECACHE_H_
+
+#include "Common.h"
+
+#define STATE_CACHE_TEXTURE_UNITS	8
+#define STATE_CACHE_ATTRIBS			8
+#define STATE_CACHE_UNIFORMS		256			// Must be a power of 2
+#define STATE_UNKNOWN				0xFFFFFFFF	// Cached value that never matches, so the next call is always issued
+
+enum enumCAP
+	{
+	enumCAP_Blend,
+	enumCAP_CullFace,
+	enumCAP_DepthTest,
+	enumCAP_ScissorTest,
+	enumCAP_MAX,
+	};
+
+struct CachedAttribPointer
+	{
+	bool				bKnown;				// False after an invalidate, when GL's pointer may be anything
+	GLuint				uiBuffer;
+	GLint				nSize;
+	GLenum				eType;
+	GLboolean			bNormalised;
+	GLsizei				nStride;
+	const void*			pPointer;
+	};
+
+struct CachedUniform
+	{
+	GLuint				uiProgram;			// 0 if the slot is free
+	GLint				nLocation;
+	unsigned int		uiSize;
+	unsigned char		aData[sizeof(float) * 16];
+	};
+
+// Shadows the GL state the demo touches and drops calls that wouldn't change anything.
+// Anything that changes GL state behind the cache's back (e.g. Print3D) must be followed by Invalidate().
+class CGLStateCache
+	{
+	private:
+		bool				m_bFilter;			// When false every call is passed straight through (for comparison)
+		unsigned int		m_uiIssued;
+		unsigned int		m_uiFiltered;
+
+		PFNGLBINDVERTEXARRAYOESPROC	m_pfnBindVertexArray;	// NULL if OES_vertex_array_object isn't in use
+
+		GLuint				m_uiProgram;
+		GLuint				m_uiFramebuffer;
+		GLuint				m_uiVertexArray;
+		GLuint				m_uiArrayBuffer;
+		GLuint				m_uiElementBuffer;
+		GLenum				m_eActiveTexture;
+		GLuint				m_auiTexture[STATE_CACHE_TEXTURE_UNITS];
+		unsigned int		m_uiAttribMask;
+		bool				m_bAttribMaskKnown;
+		CachedAttribPointer	m_aAttrib[STATE_CACHE_ATTRIBS];
+		GLuint				m_auiCap[enumCAP_MAX];
+		GLenum				m_eBlendSrc;
+		GLenum				m_eBlendDst;
+		GLenum				m_eCullFace;
+		GLenum				m_eDepthFunc;
+		GLuint				m_uiDepthMask;
+		GLuint				m_uiColourMask;
+		GLint				m_anViewport[4];
+		GLint				m_anScissor[4];
+		float				m_afClearColour[4];
+		bool				m_bClearColourKnown;
+		CachedUniform		m_aUniform[STATE_CACHE_UNIFORMS];
+
+	public:
+		CGLStateCache() : m_bFilter(true), m_uiIssued(0), m_uiFiltered(0), m_pfnBindVertexArray(NULL) { Invalidate(); InvalidateUniforms(); }
+
+		void Invalidate();
+		void InvalidateUniforms()			{ memset(m_aUniform, 0, sizeof(m_aUniform)); }
+		void SetFiltering(bool bFilter)		{ m_bFilter = bFilter; }
+		void SetVertexArrayFunc(PFNGLBINDVERTEXARRAYOESPROC pfnBind)	{ m_pfnBindVertexArray = pfnBind; }
+		void ResetCounters()				{ m_uiIssued = m_uiFiltered = 0; }
+		unsigned int GetIssued() const		{ return m_uiIssued; }
+		unsigned int GetFiltered() const	{ return m_uiFiltered; }
+
+		void UseProgram(GLuint uiProgram);
+		void BindFramebuffer(GLuint uiFramebuffer);
+		void BindVertexArray(GLuint uiVertexArray);
+		void BindBuffer(GLenum eTarget, GLuint uiBuffer);
+		void BindTexture(GLenum eUnit, GLuint uiTexture);
+		void Enable(GLenum eCap)			{ SetCap(eCap, true); }
+		void Disable(GLenum eCap)			{ SetCap(eCap, false); }
+		void BlendFunc(GLenum eSrc, GLenum eDst);
+		void CullFace(GLenum eFace);
+		void DepthFunc(GLenum eFunc);
+		void DepthMask(GLboolean bMask);
+		void ColorMask(GLboolean bR, GLboolean bG, GLboolean bB, GLboolean bA);
+		void Viewport(GLint nX, GLint nY, GLsizei nWidth, GLsizei nHeight);
+		void Scissor(GLint nX, GLint nY, GLsizei nWidth, GLsizei nHeight);
+		void ClearColor(float fR, float fG, float fB, float fA);
+		void VertexAttribArrays(unsigned int uiMask);
+		void VertexAttribPointer(GLuint uiIndex, GLint nSize, GLenum eType, GLboolean bNormalised, GLsizei nStride, const void* pPointer);
+
+		void Uniform1i(GLint nLocation, GLint nValue);
+		void Uniform1f(GLint nLocation, float fValue);
+		void Uniform2f(GLint nLocation, float fX, float fY);
+		void Uniform3fv(GLint nLocation, const float* pfValue);
+		void Uniform4fv(GLint nLocation, const float* pfValue);
+		void UniformMatrix4fv(GLint nLocation, const float* pfValue);
+
+	private:
+		bool Filter(bool bUnchanged)
+			{
+			if(bUnchanged && m_bFilter)
+				{
+				++m_uiFiltered;
+				return true;
+				}
+			++m_uiIssued;
+			return false;
+			}
+
+		void SetCap(GLenum eCap, bool bEnable);
+		void InvalidateVertexArrayState();
+		bool FilterUniform(GLint nLocation, const void* pData, unsigned int uiSize);
+	};
+
+#endif // _GLSTATECACHE_H_
@@ -0,0 +1,172 @@
+#include "JobSystem.h"
+
+// ---------------------------------------------------------------
+bool CJobSystem::Start(unsigned int uiNumThreads)
+	{
+	Stop();
+	m_nQuit = 0;
+	m_uiNumThreads = 1;
+	uiNumThreads = PVRT_CLAMP(uiNumThreads, 1u, (unsigned int)JOB_MAX_THREADS);
+	for(unsigned int i = 1; i < uiNumThreads; ++i)
+		{
+		m_aWorkers[i].pJobs = this;
+		m_aWorkers[i].uiThread = i;
+		if(!StartThread(&m_aThreads[i], ThreadMain, &m_aWorkers[i]))
+			break;			// Make do with the ones that did start
+		m_uiNumThreads = i + 1;
+		}
+
+	for(unsigned int i = 0; i < m_uiNumThreads; ++i)
+		m_aDeques[i].uiFront = m_aDeques[i].uiBack = 0;
+	ResetCounters();
+	return m_uiNumThreads == uiNumThreads;
+	}
+
+// ---------------------------------------------------------------
+void CJobSystem::Stop()
+	{
+	if(m_uiNumThreads <= 1)
+		return;
+
+	AtomicAdd(&m_nQuit, 1);
+	m_WorkSignal.Post(m_uiNumThreads - 1);
+	for(unsigned int i = 1; i < m_uiNumThreads; ++i)
+		JoinThread(m_aThreads[i]);
+	m_uiNumThreads = 1;
+	}
+
+// ---------------------------------------------------------------
+THREAD_MAIN(CJobSystem::ThreadMain)
+	{
+	Worker* pWorker = (Worker*)pUserData;
+	pWorker->pJobs->WorkerLoop(pWorker->uiThread);
+	THREAD_RETURN;
+	}
+
+// ---------------------------------------------------------------
+void CJobSystem::WorkerLoop(unsigned int uiThread)
+	{
+	for(;;)
+		{
+		m_WorkSignal.Wait();
+		if(m_nQuit)
+			return;
+
+		// Help until the ParallelFor that woke us is done. A late wake-up just finds nothing to do.
+		while(m_nPending > 0)
+			{
+			if(!RunOne(uiThread))
+				YieldThread();
+			}
+		}
+	}
+
+// ---------------------------------------------------------------
+void CJobSystem::ParallelFor(PFNJOB pfnJob, void* pUserData, unsigned int uiCount, unsigned int uiGrain)
+	{
+	// Only call this from the render thread, and not from inside a job
+	if(!uiCount)
+		return;
+
+	Job Root = { pfnJob, pUserData, 0, uiCount, PVRT_MAX(uiGrain, 1u) };
+	if(m_uiNumThreads == 1 || uiCount <= Root.uiGrain)
+		{
+		// Not worth waking anyone for
+		pfnJob(pUserData, 0, uiCount, 0);
+		++m_aStats[0].uiJobs;
+		m_aStats[0].uiItems += uiCount;
+		return;
+		}
+
+	AtomicAdd(&m_nPending, 1);
+	Push(0, Root);
+	m_WorkSignal.Post(m_uiNumThreads - 1);
+
+	while(m_nPending > 0)
+		{
+		if(!RunOne(0))
+			YieldThread();
+		}
+	MEMORY_BARRIER();			// Don't read the jobs' output before seeing them finish
+	}
+
+// ---------------------------------------------------------------
+bool CJobSystem::Push(unsigned int uiThread, const Job& NewJob)
+	{
+	Deque& Q = m_aDeques[uiThread];
+	CMutexLock Lock(Q.Mutex);
+	if(Q.uiBack - Q.uiFront == JOB_DEQUE_SIZE)
+		return false;
+	Q.aJobs[Q.uiBack++ % JOB_DEQUE_SIZE] = NewJob;
+	return true;
+	}
+
+// ---------------------------------------------------------------
+bool CJobSystem::Pop(unsigned int uiThread, Job* pJob)
+	{
+	// Newest first: it's the smallest, and the most likely to still be in this core's cache
+	Deque& Q = m_aDeques[uiThread];
+	CMutexLock Lock(Q.Mutex);
+	if(Q.uiBack == Q.uiFront)
+		return false;
+	*pJob = Q.aJobs[--Q.uiBack % JOB_DEQUE_SIZE];
+	return true;
+	}
+
+// ---------------------------------------------------------------
+bool CJobSystem::Steal(unsigned int uiThread, Job* pJob)
+	{
+	// Oldest first: it's the biggest, so the thief goes longest before it has to steal again
+	Deque& Q = m_aDeques[uiThread];
+	if(Q.uiBack == Q.uiFront)
+		return false;			// Not worth taking the lock. A stale look only means a missed chance.
+
+	CMutexLock Lock(Q.Mutex);
+	if(Q.uiBack == Q.uiFront)
+		return false;
+	*pJob = Q.aJobs[Q.uiFront++ % JOB_DEQUE_SIZE];
+	return true;
+	}
+
+// ---------------------------------------------------------------
+bool CJobSystem::RunOne(unsigned int uiThread)
+	{
+	Job CurrJob;
+	if(!Pop(uiThread, &CurrJob))
+		{
+		// Start with the next thread along, so the thieves don't all pile onto the same deque
+		bool bStolen = false;
+		for(unsigned int i = 1; i < m_uiNumThreads && !bStolen; ++i)
+			bStolen = Steal((uiThread + i) % m_uiNumThreads, &CurrJob);
+		if(!bStolen)
+			return false;
+		++m_aStats[uiThread].uiSteals;
+		}
+
+	Run(uiThread, CurrJob);
+	return true;
+	}
+
+// ---------------------------------------------------------------
+void CJobSystem::Run(unsigned int uiThread, Job CurrJob)
+	{
+	// Split off the top half until what's left is down to the grain. The halves go on this thread's deque, where it'll
+	// find them again if nobody steals them first.
+	while(CurrJob.uiEnd - CurrJob.uiBegin > CurrJob.uiGrain)
+		{
+		Job Half = CurrJob;
+		Half.uiBegin = CurrJob.uiBegin + (CurrJob.uiEnd - CurrJob.uiBegin) / 2;
+		AtomicAdd(&m_nPending, 1);
+		if(!Push(uiThread, Half))
+			{
+			AtomicAdd(&m_nPending, -1);
+			break;				// Full. Run the rest here.
+			}
+		CurrJob.uiEnd = Half.uiBegin;
+		}
+
+	CurrJob.pfnJob(CurrJob.pUserData, CurrJob.uiBegin, CurrJob.uiEnd, uiThread);
+	++m_aStats[uiThread].uiJobs;
+	m_aStats[uiThread].uiItems += CurrJob.uiEnd - CurrJob.uiBegin;
+	AtomicAdd(&m_nPending, -1);		// Publishes the job's output along with it
+	}
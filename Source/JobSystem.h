@@ -0,0 +1,93 @@
+#ifndef _JOBSYSTEM_H_
+#define _JOBSYSTEM_H_
+
+#include "Threading.h"
+
+// A small work-stealing scheduler for the CPU side of the frame. The render thread is thread 0 and the pool's workers
+// are the rest. Each thread owns a deque: it pushes and pops its own jobs at the back, and once that's empty steals from
+// the front of another's. A ParallelFor starts as a single job on the render thread's deque, and every job halves its
+// range down to the grain, pushing the halves it doesn't keep, so the work fans out without a shared queue to contend on.
+// Jobs make no GL calls. They fill in arrays that the render thread submits from once ParallelFor returns.
+#define JOB_MAX_THREADS			16
+#define JOB_DEQUE_SIZE			64			// Per thread. Halving only stacks up log2(count / grain) jobs at a time.
+#define JOB_DEFAULT_GRAIN		256
+
+#if defined(_WIN32)
+#define MEMORY_BARRIER() MemoryBarrier()
+#else
+#define MEMORY_BARRIER() __sync_synchronize()
+#endif
+
+typedef void (*PFNJOB)(void* pUserData, unsigned int uiBegin, unsigned int uiEnd, unsigned int uiThread);
+
+class CJobSystem
+	{
+	private:
+		struct Job
+			{
+			PFNJOB			pfnJob;
+			void*			pUserData;
+			unsigned int	uiBegin;
+			unsigned int	uiEnd;
+			unsigned int	uiGrain;
+			};
+
+		struct Deque
+			{
+			CMutex			Mutex;
+			Job				aJobs[JOB_DEQUE_SIZE];
+			volatile unsigned int	uiFront;	// Thieves take from here
+			volatile unsigned int	uiBack;		// The owner pushes and pops here
+			};
+
+		struct Worker
+			{
+			CJobSystem*		pJobs;
+			unsigned int	uiThread;
+			};
+
+		// Written by their own thread only, and padded so neighbours don't share a cache line
+		struct ThreadStats
+			{
+			unsigned int	uiJobs;
+			unsigned int	uiSteals;
+			unsigned int	uiItems;
+			char			aPad[64 - 3 * sizeof(unsigned int)];
+			};
+
+		ThreadHandle		m_aThreads[JOB_MAX_THREADS];
+		Worker				m_aWorkers[JOB_MAX_THREADS];
+		Deque				m_aDeques[JOB_MAX_THREADS];
+		ThreadStats			m_aStats[JOB_MAX_THREADS];
+		unsigned int		m_uiNumThreads;			// Including the render thread
+		CSemaphore			m_WorkSignal;			// Posted once per worker when a ParallelFor starts
+		volatile long		m_nPending;				// Jobs of the current ParallelFor not finished yet
+		volatile long		m_nQuit;
+
+		static THREAD_MAIN(ThreadMain);
+		void WorkerLoop(unsigned int uiThread);
+		bool Push(unsigned int uiThread, const Job& NewJob);
+		bool Pop(unsigned int uiThread, Job* pJob);
+		bool Steal(unsigned int uiThread, Job* pJob);
+		bool RunOne(unsigned int uiThread);
+		void Run(unsigned int uiThread, Job CurrJob);
+
+		CJobSystem(const CJobSystem&);
+		CJobSystem& operator=(const CJobSystem&);
+
+	public:
+		CJobSystem() : m_uiNumThreads(1), m_nPending(0), m_nQuit(0) { ResetCounters(); }
+		~CJobSystem()								{ Stop(); }
+
+		bool Start(unsigned int uiNumThreads);
+		void Stop();
+		void ParallelFor(PFNJOB pfnJob, void* pUserData, unsigned int uiCount, unsigned int uiGrain);
+
+		void ResetCounters()						{ memset(m_aStats, 0, sizeof(m_aStats)); }
+		unsigned int GetNumThreads() const			{ return m_uiNumThreads; }
+		unsigned int GetJobs(unsigned int uiThread) const	{ return m_aStats[uiThread].uiJobs; }
+		unsigned int GetSteals(unsigned int uiThread) const	{ return m_aStats[uiThread].uiSteals; }
+		unsigned int GetItems(unsigned int uiThread) const	{ return m_aStats[uiThread].uiItems; }
+	};
+
+#endif // _JOBSYSTEM_H_
@@ -1,19 +1,40 @@
-#include <math.h>
-
-#ifdef PLATFORM_IOS
-#define max(x, y) (x > y ? x : y)
-#endif
-
-
-#include "PVRShell.h"
-#include "OGLES2Tools.h"
-
-#define RTT_SIZE 128
-#define SHADOW_MAP_SIZE 512
+#include "Common.h"
+#include "JobSystem.h"
+#include "GLStateCache.h"
+#include "Package.h"
+#include "SIMDMath.h"
+#include "CompactVertex.h"
+#include "SoftRaster.h"
+#include "SceneGraph.h"
+#include "CommandBuffer.h"
+#include "FrameGraph.h"
+
+#define SHADOW_MAP_DEFAULT_SIZE		512
+#define SHADOW_LOD_DEFAULT_RATIO		0.25f		// Shadow caster triangle budget as a fraction of the full mesh, unless given with -shadowtris
+#define SHADOW_LOD_MAX_ERROR			0.01f		// Largest surface deviation allowed in the shadow caster LOD, relative to the mesh's half diagonal
 #define FLOOR_ALPHA 0.85f
-#define ELEMENTS_IN_ARRAY(x) (sizeof(x) / sizeof(x[0]))
-
-#define ASSERT(x) assert(x)
+#define CAMERA_NEAR				10.0f
+#define REFL_DEFAULT_SCALE		0.5f		// Reflection target resolution, relative to the screen
+#define REFL_CLIP_OFFSET		0.5f		// The reflection's clip plane sits this far above the floor, so contact points aren't cut
+#define BLOOM_DEFAULT_SIZE		128			// Resolution of the top level of the bloom pyramid
+#define BLOOM_DEFAULT_LEVELS	4
+#define BLOOM_DEFAULT_RADIUS	24.0f		// Gaussian reach (3 sigma), in top level texels
+#define BLOOM_MAX_LEVELS		6
+#define BLOOM_MIN_SIZE			4			// Smallest a pyramid level is allowed to get
+#define BLOOM_MAX_TAPS			8			// Linear-sampled Gaussian taps, centre included. Must match BloomBlur.fsh.
+#define BENCH_DEFAULT_FRAMES	1000
+#define BENCH_WARMUP_FRAMES		10				// Frames rendered before timing starts, so driver-side lazy compilation isn't measured.
+#define BENCH_FIXED_DT			(1.0f / 60.0f)	// Simulation timestep used in benchmark mode.
+#define BENCH_DEFAULT_REPORT	"benchmark.json"
+
+#define JOB_BENCH_DEFAULT_RUNS	50
+#define JOB_BENCH_WARMUP_RUNS	5
+#define JOB_BENCH_REPORT		"job_scaling.json"
+
+#define CROWD_MAX_INSTANCES		65536
+#define CROWD_PALETTE_SIZE		48			// Statues per draw on the palette path. Passed to StatueShader.vsh as PALETTE_SIZE.
+#define CROWD_STRINGIZE(x)		#x
+#define CROWD_STR(x)			CROWD_STRINGIZE(x)
 
 enum enumEFFECT
 	{
@@ -24,9 +45,32 @@ enum enumEFFECT
 	enumEFFECT_BloomBlur,
 	enumEFFECT_SimpleModel,
 	enumEFFECT_ChurchRefl,
+	enumEFFECT_BloomDown,
+	enumEFFECT_BloomUp,
+	enumEFFECT_Floor,
+	enumEFFECT_CrowdPalette,
+	enumEFFECT_CrowdInstanced,
 	enumEFFECT_MAX,
 	};
 
+typedef char CmdKeyEffectFits[enumEFFECT_MAX <= CMD_MAX_EFFECTS ? 1 : -1];		// The command buffer's sort key has room for this many
+
+// What a draw packet's uniforms mean, so the same packet can be run with either renderer. Each effect's table below says
+// which of its uniforms has which meaning.
+enum enumUNIFORM
+	{
+	enumUNIFORM_None = -1,
+	enumUNIFORM_MVP,
+	enumUNIFORM_ModelView,
+	enumUNIFORM_LightPos,
+	enumUNIFORM_BloomMulti,
+	enumUNIFORM_Projection,
+	enumUNIFORM_TexProjection,
+	enumUNIFORM_ReflProjection,
+	enumUNIFORM_Alpha,
+	enumUNIFORM_MAX,
+	};
+
 enum enumTEXTURE
 	{
 	enumTEXTURE_Floor,
@@ -38,41 +82,30 @@ enum enumTEXTURE
 	enumTEXTURE_MAX,
 	};
 
-enum enumMODEL
-	{
-	enumMODEL_Statue,
-	enumMODEL_Floor,
-	enumMODEL_Church,
-	enumMODEL_MAX,
-	};
-
-enum enumFRAMEBUFFER
-	{
-	enumFB_1		= 0,
-	enumFB_2		= 1,
-	enumFB_MAX,
-	};
-
 const GLuint FLAG_VRT	= (1 << 1);
 const GLuint FLAG_TEX0	= (1 << 2);
 const GLuint FLAG_TEX1	= (1 << 3);
 const GLuint FLAG_NRM	= (1 << 4);
 const GLuint FLAG_TAN	= (1 << 5);
 const GLuint FLAG_BIN	= (1 << 6);
+const GLuint FLAG_DEPTH	= (1 << 7);		// Draw from the mesh's position-only depth stream instead of the full vertex data
 
-// Utility function to strip the leading folders for iOS
-const char* StripFolder(const char* c_pszFilename)
+// Every role/attribute combination drawn by the demo. With OES_vertex_array_object each of these is baked into a VAO
+// for every mesh drawn in that role.
+struct MeshLayout
 	{
-#ifdef PLATFORM_IOS
-	const char* c_pSlash = strrchr(c_pszFilename, '/');
-	if(!c_pSlash)
-		return c_pszFilename;
-	else 
-		return c_pSlash + 1;
-#else
-	return c_pszFilename;
-#endif
-	}
+	int						nRole;
+	GLuint					uiFlags;
+	};
+
+const MeshLayout c_MeshLayouts[] =
+	{
+	{ enumMODEL_Statue,		FLAG_VRT | FLAG_DEPTH },						// Shadow pass
+	{ enumMODEL_Statue,		FLAG_VRT | FLAG_TEX0 | FLAG_NRM | FLAG_TAN },	// Statue and bloom
+	{ enumMODEL_Church,		FLAG_VRT | FLAG_TEX0 | FLAG_TEX1 },
+	{ enumMODEL_Floor,		FLAG_VRT | FLAG_TEX0 | FLAG_TEX1 },
+	};
+#define MESH_LAYOUT_MAX		ELEMENTS_IN_ARRAY(c_MeshLayouts)
 
 // ---------------------------------------------------------- RESOURCES
 const char* c_pszTextures[] = 
@@ -91,6 +124,11 @@ const char c_szSceneFile[] = "statuescene.POD";
 struct GenericShader		// Base shader
 	{
 	GLuint uiID;
+
+	// Compact vertex decode. Not every shader uses all of these.
+	GLuint uiPosScale;
+	GLuint uiPosBias;
+	GLuint uiUVScaleBias[2];
 	};
 
 // ------------------------------------- Statue shader
@@ -103,6 +141,21 @@ struct StatueShader : public GenericShader
 	GLuint uiLightPos;
 	};
 
+// ------------------------------------- Crowd. The statue shader again, placing each statue from a uniform palette or a per-instance attribute.
+struct CrowdShader : public StatueShader
+	{
+	GLuint uiInstances;
+	};
+const char* const c_szCrowdPaletteDefs[] =
+	{
+	"PALETTE",
+	"PALETTE_SIZE " CROWD_STR(CROWD_PALETTE_SIZE),
+	};
+const char* const c_szCrowdInstancedDefs[] =
+	{
+	"INSTANCED",
+	};
+
 // ------------------------------------- Statue bloom shader 1
 const char c_szBloom1ShaderFSrc[]	= "GPUPrograms/StatueBloom1.fsh";
 const char c_szBloom1ShaderVSrc[]	= "GPUPrograms/StatueBloom1.vsh";
@@ -130,6 +183,15 @@ const char* const c_szChurchShaderDefs[] =
 	{
 	"USE_SHADOW_MAP",
 	};
+struct FloorShader  : public ChurchShader			// The church shader again, mixing in the reflection target
+	{
+	GLuint uiReflProjection;
+	};
+const char* const c_szFloorShaderDefs[] =
+	{
+	"USE_SHADOW_MAP",
+	"USE_REFLECTION",
+	};
 
 // ------------------------------------- Screen Aligned Texture
 const char c_szSATextureFSrc[]	= "GPUPrograms/ScreenAlignedTexture.fsh";
@@ -138,12 +200,21 @@ struct SATexShader  : public GenericShader
 	{
 	};
 
-// ------------------------------------- Screen Aligned Texture
+// ------------------------------------- Bloom pyramid. The Gaussian, downsample and upsample filters share their source.
 const char c_szBloomBlurFSrc[]	= "GPUPrograms/BloomBlur.fsh";
 const char c_szBloomBlurVSrc[]	= "GPUPrograms/BloomBlur.vsh";
 struct BloomBlurShader  : public GenericShader
 	{
 	GLuint uiTexelOffset;
+	GLuint uiTaps;
+	};
+const char* const c_szBloomDownDefs[] =
+	{
+	"DOWNSAMPLE",
+	};
+const char* const c_szBloomUpDefs[] =
+	{
+	"UPSAMPLE",
 	};
 // ------------------------------------- Very simple vertex/frag shader
 const char c_szSimpleFSrc[]	= "GPUPrograms/SimpleShader.fsh";
@@ -160,700 +231,7173 @@ enum enumATTRIBUTE
 	enumATTRIBUTE_TEXCOORD0,
 	enumATTRIBUTE_NORMAL,
 	enumATTRIBUTE_TANGENT,
+	enumATTRIBUTE_INSTANCE,			// Crowd placement, see StatueShader.vsh
 	};
 
-class MyPVRDemo : public PVRShell
+// ------------------------------------- Effect table
+// Everything LoadShaders needs to build each effect. Uniform locations are written straight into the effect's shader struct,
+// and those with a meaning draw packets can set are also listed by it.
+struct ShaderUniform
 	{
-	private:
-		// Models
-		CPVRTModelPOD			m_Model;
-
-		// Shaders
-		StatueShader			m_StatueShader;
-		ChurchShader			m_ChurchShader;
-		SATexShader				m_SATexShader;
-		Bloom1Shader			m_Bloom1Shader;
-		BloomBlurShader			m_BloomBlurShader;
-		SimpleShader			m_SimpleShader;
-		ChurchReflShader		m_ChurchReflShader;
-
-		// Textures
-		GLuint					m_tex[enumTEXTURE_MAX];
+	const char*				pszName;
+	GLuint GenericShader::*	pLocation;
+	int						nSemantic;			// enumUNIFORM
+	};
+#define SHADER_UNIFORM(type, member, name, semantic)	{ name, static_cast<GLuint GenericShader::*>(&type::member), semantic }
 
-		// Lights
-		PVRTVec3				m_vLightPos;
-		PVRTMat4				m_mxLightView;
-		PVRTMat4				m_mxLightProj;
-		PVRTMat4				m_mxLightBias;			// Bias matrix used to smooth out the shadow texture
-		float					m_fLightAngle;
+struct ShaderSampler
+	{
+	const char*				pszName;
+	GLint					nUnit;
+	};
 
-		// Scene matrices
-		bool					m_bRotated;
-		PVRTMat4				m_mxProjection;
-		PVRTMat4				m_mxCam;
+struct ShaderConstant		// Uniforms that are set once and never change
+	{
+	const char*				pszName;
+	GLint					nComponents;
+	float					afValue[4];
+	};
 
-		float					m_fAngleY;
-		float					m_fBloomMulti;
-		float					m_fTexelOffset;
+struct EffectDesc
+	{
+	const char*				pszName;
+	const char*				pszVertSrc;
+	const char*				pszFragSrc;
+	const char* const*		ppszDefines;
+	unsigned int			uiNumDefines;
+	const char**			ppszAttribs;		// Bound to the locations in enumATTRIBUTE order, see SetMeshAttribs
+	unsigned int			uiNumAttribs;
+	const ShaderUniform*	pUniforms;
+	unsigned int			uiNumUniforms;
+	const ShaderSampler*	pSamplers;
+	unsigned int			uiNumSamplers;
+	const ShaderConstant*	pConstants;
+	unsigned int			uiNumConstants;
+	};
+#define EFFECT_ARRAY(x)		x, ELEMENTS_IN_ARRAY(x)
+#define EFFECT_NONE			NULL, 0
 
-		PVRTVec4				m_bbStatueTL;
-		PVRTVec4				m_bbStatueBR;
+// The church's second UV set goes in the normal's slot, as no mesh has both
+const char* c_aszStatueAttribs[]	= { "inVertex", "inTexCoord", "inNormal", "inTangent" };
+const char* c_aszCrowdAttribs[]	= { "inVertex", "inTexCoord", "inNormal", "inTangent", "inInstance" };
+const char* c_aszChurchAttribs[]	= { "inPosition", "inTexCoord0", "inTexCoord1" };
+const char* c_aszSATexAttribs[]	= { "inVertex", "inTexCoord" };
+const char* c_aszSimpleAttribs[]	= { "inPosition" };
 
-		// GL Handles
-		GLuint					m_uiVertShader[enumEFFECT_MAX];
-		GLuint					m_uiFragShader[enumEFFECT_MAX];
-		GLuint					m_uiVBO[enumMODEL_MAX];
-		GLuint					m_uiVBOIdx[enumMODEL_MAX];
+const ShaderUniform c_StatueUniforms[] =
+	{
+	SHADER_UNIFORM(StatueShader, uiMVP,				"MVPMatrix", enumUNIFORM_MVP),
+	SHADER_UNIFORM(StatueShader, uiModelView,		"ModelView", enumUNIFORM_ModelView),
+	SHADER_UNIFORM(StatueShader, uiLightPos,		"LightPosition", enumUNIFORM_LightPos),
+	};
+const ShaderSampler c_StatueSamplers[]		= { { "sNormMap", 0 } };
+const ShaderConstant c_StatueConstants[] =
+	{
+	{ "vDiffuse",	3, { 0.5f, 0.5f, 0.5f } },
+	{ "vSpecular",	3, { 0.3f, 0.3f, 0.3f } },
+	{ "fShininess",	1, { 50.0f } },
+	};
 
-		// FBO Handles
-		GLint					m_nOrigFBO;
-		GLuint					m_uiRTT[enumFB_MAX];		// Handle for a RTT texture
-		GLuint					m_uiFBO[enumFB_MAX];		// Handle for FBO
-		GLuint					m_uiFBODepth;				// Handle for depth buffer
-		
-		GLuint					m_uiShadowMapTex;			// Texture for the shadow map
-		GLuint					m_uiShadowMapFBO;
+const ShaderUniform c_CrowdUniforms[] =
+	{
+	SHADER_UNIFORM(CrowdShader, uiMVP,				"MVPMatrix", enumUNIFORM_MVP),
+	SHADER_UNIFORM(CrowdShader, uiModelView,		"ModelView", enumUNIFORM_ModelView),
+	SHADER_UNIFORM(CrowdShader, uiLightPos,			"LightPosition", enumUNIFORM_LightPos),
+	SHADER_UNIFORM(CrowdShader, uiInstances,		"vInstances", enumUNIFORM_None),		// Palette only
+	};
 
+const ShaderUniform c_Bloom1Uniforms[] =
+	{
+	SHADER_UNIFORM(Bloom1Shader, uiMVP,				"MVPMatrix", enumUNIFORM_MVP),
+	SHADER_UNIFORM(Bloom1Shader, uiModelView,		"ModelView", enumUNIFORM_ModelView),
+	SHADER_UNIFORM(Bloom1Shader, uiLightPos,		"LightPosition", enumUNIFORM_LightPos),
+	SHADER_UNIFORM(Bloom1Shader, uiBloomMulti,		"fBloomMulti", enumUNIFORM_BloomMulti),
+	};
+const ShaderSampler c_Bloom1Samplers[]		= { { "sNormMap", 0 }, { "sBloomMap", 1 } };
 
-		unsigned long			m_ulCurrTime;
-		float					m_fDT;
+const ShaderUniform c_ChurchUniforms[] =
+	{
+	SHADER_UNIFORM(ChurchShader, uiModelView,		"mxModelView", enumUNIFORM_ModelView),
+	SHADER_UNIFORM(ChurchShader, uiProjection,		"mxProjection", enumUNIFORM_Projection),
+	SHADER_UNIFORM(ChurchShader, uiTexProjection,	"mxTexProjection", enumUNIFORM_TexProjection),
+	SHADER_UNIFORM(ChurchShader, uiAlpha,			"fAlpha", enumUNIFORM_Alpha),
+	};
+const ShaderSampler c_ChurchSamplers[]		= { { "sTexture", 0 }, { "sShadow", 1 }, { "sLightmap", 2 } };
 
-	private:
-		bool LoadTextures(CPVRTString* pErrorStr);
-		bool LoadShaders(CPVRTString* pErrorStr);
-		void LoadVBOs();
-		bool CreateFBOs(CPVRTString* pErrorStr);
+const ShaderUniform c_FloorUniforms[] =
+	{
+	SHADER_UNIFORM(FloorShader, uiModelView,		"mxModelView", enumUNIFORM_ModelView),
+	SHADER_UNIFORM(FloorShader, uiProjection,		"mxProjection", enumUNIFORM_Projection),
+	SHADER_UNIFORM(FloorShader, uiTexProjection,	"mxTexProjection", enumUNIFORM_TexProjection),
+	SHADER_UNIFORM(FloorShader, uiAlpha,			"fAlpha", enumUNIFORM_Alpha),
+	SHADER_UNIFORM(FloorShader, uiReflProjection,	"mxReflProjection", enumUNIFORM_ReflProjection),
+	};
+const ShaderSampler c_FloorSamplers[]		= { { "sTexture", 0 }, { "sShadow", 1 }, { "sLightmap", 2 }, { "sReflection", 3 } };
 
-		void RenderStatue(const PVRTMat4& mxModel, const PVRTMat4& mxCam, const PVRTVec3& vLightPos, const StatueShader* pShader);
-		void RenderCurch(const PVRTMat4& mxCam);
-		void RenderScreenAlignedTexture(const PVRTVec2& vTL, const PVRTVec2& vBR, const PVRTVec2& vTTL, const PVRTVec2& vTBR);
-		void RenderBloom(const PVRTMat4& mxModel, const PVRTMat4& mxCam, const PVRTVec3& vLightPos);
-		void DrawMesh(int i32NodeIndex, GLuint uiFlags);
+const ShaderUniform c_ChurchReflUniforms[] =
+	{
+	SHADER_UNIFORM(ChurchReflShader, uiModelView,	"mxModelView", enumUNIFORM_ModelView),
+	SHADER_UNIFORM(ChurchReflShader, uiProjection,	"mxProjection", enumUNIFORM_Projection),
+	};
+const ShaderSampler c_ChurchReflSamplers[]	= { { "sTexture", 0 }, { "sLightmap", 2 } };
 
-		void RenderShadowScene();
+const ShaderSampler c_SATexSamplers[]		= { { "sTexture", 0 } };
 
-	public:
-		virtual bool InitApplication();
-		virtual bool InitView();
-		virtual bool ReleaseView();
-		virtual bool QuitApplication();
-		virtual bool RenderScene();
+const ShaderUniform c_BloomBlurUniforms[] =
+	{
+	SHADER_UNIFORM(BloomBlurShader, uiTexelOffset,	"vTexelOffset", enumUNIFORM_None),
+	SHADER_UNIFORM(BloomBlurShader, uiTaps,			"vTaps", enumUNIFORM_None),
 	};
 
-// ---------------------------------------------------------------
-bool MyPVRDemo::LoadTextures(CPVRTString* const pErrorStr)
+const ShaderUniform c_SimpleUniforms[] =
 	{
-	ASSERT(ELEMENTS_IN_ARRAY(c_pszTextures) == enumTEXTURE_MAX);
+	SHADER_UNIFORM(SimpleShader, uiMVP,				"mxMVP", enumUNIFORM_MVP),
+	};
 
-	// Load Textures from PVR files
-	for(int i = 0; i < enumTEXTURE_MAX; ++i)
-		{
-		if(PVRTTextureLoadFromPVR(c_pszTextures[i], &m_tex[i]) != PVR_SUCCESS)
-			{
-			*pErrorStr = CPVRTString("ERROR: Could not load: ") + CPVRTString(c_pszTextures[i]);
-			return false;
-			}
+const EffectDesc c_Effects[] =
+	{
+	// enumEFFECT_Model
+	{ "Statue", c_szModelShaderVSrc, c_szModelShaderFSrc, EFFECT_NONE, EFFECT_ARRAY(c_aszStatueAttribs),
+	  EFFECT_ARRAY(c_StatueUniforms), EFFECT_ARRAY(c_StatueSamplers), EFFECT_ARRAY(c_StatueConstants) },
+	// enumEFFECT_Church
+	{ "Church", c_szChurchShaderVSrc, c_szChurchShaderFSrc, EFFECT_ARRAY(c_szChurchShaderDefs), EFFECT_ARRAY(c_aszChurchAttribs),
+	  EFFECT_ARRAY(c_ChurchUniforms), EFFECT_ARRAY(c_ChurchSamplers), EFFECT_NONE },
+	// enumEFFECT_ScreenAlignedTex
+	{ "ScreenAlignedTex", c_szSATextureVSrc, c_szSATextureFSrc, EFFECT_NONE, EFFECT_ARRAY(c_aszSATexAttribs),
+	  EFFECT_NONE, EFFECT_ARRAY(c_SATexSamplers), EFFECT_NONE },
+	// enumEFFECT_Bloom1 (like the statue shader, but more optimized)
+	{ "Bloom1", c_szBloom1ShaderVSrc, c_szBloom1ShaderFSrc, EFFECT_NONE, EFFECT_ARRAY(c_aszStatueAttribs),
+	  EFFECT_ARRAY(c_Bloom1Uniforms), EFFECT_ARRAY(c_Bloom1Samplers), EFFECT_NONE },
+	// enumEFFECT_BloomBlur
+	{ "BloomBlur", c_szBloomBlurVSrc, c_szBloomBlurFSrc, EFFECT_NONE, EFFECT_ARRAY(c_aszSATexAttribs),
+	  EFFECT_ARRAY(c_BloomBlurUniforms), EFFECT_ARRAY(c_SATexSamplers), EFFECT_NONE },
+	// enumEFFECT_SimpleModel
+	{ "Simple", c_szSimpleVSrc, c_szSimpleFSrc, EFFECT_NONE, EFFECT_ARRAY(c_aszSimpleAttribs),
+	  EFFECT_ARRAY(c_SimpleUniforms), EFFECT_NONE, EFFECT_NONE },
+	// enumEFFECT_ChurchRefl (the church shader without the shadow map)
+	{ "ChurchRefl", c_szChurchShaderVSrc, c_szChurchShaderFSrc, EFFECT_NONE, EFFECT_ARRAY(c_aszChurchAttribs),
+	  EFFECT_ARRAY(c_ChurchReflUniforms), EFFECT_ARRAY(c_ChurchReflSamplers), EFFECT_NONE },
+	// enumEFFECT_BloomDown
+	{ "BloomDown", c_szBloomBlurVSrc, c_szBloomBlurFSrc, EFFECT_ARRAY(c_szBloomDownDefs), EFFECT_ARRAY(c_aszSATexAttribs),
+	  EFFECT_ARRAY(c_BloomBlurUniforms), EFFECT_ARRAY(c_SATexSamplers), EFFECT_NONE },
+	// enumEFFECT_BloomUp
+	{ "BloomUp", c_szBloomBlurVSrc, c_szBloomBlurFSrc, EFFECT_ARRAY(c_szBloomUpDefs), EFFECT_ARRAY(c_aszSATexAttribs),
+	  EFFECT_ARRAY(c_BloomBlurUniforms), EFFECT_ARRAY(c_SATexSamplers), EFFECT_NONE },
+	// enumEFFECT_Floor
+	{ "Floor", c_szChurchShaderVSrc, c_szChurchShaderFSrc, EFFECT_ARRAY(c_szFloorShaderDefs), EFFECT_ARRAY(c_aszChurchAttribs),
+	  EFFECT_ARRAY(c_FloorUniforms), EFFECT_ARRAY(c_FloorSamplers), EFFECT_NONE },
+	// enumEFFECT_CrowdPalette
+	{ "CrowdPalette", c_szModelShaderVSrc, c_szModelShaderFSrc, EFFECT_ARRAY(c_szCrowdPaletteDefs), EFFECT_ARRAY(c_aszCrowdAttribs),
+	  EFFECT_ARRAY(c_CrowdUniforms), EFFECT_ARRAY(c_StatueSamplers), EFFECT_ARRAY(c_StatueConstants) },
+	// enumEFFECT_CrowdInstanced
+	{ "CrowdInstanced", c_szModelShaderVSrc, c_szModelShaderFSrc, EFFECT_ARRAY(c_szCrowdInstancedDefs), EFFECT_ARRAY(c_aszCrowdAttribs),
+	  EFFECT_ARRAY(c_CrowdUniforms), EFFECT_ARRAY(c_StatueSamplers), EFFECT_ARRAY(c_StatueConstants) },
+	};
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		}
+// ---------------------------------------------------------- PROFILING
+// EXT_disjoint_timer_query. Declared here as older gl2ext.h headers don't include it.
+#ifndef GL_TIME_ELAPSED_EXT
+#define GL_TIME_ELAPSED_EXT					0x88BF
+#endif
+#ifndef GL_QUERY_RESULT_EXT
+#define GL_QUERY_RESULT_EXT					0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE_EXT
+#define GL_QUERY_RESULT_AVAILABLE_EXT		0x8867
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT					0x8FBB
+#endif
+typedef void (GL_APIENTRYP PFNDEMOGENQUERIESPROC) (GLsizei n, GLuint* ids);
+typedef void (GL_APIENTRYP PFNDEMODELETEQUERIESPROC) (GLsizei n, const GLuint* ids);
+typedef void (GL_APIENTRYP PFNDEMOBEGINQUERYPROC) (GLenum target, GLuint id);
+typedef void (GL_APIENTRYP PFNDEMOENDQUERYPROC) (GLenum target);
+typedef void (GL_APIENTRYP PFNDEMOGETQUERYOBJECTUIVPROC) (GLuint id, GLenum pname, GLuint* params);
+typedef void (GL_APIENTRYP PFNDEMOGETQUERYOBJECTUI64VPROC) (GLuint id, GLenum pname, unsigned long long* params);
+
+#define PROFILE_RING_SIZE		256		// Must be a power of 2
+#define PROFILE_WINDOW			256		// Number of samples per pass used for the rolling percentiles
+#define PROFILE_GPU_LATENCY		3		// Frames of GPU queries in flight before results are read back
+#define PROFILE_OVERLAY_UPDATE	30		// Frames between refreshes of the on-screen timings
+#define PROFILE_DEFAULT_DUMP	"pass_timings"
+
+enum enumPASS
+	{
+	enumPASS_Shadow,
+	enumPASS_Reflection,
+	enumPASS_Scene,
+	enumPASS_Crowd,
+	enumPASS_BloomExtract,
+	enumPASS_BloomDownsample,
+	enumPASS_BloomBlurH,
+	enumPASS_BloomBlurV,
+	enumPASS_BloomUpsample,
+	enumPASS_BloomComposite,
+	enumPASS_Upscale,
+	enumPASS_Frame,					// Whole of RenderScene. CPU only, as timer queries can't be nested.
+	enumPASS_MAX,
+	};
 
-	// Set some options
-	glBindTexture(GL_TEXTURE_2D, m_tex[enumTEXTURE_BloomMap]);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+const char* c_pszPassNames[] =
+	{
+	"Shadow",				// enumPASS_Shadow
+	"Reflection",			// enumPASS_Reflection
+	"Scene",				// enumPASS_Scene
+	"Crowd",				// enumPASS_Crowd
+	"BloomExtract",			// enumPASS_BloomExtract
+	"BloomDownsample",		// enumPASS_BloomDownsample
+	"BloomBlurH",			// enumPASS_BloomBlurH
+	"BloomBlurV",			// enumPASS_BloomBlurV
+	"BloomUpsample",		// enumPASS_BloomUpsample
+	"BloomComposite",		// enumPASS_BloomComposite
+	"Upscale",				// enumPASS_Upscale
+	"Frame",				// enumPASS_Frame
+	};
 
-	// Allocate a texture for the RTT
-	glGenTextures(enumFB_MAX, m_uiRTT);
-	for(int i = 0; i < enumFB_MAX; i++)
-		{
-		glBindTexture(GL_TEXTURE_2D, m_uiRTT[i]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, RTT_SIZE, RTT_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		}
+enum enumTIMER
+	{
+	enumTIMER_CPU,
+	enumTIMER_GPU,
+	enumTIMER_MAX,
+	};
 
-	// Allocate a texture for the shadow map
-	glGenTextures(1, &m_uiShadowMapTex);
-	glBindTexture(GL_TEXTURE_2D, m_uiShadowMapTex);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+struct PassSample
+	{
+	unsigned short			uiPass;
+	unsigned short			uiTimer;
+	float					fMS;
+	};
 
-	return true;
-	}
+struct PassPercentiles
+	{
+	unsigned int			uiCount;
+	float					fMean;
+	float					fP50;
+	float					fP95;
+	float					fP99;
+	};
 
-// ---------------------------------------------------------------
-bool MyPVRDemo::LoadShaders(CPVRTString* pErrorStr)
+// Ring buffer of samples waiting to go into the windows. Pushed and popped on the render thread only, so it has no
+// synchronisation of its own.
+class CPassSampleRing
 	{
-	// ---- Load Model Shader
-		{
-		if (PVRTShaderLoadFromFile(NULL, StripFolder(c_szModelShaderVSrc), GL_VERTEX_SHADER, GL_SGX_BINARY_IMG, &m_uiVertShader[enumEFFECT_Model], pErrorStr) != PVR_SUCCESS)
-			return false;
-		if (PVRTShaderLoadFromFile(NULL, StripFolder(c_szModelShaderFSrc), GL_FRAGMENT_SHADER, GL_SGX_BINARY_IMG, &m_uiFragShader[enumEFFECT_Model], pErrorStr) != PVR_SUCCESS)
-			return false;
+	private:
+		PassSample				m_aSamples[PROFILE_RING_SIZE];
+		unsigned int			m_uiHead;
+		unsigned int			m_uiTail;
 
-		const char* aszAttribs[] = { "inVertex", "inTexCoord", "inNormal", "inTangent" };
-		if (PVRTCreateProgram(&m_StatueShader.uiID, m_uiVertShader[enumEFFECT_Model], m_uiFragShader[enumEFFECT_Model], aszAttribs, 3, pErrorStr) != PVR_SUCCESS)
-			return false;
+	public:
+		CPassSampleRing() : m_uiHead(0), m_uiTail(0) {}
 
-		// --- Get Uniform locations
-		m_StatueShader.uiMVP			= glGetUniformLocation(m_StatueShader.uiID, "MVPMatrix");
-		m_StatueShader.uiModelView		= glGetUniformLocation(m_StatueShader.uiID, "ModelView");
-		m_StatueShader.uiLightPos		= glGetUniformLocation(m_StatueShader.uiID, "LightPosition");
+		bool Push(const PassSample& Sample)
+			{
+			unsigned int uiHead = m_uiHead;
+			if(uiHead - m_uiTail == PROFILE_RING_SIZE)
+				return false;				// Full. Drop the sample rather than block the render thread.
 
-		// --- Set some uniforms
-		glUniform3f(glGetUniformLocation(m_StatueShader.uiID, "vDiffuse"), 0.5f, 0.5f, 0.5f);
-		glUniform3f(glGetUniformLocation(m_StatueShader.uiID, "vSpecular"), 0.3f, 0.3f, 0.3f);
-		glUniform1f(glGetUniformLocation(m_StatueShader.uiID, "fShininess"), 50.0f);
-		glUniform1i(glGetUniformLocation(m_StatueShader.uiID, "sNormMap"), 0);
-		}
+			m_aSamples[uiHead & (PROFILE_RING_SIZE - 1)] = Sample;
+			m_uiHead = uiHead + 1;
+			return true;
+			}
 
-	// ---- Load Bloom 1 shader. (Like Model Shader, but more optimized)
-		{
-		if (PVRTShaderLoadFromFile(NULL, StripFolder(c_szBloom1ShaderVSrc), GL_VERTEX_SHADER, GL_SGX_BINARY_IMG, &m_uiVertShader[enumEFFECT_Bloom1], pErrorStr) != PVR_SUCCESS)
-			return false;
-		if (PVRTShaderLoadFromFile(NULL, StripFolder(c_szBloom1ShaderFSrc), GL_FRAGMENT_SHADER, GL_SGX_BINARY_IMG, &m_uiFragShader[enumEFFECT_Bloom1], pErrorStr) != PVR_SUCCESS)
-			return false;
+		bool Pop(PassSample& Sample)
+			{
+			unsigned int uiTail = m_uiTail;
+			if(uiTail == m_uiHead)
+				return false;
 
-		const char* aszAttribs[] = { "inVertex", "inTexCoord", "inNormal", "inTangent" };
-		if (PVRTCreateProgram(&m_Bloom1Shader.uiID, m_uiVertShader[enumEFFECT_Bloom1], m_uiFragShader[enumEFFECT_Bloom1], aszAttribs, 3, pErrorStr) != PVR_SUCCESS)
-			return false;
+			Sample = m_aSamples[uiTail & (PROFILE_RING_SIZE - 1)];
+			m_uiTail = uiTail + 1;
+			return true;
+			}
+	};
 
-		// --- Get Uniform locations
-		m_Bloom1Shader.uiMVP			= glGetUniformLocation(m_Bloom1Shader.uiID, "MVPMatrix");
-		m_Bloom1Shader.uiModelView		= glGetUniformLocation(m_Bloom1Shader.uiID, "ModelView");
-		m_Bloom1Shader.uiLightPos		= glGetUniformLocation(m_Bloom1Shader.uiID, "LightPosition");
-		m_Bloom1Shader.uiBloomMulti		= glGetUniformLocation(m_Bloom1Shader.uiID, "fBloomMulti");
+class CPassProfiler
+	{
+	private:
+		CPassSampleRing					m_Ring;
+
+		// Rolling window of the most recent samples per pass and timer
+		float*							m_pfWindow[enumTIMER_MAX][enumPASS_MAX];
+		unsigned int					m_uiWindowSize;
+		unsigned int					m_uiWindowCount[enumTIMER_MAX][enumPASS_MAX];
+		unsigned int					m_uiWindowPos[enumTIMER_MAX][enumPASS_MAX];
+
+		// CPU timing
+		double							m_dCPUStart[enumPASS_MAX];
+
+		// GPU timing
+		bool							m_bGPUTimers;
+		GLuint							m_uiQuery[PROFILE_GPU_LATENCY][enumPASS_MAX];
+		bool							m_bQueryIssued[PROFILE_GPU_LATENCY][enumPASS_MAX];
+		unsigned int					m_uiFrame;
+		float							m_fLastGPUFrameMS;		// Sum of the passes in the most recently read back frame
+		PFNDEMOGENQUERIESPROC			m_pfnGenQueries;
+		PFNDEMODELETEQUERIESPROC		m_pfnDeleteQueries;
+		PFNDEMOBEGINQUERYPROC			m_pfnBeginQuery;
+		PFNDEMOENDQUERYPROC				m_pfnEndQuery;
+		PFNDEMOGETQUERYOBJECTUIVPROC	m_pfnGetQueryObjectuiv;
+		PFNDEMOGETQUERYOBJECTUI64VPROC	m_pfnGetQueryObjectui64v;
 
-		// --- Set some uniforms
-		glUniform1i(glGetUniformLocation(m_Bloom1Shader.uiID, "sNormMap"), 0);
-		glUniform1i(glGetUniformLocation(m_Bloom1Shader.uiID, "sBloomMap"), 1);
-		}
+	public:
+		CPassProfiler();
+		~CPassProfiler();
+
+		void SetWindowSize(unsigned int uiSize);
+		void InitGPUTimers();
+		void ReleaseGPUTimers();
+		void Reset();
+		void Flush();
+
+		void BeginFrame();
+		void EndFrame();
+		void Begin(enumPASS ePass);
+		void End(enumPASS ePass);
+
+		bool HasGPUTimers() const { return m_bGPUTimers; }
+		float GetLastGPUFrameMS() const { return m_fLastGPUFrameMS; }
+		PassPercentiles GetPercentiles(enumPASS ePass, enumTIMER eTimer) const;
+		void WriteJSON(FILE* pFile, const char* pszIndent) const;
+		void WriteCSV(FILE* pFile) const;
 
-	// ---- Load Church Shader
-		{
-		if (PVRTShaderLoadFromFile(NULL, StripFolder(c_szChurchShaderVSrc), GL_VERTEX_SHADER, GL_SGX_BINARY_IMG, &m_uiVertShader[enumEFFECT_Church], pErrorStr, 0, c_szChurchShaderDefs, 1) != PVR_SUCCESS)
-			return false;
-		if (PVRTShaderLoadFromFile(NULL, StripFolder(c_szChurchShaderFSrc), GL_FRAGMENT_SHADER, GL_SGX_BINARY_IMG, &m_uiFragShader[enumEFFECT_Church], pErrorStr, 0, c_szChurchShaderDefs, 1) != PVR_SUCCESS)
-			return false;
+	private:
+		void Drain();
+		void ReadGPUResults(unsigned int uiSlot);
+	};
 
-		const char* aszAttribs[] = { "inVertex", "inTexCoord0", "inTexCoord1" };
-		if (PVRTCreateProgram(&m_ChurchShader.uiID, m_uiVertShader[enumEFFECT_Church], m_uiFragShader[enumEFFECT_Church], aszAttribs, 3, pErrorStr) != PVR_SUCCESS)
-			return false;
+// Times a pass for as long as it is in scope
+class CPassTimerScope
+	{
+	private:
+		CPassProfiler&			m_Profiler;
+		enumPASS				m_ePass;
 
-		// --- Get Uniform locations
-		m_ChurchShader.uiModelView				= glGetUniformLocation(m_ChurchShader.uiID, "mxModelView");
-		m_ChurchShader.uiProjection				= glGetUniformLocation(m_ChurchShader.uiID, "mxProjection");
-		m_ChurchShader.uiTexProjection			= glGetUniformLocation(m_ChurchShader.uiID, "mxTexProjection");
-		m_ChurchShader.uiAlpha					= glGetUniformLocation(m_ChurchShader.uiID, "fAlpha");
+	public:
+		CPassTimerScope(CPassProfiler& Profiler, enumPASS ePass) : m_Profiler(Profiler), m_ePass(ePass)	{ m_Profiler.Begin(m_ePass); }
+		~CPassTimerScope()																				{ m_Profiler.End(m_ePass); }
+	};
 
-		// --- Set some uniforms
-		glUniform1i(glGetUniformLocation(m_ChurchShader.uiID, "sTexture"), 0);
-		glUniform1i(glGetUniformLocation(m_ChurchShader.uiID, "sShadow"), 1);
-		glUniform1i(glGetUniformLocation(m_ChurchShader.uiID, "sLightmap"), 2);
-		}
+// ---------------------------------------------------------------
+CPassProfiler::CPassProfiler() : m_uiWindowSize(0), m_bGPUTimers(false), m_uiFrame(0), m_fLastGPUFrameMS(0.0f)
+	{
+	memset(m_pfWindow, 0, sizeof(m_pfWindow));
+	memset(m_uiQuery, 0, sizeof(m_uiQuery));
+	SetWindowSize(PROFILE_WINDOW);
+	}
 
-	// ---- Load Church Reflection shader
-		{
-		if (PVRTShaderLoadFromFile(NULL, StripFolder(c_szChurchShaderVSrc), GL_VERTEX_SHADER, GL_SGX_BINARY_IMG, &m_uiVertShader[enumEFFECT_ChurchRefl], pErrorStr) != PVR_SUCCESS)
-			return false;
-		if (PVRTShaderLoadFromFile(NULL, StripFolder(c_szChurchShaderFSrc), GL_FRAGMENT_SHADER, GL_SGX_BINARY_IMG, &m_uiFragShader[enumEFFECT_ChurchRefl], pErrorStr) != PVR_SUCCESS)
-			return false;
+// ---------------------------------------------------------------
+CPassProfiler::~CPassProfiler()
+	{
+	for(int t = 0; t < enumTIMER_MAX; ++t)
+		for(int p = 0; p < enumPASS_MAX; ++p)
+			delete [] m_pfWindow[t][p];
+	}
 
-		const char* aszAttribs[] = { "inVertex", "inTexCoord0", "inTexCoord1" };
-		if (PVRTCreateProgram(&m_ChurchReflShader.uiID, m_uiVertShader[enumEFFECT_ChurchRefl], m_uiFragShader[enumEFFECT_ChurchRefl], aszAttribs, 3, pErrorStr) != PVR_SUCCESS)
-			return false;
+// ---------------------------------------------------------------
+void CPassProfiler::SetWindowSize(unsigned int uiSize)
+	{
+	for(int t = 0; t < enumTIMER_MAX; ++t)
+		{
+		for(int p = 0; p < enumPASS_MAX; ++p)
+			{
+			delete [] m_pfWindow[t][p];
+			m_pfWindow[t][p] = new float[uiSize];
+			}
+		}
+	m_uiWindowSize = uiSize;
+	Reset();
+	}
 
-		// --- Get Uniform locations
-		m_ChurchReflShader.uiModelView				= glGetUniformLocation(m_ChurchReflShader.uiID, "mxModelView");
-		m_ChurchReflShader.uiProjection				= glGetUniformLocation(m_ChurchReflShader.uiID, "mxProjection");
+// ---------------------------------------------------------------
+void CPassProfiler::Reset()
+	{
+	PassSample Sample;
+	while(m_Ring.Pop(Sample))
+		;
+	memset(m_uiWindowCount, 0, sizeof(m_uiWindowCount));
+	memset(m_uiWindowPos, 0, sizeof(m_uiWindowPos));
+
+	// Queries still in flight were issued before the reset. Forget them, so they aren't read back into the new window.
+	memset(m_bQueryIssued, 0, sizeof(m_bQueryIssued));
+	}
 
-		// --- Set some uniforms
-		glUniform1i(glGetUniformLocation(m_ChurchReflShader.uiID, "sTexture"), 0);
-		glUniform1i(glGetUniformLocation(m_ChurchReflShader.uiID, "sLightmap"), 2);
+// ---------------------------------------------------------------
+void CPassProfiler::Flush()
+	{
+	// Waits for the queries still in flight and reads them, oldest first, so the last PROFILE_GPU_LATENCY frames are
+	// counted too. Stalls, so only for when the timings are about to be reported.
+	if(m_bGPUTimers)
+		{
+		glFinish();
+		for(unsigned int i = 0; i < PROFILE_GPU_LATENCY; ++i)
+			ReadGPUResults((m_uiFrame + i) % PROFILE_GPU_LATENCY);
 		}
+	Drain();
+	}
 
-	// ---- Load Screen Aligned Texture shader
-		{
-		if (PVRTShaderLoadFromFile(NULL, StripFolder(c_szSATextureVSrc), GL_VERTEX_SHADER, GL_SGX_BINARY_IMG, &m_uiVertShader[enumEFFECT_ScreenAlignedTex], pErrorStr) != PVR_SUCCESS)
-			return false;
-		if (PVRTShaderLoadFromFile(NULL, StripFolder(c_szSATextureFSrc), GL_FRAGMENT_SHADER, GL_SGX_BINARY_IMG, &m_uiFragShader[enumEFFECT_ScreenAlignedTex], pErrorStr) != PVR_SUCCESS)
-			return false;
+// ---------------------------------------------------------------
+void CPassProfiler::InitGPUTimers()
+	{
+	m_bGPUTimers = false;
+	if(!CPVRTgles2Ext::IsGLExtensionSupported("GL_EXT_disjoint_timer_query"))
+		return;
+
+	m_pfnGenQueries				= (PFNDEMOGENQUERIESPROC)eglGetProcAddress("glGenQueriesEXT");
+	m_pfnDeleteQueries			= (PFNDEMODELETEQUERIESPROC)eglGetProcAddress("glDeleteQueriesEXT");
+	m_pfnBeginQuery				= (PFNDEMOBEGINQUERYPROC)eglGetProcAddress("glBeginQueryEXT");
+	m_pfnEndQuery				= (PFNDEMOENDQUERYPROC)eglGetProcAddress("glEndQueryEXT");
+	m_pfnGetQueryObjectuiv		= (PFNDEMOGETQUERYOBJECTUIVPROC)eglGetProcAddress("glGetQueryObjectuivEXT");
+	m_pfnGetQueryObjectui64v	= (PFNDEMOGETQUERYOBJECTUI64VPROC)eglGetProcAddress("glGetQueryObjectui64vEXT");
+
+	if(!m_pfnGenQueries || !m_pfnDeleteQueries || !m_pfnBeginQuery || !m_pfnEndQuery || !m_pfnGetQueryObjectuiv || !m_pfnGetQueryObjectui64v)
+		return;
+
+	m_pfnGenQueries(PROFILE_GPU_LATENCY * enumPASS_MAX, &m_uiQuery[0][0]);
+	memset(m_bQueryIssued, 0, sizeof(m_bQueryIssued));
+	m_bGPUTimers = true;
+	}
 
-		const char* aszAttribs[] = { "inVertex", "inTexCoord" };
-		if (PVRTCreateProgram(&m_SATexShader.uiID, m_uiVertShader[enumEFFECT_ScreenAlignedTex], m_uiFragShader[enumEFFECT_ScreenAlignedTex], aszAttribs, 2, pErrorStr) != PVR_SUCCESS)
-			return false;
+// ---------------------------------------------------------------
+void CPassProfiler::ReleaseGPUTimers()
+	{
+	if(m_bGPUTimers)
+		m_pfnDeleteQueries(PROFILE_GPU_LATENCY * enumPASS_MAX, &m_uiQuery[0][0]);
+	m_bGPUTimers = false;
+	}
 
-		// --- Set some uniforms
-		glUniform1i(glGetUniformLocation(m_SATexShader.uiID, "sTexture"), 0);
-		}
+// ---------------------------------------------------------------
+void CPassProfiler::BeginFrame()
+	{
+	// Results for this slot were issued PROFILE_GPU_LATENCY frames ago, so should be ready without stalling.
+	if(m_bGPUTimers)
+		ReadGPUResults(m_uiFrame % PROFILE_GPU_LATENCY);
 
-	// ---- Load Blur shader
-		{
-		if (PVRTShaderLoadFromFile(NULL, StripFolder(c_szBloomBlurVSrc), GL_VERTEX_SHADER, GL_SGX_BINARY_IMG, &m_uiVertShader[enumEFFECT_BloomBlur], pErrorStr) != PVR_SUCCESS)
-			return false;
-		if (PVRTShaderLoadFromFile(NULL, StripFolder(c_szBloomBlurFSrc), GL_FRAGMENT_SHADER, GL_SGX_BINARY_IMG, &m_uiFragShader[enumEFFECT_BloomBlur], pErrorStr) != PVR_SUCCESS)
-			return false;
+	Begin(enumPASS_Frame);
+	}
 
-		const char* aszAttribs[] = { "inVertex", "inTexCoord" };
-		if (PVRTCreateProgram(&m_BloomBlurShader.uiID, m_uiVertShader[enumEFFECT_BloomBlur], m_uiFragShader[enumEFFECT_BloomBlur], aszAttribs, 2, pErrorStr) != PVR_SUCCESS)
-			return false;
+// ---------------------------------------------------------------
+void CPassProfiler::EndFrame()
+	{
+	End(enumPASS_Frame);
+	++m_uiFrame;
 
-		m_BloomBlurShader.uiTexelOffset				= glGetUniformLocation(m_BloomBlurShader.uiID, "vTexelOffset");
+	Drain();
+	}
 
-		// --- Set some uniforms
-		glUniform1i(glGetUniformLocation(m_BloomBlurShader.uiID, "sTexture"), 0);
-		}
+// ---------------------------------------------------------------
+void CPassProfiler::Begin(enumPASS ePass)
+	{
+	m_dCPUStart[ePass] = GetTimeMS();
 
+	if(m_bGPUTimers && ePass != enumPASS_Frame)
+		m_pfnBeginQuery(GL_TIME_ELAPSED_EXT, m_uiQuery[m_uiFrame % PROFILE_GPU_LATENCY][ePass]);
+	}
 
-	// ---- Load a simple model shader
+// ---------------------------------------------------------------
+void CPassProfiler::End(enumPASS ePass)
+	{
+	if(m_bGPUTimers && ePass != enumPASS_Frame)
 		{
-		if (PVRTShaderLoadFromFile(NULL, StripFolder(c_szSimpleVSrc), GL_VERTEX_SHADER, GL_SGX_BINARY_IMG, &m_uiVertShader[enumEFFECT_SimpleModel], pErrorStr) != PVR_SUCCESS)
-			return false;
-		if (PVRTShaderLoadFromFile(NULL, StripFolder(c_szSimpleFSrc), GL_FRAGMENT_SHADER, GL_SGX_BINARY_IMG, &m_uiFragShader[enumEFFECT_SimpleModel], pErrorStr) != PVR_SUCCESS)
-			return false;
-
-		const char* aszAttribs[] = { "inVertex" };
-		if (PVRTCreateProgram(&m_SimpleShader.uiID, m_uiVertShader[enumEFFECT_SimpleModel], m_uiFragShader[enumEFFECT_SimpleModel], aszAttribs, 1, pErrorStr) != PVR_SUCCESS)
-			return false;
-
-		m_SimpleShader.uiMVP				= glGetUniformLocation(m_SimpleShader.uiID, "mxMVP");
+		m_pfnEndQuery(GL_TIME_ELAPSED_EXT);
+		m_bQueryIssued[m_uiFrame % PROFILE_GPU_LATENCY][ePass] = true;
 		}
 
-	return true;
+	PassSample Sample;
+	Sample.uiPass	= (unsigned short)ePass;
+	Sample.uiTimer	= enumTIMER_CPU;
+	Sample.fMS		= (float)(GetTimeMS() - m_dCPUStart[ePass]);
+	m_Ring.Push(Sample);
 	}
 
 // ---------------------------------------------------------------
-void MyPVRDemo::LoadVBOs()
+void CPassProfiler::ReadGPUResults(unsigned int uiSlot)
 	{
-	glGenBuffers(enumMODEL_MAX, m_uiVBO);
-	glGenBuffers(enumMODEL_MAX, m_uiVBOIdx);
+	// A disjoint event (e.g. a frequency change) invalidates every query in flight.
+	GLint nDisjoint = 0;
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &nDisjoint);
 
-	for (unsigned int i = 0; i < enumMODEL_MAX; ++i)
+	float fFrameMS = 0.0f;
+	bool bComplete = true;
+	for(int p = 0; p < enumPASS_MAX; ++p)
 		{
-		SPODMesh& Mesh = m_Model.pMesh[i];
-		unsigned int uiSize = Mesh.nNumVertex * Mesh.sVertex.nStride;
-		glBindBuffer(GL_ARRAY_BUFFER, m_uiVBO[i]);
-		glBufferData(GL_ARRAY_BUFFER, uiSize, Mesh.pInterleaved, GL_STATIC_DRAW);
+		if(!m_bQueryIssued[uiSlot][p])
+			continue;
 
-		uiSize = PVRTModelPODCountIndices(Mesh) * sizeof(GLshort);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_uiVBOIdx[i]);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, uiSize, Mesh.sFaces.pData, GL_STATIC_DRAW);
+		GLuint uiAvailable = GL_FALSE;
+		m_pfnGetQueryObjectuiv(m_uiQuery[uiSlot][p], GL_QUERY_RESULT_AVAILABLE_EXT, &uiAvailable);
+		if(!uiAvailable)
+			{
+			bComplete = false;
+			continue;						// Still pending. The query object is reused this frame, so the sample is lost.
+			}
+
+		unsigned long long ullNS = 0;
+		m_pfnGetQueryObjectui64v(m_uiQuery[uiSlot][p], GL_QUERY_RESULT_EXT, &ullNS);
+		m_bQueryIssued[uiSlot][p] = false;
+
+		if(nDisjoint)
+			continue;
+
+		PassSample Sample;
+		Sample.uiPass	= (unsigned short)p;
+		Sample.uiTimer	= enumTIMER_GPU;
+		Sample.fMS		= (float)(ullNS * 1.0e-6);
+		m_Ring.Push(Sample);
+		fFrameMS += Sample.fMS;
 		}
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	// Keep the previous total if this frame is missing any passes
+	if(bComplete && !nDisjoint && fFrameMS > 0.0f)
+		m_fLastGPUFrameMS = fFrameMS;
 	}
 
 // ---------------------------------------------------------------
-bool MyPVRDemo::CreateFBOs(CPVRTString* pErrorStr)
+void CPassProfiler::Drain()
+	{
+	PassSample Sample;
+	while(m_Ring.Pop(Sample))
+		{
+		unsigned int& uiPos = m_uiWindowPos[Sample.uiTimer][Sample.uiPass];
+		m_pfWindow[Sample.uiTimer][Sample.uiPass][uiPos] = Sample.fMS;
+		uiPos = (uiPos + 1) % m_uiWindowSize;
+
+		unsigned int& uiCount = m_uiWindowCount[Sample.uiTimer][Sample.uiPass];
+		if(uiCount < m_uiWindowSize)
+			++uiCount;
+		}
+	}
+
+// ---------------------------------------------------------------
+PassPercentiles CPassProfiler::GetPercentiles(enumPASS ePass, enumTIMER eTimer) const
+	{
+	PassPercentiles Result;
+	memset(&Result, 0, sizeof(Result));
+
+	unsigned int uiCount = m_uiWindowCount[eTimer][ePass];
+	if(!uiCount)
+		return Result;
+
+	float* pfSorted = new float[uiCount];
+	memcpy(pfSorted, m_pfWindow[eTimer][ePass], sizeof(float) * uiCount);
+	qsort(pfSorted, uiCount, sizeof(float), CompareFloat);
+
+	double dTotal = 0.0;
+	for(unsigned int i = 0; i < uiCount; ++i)
+		dTotal += pfSorted[i];
+
+	Result.uiCount	= uiCount;
+	Result.fMean	= (float)(dTotal / uiCount);
+	Result.fP50		= Percentile(pfSorted, uiCount, 50.0f);
+	Result.fP95		= Percentile(pfSorted, uiCount, 95.0f);
+	Result.fP99		= Percentile(pfSorted, uiCount, 99.0f);
+
+	delete [] pfSorted;
+	return Result;
+	}
+
+// ---------------------------------------------------------------
+void CPassProfiler::WriteJSON(FILE* pFile, const char* pszIndent) const
+	{
+	const char* c_pszTimers[enumTIMER_MAX] = { "cpu_ms", "gpu_ms" };
+
+	fprintf(pFile, "{\n");
+	for(int p = 0; p < enumPASS_MAX; ++p)
+		{
+		fprintf(pFile, "%s\t\"%s\": {", pszIndent, c_pszPassNames[p]);
+		for(int t = 0; t < enumTIMER_MAX; ++t)
+			{
+			PassPercentiles Stats = GetPercentiles((enumPASS)p, (enumTIMER)t);
+			fprintf(pFile, "%s \"%s\": { \"count\": %u, \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f }",
+					t ? "," : "", c_pszTimers[t], Stats.uiCount, Stats.fMean, Stats.fP50, Stats.fP95, Stats.fP99);
+			}
+		fprintf(pFile, " }%s\n", p + 1 < enumPASS_MAX ? "," : "");
+		}
+	fprintf(pFile, "%s}", pszIndent);
+	}
+
+// ---------------------------------------------------------------
+void CPassProfiler::WriteCSV(FILE* pFile) const
+	{
+	const char* c_pszTimers[enumTIMER_MAX] = { "cpu", "gpu" };
+
+	fprintf(pFile, "pass,timer,count,mean_ms,p50_ms,p95_ms,p99_ms\n");
+	for(int p = 0; p < enumPASS_MAX; ++p)
+		{
+		for(int t = 0; t < enumTIMER_MAX; ++t)
+			{
+			PassPercentiles Stats = GetPercentiles((enumPASS)p, (enumTIMER)t);
+			fprintf(pFile, "%s,%s,%u,%.4f,%.4f,%.4f,%.4f\n",
+					c_pszPassNames[p], c_pszTimers[t], Stats.uiCount, Stats.fMean, Stats.fP50, Stats.fP95, Stats.fP99);
+			}
+		}
+	}
+
+// ---------------------------------------------------------- MATH
+// -mathbench checks the SIMD kernels in SIMDMath.h against PVRTools, and times both.
+#define MATH_BENCH_DEFAULT_RUNS		200
+#define MATH_BENCH_COUNT			4096		// Matrices, points or vertices per kernel call
+#define MATH_BENCH_TOLERANCE		1e-4f		// Largest error allowed against PVRTools, relative to values over 1. Only the inverse rounds differently.
+#define MATH_BENCH_REPORT			"math_bench.json"
+
+// ---------------------------------------------------------------
+// What -mathbench checks and times each kernel with. Every kernel runs as PVRTools would do it, then with the SIMD
+// version, on the same inputs.
+enum enumMATHKERNEL
+	{
+	enumMATHKERNEL_Multiply,
+	enumMATHKERNEL_Inverse,
+	enumMATHKERNEL_TransformPoints,
+	enumMATHKERNEL_ProjectBounds,
+	enumMATHKERNEL_BoundingBox,
+	enumMATHKERNEL_MAX,
+	};
+
+const char* const c_pszMathKernels[enumMATHKERNEL_MAX] = { "mat4_multiply", "mat4_inverse", "transform_points", "project_bounds", "bounding_box" };
+
+#define MATH_BENCH_STRIDE		32			// Bytes per vertex for the bounding box: a position, a normal and a UV
+#define MATH_BENCH_VERTICES		(MATH_BENCH_COUNT * 16)
+#define MATH_BENCH_GROUP		8			// Points per ProjectBounds call, a box's corners
+
+struct MathBench
+	{
+	PVRTMat4*		pmxA;					// Affine, MATH_BENCH_COUNT of each
+	PVRTMat4*		pmxB;
+	PVRTVec3*		pvPoints;				// All in front of mxViewProj's eye
+	unsigned char*	pVertices;				// MATH_BENCH_VERTICES of MATH_BENCH_STRIDE bytes
+	PVRTMat4		mxViewProj;
+	float*			apfOut[2];				// PVRTools, then SIMD. MATH_BENCH_COUNT matrices' worth each.
+	};
+
+// ---------------------------------------------------------------
+float RandomFloat(float fMin, float fMax)
+	{
+	return fMin + (fMax - fMin) * ((float)rand() / (float)RAND_MAX);
+	}
+
+// ---------------------------------------------------------------
+void InitMathBench(MathBench& Bench, const PVRTMat4& mxViewProj)
+	{
+	// Seeded, so every run checks the same numbers
+	srand(1);
+	Bench.pmxA		= new PVRTMat4[MATH_BENCH_COUNT];
+	Bench.pmxB		= new PVRTMat4[MATH_BENCH_COUNT];
+	Bench.pvPoints	= new PVRTVec3[MATH_BENCH_COUNT];
+	Bench.pVertices	= new unsigned char[MATH_BENCH_VERTICES * MATH_BENCH_STRIDE];
+	Bench.mxViewProj = mxViewProj;
+	for(int i = 0; i < 2; ++i)
+		Bench.apfOut[i] = new float[MATH_BENCH_COUNT * 16];
+
+	for(unsigned int i = 0; i < MATH_BENCH_COUNT; ++i)
+		{
+		// Placed, turned and scaled as scene nodes are
+		PVRTMat4* apmx[2] = { &Bench.pmxA[i], &Bench.pmxB[i] };
+		for(int m = 0; m < 2; ++m)
+			{
+			float fScale = RandomFloat(0.5f, 2.0f);
+			*apmx[m] = PVRTMat4::Translation(RandomFloat(-100.0f, 100.0f), RandomFloat(-100.0f, 100.0f), RandomFloat(-100.0f, 100.0f)) *
+					   PVRTMat4::RotationY(RandomFloat(-PVRT_PI, PVRT_PI)) * PVRTMat4::RotationX(RandomFloat(-PVRT_PI, PVRT_PI)) *
+					   PVRTMat4::Scale(fScale, fScale, fScale);
+			}
+		Bench.pvPoints[i] = PVRTVec3(RandomFloat(-30.0f, 30.0f), RandomFloat(0.0f, 60.0f), RandomFloat(-30.0f, 30.0f));
+		}
+
+	float* pfVertex = (float*)Bench.pVertices;
+	for(unsigned int i = 0; i < MATH_BENCH_VERTICES * MATH_BENCH_STRIDE / sizeof(float); ++i)
+		pfVertex[i] = RandomFloat(-100.0f, 100.0f);
+	}
+
+// ---------------------------------------------------------------
+void ReleaseMathBench(MathBench& Bench)
+	{
+	delete [] Bench.pmxA;
+	delete [] Bench.pmxB;
+	delete [] Bench.pvPoints;
+	delete [] Bench.pVertices;
+	for(int i = 0; i < 2; ++i)
+		delete [] Bench.apfOut[i];
+	}
+
+// ---------------------------------------------------------------
+// Runs one kernel over the bench's inputs and returns how many floats it wrote to apfOut[bSIMD]
+unsigned int RunMathKernel(unsigned int uiKernel, bool bSIMD, MathBench& Bench)
+	{
+	float* pfOut = Bench.apfOut[bSIMD ? 1 : 0];
+	PVRTMat4* pmxOut = (PVRTMat4*)pfOut;
+	switch(uiKernel)
+		{
+		case enumMATHKERNEL_Multiply:
+			for(unsigned int i = 0; i < MATH_BENCH_COUNT; ++i)
+				{
+				if(bSIMD)
+					Mat4Multiply(pmxOut[i], Bench.pmxA[i], Bench.pmxB[i]);
+				else
+					pmxOut[i] = Bench.pmxA[i] * Bench.pmxB[i];
+				}
+			return MATH_BENCH_COUNT * 16;
+
+		case enumMATHKERNEL_Inverse:
+			for(unsigned int i = 0; i < MATH_BENCH_COUNT; ++i)
+				{
+				if(bSIMD)
+					Mat4InverseAffine(pmxOut[i], Bench.pmxA[i]);
+				else
+					pmxOut[i] = Bench.pmxA[i].inverse();
+				}
+			return MATH_BENCH_COUNT * 16;
+
+		case enumMATHKERNEL_TransformPoints:
+			{
+			PVRTVec4* pvOut = (PVRTVec4*)pfOut;
+			if(bSIMD)
+				TransformPoints(Bench.mxViewProj, Bench.pvPoints, MATH_BENCH_COUNT, pvOut);
+			else
+				{
+				for(unsigned int i = 0; i < MATH_BENCH_COUNT; ++i)
+					pvOut[i] = Bench.mxViewProj * PVRTVec4(Bench.pvPoints[i], 1.0f);
+				}
+			return MATH_BENCH_COUNT * 4;
+			}
+
+		case enumMATHKERNEL_ProjectBounds:
+			for(unsigned int g = 0; g < MATH_BENCH_COUNT / MATH_BENCH_GROUP; ++g)
+				{
+				const PVRTVec3* pvGroup = &Bench.pvPoints[g * MATH_BENCH_GROUP];
+				PVRTVec2 vMin(1e30f, 1e30f), vMax(-1e30f, -1e30f);
+				bool bInFront = true;
+				if(bSIMD)
+					bInFront = ProjectBounds(Bench.mxViewProj, pvGroup, MATH_BENCH_GROUP, vMin, vMax);
+				else
+					{
+					// As GetStatueScreenBounds did it
+					for(unsigned int i = 0; i < MATH_BENCH_GROUP && bInFront; ++i)
+						{
+						PVRTVec4 vClip = Bench.mxViewProj * PVRTVec4(pvGroup[i], 1.0f);
+						bInFront = vClip.w > 0.0f;
+						float fX = vClip.x / vClip.w, fY = vClip.y / vClip.w;
+						vMin.x = PVRT_MIN(vMin.x, fX);	vMax.x = PVRT_MAX(vMax.x, fX);
+						vMin.y = PVRT_MIN(vMin.y, fY);	vMax.y = PVRT_MAX(vMax.y, fY);
+						}
+					}
+				float* pfGroup = &pfOut[g * 5];
+				pfGroup[0] = vMin.x;	pfGroup[1] = vMin.y;
+				pfGroup[2] = vMax.x;	pfGroup[3] = vMax.y;
+				pfGroup[4] = bInFront ? 1.0f : 0.0f;
+				}
+			return MATH_BENCH_COUNT / MATH_BENCH_GROUP * 5;
+
+		case enumMATHKERNEL_BoundingBox:
+			{
+			PVRTBOUNDINGBOX* pBox = (PVRTBOUNDINGBOX*)pfOut;
+			if(bSIMD)
+				ComputeBoundingBox(pBox, Bench.pVertices, MATH_BENCH_VERTICES, 0, MATH_BENCH_STRIDE);
+			else
+				PVRTBoundingBoxComputeInterleaved(pBox, Bench.pVertices, MATH_BENCH_VERTICES, 0, MATH_BENCH_STRIDE);
+			return sizeof(PVRTBOUNDINGBOX) / sizeof(float);
+			}
+		}
+	return 0;
+	}
+
+// ---------------------------------------------------------------
+// Largest difference between the two outputs, relative to the PVRTools value where that's over 1
+float GetMathError(const float* pfRef, const float* pfOut, unsigned int uiCount)
+	{
+	float fError = 0.0f;
+	for(unsigned int i = 0; i < uiCount; ++i)
+		fError = PVRT_MAX(fError, (float)fabs(pfOut[i] - pfRef[i]) / PVRT_MAX((float)fabs(pfRef[i]), 1.0f));
+	return fError;
+	}
+
+// ---------------------------------------------------------- MESH OPTIMISATION
+// Load time re-ordering of indexed triangle lists:
+//   1. Triangles are re-ordered for the post-transform vertex cache (Forsyth's linear-speed algorithm).
+//   2. The cache-friendly runs are clustered and the clusters sorted outside-in to reduce overdraw.
+//   3. Vertices are renumbered in first use order so vertex fetch walks through memory.
+#define MESHOPT_SCORE_CACHE_SIZE		32		// Cache size assumed while scoring
+#define MESHOPT_FIFO_CACHE_SIZE			16		// FIFO cache used to measure ACMR/ATVR and find cluster boundaries
+#define MESHOPT_CACHE_DECAY_POWER		1.5f
+#define MESHOPT_LAST_TRI_SCORE			0.75f
+#define MESHOPT_VALENCE_BOOST_SCALE		2.0f
+#define MESHOPT_VALENCE_BOOST_POWER		0.5f
+#define MESHOPT_NO_VERTEX				0xFFFF
+#define MESH_BENCH_DEFAULT_RUNS			20
+#define MESH_BENCH_REPORT				"mesh_bench.json"
+
+struct VertexCacheStats
+	{
+	float				fACMR;			// Average cache misses per triangle. 0.5 is ideal, 3.0 the worst case.
+	float				fATVR;			// Average transformed vertices per vertex. 1.0 is ideal.
+	};
+
+// Simulates a FIFO post-transform cache over a triangle list
+void MeasureVertexCache(const unsigned short* puIndices, unsigned int uiNumIndices, unsigned int uiNumVertices, VertexCacheStats* pStats)
+	{
+	unsigned short auCache[MESHOPT_FIFO_CACHE_SIZE];
+	for(unsigned int i = 0; i < MESHOPT_FIFO_CACHE_SIZE; ++i)
+		auCache[i] = MESHOPT_NO_VERTEX;
+
+	unsigned int uiMisses = 0, uiHead = 0;
+	for(unsigned int i = 0; i < uiNumIndices; ++i)
+		{
+		bool bHit = false;
+		for(unsigned int c = 0; c < MESHOPT_FIFO_CACHE_SIZE && !bHit; ++c)
+			bHit = auCache[c] == puIndices[i];
+
+		if(!bHit)
+			{
+			auCache[uiHead] = puIndices[i];
+			uiHead = (uiHead + 1) % MESHOPT_FIFO_CACHE_SIZE;
+			++uiMisses;
+			}
+		}
+
+	pStats->fACMR = uiNumIndices ? uiMisses / (uiNumIndices / 3.0f) : 0.0f;
+	pStats->fATVR = uiNumVertices ? uiMisses / (float)uiNumVertices : 0.0f;
+	}
+
+float ForsythVertexScore(int nCachePos, unsigned int uiValence)
+	{
+	if(uiValence == 0)
+		return -1.0f;			// No triangles left to use this vertex
+
+	float fScore = 0.0f;
+	if(nCachePos >= 0)
+		{
+		// The last triangle's vertices get a fixed score so we don't favour any one of them
+		if(nCachePos < 3)
+			fScore = MESHOPT_LAST_TRI_SCORE;
+		else
+			fScore = (float)pow(1.0f - (nCachePos - 3) / (float)(MESHOPT_SCORE_CACHE_SIZE - 3), MESHOPT_CACHE_DECAY_POWER);
+		}
+
+	// Boost vertices with few triangles left so we don't leave lone triangles behind
+	fScore += MESHOPT_VALENCE_BOOST_SCALE * (float)pow((float)uiValence, -MESHOPT_VALENCE_BOOST_POWER);
+	return fScore;
+	}
+
+// Re-orders the triangles in puIn for the post-transform vertex cache and writes them to puOut
+void OptimiseVertexCache(const unsigned short* puIn, unsigned short* puOut, unsigned int uiNumIndices, unsigned int uiNumVertices)
+	{
+	unsigned int uiNumTris = uiNumIndices / 3;
+
+	// --- Build vertex -> triangle adjacency. The first 'valence' entries of each list are the triangles not yet emitted.
+	unsigned int* puValence		= new unsigned int[uiNumVertices];
+	unsigned int* puAdjOffset	= new unsigned int[uiNumVertices + 1];
+	unsigned int* puAdj			= new unsigned int[uiNumIndices];
+	memset(puValence, 0, sizeof(unsigned int) * uiNumVertices);
+	for(unsigned int i = 0; i < uiNumIndices; ++i)
+		++puValence[puIn[i]];
+
+	puAdjOffset[0] = 0;
+	for(unsigned int v = 0; v < uiNumVertices; ++v)
+		puAdjOffset[v + 1] = puAdjOffset[v] + puValence[v];
+
+	memset(puValence, 0, sizeof(unsigned int) * uiNumVertices);
+	for(unsigned int i = 0; i < uiNumIndices; ++i)
+		{
+		unsigned int v = puIn[i];
+		puAdj[puAdjOffset[v] + puValence[v]++] = i / 3;
+		}
+
+	// --- Initial scores
+	int* pnCachePos		= new int[uiNumVertices];
+	float* pfVtxScore	= new float[uiNumVertices];
+	float* pfTriScore	= new float[uiNumTris];
+	bool* pbEmitted		= new bool[uiNumTris];
+	for(unsigned int v = 0; v < uiNumVertices; ++v)
+		{
+		pnCachePos[v] = -1;
+		pfVtxScore[v] = ForsythVertexScore(-1, puValence[v]);
+		}
+
+	for(unsigned int t = 0; t < uiNumTris; ++t)
+		{
+		pbEmitted[t] = false;
+		pfTriScore[t] = pfVtxScore[puIn[t * 3]] + pfVtxScore[puIn[t * 3 + 1]] + pfVtxScore[puIn[t * 3 + 2]];
+		}
+
+	// --- Greedily emit the best scoring triangle touching the cache
+	unsigned int auCache[MESHOPT_SCORE_CACHE_SIZE + 3];
+	unsigned int auNewCache[MESHOPT_SCORE_CACHE_SIZE + 3];
+	unsigned int uiCacheSize = 0;
+	unsigned int uiCursor = 0;			// Fallback when nothing in the cache has triangles left
+	int nBest = -1;
+
+	for(unsigned int uiOut = 0; uiOut < uiNumTris; ++uiOut)
+		{
+		if(nBest < 0)
+			{
+			while(pbEmitted[uiCursor])
+				++uiCursor;
+			nBest = (int)uiCursor;
+			}
+
+		const unsigned short* puTri = &puIn[nBest * 3];
+		puOut[uiOut * 3]		= puTri[0];
+		puOut[uiOut * 3 + 1]	= puTri[1];
+		puOut[uiOut * 3 + 2]	= puTri[2];
+		pbEmitted[nBest] = true;
+
+		// Remove the triangle from its vertices' live lists
+		for(unsigned int c = 0; c < 3; ++c)
+			{
+			unsigned int v = puTri[c];
+			unsigned int* puList = &puAdj[puAdjOffset[v]];
+			for(unsigned int j = 0; j < puValence[v]; ++j)
+				{
+				if(puList[j] == (unsigned int)nBest)
+					{
+					puList[j] = puList[puValence[v] - 1];
+					--puValence[v];
+					break;
+					}
+				}
+			}
+
+		// Move the triangle's vertices to the front of the cache
+		unsigned int uiNewSize = 0;
+		for(unsigned int c = 0; c < 3; ++c)
+			auNewCache[uiNewSize++] = puTri[c];
+		for(unsigned int c = 0; c < uiCacheSize; ++c)
+			{
+			unsigned int v = auCache[c];
+			if(v != puTri[0] && v != puTri[1] && v != puTri[2])
+				auNewCache[uiNewSize++] = v;
+			}
+
+		// Re-score everything that was or is in the cache, and the triangles using it
+		float fBestScore = -1.0f;
+		nBest = -1;
+		for(unsigned int c = 0; c < uiNewSize; ++c)
+			{
+			unsigned int v = auNewCache[c];
+			pnCachePos[v] = c < MESHOPT_SCORE_CACHE_SIZE ? (int)c : -1;
+			pfVtxScore[v] = ForsythVertexScore(pnCachePos[v], puValence[v]);
+			}
+
+		for(unsigned int c = 0; c < uiNewSize; ++c)
+			{
+			unsigned int v = auNewCache[c];
+			const unsigned int* puList = &puAdj[puAdjOffset[v]];
+			for(unsigned int j = 0; j < puValence[v]; ++j)
+				{
+				unsigned int t = puList[j];
+				pfTriScore[t] = pfVtxScore[puIn[t * 3]] + pfVtxScore[puIn[t * 3 + 1]] + pfVtxScore[puIn[t * 3 + 2]];
+				if(pfTriScore[t] > fBestScore)
+					{
+					fBestScore = pfTriScore[t];
+					nBest = (int)t;
+					}
+				}
+			}
+
+		uiCacheSize = PVRT_MIN(uiNewSize, (unsigned int)MESHOPT_SCORE_CACHE_SIZE);
+		memcpy(auCache, auNewCache, sizeof(unsigned int) * uiCacheSize);
+		}
+
+	delete [] puValence;
+	delete [] puAdjOffset;
+	delete [] puAdj;
+	delete [] pnCachePos;
+	delete [] pfVtxScore;
+	delete [] pfTriScore;
+	delete [] pbEmitted;
+	}
+
+struct TriangleCluster
+	{
+	unsigned int		uiFirstIndex;
+	unsigned int		uiNumIndices;
+	float				fSortKey;
+	};
+
+int CompareClusters(const void* pA, const void* pB)
+	{
+	float fA = ((const TriangleCluster*)pA)->fSortKey;
+	float fB = ((const TriangleCluster*)pB)->fSortKey;
+	return fA > fB ? -1 : (fA < fB ? 1 : 0);
+	}
+
+// Re-orders a cache optimised triangle list to reduce overdraw without giving up the cache ordering.
+// The list is split wherever the FIFO cache misses on all three vertices, which costs nothing to reorder around,
+// and the clusters are then drawn outward facing first as they're the most likely to occlude the rest.
+void OptimiseOverdraw(const unsigned short* puIn, unsigned short* puOut, unsigned int uiNumIndices, const SPODMesh& Mesh)
+	{
+	unsigned int uiNumTris = uiNumIndices / 3;
+	if(uiNumTris == 0)
+		return;
+
+	// --- Find the cluster boundaries
+	TriangleCluster* pClusters = new TriangleCluster[uiNumTris];
+	unsigned int uiNumClusters = 0;
+
+	unsigned short auCache[MESHOPT_FIFO_CACHE_SIZE];
+	for(unsigned int i = 0; i < MESHOPT_FIFO_CACHE_SIZE; ++i)
+		auCache[i] = MESHOPT_NO_VERTEX;
+	unsigned int uiHead = 0;
+
+	for(unsigned int t = 0; t < uiNumTris; ++t)
+		{
+		unsigned int uiMisses = 0;
+		for(unsigned int c = 0; c < 3; ++c)
+			{
+			unsigned short v = puIn[t * 3 + c];
+			bool bHit = false;
+			for(unsigned int k = 0; k < MESHOPT_FIFO_CACHE_SIZE && !bHit; ++k)
+				bHit = auCache[k] == v;
+
+			if(!bHit)
+				{
+				auCache[uiHead] = v;
+				uiHead = (uiHead + 1) % MESHOPT_FIFO_CACHE_SIZE;
+				++uiMisses;
+				}
+			}
+
+		if(t == 0 || uiMisses == 3)
+			{
+			pClusters[uiNumClusters].uiFirstIndex = t * 3;
+			pClusters[uiNumClusters].uiNumIndices = 0;
+			++uiNumClusters;
+			}
+		pClusters[uiNumClusters - 1].uiNumIndices += 3;
+		}
+
+	// --- Area weighted centroid of the mesh and of each cluster
+	PVRTVec3 vMeshCentroid(0.0f, 0.0f, 0.0f);
+	float fMeshArea = 0.0f;
+	PVRTVec3* pvCentroids	= new PVRTVec3[uiNumClusters];
+	PVRTVec3* pvNormals		= new PVRTVec3[uiNumClusters];
+
+	for(unsigned int i = 0; i < uiNumClusters; ++i)
+		{
+		PVRTVec3 vCentroid(0.0f, 0.0f, 0.0f);
+		PVRTVec3 vNormal(0.0f, 0.0f, 0.0f);
+		float fArea = 0.0f;
+
+		for(unsigned int j = 0; j < pClusters[i].uiNumIndices; j += 3)
+			{
+			const unsigned short* puTri = &puIn[pClusters[i].uiFirstIndex + j];
+			const float* pf0 = PODVertexData(Mesh, Mesh.sVertex, puTri[0]);
+			const float* pf1 = PODVertexData(Mesh, Mesh.sVertex, puTri[1]);
+			const float* pf2 = PODVertexData(Mesh, Mesh.sVertex, puTri[2]);
+			PVRTVec3 v0(pf0[0], pf0[1], pf0[2]);
+			PVRTVec3 v1(pf1[0], pf1[1], pf1[2]);
+			PVRTVec3 v2(pf2[0], pf2[1], pf2[2]);
+
+			PVRTVec3 vCross = (v1 - v0).cross(v2 - v0);
+			float fTriArea = vCross.length() * 0.5f;
+			vNormal += vCross;
+			vCentroid += (v0 + v1 + v2) * (fTriArea / 3.0f);
+			fArea += fTriArea;
+			}
+
+		vMeshCentroid += vCentroid;
+		fMeshArea += fArea;
+		pvCentroids[i] = fArea > 0.0f ? vCentroid / fArea : vCentroid;
+		pvNormals[i] = vNormal.length() > 0.0f ? vNormal.normalized() : vNormal;
+		}
+
+	if(fMeshArea > 0.0f)
+		vMeshCentroid /= fMeshArea;
+
+	// --- Sort outward facing clusters first and write them out
+	for(unsigned int i = 0; i < uiNumClusters; ++i)
+		pClusters[i].fSortKey = (pvCentroids[i] - vMeshCentroid).dot(pvNormals[i]);
+
+	qsort(pClusters, uiNumClusters, sizeof(TriangleCluster), CompareClusters);
+
+	unsigned int uiOut = 0;
+	for(unsigned int i = 0; i < uiNumClusters; ++i)
+		{
+		memcpy(&puOut[uiOut], &puIn[pClusters[i].uiFirstIndex], sizeof(unsigned short) * pClusters[i].uiNumIndices);
+		uiOut += pClusters[i].uiNumIndices;
+		}
+
+	delete [] pClusters;
+	delete [] pvCentroids;
+	delete [] pvNormals;
+	}
+
+// Renumbers the vertices in the order the indices first reference them and re-orders the vertex data to match.
+// Unreferenced vertices are moved to the end. Returns the number of referenced vertices.
+unsigned int OptimiseVertexFetch(unsigned short* puIndices, unsigned int uiNumIndices, unsigned char* pVertices, unsigned int uiNumVertices, unsigned int uiStride)
+	{
+	unsigned short* puRemap = new unsigned short[uiNumVertices];
+	for(unsigned int v = 0; v < uiNumVertices; ++v)
+		puRemap[v] = MESHOPT_NO_VERTEX;
+
+	unsigned int uiNext = 0;
+	for(unsigned int i = 0; i < uiNumIndices; ++i)
+		{
+		if(puRemap[puIndices[i]] == MESHOPT_NO_VERTEX)
+			puRemap[puIndices[i]] = (unsigned short)uiNext++;
+		puIndices[i] = puRemap[puIndices[i]];
+		}
+	unsigned int uiNumReferenced = uiNext;
+
+	for(unsigned int v = 0; v < uiNumVertices; ++v)
+		{
+		if(puRemap[v] == MESHOPT_NO_VERTEX)
+			puRemap[v] = (unsigned short)uiNext++;
+		}
+
+	unsigned char* pCopy = new unsigned char[uiNumVertices * uiStride];
+	memcpy(pCopy, pVertices, uiNumVertices * uiStride);
+	for(unsigned int v = 0; v < uiNumVertices; ++v)
+		memcpy(pVertices + puRemap[v] * uiStride, pCopy + v * uiStride, uiStride);
+
+	delete [] pCopy;
+	delete [] puRemap;
+	return uiNumReferenced;
+	}
+
+// A triangle as one sortable key, rotated so its smallest index is first. The rotation keeps the winding.
+unsigned long long TriangleKey(unsigned int ui0, unsigned int ui1, unsigned int ui2)
+	{
+	if(ui1 < ui0 && ui1 < ui2)
+		return ((unsigned long long)ui1 << 32) | ((unsigned long long)ui2 << 16) | ui0;
+	if(ui2 < ui0 && ui2 < ui1)
+		return ((unsigned long long)ui2 << 32) | ((unsigned long long)ui0 << 16) | ui1;
+	return ((unsigned long long)ui0 << 32) | ((unsigned long long)ui1 << 16) | ui2;
+	}
+
+int CompareTriangleKeys(const void* pA, const void* pB)
+	{
+	unsigned long long ullA = *(const unsigned long long*)pA, ullB = *(const unsigned long long*)pB;
+	return ullA < ullB ? -1 : (ullA > ullB ? 1 : 0);
+	}
+
+// Checks an optimised index list draws what the original did. puVertexIDs is what OptimiseVertexFetch made of an array
+// holding each vertex's original number: it has to be a permutation, and the optimised triangles, mapped back through
+// it, have to be the original triangles with the same winding, each as often as before.
+bool CheckOptimisedMesh(const unsigned short* puOriginal, const unsigned short* puOptimised, unsigned int uiNumIndices,
+						const unsigned int* puVertexIDs, unsigned int uiNumVertices)
+	{
+	bool bValid = true;
+	bool* pbSeen = new bool[uiNumVertices];
+	memset(pbSeen, 0, uiNumVertices * sizeof(bool));
+	for(unsigned int v = 0; v < uiNumVertices && bValid; ++v)
+		{
+		bValid = puVertexIDs[v] < uiNumVertices && !pbSeen[puVertexIDs[v]];
+		if(bValid)
+			pbSeen[puVertexIDs[v]] = true;
+		}
+	delete [] pbSeen;
+
+	unsigned int uiNumTris = uiNumIndices / 3;
+	unsigned long long* pullBefore = new unsigned long long[uiNumTris];
+	unsigned long long* pullAfter = new unsigned long long[uiNumTris];
+	for(unsigned int t = 0; t < uiNumTris && bValid; ++t)
+		{
+		const unsigned short* puTri = &puOptimised[t * 3];
+		bValid = puTri[0] < uiNumVertices && puTri[1] < uiNumVertices && puTri[2] < uiNumVertices;
+		if(bValid)
+			{
+			pullBefore[t] = TriangleKey(puOriginal[t * 3], puOriginal[t * 3 + 1], puOriginal[t * 3 + 2]);
+			pullAfter[t] = TriangleKey(puVertexIDs[puTri[0]], puVertexIDs[puTri[1]], puVertexIDs[puTri[2]]);
+			}
+		}
+	if(bValid)
+		{
+		qsort(pullBefore, uiNumTris, sizeof(unsigned long long), CompareTriangleKeys);
+		qsort(pullAfter, uiNumTris, sizeof(unsigned long long), CompareTriangleKeys);
+		bValid = memcmp(pullBefore, pullAfter, uiNumTris * sizeof(unsigned long long)) == 0;
+		}
+
+	delete [] pullBefore;
+	delete [] pullAfter;
+	return bValid;
+	}
+
+// ---------------------------------------------------------- MESH SIMPLIFICATION
+// Builds position-only meshes for depth passes. Vertices that only differed by UVs/normals are welded together,
+// and shadow casters can be simplified with quadric error metric edge collapses down to a triangle budget.
+struct Quadric
+	{
+	double				af[10];			// Symmetric 4x4: aa ab ac ad bb bc bd cc cd dd
+	};
+
+void QuadricFromTriangle(Quadric* pQ, const PVRTVec3& v0, const PVRTVec3& v1, const PVRTVec3& v2)
+	{
+	memset(pQ, 0, sizeof(*pQ));
+
+	PVRTVec3 vNormal = (v1 - v0).cross(v2 - v0);
+	if(vNormal.length() == 0.0f)
+		return;
+	vNormal.normalize();
+
+	double a = vNormal.x, b = vNormal.y, c = vNormal.z, d = -vNormal.dot(v0);
+	pQ->af[0] = a * a;	pQ->af[1] = a * b;	pQ->af[2] = a * c;	pQ->af[3] = a * d;
+	pQ->af[4] = b * b;	pQ->af[5] = b * c;	pQ->af[6] = b * d;
+	pQ->af[7] = c * c;	pQ->af[8] = c * d;
+	pQ->af[9] = d * d;
+	}
+
+void QuadricAdd(Quadric* pQ, const Quadric& Other)
+	{
+	for(unsigned int i = 0; i < 10; ++i)
+		pQ->af[i] += Other.af[i];
+	}
+
+// Sum of squared distances from v to the quadric's planes
+double QuadricError(const Quadric& Q, const PVRTVec3& v)
+	{
+	const double* f = Q.af;
+	double x = v.x, y = v.y, z = v.z;
+	double fError =	f[0] * x * x + 2.0 * f[1] * x * y + 2.0 * f[2] * x * z + 2.0 * f[3] * x
+				+	f[4] * y * y + 2.0 * f[5] * y * z + 2.0 * f[6] * y
+				+	f[7] * z * z + 2.0 * f[8] * z
+				+	f[9];
+	return fError > 0.0 ? fError : 0.0;
+	}
+
+// Merges vertices with identical positions. Writes the unique positions to pvOut and rewrites puIndices to use them.
+// Returns the number of unique positions.
+unsigned int WeldPositions(const SPODMesh& Mesh, unsigned short* puIndices, unsigned int uiNumIndices, PVRTVec3* pvOut)
+	{
+	unsigned int uiTableSize = 1;
+	while(uiTableSize < Mesh.nNumVertex * 2)
+		uiTableSize <<= 1;
+
+	unsigned int* puTable = new unsigned int[uiTableSize];		// Open addressing; holds unique position indices
+	unsigned short* puRemap = new unsigned short[Mesh.nNumVertex];
+	for(unsigned int i = 0; i < uiTableSize; ++i)
+		puTable[i] = 0xFFFFFFFF;
+
+	unsigned int uiNumUnique = 0;
+	for(unsigned int v = 0; v < Mesh.nNumVertex; ++v)
+		{
+		const float* pfPos = PODVertexData(Mesh, Mesh.sVertex, v);
+		unsigned int auBits[3];
+		memcpy(auBits, pfPos, sizeof(auBits));
+
+		unsigned int uiSlot = (auBits[0] * 73856093u ^ auBits[1] * 19349663u ^ auBits[2] * 83492791u) & (uiTableSize - 1);
+		for(;;)
+			{
+			unsigned int uiEntry = puTable[uiSlot];
+			if(uiEntry == 0xFFFFFFFF)
+				{
+				pvOut[uiNumUnique] = PVRTVec3(pfPos[0], pfPos[1], pfPos[2]);
+				puTable[uiSlot] = uiNumUnique;
+				puRemap[v] = (unsigned short)uiNumUnique++;
+				break;
+				}
+
+			if(pvOut[uiEntry].x == pfPos[0] && pvOut[uiEntry].y == pfPos[1] && pvOut[uiEntry].z == pfPos[2])
+				{
+				puRemap[v] = (unsigned short)uiEntry;
+				break;
+				}
+
+			uiSlot = (uiSlot + 1) & (uiTableSize - 1);
+			}
+		}
+
+	for(unsigned int i = 0; i < uiNumIndices; ++i)
+		puIndices[i] = puRemap[puIndices[i]];
+
+	delete [] puTable;
+	delete [] puRemap;
+	return uiNumUnique;
+	}
+
+// Removes triangles that use the same vertex twice. Returns the new index count.
+unsigned int RemoveDegenerates(unsigned short* puIndices, unsigned int uiNumIndices)
+	{
+	unsigned int uiOut = 0;
+	for(unsigned int i = 0; i < uiNumIndices; i += 3)
+		{
+		unsigned short a = puIndices[i], b = puIndices[i + 1], c = puIndices[i + 2];
+		if(a == b || b == c || a == c)
+			continue;
+
+		puIndices[uiOut++] = a;
+		puIndices[uiOut++] = b;
+		puIndices[uiOut++] = c;
+		}
+	return uiOut;
+	}
+
+struct EdgeCollapse
+	{
+	unsigned short		uFrom;
+	unsigned short		uTo;
+	double				fCost;
+	};
+
+int CompareCollapses(const void* pA, const void* pB)
+	{
+	double fA = ((const EdgeCollapse*)pA)->fCost;
+	double fB = ((const EdgeCollapse*)pB)->fCost;
+	return fA < fB ? -1 : (fA > fB ? 1 : 0);
+	}
+
+// Collapses edges onto one of their end points, cheapest first, until the mesh is down to uiTargetIndices or the next
+// collapse would move the surface by more than fMaxError. Works in place on a welded, position-only triangle list.
+// Returns the new index count and writes the largest error introduced to pfError.
+unsigned int SimplifyMesh(const PVRTVec3* pvPositions, unsigned int uiNumVertices, unsigned short* puIndices, unsigned int uiNumIndices,
+						  unsigned int uiTargetIndices, float fMaxError, float* pfError)
+	{
+	double fMaxCost = (double)fMaxError * fMaxError;
+	double fWorstCost = 0.0;
+
+	// --- Each vertex starts with the planes of the triangles around it
+	Quadric* pQuadrics = new Quadric[uiNumVertices];
+	memset(pQuadrics, 0, sizeof(Quadric) * uiNumVertices);
+	for(unsigned int i = 0; i < uiNumIndices; i += 3)
+		{
+		Quadric Q;
+		QuadricFromTriangle(&Q, pvPositions[puIndices[i]], pvPositions[puIndices[i + 1]], pvPositions[puIndices[i + 2]]);
+		for(unsigned int c = 0; c < 3; ++c)
+			QuadricAdd(&pQuadrics[puIndices[i + c]], Q);
+		}
+
+	unsigned short* puRemap		= new unsigned short[uiNumVertices];
+	bool* pbLocked				= new bool[uiNumVertices];
+	unsigned int* puAdjOffset	= new unsigned int[uiNumVertices + 1];
+	unsigned int* puAdjCount	= new unsigned int[uiNumVertices];
+	unsigned int* puAdj			= new unsigned int[uiNumIndices];
+	EdgeCollapse* pCollapses	= new EdgeCollapse[uiNumIndices];
+
+	// --- Each pass collapses an independent set of edges, then the mesh is rebuilt and re-evaluated
+	while(uiNumIndices > uiTargetIndices)
+		{
+		// Vertex -> triangle adjacency
+		memset(puAdjCount, 0, sizeof(unsigned int) * uiNumVertices);
+		for(unsigned int i = 0; i < uiNumIndices; ++i)
+			++puAdjCount[puIndices[i]];
+
+		puAdjOffset[0] = 0;
+		for(unsigned int v = 0; v < uiNumVertices; ++v)
+			{
+			puAdjOffset[v + 1] = puAdjOffset[v] + puAdjCount[v];
+			puAdjCount[v] = 0;
+			}
+
+		for(unsigned int i = 0; i < uiNumIndices; ++i)
+			{
+			unsigned int v = puIndices[i];
+			puAdj[puAdjOffset[v] + puAdjCount[v]++] = i / 3;
+			}
+
+		// Cost every edge, picking the cheaper direction
+		unsigned int uiNumCollapses = 0;
+		for(unsigned int i = 0; i < uiNumIndices; ++i)
+			{
+			unsigned short a = puIndices[i];
+			unsigned short b = puIndices[(i % 3 == 2) ? i - 2 : i + 1];
+
+			Quadric Q = pQuadrics[a];
+			QuadricAdd(&Q, pQuadrics[b]);
+			double fCostAB = QuadricError(Q, pvPositions[b]);
+			double fCostBA = QuadricError(Q, pvPositions[a]);
+
+			EdgeCollapse& Collapse = pCollapses[uiNumCollapses++];
+			Collapse.uFrom	= fCostAB <= fCostBA ? a : b;
+			Collapse.uTo	= fCostAB <= fCostBA ? b : a;
+			Collapse.fCost	= PVRT_MIN(fCostAB, fCostBA);
+			}
+
+		qsort(pCollapses, uiNumCollapses, sizeof(EdgeCollapse), CompareCollapses);
+
+		for(unsigned int v = 0; v < uiNumVertices; ++v)
+			{
+			puRemap[v] = (unsigned short)v;
+			pbLocked[v] = false;
+			}
+
+		// Apply as many as we can without two collapses touching the same triangles
+		unsigned int uiRemaining = uiNumIndices;
+		unsigned int uiApplied = 0;
+		for(unsigned int i = 0; i < uiNumCollapses && uiRemaining > uiTargetIndices; ++i)
+			{
+			const EdgeCollapse& Collapse = pCollapses[i];
+			if(Collapse.fCost > fMaxCost)
+				break;
+
+			unsigned int uFrom = Collapse.uFrom, uTo = Collapse.uTo;
+			if(pbLocked[uFrom] || pbLocked[uTo])
+				continue;
+
+			// Reject the collapse if it would flip any of the triangles that survive it
+			const unsigned int* puTris = &puAdj[puAdjOffset[uFrom]];
+			unsigned int uiNumTris = puAdjOffset[uFrom + 1] - puAdjOffset[uFrom];
+			unsigned int uiRemoved = 0;
+			bool bFlips = false;
+			for(unsigned int t = 0; t < uiNumTris && !bFlips; ++t)
+				{
+				const unsigned short* puTri = &puIndices[puTris[t] * 3];
+				if(puTri[0] == uTo || puTri[1] == uTo || puTri[2] == uTo)
+					{
+					++uiRemoved;
+					continue;
+					}
+
+				PVRTVec3 av[3], avNew[3];
+				for(unsigned int c = 0; c < 3; ++c)
+					{
+					av[c] = pvPositions[puTri[c]];
+					avNew[c] = puTri[c] == uFrom ? pvPositions[uTo] : av[c];
+					}
+
+				PVRTVec3 vOld = (av[1] - av[0]).cross(av[2] - av[0]);
+				PVRTVec3 vNew = (avNew[1] - avNew[0]).cross(avNew[2] - avNew[0]);
+				bFlips = vOld.dot(vNew) <= 0.0f;
+				}
+
+			if(bFlips)
+				continue;
+
+			puRemap[uFrom] = (unsigned short)uTo;
+			QuadricAdd(&pQuadrics[uTo], pQuadrics[uFrom]);
+			fWorstCost = PVRT_MAX(fWorstCost, Collapse.fCost);
+			uiRemaining -= uiRemoved * 3;
+			++uiApplied;
+
+			// Everything around the collapse is now stale for this pass
+			for(unsigned int t = 0; t < uiNumTris; ++t)
+				{
+				const unsigned short* puTri = &puIndices[puTris[t] * 3];
+				pbLocked[puTri[0]] = pbLocked[puTri[1]] = pbLocked[puTri[2]] = true;
+				}
+			pbLocked[uTo] = true;
+			}
+
+		if(!uiApplied)
+			break;			// Everything left is over the error bound, or would flip
+
+		for(unsigned int i = 0; i < uiNumIndices; ++i)
+			puIndices[i] = puRemap[puIndices[i]];
+		uiNumIndices = RemoveDegenerates(puIndices, uiNumIndices);
+		}
+
+	delete [] pQuadrics;
+	delete [] puRemap;
+	delete [] pbLocked;
+	delete [] puAdjOffset;
+	delete [] puAdjCount;
+	delete [] puAdj;
+	delete [] pCollapses;
+
+	*pfError = (float)sqrt(fWorstCost);
+	return uiNumIndices;
+	}
+
+// ---------------------------------------------------------- SCENE PACKAGE
+// A baked package holds what the demo would otherwise build from the POD and .pvr files at startup, already in the
+// layout it's uploaded in. It's written with -bake and loaded with -package. See Package.h for the file itself.
+#define PACKAGE_DEFAULT_FILE		"statuescene.pak"
+#define PACKAGE_FLAG_MESHOPT		(1 << 0)		// Baked with the mesh optimiser
+#define PACKAGE_FLAG_SHADOWLOD		(1 << 1)		// Baked with the shadow caster LOD
+
+enum enumPACKAGE
+	{
+	enumPACKAGE_Scene,				// PackageScene
+	enumPACKAGE_Vertices,			// Compact vertex data, indexed by mesh
+	enumPACKAGE_Indices,
+	enumPACKAGE_DepthVertices,
+	enumPACKAGE_DepthIndices,
+	enumPACKAGE_Texture,			// Whole .pvr file, indexed by enumTEXTURE
+	enumPACKAGE_Nodes,				// SceneNode array
+	};
+
+// Everything the demo takes from the POD, other than buffer contents
+struct PackageScene
+	{
+	unsigned int		uiNumMeshes;
+	unsigned int		auNumIndices[SCENE_MAX_MESHES];
+	unsigned int		auDepthNumIndices[SCENE_MAX_MESHES];
+	CompactVertexFormat	aFormats[SCENE_MAX_MESHES];
+	PVRTVec4			vStatueTL;
+	PVRTVec4			vStatueBR;
+	};
+
+// ---------------------------------------------------------- ASSET LOADING
+// Assets are read and processed on a pool of worker threads. Finished assets queue up for the GL thread, which
+// uploads them a few at a time between placeholder frames. Every asset's queue, work and upload times are kept
+// so the overlap can be checked.
+#define LOADER_MAX_WORKERS			8
+#define LOADER_MAX_ASSETS			64
+#define LOADER_UPLOAD_BUDGET_MS		8.0			// GL thread time spent uploading per placeholder frame
+#define LOADER_GL_THREAD			-1			// AssetTiming::nWorker for work done on the GL thread
+
+typedef void (*PFNLOADTASK)(void* pUserData, unsigned int uiAsset);
+
+struct AssetTiming
+	{
+	const char*			pszName;			// NULL if the asset was never submitted
+	int					nWorker;
+	double				dQueuedMS;			// All relative to the loader's base time
+	double				dStartMS;
+	double				dEndMS;
+	double				dUploadStartMS;
+	double				dUploadEndMS;
+	};
+
+class CAssetLoader
+	{
+	private:
+		struct Task
+			{
+			PFNLOADTASK		pfnTask;
+			void*			pUserData;
+			unsigned int	uiAsset;
+			};
+
+		struct Worker
+			{
+			CAssetLoader*	pLoader;
+			int				nIndex;
+			};
+
+		ThreadHandle		m_aThreads[LOADER_MAX_WORKERS];
+		Worker				m_aWorkers[LOADER_MAX_WORKERS];
+		unsigned int		m_uiNumWorkers;
+		bool				m_bRunning;
+		double				m_dBaseMS;
+
+		CMutex				m_Mutex;				// Guards everything below
+		CSemaphore			m_TaskSignal;
+		Task				m_aTasks[LOADER_MAX_ASSETS];	// FIFO. Each asset is only ever submitted once.
+		unsigned int		m_uiTaskHead;
+		unsigned int		m_uiTaskTail;
+		unsigned int		m_auReady[LOADER_MAX_ASSETS];	// FIFO of assets waiting for the GL thread
+		unsigned int		m_uiReadyHead;
+		unsigned int		m_uiReadyTail;
+		unsigned int		m_uiNumSubmitted;
+		unsigned int		m_uiNumUploaded;
+		bool				m_bQuit;
+		AssetTiming			m_aTimings[LOADER_MAX_ASSETS];
+
+		static THREAD_MAIN(ThreadMain);
+		void WorkerLoop(int nIndex);
+
+	public:
+		CAssetLoader() : m_uiNumWorkers(0), m_bRunning(false) { Reset(0.0); }
+
+		void Reset(double dBaseMS);
+		bool Start(unsigned int uiNumWorkers, double dBaseMS);
+		void Stop();
+		unsigned int GetNumWorkers() const			{ return m_uiNumWorkers; }
+
+		void Submit(unsigned int uiAsset, const char* pszName, PFNLOADTASK pfnTask, void* pUserData);
+		bool PopReady(unsigned int* puAsset);
+		void BeginUpload(unsigned int uiAsset);
+		void EndUpload(unsigned int uiAsset);
+		void RecordGLWork(unsigned int uiAsset, const char* pszName, double dStartMS, double dEndMS);
+		bool IsDone();
+
+		double GetWallMS() const;
+		double GetWorkMS() const;
+		const AssetTiming& GetTiming(unsigned int uiAsset) const	{ return m_aTimings[uiAsset]; }
+		void WriteJSON(FILE* pFile, const char* pszIndent) const;
+	};
+
+// ---------------------------------------------------------------
+void CAssetLoader::Reset(double dBaseMS)
+	{
+	m_dBaseMS = dBaseMS;
+	m_uiTaskHead = m_uiTaskTail = 0;
+	m_uiReadyHead = m_uiReadyTail = 0;
+	m_uiNumSubmitted = m_uiNumUploaded = 0;
+	m_bQuit = false;
+	memset(m_aTimings, 0, sizeof(m_aTimings));
+	}
+
+// ---------------------------------------------------------------
+bool CAssetLoader::Start(unsigned int uiNumWorkers, double dBaseMS)
+	{
+	Reset(dBaseMS);
+
+	uiNumWorkers = PVRT_CLAMP(uiNumWorkers, 1u, (unsigned int)LOADER_MAX_WORKERS);
+	for(m_uiNumWorkers = 0; m_uiNumWorkers < uiNumWorkers; ++m_uiNumWorkers)
+		{
+		Worker& Info = m_aWorkers[m_uiNumWorkers];
+		Info.pLoader = this;
+		Info.nIndex = (int)m_uiNumWorkers;
+		if(!StartThread(&m_aThreads[m_uiNumWorkers], ThreadMain, &Info))
+			break;
+		}
+
+	m_bRunning = m_uiNumWorkers > 0;
+	return m_bRunning;
+	}
+
+// ---------------------------------------------------------------
+void CAssetLoader::Stop()
+	{
+	if(!m_bRunning)
+		return;
+
+	m_Mutex.Lock();
+	m_bQuit = true;
+	m_Mutex.Unlock();
+	m_TaskSignal.Post(m_uiNumWorkers);
+
+	for(unsigned int i = 0; i < m_uiNumWorkers; ++i)
+		JoinThread(m_aThreads[i]);
+	m_bRunning = false;
+	}
+
+// ---------------------------------------------------------------
+THREAD_MAIN(CAssetLoader::ThreadMain)
+	{
+	Worker* pWorker = (Worker*)pUserData;
+	pWorker->pLoader->WorkerLoop(pWorker->nIndex);
+	THREAD_RETURN;
+	}
+
+// ---------------------------------------------------------------
+void CAssetLoader::WorkerLoop(int nIndex)
+	{
+	for(;;)
+		{
+		m_TaskSignal.Wait();
+
+		Task CurrTask;
+			{
+			CMutexLock Lock(m_Mutex);
+			if(m_uiTaskHead == m_uiTaskTail)
+				{
+				if(m_bQuit)
+					return;
+				continue;
+				}
+
+			CurrTask = m_aTasks[m_uiTaskHead++ % LOADER_MAX_ASSETS];
+			m_aTimings[CurrTask.uiAsset].nWorker = nIndex;
+			m_aTimings[CurrTask.uiAsset].dStartMS = GetTimeMS() - m_dBaseMS;
+			}
+
+		CurrTask.pfnTask(CurrTask.pUserData, CurrTask.uiAsset);
+
+		CMutexLock Lock(m_Mutex);
+		m_aTimings[CurrTask.uiAsset].dEndMS = GetTimeMS() - m_dBaseMS;
+		m_auReady[m_uiReadyTail++ % LOADER_MAX_ASSETS] = CurrTask.uiAsset;
+		}
+	}
+
+// ---------------------------------------------------------------
+void CAssetLoader::Submit(unsigned int uiAsset, const char* pszName, PFNLOADTASK pfnTask, void* pUserData)
+	{
+	ASSERT(uiAsset < LOADER_MAX_ASSETS);
+
+		{
+		CMutexLock Lock(m_Mutex);
+		Task& NewTask = m_aTasks[m_uiTaskTail++ % LOADER_MAX_ASSETS];
+		NewTask.pfnTask		= pfnTask;
+		NewTask.pUserData	= pUserData;
+		NewTask.uiAsset		= uiAsset;
+
+		m_aTimings[uiAsset].pszName		= pszName;
+		m_aTimings[uiAsset].dQueuedMS	= GetTimeMS() - m_dBaseMS;
+		++m_uiNumSubmitted;
+		}
+
+	m_TaskSignal.Post();
+	}
+
+// ---------------------------------------------------------------
+bool CAssetLoader::PopReady(unsigned int* puAsset)
+	{
+	CMutexLock Lock(m_Mutex);
+	if(m_uiReadyHead == m_uiReadyTail)
+		return false;
+
+	*puAsset = m_auReady[m_uiReadyHead++ % LOADER_MAX_ASSETS];
+	return true;
+	}
+
+// ---------------------------------------------------------------
+void CAssetLoader::BeginUpload(unsigned int uiAsset)
+	{
+	CMutexLock Lock(m_Mutex);
+	m_aTimings[uiAsset].dUploadStartMS = GetTimeMS() - m_dBaseMS;
+	}
+
+// ---------------------------------------------------------------
+void CAssetLoader::EndUpload(unsigned int uiAsset)
+	{
+	CMutexLock Lock(m_Mutex);
+	m_aTimings[uiAsset].dUploadEndMS = GetTimeMS() - m_dBaseMS;
+	++m_uiNumUploaded;
+	}
+
+// ---------------------------------------------------------------
+void CAssetLoader::RecordGLWork(unsigned int uiAsset, const char* pszName, double dStartMS, double dEndMS)
+	{
+	CMutexLock Lock(m_Mutex);
+	AssetTiming& Timing = m_aTimings[uiAsset];
+	Timing.pszName			= pszName;
+	Timing.nWorker			= LOADER_GL_THREAD;
+	Timing.dQueuedMS		= Timing.dStartMS = Timing.dUploadStartMS = dStartMS - m_dBaseMS;
+	Timing.dEndMS			= Timing.dUploadEndMS = dEndMS - m_dBaseMS;
+	}
+
+// ---------------------------------------------------------------
+bool CAssetLoader::IsDone()
+	{
+	// Tasks submit their dependants before they finish, so this can't be true early
+	CMutexLock Lock(m_Mutex);
+	return m_uiNumUploaded == m_uiNumSubmitted;
+	}
+
+// ---------------------------------------------------------------
+double CAssetLoader::GetWallMS() const
+	{
+	double dEnd = 0.0;
+	for(unsigned int i = 0; i < LOADER_MAX_ASSETS; ++i)
+		{
+		if(m_aTimings[i].pszName)
+			dEnd = PVRT_MAX(dEnd, m_aTimings[i].dUploadEndMS);
+		}
+	return dEnd;
+	}
+
+// ---------------------------------------------------------------
+double CAssetLoader::GetWorkMS() const
+	{
+	// What the same work would take back to back on one thread
+	double dTotal = 0.0;
+	for(unsigned int i = 0; i < LOADER_MAX_ASSETS; ++i)
+		{
+		const AssetTiming& Timing = m_aTimings[i];
+		if(!Timing.pszName)
+			continue;
+
+		dTotal += Timing.dUploadEndMS - Timing.dUploadStartMS;
+		if(Timing.nWorker != LOADER_GL_THREAD)
+			dTotal += Timing.dEndMS - Timing.dStartMS;
+		}
+	return dTotal;
+	}
+
+// ---------------------------------------------------------------
+void CAssetLoader::WriteJSON(FILE* pFile, const char* pszIndent) const
+	{
+	fprintf(pFile, "{\n");
+	fprintf(pFile, "%s\t\"workers\": %u,\n", pszIndent, m_uiNumWorkers);
+	fprintf(pFile, "%s\t\"wall_ms\": %.4f,\n", pszIndent, GetWallMS());
+	fprintf(pFile, "%s\t\"work_ms\": %.4f,\n", pszIndent, GetWorkMS());
+	fprintf(pFile, "%s\t\"assets\": [", pszIndent);
+
+	bool bFirst = true;
+	for(unsigned int i = 0; i < LOADER_MAX_ASSETS; ++i)
+		{
+		const AssetTiming& Timing = m_aTimings[i];
+		if(!Timing.pszName)
+			continue;
+
+		fprintf(pFile, "%s\n%s\t\t{ \"name\": \"%s\", \"thread\": %d, \"queued\": %.4f, \"start\": %.4f, \"end\": %.4f, \"upload_start\": %.4f, \"upload_end\": %.4f }",
+				bFirst ? "" : ",", pszIndent, Timing.pszName, Timing.nWorker,
+				Timing.dQueuedMS, Timing.dStartMS, Timing.dEndMS, Timing.dUploadStartMS, Timing.dUploadEndMS);
+		bFirst = false;
+		}
+
+	fprintf(pFile, "\n%s\t]\n%s}", pszIndent, pszIndent);
+	}
+
+// Everything the loader fetches, by ID
+enum enumASSET
+	{
+	enumASSET_Scene,												// The POD. Submits the meshes when it's done.
+	enumASSET_Mesh,													// + mesh index
+	enumASSET_Texture	= enumASSET_Mesh + SCENE_MAX_MESHES,		// + enumTEXTURE
+	enumASSET_Shaders	= enumASSET_Texture + enumTEXTURE_MAX,		// Compiled on the GL thread in InitView
+	enumASSET_MAX,
+	};
+
+// A mesh's GPU-ready buffers, built off the GL thread
+struct MeshPayload
+	{
+	CompactVertexFormat	Format;
+	unsigned char*		pVertices;
+	unsigned int		uiVertexBytes;
+	unsigned short*		puIndices;
+	unsigned int		uiNumIndices;
+	short*				pnDepthVertices;
+	unsigned int		uiDepthVertexBytes;
+	unsigned short*		puDepthIndices;
+	unsigned int		uiDepthNumIndices;
+	};
+
+// ---------------------------------------------------------- BLOOM
+// One level of the bloom pyramid
+struct BloomLevel
+	{
+	GLuint				uiTexture;
+	int					nWidth;							// Of the allocation the frame graph put it in. Square unless it's shared.
+	int					nHeight;
+	int					nActive;						// Width and height of the corner in use, see ApplyDynamicResolution
+	};
+
+const char* c_pszBloomTargets[BLOOM_MAX_LEVELS] = { "bloom0", "bloom1", "bloom2", "bloom3", "bloom4", "bloom5" };
+const char* c_pszBloomDownPasses[BLOOM_MAX_LEVELS] = { NULL, "bloom_down1", "bloom_down2", "bloom_down3", "bloom_down4", "bloom_down5" };
+const char* c_pszBloomUpPasses[BLOOM_MAX_LEVELS] = { "bloom_up0", "bloom_up1", "bloom_up2", "bloom_up3", "bloom_up4", NULL };
+
+// Separable Gaussian with neighbouring texels paired up, so one bilinear fetch samples both in the right ratio
+struct BloomKernel
+	{
+	float				fSigma;
+	unsigned int		uiNumTaps;						// Taps either side of the centre that have any weight
+	float				afTaps[BLOOM_MAX_TAPS * 2];		// Offset (in texels) and weight pairs. The first is the centre texel.
+	};
+
+// Where a frame's bloom works, from GetBloomRegions
+struct BloomRegions
+	{
+	PixelRect			aRects[BLOOM_MAX_LEVELS];		// Each level's working area
+	PixelRect			Composite;						// The part of the scene it's added to
+	PVRTVec2			vCompositeTTL;					// The top level's texture coordinates at the composite's corners
+	PVRTVec2			vCompositeTBR;
+	PVRTMat4			mxCrop;							// Narrows the camera's projection to aRects[0]
+	};
+
+// ---------------------------------------------------------------
+void GenerateBloomKernel(float fSigma, BloomKernel* pKernel)
+	{
+	// Discrete weights out to 3 sigma, or as far as the taps reach
+	const int nMaxRadius = 2 * (BLOOM_MAX_TAPS - 1);
+	int nRadius = PVRT_MIN((int)ceil(fSigma * 3.0f), nMaxRadius);
+
+	float afWeights[nMaxRadius + 1];
+	float fTotal = 0.0f;
+	for(int i = 0; i <= nMaxRadius; ++i)
+		{
+		afWeights[i] = i <= nRadius ? (float)exp(-(i * i) / (2.0f * fSigma * fSigma)) : 0.0f;
+		fTotal += i ? 2.0f * afWeights[i] : afWeights[i];
+		}
+	for(int i = 0; i <= nMaxRadius; ++i)
+		afWeights[i] /= fTotal;
+
+	pKernel->fSigma		= fSigma;
+	pKernel->uiNumTaps	= 0;
+	pKernel->afTaps[0]	= 0.0f;
+	pKernel->afTaps[1]	= afWeights[0];
+	for(unsigned int t = 1; t < BLOOM_MAX_TAPS; ++t)
+		{
+		int n1 = 2 * t - 1, n2 = 2 * t;
+		float fWeight = afWeights[n1] + afWeights[n2];
+		pKernel->afTaps[t * 2]		= fWeight > 0.0f ? (n1 * afWeights[n1] + n2 * afWeights[n2]) / fWeight : 0.0f;
+		pKernel->afTaps[t * 2 + 1]	= fWeight;
+		if(fWeight > 0.0f)
+			pKernel->uiNumTaps = t;
+		}
+	}
+
+// ---------------------------------------------------------- DYNAMIC RESOLUTION
+#define DYNRES_DEFAULT_BUDGET_MS	(1000.0f / 60.0f)
+#define DYNRES_WINDOW				30			// Frames averaged for each decision
+#define DYNRES_HEADROOM				0.8f		// Fraction of the budget a window has to come in under before scaling back up
+#define DYNRES_STEP					0.125f
+#define DYNRES_MIN_SCALE			0.5f
+
+// In the order they're given up when over budget
+enum enumDYNRES
+	{
+	enumDYNRES_Bloom,
+	enumDYNRES_Shadow,
+	enumDYNRES_Scene,
+	enumDYNRES_MAX,
+	};
+
+const char* c_pszDynResTargets[] =
+	{
+	"bloom",				// enumDYNRES_Bloom
+	"shadow",				// enumDYNRES_Shadow
+	"scene",				// enumDYNRES_Scene
+	};
+
+#ifndef GL_DEPTH_COMPONENT24_OES
+#define GL_DEPTH_COMPONENT24_OES			0x81A6
+#endif
+
+// Picks a resolution scale for each offscreen target to keep the frame time within a budget
+class CDynamicResolution
+	{
+	private:
+		float					m_fBudgetMS;
+		float					m_afScale[enumDYNRES_MAX];
+		bool					m_abEnabled[enumDYNRES_MAX];
+		float					m_fWindowMS;
+		unsigned int			m_uiWindowFrames;
+		unsigned int			m_uiChanges;
+
+	public:
+		CDynamicResolution() { Init(DYNRES_DEFAULT_BUDGET_MS, false); }
+
+		void Init(float fBudgetMS, bool bScene);
+		bool Update(float fFrameMS);
+
+		float GetScale(enumDYNRES eTarget) const	{ return m_afScale[eTarget]; }
+		float GetBudgetMS() const					{ return m_fBudgetMS; }
+		unsigned int GetChanges() const				{ return m_uiChanges; }
+	};
+
+// ---------------------------------------------------------------
+void CDynamicResolution::Init(float fBudgetMS, bool bScene)
+	{
+	m_fBudgetMS = fBudgetMS;
+	for(int i = 0; i < enumDYNRES_MAX; ++i)
+		{
+		m_afScale[i]	= 1.0f;
+		m_abEnabled[i]	= i != enumDYNRES_Scene || bScene;
+		}
+	m_fWindowMS			= 0.0f;
+	m_uiWindowFrames	= 0;
+	m_uiChanges			= 0;
+	}
+
+// ---------------------------------------------------------------
+// Returns true when one of the scales has changed
+bool CDynamicResolution::Update(float fFrameMS)
+	{
+	m_fWindowMS += fFrameMS;
+	if(++m_uiWindowFrames < DYNRES_WINDOW)
+		return false;
+
+	// A fresh window after every decision, so the next one only sees frames at the new scale
+	float fAverageMS = m_fWindowMS / m_uiWindowFrames;
+	m_fWindowMS			= 0.0f;
+	m_uiWindowFrames	= 0;
+
+	if(fAverageMS > m_fBudgetMS)
+		{
+		// Over budget: one step down on the first target with any left to give
+		for(int i = 0; i < enumDYNRES_MAX; ++i)
+			{
+			if(m_abEnabled[i] && m_afScale[i] > DYNRES_MIN_SCALE)
+				{
+				m_afScale[i] = PVRT_MAX(m_afScale[i] - DYNRES_STEP, DYNRES_MIN_SCALE);
+				++m_uiChanges;
+				return true;
+				}
+			}
+		}
+	else if(fAverageMS < m_fBudgetMS * DYNRES_HEADROOM)
+		{
+		// Comfortably under: restore them in the opposite order
+		for(int i = enumDYNRES_MAX - 1; i >= 0; --i)
+			{
+			if(m_abEnabled[i] && m_afScale[i] < 1.0f)
+				{
+				m_afScale[i] = PVRT_MIN(m_afScale[i] + DYNRES_STEP, 1.0f);
+				++m_uiChanges;
+				return true;
+				}
+			}
+		}
+	return false;
+	}
+
+// ---------------------------------------------------------- SHADOW FITTING
+#define SHADOW_FIT_FOV			(PVRT_PI / 2)		// The fitted frustum is cropped out of this. It only has to take in the statue.
+#define SHADOW_FIT_MARGIN		2					// Texels left clear around the edge, so clamped lookups past it read as lit
+#define SHADOW_FIT_SIZE_STEP	(2.0f / 64.0f)		// The fitted size is rounded up to this, in the uncropped projection's clip space
+#define SHADOW_FIT_MAX_VERTS	16					// A quad clipped by five planes has at most nine
+
+// ---------------------------------------------------------------
+// The left, right, bottom and top planes of a view-projection's frustum, as (a, b, c, d) with ax + by + cz + d >= 0 inside
+void GetFrustumSidePlanes(const PVRTMat4& mxViewProj, PVRTVec4* pPlanes)
+	{
+	const float* f = mxViewProj.f;			// Column major
+	for(int i = 0; i < 4; ++i)
+		{
+		int nRow = i >> 1;
+		float fSign = (i & 1) ? -1.0f : 1.0f;
+		pPlanes[i] = PVRTVec4(f[3] + fSign * f[nRow], f[7] + fSign * f[4 + nRow], f[11] + fSign * f[8 + nRow], f[15] + fSign * f[12 + nRow]);
+		}
+	}
+
+// ---------------------------------------------------------------
+// Clips a convex polygon to the inside of a plane (Sutherland-Hodgman) and returns the number of vertices left
+unsigned int ClipPolygon(const PVRTVec3* pIn, unsigned int uiNumIn, const PVRTVec4& vPlane, PVRTVec3* pOut)
+	{
+	unsigned int uiNumOut = 0;
+	for(unsigned int i = 0; i < uiNumIn; ++i)
+		{
+		const PVRTVec3& vA = pIn[i];
+		const PVRTVec3& vB = pIn[(i + 1) % uiNumIn];
+		float fA = vPlane.x * vA.x + vPlane.y * vA.y + vPlane.z * vA.z + vPlane.w;
+		float fB = vPlane.x * vB.x + vPlane.y * vB.y + vPlane.z * vB.z + vPlane.w;
+		if(fA >= 0.0f)
+			pOut[uiNumOut++] = vA;
+		if((fA >= 0.0f) != (fB >= 0.0f))
+			pOut[uiNumOut++] = vA + (vB - vA) * (fA / (fA - fB));
+		}
+	ASSERT(uiNumOut <= SHADOW_FIT_MAX_VERTS);
+	return uiNumOut;
+	}
+
+// ---------------------------------------------------------- REFLECTION
+// ---------------------------------------------------------------
+// Moves a projection's near plane onto an arbitrary plane, given in view space with the camera on its negative side.
+// Geometry behind the plane is then clipped for free, which ES2 has no user clip planes for. The projection has to have
+// a finite far plane. See Lengyel, "Oblique View Frustum Depth Projection and Clipping".
+PVRTMat4 ObliqueClipProjection(const PVRTMat4& mxProj, const PVRTVec4& vPlane)
+	{
+	// The plane in clip space, and the corner of the frustum furthest from it
+	PVRTMat4 mxInvProj = mxProj.inverseEx();
+	const float* fi = mxInvProj.f;			// Column major
+	float fClipX = fi[0] * vPlane.x + fi[1] * vPlane.y + fi[2] * vPlane.z + fi[3] * vPlane.w;
+	float fClipY = fi[4] * vPlane.x + fi[5] * vPlane.y + fi[6] * vPlane.z + fi[7] * vPlane.w;
+	PVRTVec4 vCorner = mxInvProj * PVRTVec4(fClipX >= 0.0f ? 1.0f : -1.0f, fClipY >= 0.0f ? 1.0f : -1.0f, 1.0f, 1.0f);
+
+	// Replace the z row so the plane maps to -1 and the far corner stays at 1
+	PVRTMat4 mxOblique = mxProj;
+	float* f = mxOblique.f;
+	PVRTVec4 vRowW(f[3], f[7], f[11], f[15]);
+	float fScale = 2.0f * vRowW.dot(vCorner) / vPlane.dot(vCorner);
+	f[2]	= vPlane.x * fScale - vRowW.x;
+	f[6]	= vPlane.y * fScale - vRowW.y;
+	f[10]	= vPlane.z * fScale - vRowW.z;
+	f[14]	= vPlane.w * fScale - vRowW.w;
+	return mxOblique;
+	}
+
+// ---------------------------------------------------------- PROGRAM CACHE
+#define PROGRAM_CACHE_MAGIC			0x50524743		// 'CGRP'
+#define PROGRAM_CACHE_VERSION		1
+#define PROGRAM_CACHE_DEFAULT_FILE	"programcache.bin"
+
+// OES_get_program_binary. Declared here as older gl2ext.h headers don't include it.
+#ifndef GL_PROGRAM_BINARY_LENGTH_OES
+#define GL_PROGRAM_BINARY_LENGTH_OES		0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS_OES
+#define GL_NUM_PROGRAM_BINARY_FORMATS_OES	0x87FE
+#endif
+typedef void (GL_APIENTRYP PFNDEMOGETPROGRAMBINARYPROC) (GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, GLvoid* binary);
+typedef void (GL_APIENTRYP PFNDEMOPROGRAMBINARYPROC) (GLuint program, GLenum binaryFormat, const GLvoid* binary, GLint length);
+
+struct ProgramCacheHeader
+	{
+	unsigned int		uiMagic;
+	unsigned int		uiVersion;
+	unsigned int		uiNumEntries;
+	unsigned int		uiReserved;
+	};
+
+struct ProgramCacheEntry	// Followed by uiSize bytes of program binary
+	{
+	unsigned long long	ullKey;
+	unsigned int		uiFormat;
+	unsigned int		uiSize;
+	};
+
+// ---------------------------------------------------------------
+unsigned long long HashBytes(unsigned long long ullHash, const void* pData, size_t uiSize)
+	{
+	// 64 bit FNV-1a
+	const unsigned char* pByte = (const unsigned char*)pData;
+	for(size_t i = 0; i < uiSize; ++i)
+		{
+		ullHash ^= pByte[i];
+		ullHash *= 0x100000001b3ULL;
+		}
+	return ullHash;
+	}
+
+// ---------------------------------------------------------------
+unsigned long long HashString(unsigned long long ullHash, const char* pszString)
+	{
+	// Include the terminator so that "ab" + "c" and "a" + "bc" differ
+	return pszString ? HashBytes(ullHash, pszString, strlen(pszString) + 1) : HashBytes(ullHash, "", 1);
+	}
+
+// ---------------------------------------------------------------
+CPVRTString GetDriverString()
+	{
+	CPVRTString Driver;
+	const GLenum aeStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for(unsigned int i = 0; i < ELEMENTS_IN_ARRAY(aeStrings); ++i)
+		{
+		const char* pszString = (const char*)glGetString(aeStrings[i]);
+		Driver += pszString ? pszString : "";
+		Driver += "|";
+		}
+	return Driver;
+	}
+
+// ---------------------------------------------------------------
+unsigned long long HashEffect(const EffectDesc& Effect, const CPVRTString& Driver)
+	{
+	// Everything that goes into the linked program. Returns 0 if a source file is missing, so it won't be cached.
+	unsigned long long ullHash = HashString(0xcbf29ce484222325ULL, Driver.c_str());
+
+	const char* apszSources[] = { Effect.pszVertSrc, Effect.pszFragSrc };
+	for(unsigned int i = 0; i < ELEMENTS_IN_ARRAY(apszSources); ++i)
+		{
+		CPVRTResourceFile File(StripFolder(apszSources[i]));
+		if(!File.IsOpen())
+			return 0;
+		ullHash = HashBytes(ullHash, File.DataPtr(), File.Size());
+		ullHash = HashBytes(ullHash, "", 1);
+		}
+
+	for(unsigned int i = 0; i < Effect.uiNumDefines; ++i)
+		ullHash = HashString(ullHash, Effect.ppszDefines[i]);
+	ullHash = HashBytes(ullHash, "", 1);
+	for(unsigned int i = 0; i < Effect.uiNumAttribs; ++i)
+		ullHash = HashString(ullHash, Effect.ppszAttribs[i]);
+
+	return ullHash ? ullHash : 1;
+	}
+
+// Linked program binaries from earlier runs, so warm starts can skip compiling and linking
+class CProgramCache
+	{
+	private:
+		struct CachedProgram
+			{
+			unsigned long long	ullKey;
+			GLenum				eFormat;
+			unsigned int		uiSize;
+			unsigned char*		pData;
+			};
+
+		CPVRTArray<CachedProgram>		m_Programs;
+		PFNDEMOGETPROGRAMBINARYPROC		m_pfnGetProgramBinary;
+		PFNDEMOPROGRAMBINARYPROC		m_pfnProgramBinary;
+		bool							m_bDirty;
+
+		int Find(unsigned long long ullKey) const;
+		void Clear();
+
+	public:
+		CProgramCache() : m_pfnGetProgramBinary(NULL), m_pfnProgramBinary(NULL), m_bDirty(false) {}
+		~CProgramCache();
+
+		bool Init();
+		bool Read(const char* pszFilename);
+		bool Write(const char* pszFilename) const;
+		GLuint Load(unsigned long long ullKey);
+		void Store(unsigned long long ullKey, GLuint uiProgram);
+		bool IsDirty() const { return m_bDirty; }
+	};
+
+// ---------------------------------------------------------------
+CProgramCache::~CProgramCache()
+	{
+	Clear();
+	}
+
+// ---------------------------------------------------------------
+void CProgramCache::Clear()
+	{
+	for(unsigned int i = 0; i < m_Programs.GetSize(); ++i)
+		delete [] m_Programs[i].pData;
+	m_Programs.Clear();
+	}
+
+// ---------------------------------------------------------------
+bool CProgramCache::Init()
+	{
+	if(!CPVRTgles2Ext::IsGLExtensionSupported("GL_OES_get_program_binary"))
+		return false;
+
+	// The extension can be exposed with no formats at all
+	GLint nFormats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &nFormats);
+	if(nFormats <= 0)
+		return false;
+
+	m_pfnGetProgramBinary	= (PFNDEMOGETPROGRAMBINARYPROC)eglGetProcAddress("glGetProgramBinaryOES");
+	m_pfnProgramBinary		= (PFNDEMOPROGRAMBINARYPROC)eglGetProcAddress("glProgramBinaryOES");
+	return m_pfnGetProgramBinary && m_pfnProgramBinary;
+	}
+
+// ---------------------------------------------------------------
+int CProgramCache::Find(unsigned long long ullKey) const
+	{
+	for(unsigned int i = 0; i < m_Programs.GetSize(); ++i)
+		{
+		if(m_Programs[i].ullKey == ullKey)
+			return (int)i;
+		}
+	return -1;
+	}
+
+// ---------------------------------------------------------------
+bool CProgramCache::Read(const char* pszFilename)
+	{
+	FILE* pFile = fopen(pszFilename, "rb");
+	if(!pFile)
+		return false;
+
+	// The sizes are checked against what's left of the file before anything is allocated for them
+	long lFileSize = fseek(pFile, 0, SEEK_END) == 0 ? ftell(pFile) : -1;
+	rewind(pFile);
+
+	ProgramCacheHeader Header;
+	bool bResult = lFileSize > 0 && fread(&Header, sizeof(Header), 1, pFile) == 1 && Header.uiMagic == PROGRAM_CACHE_MAGIC &&
+				   Header.uiVersion == PROGRAM_CACHE_VERSION;
+	for(unsigned int i = 0; bResult && i < Header.uiNumEntries; ++i)
+		{
+		ProgramCacheEntry Entry;
+		if(fread(&Entry, sizeof(Entry), 1, pFile) != 1)
+			break;
+
+		// A size that runs past the end means the file is corrupt rather than cut short, so none of it is trusted
+		long lRemaining = lFileSize - ftell(pFile);
+		if(lRemaining < 0 || Entry.uiSize > (unsigned long)lRemaining)
+			{
+			Clear();
+			bResult = false;
+			break;
+			}
+
+		CachedProgram Program;
+		Program.ullKey	= Entry.ullKey;
+		Program.eFormat	= (GLenum)Entry.uiFormat;
+		Program.uiSize	= Entry.uiSize;
+		Program.pData	= new unsigned char[Entry.uiSize];
+		if(fread(Program.pData, 1, Entry.uiSize, pFile) != Entry.uiSize)
+			{
+			// Truncated; keep the entries before it
+			delete [] Program.pData;
+			break;
+			}
+		m_Programs.Append(Program);
+		}
+
+	fclose(pFile);
+	return bResult;
+	}
+
+// ---------------------------------------------------------------
+bool CProgramCache::Write(const char* pszFilename) const
+	{
+	FILE* pFile = fopen(pszFilename, "wb");
+	if(!pFile)
+		return false;
+
+	ProgramCacheHeader Header;
+	Header.uiMagic		= PROGRAM_CACHE_MAGIC;
+	Header.uiVersion	= PROGRAM_CACHE_VERSION;
+	Header.uiNumEntries	= m_Programs.GetSize();
+	Header.uiReserved	= 0;
+
+	bool bResult = fwrite(&Header, sizeof(Header), 1, pFile) == 1;
+	for(unsigned int i = 0; bResult && i < m_Programs.GetSize(); ++i)
+		{
+		ProgramCacheEntry Entry;
+		Entry.ullKey	= m_Programs[i].ullKey;
+		Entry.uiFormat	= (unsigned int)m_Programs[i].eFormat;
+		Entry.uiSize	= m_Programs[i].uiSize;
+		bResult &= fwrite(&Entry, sizeof(Entry), 1, pFile) == 1;
+		bResult &= fwrite(m_Programs[i].pData, 1, Entry.uiSize, pFile) == Entry.uiSize;
+		}
+
+	fclose(pFile);
+	return bResult;
+	}
+
+// ---------------------------------------------------------------
+GLuint CProgramCache::Load(unsigned long long ullKey)
+	{
+	int nIdx = Find(ullKey);
+	if(nIdx < 0)
+		return 0;
+
+	const CachedProgram& Program = m_Programs[nIdx];
+	GLuint uiProgram = glCreateProgram();
+	m_pfnProgramBinary(uiProgram, Program.eFormat, Program.pData, (GLint)Program.uiSize);
+
+	// A driver update can make the binary unusable even though the key matched. The caller compiles from source and replaces it.
+	GLint nLinked = 0;
+	glGetProgramiv(uiProgram, GL_LINK_STATUS, &nLinked);
+	if(!nLinked)
+		{
+		glDeleteProgram(uiProgram);
+		return 0;
+		}
+
+	return uiProgram;
+	}
+
+// ---------------------------------------------------------------
+void CProgramCache::Store(unsigned long long ullKey, GLuint uiProgram)
+	{
+	GLint nLength = 0;
+	glGetProgramiv(uiProgram, GL_PROGRAM_BINARY_LENGTH_OES, &nLength);
+	if(nLength <= 0)
+		return;
+
+	CachedProgram Program;
+	Program.ullKey	= ullKey;
+	Program.eFormat	= 0;
+	Program.pData	= new unsigned char[nLength];
+
+	GLsizei nWritten = 0;
+	m_pfnGetProgramBinary(uiProgram, nLength, &nWritten, &Program.eFormat, Program.pData);
+	if(nWritten <= 0)
+		{
+		delete [] Program.pData;
+		return;
+		}
+	Program.uiSize = (unsigned int)nWritten;
+
+	int nIdx = Find(ullKey);
+	if(nIdx >= 0)
+		{
+		delete [] m_Programs[nIdx].pData;
+		m_Programs[nIdx] = Program;
+		}
+	else
+		{
+		m_Programs.Append(Program);
+		}
+	m_bDirty = true;
+	}
+
+// ---------------------------------------------------------- SHADOW UPDATES
+// Decides whether the shadow map needs rendering this frame. Anything that would change its contents goes into a hash,
+// so a frame whose light, projection and casters all match the last rendered one reuses the map as it is. On top of that
+// a refresh policy can let it go stale for a while when something has changed: until a number of frames have passed, or
+// until the light has turned through a given angle. With neither set it refreshes on every change. The demo's light never
+// stops orbiting, so without a policy the hash never matches, and the scheduler is only used when asked for.
+class CShadowScheduler
+	{
+	private:
+		unsigned int			m_uiInterval;				// Frames between refreshes while something is changing, or 0
+		float					m_fMaxAngle;				// Radians the light can turn before a refresh, or 0
+		bool					m_bValid;					// The map holds a render from m_ullHash
+		unsigned long long		m_ullHash;
+		int						m_nMapSize;					// Of the last render
+		PVRTVec3				m_vLightDir;				// At the last refresh
+		unsigned int			m_uiFramesSince;
+		unsigned int			m_uiRendered;
+		unsigned int			m_uiSkipped;
+
+	public:
+		CShadowScheduler() : m_uiInterval(0), m_fMaxAngle(0.0f), m_bValid(false), m_ullHash(0), m_nMapSize(0), m_vLightDir(0.0f, 0.0f, 0.0f),
+			m_uiFramesSince(0), m_uiRendered(0), m_uiSkipped(0) {}
+
+		void SetPolicy(unsigned int uiInterval, float fMaxAngle)	{ m_uiInterval = uiInterval; m_fMaxAngle = fMaxAngle; }
+		void Invalidate()											{ m_bValid = false; }
+		void ResetCounters()										{ m_uiRendered = m_uiSkipped = 0; }
+		bool Update(const PVRTMat4& mxLightView, const PVRTMat4& mxLightProj, const PVRTMat4* pCasters, unsigned int uiNumCasters,
+					const PVRTVec3& vLightDir, int nMapSize);
+
+		unsigned int GetRendered() const	{ return m_uiRendered; }
+		unsigned int GetSkipped() const		{ return m_uiSkipped; }
+	};
+
+// ---------------------------------------------------------------
+// Returns true if the shadow map should be rendered
+bool CShadowScheduler::Update(const PVRTMat4& mxLightView, const PVRTMat4& mxLightProj, const PVRTMat4* pCasters, unsigned int uiNumCasters,
+							  const PVRTVec3& vLightDir, int nMapSize)
+	{
+	unsigned long long ullHash = 0xcbf29ce484222325ULL;
+	ullHash = HashBytes(ullHash, mxLightView.f, sizeof(mxLightView.f));
+	ullHash = HashBytes(ullHash, mxLightProj.f, sizeof(mxLightProj.f));
+	for(unsigned int i = 0; i < uiNumCasters; ++i)
+		ullHash = HashBytes(ullHash, pCasters[i].f, sizeof(pCasters[i].f));
+	ullHash = HashBytes(ullHash, &nMapSize, sizeof(nMapSize));
+
+	++m_uiFramesSince;
+	bool bRender;
+	if(m_bValid && ullHash == m_ullHash)
+		bRender = false;
+	else if(!m_bValid || nMapSize != m_nMapSize || (!m_uiInterval && m_fMaxAngle <= 0.0f))
+		bRender = true;					// A resize leaves the old render in the wrong corner of the texture, so it's never put off
+	else
+		{
+		float fCos = PVRT_CLAMP(vLightDir.dot(m_vLightDir), -1.0f, 1.0f);
+		bRender = (m_uiInterval && m_uiFramesSince >= m_uiInterval) || (m_fMaxAngle > 0.0f && (float)acos(fCos) >= m_fMaxAngle);
+		}
+
+	if(!bRender)
+		{
+		++m_uiSkipped;
+		return false;
+		}
+
+	m_bValid		= true;
+	m_ullHash		= ullHash;
+	m_nMapSize		= nMapSize;
+	m_vLightDir		= vLightDir;
+	m_uiFramesSince	= 0;
+	++m_uiRendered;
+	return true;
+	}
+
+// ---------------------------------------------------------- FRAME GRAPH
+// The demo's passes and targets in the frame graph, FG_NONE for any it doesn't declare
+struct FrameGraphIDs
+	{
+	unsigned int		uiShadowPass;
+	unsigned int		uiReflPass;
+	unsigned int		uiScenePass;
+	unsigned int		uiBloomExtractPass;
+	unsigned int		auiBloomDownPass[BLOOM_MAX_LEVELS];		// Into each level below the top
+	unsigned int		uiBloomBlurHPass;
+	unsigned int		uiBloomBlurVPass;
+	unsigned int		auiBloomUpPass[BLOOM_MAX_LEVELS];		// Into each level above the bottom
+	unsigned int		uiCompositePass;
+	unsigned int		uiUpscalePass;
+
+	unsigned int		uiScreen;
+	unsigned int		uiScreenDepth;
+	unsigned int		uiShadowMap;
+	unsigned int		uiReflColour;
+	unsigned int		uiReflDepth;
+	unsigned int		uiSceneColour;							// The reduced resolution scene, see BuildFrameGraph
+	unsigned int		uiSceneDepth;
+	unsigned int		auiBloom[BLOOM_MAX_LEVELS];
+	unsigned int		uiBloomScratch;
+	unsigned int		uiBloomDepth;
+	};
+
+// ---------------------------------------------------------- CROWD
+// Stress mode: copies of the statue spread over the floor, to find where the CPU and the driver stop keeping up as the
+// number of statues grows. A statue is placed by a single vec4: x and z on the floor, a turn about Y and a scale.
+#define CROWD_SPACING			1.25f		// Distance between neighbours, in statue diameters
+#define CROWD_MAX_STEPS			16
+#define CROWD_SWEEP_SETTLE		5			// Frames at the start of each sweep step left out of its stats
+#define CROWD_KEY_DEPTH_SCALE	16.0f		// Sort keys are the view depth in 1/16ths in the top 16 bits, and the statue in the bottom 16
+#define CROWD_KEY_INDEX_BITS	16
+#define CROWD_KEY_INDEX_MASK	((1u << CROWD_KEY_INDEX_BITS) - 1)
+#define CROWD_KEY_CULLED		0xFFFFFFFF
+
+// Every statue index has to fit under the depth, or statues past the mask would be decoded as others
+typedef char CrowdKeyIndexFits[CROWD_MAX_INSTANCES <= (1u << CROWD_KEY_INDEX_BITS) ? 1 : -1];
+
+enum enumCROWD
+	{
+	enumCROWD_Single,			// A draw and a set of uniforms per statue, as RecordStatue does
+	enumCROWD_Palette,			// Batches of statues per draw, placed from a uniform array
+	enumCROWD_Instanced,		// One instanced draw, placed from a per-instance attribute
+	enumCROWD_MAX,
+	};
+
+const char* c_pszCrowdPaths[] =
+	{
+	"single",
+	"palette",
+	"instanced",
+	};
+
+// One step of the -crowdsweep benchmark
+struct CrowdStep
+	{
+	unsigned int		uiCount;			// Statues
+	unsigned int		uiVisible;			// Per frame
+	unsigned int		uiDraws;			// Per frame
+	unsigned int		uiVertices;			// Per frame
+	};
+
+// EXT_instanced_arrays and ANGLE_instanced_arrays. Declared here as older gl2ext.h headers don't include them.
+typedef void (GL_APIENTRYP PFNDEMODRAWELEMENTSINSTANCEDPROC) (GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei primcount);
+typedef void (GL_APIENTRYP PFNDEMOVERTEXATTRIBDIVISORPROC) (GLuint index, GLuint divisor);
+
+// ---------------------------------------------------------------
+// Lays uiCount statues of radius fRadius out on a square grid about the origin, leaving the middle to the real statue. The
+// grid is shrunk, statues and all, to fit inside the floor's bounds. Each statue comes out as (x, z, yaw, scale).
+void PlaceCrowd(PVRTVec4* pvInstances, unsigned int uiCount, float fRadius, const PVRTVec3& vFloorMin, const PVRTVec3& vFloorMax)
+	{
+	// Cells within half a cell of the origin are left out: one when the side's odd, four when it's even
+	unsigned int uiSide = 1;
+	while(uiSide * uiSide - ((uiSide & 1) ? 1 : 4) < uiCount)
+		++uiSide;
+
+	float fSpacing = 2.0f * fRadius * CROWD_SPACING;
+	float fHalfWidth = (uiSide - 1) * 0.5f * fSpacing + fRadius;
+	float fFloor = PVRT_MIN(PVRT_MIN(-vFloorMin.x, vFloorMax.x), PVRT_MIN(-vFloorMin.z, vFloorMax.z));
+	float fScale = (fFloor > 0.0f && fFloor < fHalfWidth) ? fFloor / fHalfWidth : 1.0f;
+
+	unsigned int uiPlaced = 0;
+	for(unsigned int z = 0; z < uiSide && uiPlaced < uiCount; ++z)
+		{
+		for(unsigned int x = 0; x < uiSide && uiPlaced < uiCount; ++x)
+			{
+			float fX = x - (uiSide - 1) * 0.5f, fZ = z - (uiSide - 1) * 0.5f;
+			if(fabs(fX) <= 0.5f && fabs(fZ) <= 0.5f)
+				continue;
+
+			// Hash the index for the yaw, so the statues don't all face the same way but every run is the same
+			unsigned int uiHash = (uiPlaced + 1) * 2654435761u;
+			float fYaw = (uiHash >> 8) * (PVRT_TWO_PI / 16777216.0f);
+			pvInstances[uiPlaced++] = PVRTVec4(fX * fSpacing * fScale, fZ * fSpacing * fScale, fYaw, fScale);
+			}
+		}
+	}
+
+// ---------------------------------------------------------------
+// What the crowd's per-frame update reads and writes. The render thread fills it in, the job system runs UpdateCrowd
+// over the statues, then the render thread sorts the keys and draws.
+struct CrowdUpdate
+	{
+	const PVRTVec4*		pvInstances;
+	PVRTMat4			mxCam;
+	PVRTMat4			mxProjection;
+	PVRTVec3			vLightPos;
+	PVRTVec4			avPlanes[6];		// The camera's, see GetFrustumPlanes
+	unsigned int		uiNumPlanes;		// 0 draws every statue
+	PVRTVec3			vCentre;			// The statue's bounding sphere, in its own space
+	float				fRadius;
+	unsigned int*		puKeys;				// Out. See CROWD_KEY_DEPTH_SCALE.
+	PVRTMat4*			pmxMVP;				// Out, unless NULL. Only the single path needs matrices per statue.
+	PVRTMat4*			pmxModelView;
+	PVRTVec3*			pvLightPos;			// Out. The light in each statue's space.
+	};
+
+// ---------------------------------------------------------------
+void UpdateCrowd(void* pUserData, unsigned int uiBegin, unsigned int uiEnd, unsigned int /*uiThread*/)
+	{
+	const CrowdUpdate& Update = *(const CrowdUpdate*)pUserData;
+	const float* fc = Update.mxCam.f;
+	for(unsigned int i = uiBegin; i < uiEnd; ++i)
+		{
+		// Turn about Y, scale, then move across the floor, as StatueShader.vsh does
+		const PVRTVec4& vInstance = Update.pvInstances[i];
+		float fSin = (float)sin(vInstance.z), fCos = (float)cos(vInstance.z), fScale = vInstance.w;
+		PVRTVec3 vOffset(vInstance.x, 0.0f, vInstance.y);
+		const PVRTVec3& c = Update.vCentre;
+		PVRTVec3 vCentre = PVRTVec3(fCos * c.x + fSin * c.z, c.y, fCos * c.z - fSin * c.x) * fScale + vOffset;
+
+		bool bVisible = true;
+		for(unsigned int p = 0; p < Update.uiNumPlanes && bVisible; ++p)
+			{
+			const PVRTVec4& vPlane = Update.avPlanes[p];
+			bVisible = vPlane.x * vCentre.x + vPlane.y * vCentre.y + vPlane.z * vCentre.z + vPlane.w >= -Update.fRadius * fScale;
+			}
+		if(!bVisible)
+			{
+			Update.puKeys[i] = CROWD_KEY_CULLED;
+			continue;
+			}
+
+		float fDepth = -(fc[2] * vCentre.x + fc[6] * vCentre.y + fc[10] * vCentre.z + fc[14]);
+		unsigned int uiDepth = (unsigned int)PVRT_CLAMP(fDepth * CROWD_KEY_DEPTH_SCALE, 0.0f, 65534.0f);
+		Update.puKeys[i] = (uiDepth << CROWD_KEY_INDEX_BITS) | i;
+
+		if(Update.pmxMVP)
+			{
+			// Translation * RotationY * Scale, written out
+			PVRTMat4 mxWorld(fCos * fScale, 0.0f, -fSin * fScale, 0.0f,
+							 0.0f, fScale, 0.0f, 0.0f,
+							 fSin * fScale, 0.0f, fCos * fScale, 0.0f,
+							 vOffset.x, 0.0f, vOffset.z, 1.0f);
+			Mat4Multiply(Update.pmxModelView[i], Update.mxCam, mxWorld);
+			Mat4Multiply(Update.pmxMVP[i], Update.mxProjection, Update.pmxModelView[i]);
+
+			PVRTVec3 vToLight = (Update.vLightPos - vOffset) / fScale;
+			Update.pvLightPos[i] = PVRTVec3(fCos * vToLight.x - fSin * vToLight.z, vToLight.y, fSin * vToLight.x + fCos * vToLight.z);
+			}
+		}
+	}
+
+// ---------------------------------------------------------------
+// Moves the visible statues' keys to the front of puKeys, sorted front to back, and returns how many there are
+unsigned int SortCrowdKeys(unsigned int* puKeys, unsigned int* puTemp, unsigned int uiCount)
+	{
+	unsigned int uiVisible = 0;
+	for(unsigned int i = 0; i < uiCount; ++i)
+		{
+		if(puKeys[i] != CROWD_KEY_CULLED)
+			puKeys[uiVisible++] = puKeys[i];
+		}
+
+	// Two 8 bit radix passes over the depth. The statue index under it needs no ordering.
+	unsigned int* apuFrom[2] = { puKeys, puTemp };
+	for(unsigned int uiPass = 0; uiPass < 2; ++uiPass)
+		{
+		const unsigned int* puSrc = apuFrom[uiPass];
+		unsigned int* puDst = apuFrom[uiPass ^ 1];
+		unsigned int uiShift = CROWD_KEY_INDEX_BITS + uiPass * 8;
+
+		unsigned int auiStart[256];
+		memset(auiStart, 0, sizeof(auiStart));
+		for(unsigned int i = 0; i < uiVisible; ++i)
+			++auiStart[(puSrc[i] >> uiShift) & 0xFF];
+		for(unsigned int b = 0, uiTotal = 0; b < 256; ++b)
+			{
+			unsigned int uiBucket = auiStart[b];
+			auiStart[b] = uiTotal;
+			uiTotal += uiBucket;
+			}
+		for(unsigned int i = 0; i < uiVisible; ++i)
+			puDst[auiStart[(puSrc[i] >> uiShift) & 0xFF]++] = puSrc[i];
+		}
+	return uiVisible;
+	}
+
+// ---------------------------------------------------------- SOFTWARE RASTERIZER
+// -softraster and -regress draw the frame with the CPU backend in SoftRaster.h, without a GL context.
+#define SOFT_DEFAULT_FRAMES		8
+#define SOFT_REPORT				"soft_raster.json"
+#define SOFT_IMAGE_NAME			"soft_frame%u.tga"
+
+typedef char SoftTexturesFit[SOFT_MAX_TEXTURES == CMD_TEXTURE_UNITS ? 1 : -1];		// A packet's every texture unit is drawn with
+typedef char SoftTapsMatch[SOFT_MAX_TAPS == BLOOM_MAX_TAPS ? 1 : -1];			// The blur's constants carry every tap
+
+// One of the buffers LoadVBOs gives GL, kept in memory instead. See LoadSoftMeshes.
+struct SoftBuffer
+	{
+	unsigned char*		pData;
+	unsigned int		uiSize;
+	};
+
+#define SOFT_MESH_BUFFERS		(enumPACKAGE_DepthIndices - enumPACKAGE_Vertices + 1)
+
+// The demo's targets, for the CPU
+struct SoftTargets
+	{
+	SoftTexture			Scene;
+	SoftTexture			SceneDepth;
+	SoftTexture			ShadowMap;
+	SoftTexture			Reflection;
+	SoftTexture			ReflectionDepth;
+	SoftTexture			aBloom[BLOOM_MAX_LEVELS];
+	SoftTexture			BloomScratch;
+	SoftTexture			BloomDepth;
+	};
+
+// ---------------------------------------------------------- REGRESSION
+// -regress renders a scripted set of camera and light poses on the software rasterizer, which gives the same bits on any
+// thread count, and checks them against golden images kept with the budgets below. Images are compared by how different
+// they look rather than by their bits, so a sub-pixel edge shift or a rounding change from another compiler or SIMD path
+// doesn't fail the run while a lost shadow or a wrong blend does. Pass timings are only comparable on the machine that
+// recorded them, so budgets.txt starts with the machine it was recorded on, and its times are only held to on one that
+// matches. Elsewhere they're reported but skipped, and the images and counts are still checked.
+#define REGRESS_DEFAULT_DIR		"Golden/"		// Under the read path, next to the scene's other data
+#define REGRESS_IMAGE_NAME		"golden_frame%u.tga"
+#define REGRESS_BUDGETS			"budgets.txt"
+#define REGRESS_REPORT			"regress.json"
+#define REGRESS_OUTPUT_NAME		"regress_frame%u.tga"
+#define REGRESS_DIFF_NAME		"regress_diff%u.tga"
+#define REGRESS_RUNS			3				// The sweep is timed this many times, and each pass's best time kept
+#define REGRESS_PIXEL_TOLERANCE	0.04f			// How far a pixel may look from its golden, 1 being black to white
+#define REGRESS_AREA_TOLERANCE	0.001f			// Fraction of the image that may be further than that
+#define REGRESS_TIME_TOLERANCE	0.25f			// A pass may take this much longer than its budget...
+#define REGRESS_TIME_SLACK_MS	0.25f			// ...plus this, so the shortest passes aren't failed by timer noise
+#define REGRESS_MAX_BUDGETS		64
+#define REGRESS_MAX_NAME		64
+#define REGRESS_MACHINE_WRITE	"# Per frame, recorded by -regressrecord at %dx%d on %u threads (%u cores, %s)\n"
+#define REGRESS_MACHINE_READ	"# Per frame, recorded by -regressrecord at %dx%d on %u threads (%u cores, %15[^)])"
+
+// The path: the camera's turn and the light's, separately and together. The first is where InitApplication starts them.
+struct RegressPose
+	{
+	float	fAngleY;
+	float	fLightAngle;
+	};
+
+const RegressPose c_aRegressPoses[] =
+	{
+	{ 0.0f,						PVRT_PI / 8 },
+	{ PVRT_PI / 4,				PVRT_PI / 8 },
+	{ PVRT_PI_OVER_TWO,			PVRT_PI / 8 },
+	{ PVRT_PI,					PVRT_PI / 8 },
+	{ 0.0f,						PVRT_PI_OVER_TWO },
+	{ 0.0f,						PVRT_PI },
+	{ 0.0f,						PVRT_PI * 1.5f },
+	{ PVRT_PI * 1.25f,			PVRT_PI * 0.75f },
+	};
+
+// A number the run mustn't go over, as name and value. Pass times are "<pass>.ms" and draws "<pass>.draws", and the
+// command buffer's counts are "frame.<count>", all per frame.
+struct RegressBudget
+	{
+	char	szName[REGRESS_MAX_NAME];
+	float	fValue;
+	};
+
+// What the budgets' times were recorded on: the header line of budgets.txt
+struct RegressMachine
+	{
+	int				nWidth;
+	int				nHeight;
+	unsigned int	uiThreads;
+	unsigned int	uiCores;
+	char			szSIMD[16];
+	};
+
+// One of the run's numbers, against its budget
+struct RegressCheck
+	{
+	char					szName[REGRESS_MAX_NAME];
+	float					fValue;
+	const RegressBudget*	pBudget;			// NULL if the budgets don't have it, and it goes unchecked
+	bool					bSkipped;			// A time whose budget was recorded on another machine
+	bool					bPassed;
+	};
+
+// How one image compares with its golden
+struct RegressImageDiff
+	{
+	unsigned int	uiChanged;				// Pixels over REGRESS_PIXEL_TOLERANCE
+	float			fMaxDistance;
+	};
+
+// ---------------------------------------------------------------
+// For -regressrecord, so the goldens can go in a directory that isn't there yet. True if it's there afterwards.
+bool CreateRegressDir(const char* pszPath)
+	{
+#if defined(_WIN32)
+	return CreateDirectoryA(pszPath, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+	struct stat Stat;
+	return mkdir(pszPath, 0755) == 0 || (stat(pszPath, &Stat) == 0 && S_ISDIR(Stat.st_mode));
+#endif
+	}
+
+// ---------------------------------------------------------------
+// Reads an uncompressed 24 or 32 bit TGA, as WriteSoftTGA writes them, into level 0 of a target
+bool ReadSoftTGA(const char* pszPath, SoftTexture* pTexture)
+	{
+	FILE* pFile = fopen(pszPath, "rb");
+	if(!pFile)
+		return false;
+
+	unsigned char aucHeader[18];
+	bool bRead = fread(aucHeader, sizeof(aucHeader), 1, pFile) == 1 && aucHeader[1] == 0 && aucHeader[2] == 2 &&
+				 (aucHeader[16] == 24 || aucHeader[16] == 32) && fseek(pFile, aucHeader[0], SEEK_CUR) == 0;
+	if(!bRead)
+		{
+		fclose(pFile);
+		return false;
+		}
+
+	int nWidth = aucHeader[12] | (aucHeader[13] << 8);
+	int nHeight = aucHeader[14] | (aucHeader[15] << 8);
+	unsigned int uiBytes = aucHeader[16] / 8;
+	bool bTopDown = (aucHeader[17] & 0x20) != 0;
+	CreateSoftTarget(pTexture, nWidth, nHeight, false);
+
+	unsigned char* pucRow = new unsigned char[nWidth * uiBytes];
+	for(int y = 0; y < nHeight && bRead; ++y)
+		{
+		bRead = fread(pucRow, nWidth * uiBytes, 1, pFile) == 1;
+		unsigned int* puTexels = pTexture->apuLevels[0] + (bTopDown ? nHeight - 1 - y : y) * nWidth;
+		for(int x = 0; x < nWidth && bRead; ++x)
+			{
+			const unsigned char* pucTexel = pucRow + x * uiBytes;		// BGR(A)
+			puTexels[x] = PVRTRGBA(pucTexel[2], pucTexel[1], pucTexel[0], uiBytes == 4 ? pucTexel[3] : 255);
+			}
+		}
+	delete [] pucRow;
+	fclose(pFile);
+	return bRead;
+	}
+
+// ---------------------------------------------------------------
+// How different two colours look, 0 to 1: the distance in YCoCg with the chroma at half weight, as the eye is less
+// sensitive to it than to brightness. Alpha isn't shown, so it's ignored.
+inline float GetSoftColourDistance(unsigned int uiA, unsigned int uiB)
+	{
+	float fR = ((int)(uiA & 0xFF) - (int)(uiB & 0xFF)) / 255.0f;
+	float fG = ((int)((uiA >> 8) & 0xFF) - (int)((uiB >> 8) & 0xFF)) / 255.0f;
+	float fB = ((int)((uiA >> 16) & 0xFF) - (int)((uiB >> 16) & 0xFF)) / 255.0f;
+	float fY = 0.25f * fR + 0.5f * fG + 0.25f * fB;
+	float fCo = 0.5f * (fR - fB);
+	float fCg = 0.5f * fG - 0.25f * (fR + fB);
+	return sqrtf(fY * fY + 0.5f * (fCo * fCo + fCg * fCg));
+	}
+
+// ---------------------------------------------------------------
+// Compares level 0 of two targets of the same size. Each pixel is matched against the nearest looking of its golden's
+// 3x3 neighbourhood, so edges that move by a pixel aren't counted. The diff shows the golden dimmed, with the pixels
+// that changed in red, brighter the further they are out.
+void CompareSoftImages(const SoftTexture& Golden, const SoftTexture& Image, SoftTexture* pDiff, RegressImageDiff& Result)
+	{
+	CreateSoftTarget(pDiff, Golden.nWidth, Golden.nHeight, false);
+	Result.uiChanged = 0;
+	Result.fMaxDistance = 0.0f;
+	for(int y = 0; y < Golden.nHeight; ++y)
+		{
+		for(int x = 0; x < Golden.nWidth; ++x)
+			{
+			unsigned int uiPixel = Image.apuLevels[0][y * Golden.nWidth + x];
+			float fDistance = 1.0f;
+			for(int j = PVRT_MAX(y - 1, 0); j <= PVRT_MIN(y + 1, Golden.nHeight - 1); ++j)
+				{
+				for(int i = PVRT_MAX(x - 1, 0); i <= PVRT_MIN(x + 1, Golden.nWidth - 1); ++i)
+					fDistance = PVRT_MIN(fDistance, GetSoftColourDistance(uiPixel, Golden.apuLevels[0][j * Golden.nWidth + i]));
+				}
+			Result.fMaxDistance = PVRT_MAX(Result.fMaxDistance, fDistance);
+
+			unsigned int uiGolden = Golden.apuLevels[0][y * Golden.nWidth + x];
+			unsigned int uiGrey = (((uiGolden & 0xFF) + ((uiGolden >> 7) & 0x1FE) + ((uiGolden >> 16) & 0xFF)) >> 2) / 4;
+			unsigned int& uiDiff = pDiff->apuLevels[0][y * Golden.nWidth + x];
+			if(fDistance > REGRESS_PIXEL_TOLERANCE)
+				{
+				++Result.uiChanged;
+				uiDiff = PVRTRGBA(128 + (unsigned int)(PVRT_MIN(fDistance * 2.0f, 1.0f) * 127.0f), 0, 0, 255);
+				}
+			else
+				uiDiff = PVRTRGBA(uiGrey, uiGrey, uiGrey, 255);
+			}
+		}
+	}
+
+// ---------------------------------------------------------------
+// Reads a budgets file: a name and a number a line, with # starting a comment. The REGRESS_MACHINE_WRITE comment is read
+// into pMachine, and pbMachine set to whether there was one. Returns how many budgets were read.
+unsigned int ReadRegressBudgets(const char* pszPath, RegressBudget* pBudgets, unsigned int uiMax, RegressMachine* pMachine,
+								bool* pbMachine)
+	{
+	*pbMachine = false;
+	FILE* pFile = fopen(pszPath, "r");
+	if(!pFile)
+		return 0;
+
+	char szLine[256];
+	unsigned int uiNum = 0;
+	while(uiNum < uiMax && fgets(szLine, sizeof(szLine), pFile))
+		{
+		RegressBudget& Budget = pBudgets[uiNum];
+		if(szLine[0] == '#')
+			{
+			if(sscanf(szLine, REGRESS_MACHINE_READ, &pMachine->nWidth, &pMachine->nHeight, &pMachine->uiThreads, &pMachine->uiCores,
+					  pMachine->szSIMD) == 5)
+				*pbMachine = true;
+			}
+		else if(sscanf(szLine, "%63s %f", Budget.szName, &Budget.fValue) == 2)
+			++uiNum;
+		}
+	fclose(pFile);
+	return uiNum;
+	}
+
+// ---------------------------------------------------------------
+const RegressBudget* FindRegressBudget(const RegressBudget* pBudgets, unsigned int uiNum, const char* pszName)
+	{
+	for(unsigned int i = 0; i < uiNum; ++i)
+		{
+		if(strcmp(pBudgets[i].szName, pszName) == 0)
+			return &pBudgets[i];
+		}
+	return NULL;
+	}
+
+// ---------------------------------------------------------------
+// Times may go over their budgets by REGRESS_TIME_TOLERANCE and REGRESS_TIME_SLACK_MS; counts may not go over at all
+void CheckRegressBudget(RegressCheck& Check, const RegressBudget* pBudgets, unsigned int uiNumBudgets, bool bTime)
+	{
+	Check.pBudget = FindRegressBudget(pBudgets, uiNumBudgets, Check.szName);
+	Check.bSkipped = false;
+	Check.bPassed = true;
+	if(Check.pBudget && bTime)
+		Check.bPassed = Check.fValue <= Check.pBudget->fValue * (1.0f + REGRESS_TIME_TOLERANCE) + REGRESS_TIME_SLACK_MS;
+	else if(Check.pBudget)
+		Check.bPassed = Check.fValue <= Check.pBudget->fValue + 0.001f;		// The budgets are written to 3 places
+	}
+
+class MyPVRDemo : public PVRShell
+	{
+	private:
+		// Models
+		CPVRTModelPOD			m_Model;					// Not loaded when running from a package
+		unsigned int			m_uiNumIndices[SCENE_MAX_MESHES];	// Per mesh
+
+		// Scene graph
+		CSceneGraph				m_Scene;					// Built from m_Model, or read from the package
+		bool					m_bCulling;					// Frustum cull each view against the BVH
+
+		// Command buffer
+		CCommandBuffer			m_Commands;					// Draws recorded by the pass, executed by ExecuteCommands
+		bool					m_bCmdSort;					// Execute in key order rather than as recorded
+
+		// Baked package
+		CPackage				m_Package;					// Open when running from a package
+		CPackageWriter*			m_pPackageWriter;			// Non-NULL while baking
+		bool					m_bBake;
+		bool					m_bUsePackage;
+		CPVRTString				m_PackageFile;				// Read by -package, from the read path
+		CPVRTString				m_BakeFile;					// Written by -bake, to the write path
+		double					m_dStartupMS;				// Timestamp at the start of InitApplication
+		float					m_fFirstFrameMS;			// From m_dStartupMS to the end of the first frame
+
+		// Asynchronous loading
+		CAssetLoader			m_Loader;
+		bool					m_bAsyncLoad;				// Load the POD and textures on worker threads
+		bool					m_bLoading;					// Assets are still arriving; RenderScene draws placeholder frames
+		bool					m_bLoadedAsync;
+		unsigned int			m_uiLoadThreads;			// 0 picks a count from the number of CPUs
+		unsigned int			m_uiAssetsUploaded;
+		unsigned int			m_uiPlaceholderFrames;
+		float					m_fFirstPlaceholderMS;
+		bool					m_abAssetFailed[enumASSET_MAX];		// Written by the worker that ran the asset
+		MeshPayload				m_MeshPayload[SCENE_MAX_MESHES];
+		char					m_aszMeshAssets[SCENE_MAX_MESHES][16];	// Names for the loader's timeline
+		unsigned int			m_uiNumMeshAssets;			// Meshes submitted, once the POD is in
+		CPVRTResourceFile*		m_apTextureFiles[enumTEXTURE_MAX];	// Read by the workers, uploaded on the GL thread
+		CPVRTString				m_LoadError;
+
+		// Shaders
+		StatueShader			m_StatueShader;
+		ChurchShader			m_ChurchShader;
+		FloorShader				m_FloorShader;
+		SATexShader				m_SATexShader;
+		Bloom1Shader			m_Bloom1Shader;
+		BloomBlurShader			m_BloomBlurShader;
+		BloomBlurShader			m_BloomDownShader;
+		BloomBlurShader			m_BloomUpShader;
+		SimpleShader			m_SimpleShader;
+		ChurchReflShader		m_ChurchReflShader;
+		CrowdShader				m_CrowdPaletteShader;
+		CrowdShader				m_CrowdInstancedShader;
+		bool					m_bProgramCache;			// Load linked programs from OES_get_program_binary blobs saved by earlier runs
+		CPVRTString				m_ProgramCacheFile;
+		float					m_fShaderSetupMS;
+		unsigned int			m_uiProgramsCached;			// Programs loaded from the cache by the last LoadShaders
+		unsigned int			m_uiProgramsCompiled;		// Programs compiled from source by the last LoadShaders
+
+		// Textures
+		GLuint					m_tex[enumTEXTURE_MAX];
+
+		// Lights
+		PVRTVec3				m_vLightPos;
+		PVRTMat4				m_mxLightView;
+		PVRTMat4				m_mxLightProj;
+		PVRTMat4				m_mxShadowViewProj;		// The light's view-projection the shadow map was last rendered with
+		int						m_nShadowMapRendered;	// ...and the width and height of the corner it was rendered to
+		PVRTMat4				m_mxLightBias;			// Bias matrix used to smooth out the shadow texture
+		float					m_fLightAngle;
+
+		// Scene matrices
+		bool					m_bRotated;
+		PVRTMat4				m_mxProjection;
+		PVRTMat4				m_mxCam;
+
+		float					m_fAngleY;
+		float					m_fBloomMulti;
+		bool					m_bBloomScissor;			// Limit the bloom passes to the statue's screen footprint
+
+		// Bloom pyramid
+		BloomLevel				m_BloomLevels[BLOOM_MAX_LEVELS];	// Level 0 is the extract target, each one after it is half the size
+		BloomLevel				m_BloomScratch;				// The Gaussian's horizontal pass output, the same size as the bottom level
+		unsigned int			m_uiBloomLevels;
+		unsigned int			m_uiBloomSize;				// Resolution of level 0
+		float					m_fBloomRadius;				// Gaussian reach in level 0 texels
+		BloomKernel				m_BloomKernel;				// For the bottom level
+
+		PVRTVec4				m_bbStatueTL;
+		PVRTVec4				m_bbStatueBR;
+
+		// GL Handles
+		GLuint					m_uiVertShader[enumEFFECT_MAX];
+		GLuint					m_uiFragShader[enumEFFECT_MAX];
+		GLint					m_anUniforms[enumEFFECT_MAX][enumUNIFORM_MAX];	// Where each packet uniform goes, or -1
+		GLuint					m_uiVBO[SCENE_MAX_MESHES];
+		GLuint					m_uiVBOIdx[SCENE_MAX_MESHES];
+		GLuint					m_uiVAO[SCENE_MAX_MESHES][MESH_LAYOUT_MAX];	// Per mesh and c_MeshLayouts entry, or 0 if not drawn that way
+		CompactVertexFormat		m_VertexFormat[SCENE_MAX_MESHES];	// Layout of each mesh's (compressed) VBO
+		bool					m_bMeshOpt;					// Re-order index and vertex data for the vertex cache and overdraw
+		GLuint					m_uiDepthVBO[SCENE_MAX_MESHES];	// Position-only streams for the shadow casters, see BuildDepthStream
+		GLuint					m_uiDepthVBOIdx[SCENE_MAX_MESHES];
+		unsigned int			m_uiDepthNumIndices[SCENE_MAX_MESHES];
+		bool					m_bShadowLOD;				// Simplify the statue's depth stream for the shadow pass
+		unsigned int			m_uiShadowTris;				// Shadow caster triangle budget, or 0 for the default
+
+		// Extensions
+		CPVRTgles2Ext			m_Extensions;
+		bool					m_bVAO;						// Use OES_vertex_array_object when available
+		bool					m_bVAOActive;				// The extension is present and VAOs were created
+
+		// FBO Handles
+		GLint					m_nOrigFBO;
+
+		// Frame graph
+		CFrameGraph				m_FrameGraph;				// The offscreen targets and the passes that use them, see BuildFrameGraph
+		FrameGraphIDs			m_FG;
+		bool					m_bFGAlias;					// Let targets whose passes don't overlap share an allocation
+		bool					m_bFGDiscard;				// Use EXT_discard_framebuffer, when it's there
+
+		int						m_nReflWidth;				// Reflected statue and church, sampled by the floor
+		int						m_nReflHeight;
+		bool					m_bReflectionRTT;			// Render the reflection offscreen instead of under the floor
+		float					m_fReflScale;
+
+		GLuint					m_uiShadowMapTex;			// Texture for the shadow map
+		int						m_nShadowMapSize;			// Allocated width and height
+		int						m_nShadowMapActive;			// Width and height of the corner rendered to
+		bool					m_bShadowFit;				// Fit the light's frustum to the statue every frame
+		PVRTMat4				m_mxLightProjWide;			// The light's projection when it isn't fitted
+		float					m_fShadowCoverage;			// Fraction of the shadow map the statue's bounds covered last frame
+		double					m_dBenchShadowCoverage;
+		unsigned int			m_uiBenchShadowHidden;		// Timed frames with no visible shadow to render
+		CShadowScheduler		m_ShadowScheduler;
+		bool					m_bShadowSkip;				// Reuse the shadow map when the scheduler allows it
+		unsigned int			m_uiShadowInterval;
+		float					m_fShadowMaxAngle;			// Radians
+
+		// Dynamic resolution
+		CDynamicResolution		m_DynRes;
+		bool					m_bDynRes;					// Scale the offscreen targets to hold m_fDynResBudgetMS
+		bool					m_bDynResScene;				// Render the scene offscreen too, so it can be scaled as a last resort
+		float					m_fDynResBudgetMS;
+		GLuint					m_uiSceneFBO;				// Where the scene is drawn this frame: the frame graph's scene target, or m_nOrigFBO
+		int						m_nSceneWidth;
+		int						m_nSceneHeight;
+		double					m_dLastFrameStartMS;
+		float					m_fLastCPUFrameMS;
+
+
+		unsigned long			m_ulCurrTime;
+		float					m_fDT;
+
+		// Benchmark mode
+		bool					m_bBenchmark;				// Render offscreen on a fixed timestep and write a timing report
+		unsigned int			m_uiBenchFrames;			// Number of timed frames
+		unsigned int			m_uiBenchFrame;				// Current frame, including warm-up frames
+		float*					m_pfBenchFrameMS;			// Per-frame CPU+GPU time for each timed frame
+		double					m_dBenchStartMS;			// Timestamp of the first timed frame
+		double					m_dBenchEndMS;				// Timestamp of the end of the last timed frame
+		CPVRTString				m_BenchReportFile;
+
+		// Per-pass timing
+		CPassProfiler			m_Profiler;
+		CPVRTPrint3D			m_Print3D;
+		bool					m_bShowTimings;				// Draw the per-pass timing overlay
+		bool					m_bDumpTimings;				// Write the per-pass timings out on exit
+		CPVRTString				m_TimingsFile;				// Base file name for the CSV and JSON timing dumps
+		unsigned int			m_uiOverlayFrame;
+		PassPercentiles			m_OverlayStats[enumTIMER_MAX][enumPASS_MAX];
+
+		// GL state
+		CGLStateCache			m_GLState;
+		bool					m_bStateCache;				// Filter redundant GL calls
+		unsigned int			m_uiGLIssued;				// GL state calls made last frame
+		unsigned int			m_uiGLFiltered;				// GL state calls dropped last frame
+		double					m_dBenchGLIssued;
+		double					m_dBenchGLFiltered;
+
+		// Crowd stress mode
+		unsigned int			m_uiCrowd;					// Statues in the crowd, or 0 for none
+		int						m_nCrowdRequest;			// enumCROWD from -crowdpath, or -1 for the best available
+		int						m_nCrowdPath;				// enumCROWD the crowd is drawn with, see InitCrowd
+		bool					m_bCrowdSweep;				// Grow the crowd up to m_uiCrowd over the benchmark
+		CrowdStep				m_aCrowdSteps[CROWD_MAX_STEPS];
+		unsigned int			m_uiCrowdSteps;				// 1 unless sweeping
+		unsigned int			m_uiCrowdStep;				// This frame's
+		unsigned int			m_uiCrowdActive;			// Statues drawn this frame
+		unsigned int			m_uiCrowdPlaced;			// Statues in m_pvCrowd and the instance buffer
+		PVRTVec4*				m_pvCrowd;					// See PlaceCrowd
+		unsigned int			m_uiCrowdMeshVertices;		// In the statue's mesh
+		unsigned int			m_uiCrowdBatch;				// Statues per palette draw
+		GLuint					m_uiCrowdInstanceVBO;		// m_pvCrowd, for the instanced path
+		GLuint					m_uiCrowdVBO;				// m_uiCrowdBatch copies of the statue's vertices, for the palette path
+		GLuint					m_uiCrowdVBOIdx;
+		GLuint					m_uiCrowdPaletteVBO;		// Each copy's palette entry, per vertex
+		PFNDEMODRAWELEMENTSINSTANCEDPROC	m_pfnDrawElementsInstanced;
+		PFNDEMOVERTEXATTRIBDIVISORPROC		m_pfnVertexAttribDivisor;
+		unsigned int			m_uiCrowdDraws;				// Last frame
+		unsigned int			m_uiCrowdVertices;			// Last frame
+		unsigned int			m_uiCrowdVisible;			// Last frame, after culling
+		unsigned int*			m_puCrowdKeys;				// See UpdateCrowd and SortCrowdKeys
+		unsigned int*			m_puCrowdTemp;
+		PVRTVec4*				m_pvCrowdDraw;				// The visible statues, front to back, for the batched paths
+		PVRTMat4*				m_pmxCrowdMVP;				// Per statue, for the single path only
+		PVRTMat4*				m_pmxCrowdModelView;
+		PVRTVec3*				m_pvCrowdLightPos;
+		float					m_fCrowdUpdateMS;			// CPU time spent culling, transforming and sorting the crowd last frame
+		float					m_fCrowdSubmitMS;			// CPU time spent drawing the crowd last frame
+		float*					m_pfBenchCrowdMS;			// m_fCrowdSubmitMS for each timed frame
+		float*					m_pfBenchCrowdUpdateMS;		// m_fCrowdUpdateMS for each timed frame
+
+		// Job system
+		CJobSystem				m_Jobs;
+		unsigned int			m_uiJobThreads;				// Including the render thread, or 0 for one per core
+		bool					m_bJobBench;				// Time the crowd's update on 1 to m_uiJobThreads threads, then quit
+		unsigned int			m_uiJobBenchRuns;
+
+		// SIMD maths
+		bool					m_bMathBench;				// Check the SIMD maths against PVRTools and time both, then quit
+		unsigned int			m_uiMathBenchRuns;
+
+		// Mesh optimiser
+		bool					m_bMeshBench;				// Check and time the mesh optimiser on every mesh, then quit
+		unsigned int			m_uiMeshBenchRuns;
+
+		// Software rasterizer
+		bool					m_bSoftRaster;				// Render on the CPU at 1 to m_uiJobThreads threads, write the frames out, then quit
+		unsigned int			m_uiSoftFrames;
+		CSoftRasterizer			m_SoftRaster;
+		SoftTexture				m_aSoftTextures[enumTEXTURE_MAX];	// Decoded from the same .pvr files as m_tex
+		SoftBuffer				m_aSoftBuffers[SCENE_MAX_MESHES][SOFT_MESH_BUFFERS];	// The mesh buffers LoadVBOs would make, from enumPACKAGE_Vertices on
+		SoftTargets				m_SoftTargets;
+
+		// Regression
+		bool					m_bRegress;					// Check c_aRegressPoses on the CPU against the goldens and budgets, then quit
+		bool					m_bRegressRecord;			// Write the goldens and budgets instead
+		CPVRTString				m_RegressDir;				// Where the goldens are, ending in a separator
+
+	public:
+		MyPVRDemo() : m_bCulling(true), m_bCmdSort(true), m_pPackageWriter(NULL), m_bBake(false), m_bUsePackage(false), m_PackageFile(PACKAGE_DEFAULT_FILE), m_BakeFile(PACKAGE_DEFAULT_FILE), m_dStartupMS(0.0), m_fFirstFrameMS(0.0f),
+			m_bAsyncLoad(true), m_bLoading(false), m_bLoadedAsync(false), m_uiLoadThreads(0), m_uiAssetsUploaded(0), m_uiPlaceholderFrames(0), m_fFirstPlaceholderMS(0.0f), m_uiNumMeshAssets(0),
+			m_bProgramCache(true), m_ProgramCacheFile(PROGRAM_CACHE_DEFAULT_FILE), m_fShaderSetupMS(0.0f), m_uiProgramsCached(0), m_uiProgramsCompiled(0),
+			m_bBloomScissor(true), m_uiBloomLevels(BLOOM_DEFAULT_LEVELS), m_uiBloomSize(BLOOM_DEFAULT_SIZE), m_fBloomRadius(BLOOM_DEFAULT_RADIUS),
+			m_bMeshOpt(true), m_bShadowLOD(true), m_uiShadowTris(0), m_bVAO(true), m_bVAOActive(false),
+			m_bFGAlias(true), m_bFGDiscard(true), m_nReflWidth(0), m_nReflHeight(0), m_bReflectionRTT(true), m_fReflScale(REFL_DEFAULT_SCALE),
+			m_nShadowMapSize(SHADOW_MAP_DEFAULT_SIZE), m_nShadowMapActive(SHADOW_MAP_DEFAULT_SIZE), m_bShadowFit(true), m_fShadowCoverage(0.0f), m_dBenchShadowCoverage(0.0), m_uiBenchShadowHidden(0),
+			m_bShadowSkip(false), m_uiShadowInterval(0), m_fShadowMaxAngle(0.0f),
+			m_bDynRes(false), m_bDynResScene(false), m_fDynResBudgetMS(DYNRES_DEFAULT_BUDGET_MS),
+			m_uiSceneFBO(0), m_nSceneWidth(0), m_nSceneHeight(0), m_dLastFrameStartMS(0.0), m_fLastCPUFrameMS(0.0f),
+			m_bBenchmark(false), m_uiBenchFrames(BENCH_DEFAULT_FRAMES), m_uiBenchFrame(0), m_pfBenchFrameMS(NULL),
+			m_dBenchStartMS(0.0), m_dBenchEndMS(0.0), m_BenchReportFile(BENCH_DEFAULT_REPORT),
+			m_bShowTimings(false), m_bDumpTimings(false), m_TimingsFile(PROFILE_DEFAULT_DUMP), m_uiOverlayFrame(0),
+			m_bStateCache(true), m_uiGLIssued(0), m_uiGLFiltered(0), m_dBenchGLIssued(0.0), m_dBenchGLFiltered(0.0),
+			m_uiCrowd(0), m_nCrowdRequest(-1), m_nCrowdPath(enumCROWD_Single), m_bCrowdSweep(false), m_uiCrowdSteps(0), m_uiCrowdStep(0), m_uiCrowdActive(0),
+			m_uiCrowdPlaced(0), m_pvCrowd(NULL), m_uiCrowdMeshVertices(0), m_uiCrowdBatch(0), m_uiCrowdInstanceVBO(0), m_uiCrowdVBO(0), m_uiCrowdVBOIdx(0),
+			m_uiCrowdPaletteVBO(0), m_pfnDrawElementsInstanced(NULL), m_pfnVertexAttribDivisor(NULL), m_uiCrowdDraws(0), m_uiCrowdVertices(0),
+			m_uiCrowdVisible(0), m_puCrowdKeys(NULL), m_puCrowdTemp(NULL), m_pvCrowdDraw(NULL), m_pmxCrowdMVP(NULL), m_pmxCrowdModelView(NULL),
+			m_pvCrowdLightPos(NULL), m_fCrowdUpdateMS(0.0f), m_fCrowdSubmitMS(0.0f), m_pfBenchCrowdMS(NULL), m_pfBenchCrowdUpdateMS(NULL),
+			m_uiJobThreads(0), m_bJobBench(false), m_uiJobBenchRuns(JOB_BENCH_DEFAULT_RUNS),
+			m_bMathBench(false), m_uiMathBenchRuns(MATH_BENCH_DEFAULT_RUNS),
+			m_bMeshBench(false), m_uiMeshBenchRuns(MESH_BENCH_DEFAULT_RUNS), m_bSoftRaster(false), m_uiSoftFrames(SOFT_DEFAULT_FRAMES),
+			m_bRegress(false), m_bRegressRecord(false)
+			{
+			memset(&m_FG, 0xFF, sizeof(m_FG));
+			memset(m_aSoftTextures, 0, sizeof(m_aSoftTextures));
+			memset(m_aSoftBuffers, 0, sizeof(m_aSoftBuffers));
+			memset(&m_SoftTargets, 0, sizeof(m_SoftTargets));
+			}
+
+	private:
+		void ParseCommandLine();
+		bool WriteBenchmarkReport();
+		bool WritePassTimings();
+		void RenderTimingsOverlay();
+
+		bool LoadTextures(CPVRTString* pErrorStr);
+		bool LoadShaders(CPVRTString* pErrorStr);
+		void GetVertexDecodeUniforms(GenericShader* pShader);
+		GenericShader* GetEffectShader(unsigned int uiEffect);
+		bool IsEffectUsed(unsigned int uiEffect) const;
+		const char* GetShaderStartType() const;
+		bool LoadPOD();
+		bool OpenPackage();
+		bool WritePackage();
+		void UploadBuffer(GLenum eTarget, GLuint uiBuffer, unsigned int uiPackageType, unsigned int uiIndex, const void* pData, unsigned int uiSize);
+		bool UploadPackageBuffer(GLenum eTarget, GLuint uiBuffer, unsigned int uiPackageType, unsigned int uiIndex, CPVRTString* pErrorStr);
+		const void* FindPackageEntry(unsigned int uiPackageType, unsigned int uiIndex, unsigned int* puiSize, CPVRTString* pErrorStr) const;
+		bool LoadVBOs(CPVRTString* pErrorStr);
+		void BuildMesh(unsigned int uiMeshIdx, MeshPayload* pPayload) const;
+		void BuildDepthStream(unsigned int uiMeshIdx, bool bSimplify, MeshPayload* pPayload) const;
+		void UploadMesh(unsigned int uiMeshIdx, MeshPayload* pPayload);
+		bool LoadTexture(unsigned int uiTexture, const void* pData, CPVRTString* pErrorStr);
+
+		bool StartLoading();
+		static void LoadTask(void* pUserData, unsigned int uiAsset);
+		void RunLoadTask(unsigned int uiAsset);
+		bool UploadAsset(unsigned int uiAsset);
+		bool RenderLoadingFrame();
+		void FinishLoading();
+		void CancelLoading();
+		void PrintLoadTimeline();
+		void CreateVAOs();
+		bool CreateFBOs(CPVRTString* pErrorStr);
+		void SetTargetSizes();
+		bool BuildFrameGraph(CPVRTString* pErrorStr);
+		void ReleaseFrameGraph();
+		bool IsSceneDirect() const;
+		void SetBloomTarget(unsigned int uiPass, const PixelRect& Rect);
+		void DrawBloomQuad(const BloomLevel& Level, const PixelRect& Rect);
+		void GetBloomQuadUVs(const BloomLevel& Level, const PixelRect& Rect, PVRTVec2& vTTL, PVRTVec2& vTBR) const;
+		void UpdateDynamicResolution(double dFrameStartMS);
+		void ApplyDynamicResolution();
+		void SetUpViews();
+
+		void RecordStatue(const PVRTMat4& mxModel, const PVRTMat4& mxCam, const PVRTMat4& mxProjection, const PVRTVec3& vLightPos, unsigned int uiEffect, unsigned int uiView, GLenum eCullFace);
+		void RecordChurch(const PVRTMat4& mxCam);
+		void RecordChurchNodes(const DrawPacket& Template, const PVRTMat4& mxView, unsigned int uiView, int nRole, unsigned int uiLayer);
+		void ExecuteCommands();
+		GLuint GetCmdTexture(unsigned int uiTexture) const;
+		void RecordReflection(const PVRTMat4& mxModel, const PVRTMat4& mxCam, const PVRTVec3& vLightPos);
+		void RenderReflection(const PVRTMat4& mxModel, const PVRTMat4& mxCam, const PVRTVec3& vLightPos);
+		void GetChurchBounds(PVRTVec3& vMin, PVRTVec3& vMax) const;
+		void RenderScreenAlignedTexture(const PVRTVec2& vTL, const PVRTVec2& vBR, const PVRTVec2& vTTL, const PVRTVec2& vTBR);
+		bool GetBloomRegions(const PVRTMat4& mxModel, const PVRTMat4& mxCam, BloomRegions& Regions) const;
+		void RenderBloom(const PVRTMat4& mxModel, const PVRTMat4& mxCam, const PVRTVec3& vLightPos);
+		bool GetStatueScreenBounds(const PVRTMat4& mxMVP, PVRTVec2& vMin, PVRTVec2& vMax) const;
+		void DrawMesh(const GenericShader* pShader, int i32NodeIndex, GLuint uiFlags);
+		void SetMeshAttribs(int i32MeshIndex, GLuint uiFlags);
+		void SetMeshAttribs(GLuint uiVBO, GLuint uiVBOIdx, const CompactVertexFormat& Format, GLuint uiFlags);
+
+		bool UpdateLight(const PVRTMat4& mxCam, PVRTVec3& vLightPos);
+		bool FitLightProjection(const PVRTVec3& vLightPos, const PVRTMat4& mxCam, bool& bVisible);
+		void RenderShadowScene(bool bCasters);
+
+		void InitCrowd();
+		void PrepareCrowdMesh(unsigned int uiMeshIdx, const void* pVertices, unsigned int uiVertexBytes, const unsigned short* puIndices, unsigned int uiNumIndices);
+		void RenderCrowd(const PVRTMat4& mxCam, const PVRTVec3& vLightPos);
+		void SetCrowdUpdate(CrowdUpdate* pUpdate, const PVRTVec4* pvInstances, const PVRTMat4& mxCam, const PVRTVec3& vLightPos) const;
+		bool RunJobBenchmark();
+		bool RunMathBenchmark();
+		bool RunMeshBenchmark();
+
+		const SoftTexture* GetSoftTexture(unsigned int uiTexture) const;
+		void SetSoftBuffer(unsigned int uiPackageType, unsigned int uiIndex, const void* pData, unsigned int uiSize);
+		bool LoadSoftMeshes(CPVRTString* pErrorStr);
+		bool LoadSoftTextures(CPVRTString* pErrorStr);
+		void SetSoftSizes();
+		bool InitSoftRaster(CPVRTString* pErrorStr);
+		void CreateSoftTargets();
+		void ReleaseSoftRaster();
+		void ExecuteSoftCommands(const SoftState& BaseState);
+		void DrawSoftQuad(unsigned int uiProgram, const SoftTexture* pSource, const PixelRect& Rect, const PVRTVec2& vTTL, const PVRTVec2& vTBR, float fTexelX, float fTexelY, unsigned int eBlend);
+		void DrawSoftBloomQuad(unsigned int uiProgram, const SoftTexture* pSource, const BloomLevel& Level, const PixelRect& Rect, float fTexelX, float fTexelY, unsigned int eBlend);
+		void RenderSoftBloom(const PVRTMat4& mxModel, const PVRTMat4& mxCam, const PVRTVec3& vLightPos);
+		void RenderSoftFrame();
+		bool RunSoftRaster();
+		bool RunRegression();
+
+	public:
+		virtual bool InitApplication();
+		virtual bool InitView();
+		virtual bool ReleaseView();
+		virtual bool QuitApplication();
+		virtual bool RenderScene();
+	};
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::LoadTextures(CPVRTString* const pErrorStr)
+	{
+	ASSERT(ELEMENTS_IN_ARRAY(c_pszTextures) == enumTEXTURE_MAX);
+
+	// Load Textures from PVR files. When loading asynchronously they're uploaded as they arrive instead.
+	for(unsigned int i = 0; i < enumTEXTURE_MAX && !m_bLoading; ++i)
+		{
+		if(!LoadTexture(i, NULL, pErrorStr))
+			return false;
+		}
+
+	// Allocate a texture for the shadow map
+	glGenTextures(1, &m_uiShadowMapTex);
+	glBindTexture(GL_TEXTURE_2D, m_uiShadowMapTex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, m_nShadowMapSize, m_nShadowMapSize, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	return true;
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::LoadTexture(unsigned int uiTexture, const void* pData, CPVRTString* pErrorStr)
+	{
+	// pData is the .pvr file if it's already in memory, otherwise it comes from the package or the file
+	EPVRTError eResult;
+	if(pData)
+		{
+		eResult = PVRTTextureLoadFromPointer(pData, &m_tex[uiTexture]);
+		}
+	else if(m_Package.IsOpen())
+		{
+		pData = m_Package.Find(enumPACKAGE_Texture, uiTexture, NULL);
+		if(!pData)
+			{
+			*pErrorStr = CPVRTString("ERROR: ") + m_PackageFile + CPVRTString(" has no entry for: ") + CPVRTString(c_pszTextures[uiTexture]);
+			return false;
+			}
+		eResult = PVRTTextureLoadFromPointer(pData, &m_tex[uiTexture]);
+		}
+	else
+		{
+		eResult = PVRTTextureLoadFromPVR(c_pszTextures[uiTexture], &m_tex[uiTexture]);
+		if(eResult == PVR_SUCCESS && m_pPackageWriter)
+			{
+			CPVRTResourceFile File(c_pszTextures[uiTexture]);
+			m_pPackageWriter->Add(enumPACKAGE_Texture, uiTexture, File.DataPtr(), (unsigned int)File.Size());
+			}
+		}
+
+	if(eResult != PVR_SUCCESS)
+		{
+		*pErrorStr = CPVRTString("ERROR: Could not load: ") + CPVRTString(c_pszTextures[uiTexture]);
+		return false;
+		}
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+	// Set some options
+	if(uiTexture == enumTEXTURE_BloomMap)
+		{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+
+	return true;
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::LoadShaders(CPVRTString* pErrorStr)
+	{
+	ASSERT(ELEMENTS_IN_ARRAY(c_Effects) == enumEFFECT_MAX);
+
+	double dStartMS = GetTimeMS();
+
+	// Programs linked on earlier runs are keyed on their sources, defines, attribute bindings and the driver
+	CProgramCache Cache;
+	CPVRTString CachePath = CPVRTString((const char*)PVRShellGet(prefWritePath)) + m_ProgramCacheFile;
+	bool bCache = m_bProgramCache && Cache.Init();
+	if(bCache)
+		Cache.Read(CachePath.c_str());
+	CPVRTString Driver = bCache ? GetDriverString() : CPVRTString();
+
+	m_uiProgramsCached = 0;
+	m_uiProgramsCompiled = 0;
+
+	for(unsigned int i = 0; i < enumEFFECT_MAX; ++i)
+		{
+		const EffectDesc& Effect = c_Effects[i];
+		GenericShader* pShader = GetEffectShader(i);
+		m_uiVertShader[i] = 0;
+		m_uiFragShader[i] = 0;
+		for(unsigned int j = 0; j < enumUNIFORM_MAX; ++j)
+			m_anUniforms[i][j] = -1;
+		if(!IsEffectUsed(i))
+			{
+			pShader->uiID = 0;
+			continue;
+			}
+
+		unsigned long long ullKey = bCache ? HashEffect(Effect, Driver) : 0;
+		pShader->uiID = ullKey ? Cache.Load(ullKey) : 0;
+		if(pShader->uiID)
+			{
+			++m_uiProgramsCached;
+			}
+		else
+			{
+			// ---- Compile and link from source
+			if (PVRTShaderLoadFromFile(NULL, StripFolder(Effect.pszVertSrc), GL_VERTEX_SHADER, GL_SGX_BINARY_IMG, &m_uiVertShader[i], pErrorStr, 0, Effect.ppszDefines, Effect.uiNumDefines) != PVR_SUCCESS)
+				return false;
+			if (PVRTShaderLoadFromFile(NULL, StripFolder(Effect.pszFragSrc), GL_FRAGMENT_SHADER, GL_SGX_BINARY_IMG, &m_uiFragShader[i], pErrorStr, 0, Effect.ppszDefines, Effect.uiNumDefines) != PVR_SUCCESS)
+				return false;
+			if (PVRTCreateProgram(&pShader->uiID, m_uiVertShader[i], m_uiFragShader[i], Effect.ppszAttribs, Effect.uiNumAttribs, pErrorStr) != PVR_SUCCESS)
+				return false;
+
+			if(ullKey)
+				Cache.Store(ullKey, pShader->uiID);
+			++m_uiProgramsCompiled;
+			}
+
+		// --- Get Uniform locations
+		glUseProgram(pShader->uiID);
+		for(unsigned int j = 0; j < Effect.uiNumUniforms; ++j)
+			{
+			const ShaderUniform& Uniform = Effect.pUniforms[j];
+			pShader->*Uniform.pLocation = glGetUniformLocation(pShader->uiID, Uniform.pszName);
+			if(Uniform.nSemantic != enumUNIFORM_None)
+				m_anUniforms[i][Uniform.nSemantic] = pShader->*Uniform.pLocation;
+			}
+		GetVertexDecodeUniforms(pShader);
+
+		// --- Set some uniforms. Loading a program binary resets them, so this is done either way.
+		for(unsigned int j = 0; j < Effect.uiNumSamplers; ++j)
+			glUniform1i(glGetUniformLocation(pShader->uiID, Effect.pSamplers[j].pszName), Effect.pSamplers[j].nUnit);
+
+		for(unsigned int j = 0; j < Effect.uiNumConstants; ++j)
+			{
+			const ShaderConstant& Constant = Effect.pConstants[j];
+			GLint nLocation = glGetUniformLocation(pShader->uiID, Constant.pszName);
+			switch(Constant.nComponents)
+				{
+				case 1:	glUniform1fv(nLocation, 1, Constant.afValue); break;
+				case 2:	glUniform2fv(nLocation, 1, Constant.afValue); break;
+				case 3:	glUniform3fv(nLocation, 1, Constant.afValue); break;
+				case 4:	glUniform4fv(nLocation, 1, Constant.afValue); break;
+				}
+			}
+		}
+
+	if(Cache.IsDirty() && !Cache.Write(CachePath.c_str()))
+		PVRShellOutputDebug("WARNING: Could not write the program cache: %s\n", CachePath.c_str());
+
+	m_fShaderSetupMS = (float)(GetTimeMS() - dStartMS);
+	PVRShellOutputDebug("Shader setup: %.2fms, %u of %u programs from the cache (%s start)\n", m_fShaderSetupMS,
+						m_uiProgramsCached, m_uiProgramsCached + m_uiProgramsCompiled, GetShaderStartType());
+	return true;
+	}
+
+// ---------------------------------------------------------------
+GenericShader* MyPVRDemo::GetEffectShader(unsigned int uiEffect)
+	{
+	GenericShader* const apShaders[] =
+		{
+		&m_StatueShader,		// enumEFFECT_Model
+		&m_ChurchShader,		// enumEFFECT_Church
+		&m_SATexShader,			// enumEFFECT_ScreenAlignedTex
+		&m_Bloom1Shader,		// enumEFFECT_Bloom1
+		&m_BloomBlurShader,		// enumEFFECT_BloomBlur
+		&m_SimpleShader,		// enumEFFECT_SimpleModel
+		&m_ChurchReflShader,	// enumEFFECT_ChurchRefl
+		&m_BloomDownShader,		// enumEFFECT_BloomDown
+		&m_BloomUpShader,		// enumEFFECT_BloomUp
+		&m_FloorShader,			// enumEFFECT_Floor
+		&m_CrowdPaletteShader,	// enumEFFECT_CrowdPalette
+		&m_CrowdInstancedShader,	// enumEFFECT_CrowdInstanced
+		};
+	ASSERT(ELEMENTS_IN_ARRAY(apShaders) == enumEFFECT_MAX);
+	return apShaders[uiEffect];
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::IsEffectUsed(unsigned int uiEffect) const
+	{
+	// The crowd's programs are only built for the path it's drawn with
+	if(uiEffect == enumEFFECT_CrowdPalette)
+		return m_uiCrowd && m_nCrowdPath == enumCROWD_Palette;
+	if(uiEffect == enumEFFECT_CrowdInstanced)
+		return m_uiCrowd && m_nCrowdPath == enumCROWD_Instanced;
+	return true;
+	}
+
+// ---------------------------------------------------------------
+const char* MyPVRDemo::GetShaderStartType() const
+	{
+	if(!m_uiProgramsCompiled)
+		return "warm";
+	return m_uiProgramsCached ? "partial" : "cold";
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::GetVertexDecodeUniforms(GenericShader* pShader)
+	{
+	pShader->uiPosScale			= glGetUniformLocation(pShader->uiID, "vPosScale");
+	pShader->uiPosBias			= glGetUniformLocation(pShader->uiID, "vPosBias");
+	pShader->uiUVScaleBias[0]	= glGetUniformLocation(pShader->uiID, "vUVScaleBias0");
+	pShader->uiUVScaleBias[1]	= glGetUniformLocation(pShader->uiID, "vUVScaleBias1");
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::UploadBuffer(GLenum eTarget, GLuint uiBuffer, unsigned int uiPackageType, unsigned int uiIndex, const void* pData, unsigned int uiSize)
+	{
+	glBindBuffer(eTarget, uiBuffer);
+	glBufferData(eTarget, uiSize, pData, GL_STATIC_DRAW);
+
+	if(m_pPackageWriter)
+		m_pPackageWriter->Add(uiPackageType, uiIndex, pData, uiSize);
+	}
+
+// ---------------------------------------------------------------
+const void* MyPVRDemo::FindPackageEntry(unsigned int uiPackageType, unsigned int uiIndex, unsigned int* puiSize, CPVRTString* pErrorStr) const
+	{
+	// A package baked by a different build, or cut short, may be missing entries the header didn't catch
+	const void* pData = m_Package.Find(uiPackageType, uiIndex, puiSize);
+	if(!pData)
+		{
+		char szError[256];
+		sprintf(szError, "ERROR: %s has no entry of type %u for mesh %u\n", m_PackageFile.c_str(), uiPackageType, uiIndex);
+		*pErrorStr = szError;
+		}
+	return pData;
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::UploadPackageBuffer(GLenum eTarget, GLuint uiBuffer, unsigned int uiPackageType, unsigned int uiIndex, CPVRTString* pErrorStr)
+	{
+	unsigned int uiSize = 0;
+	const void* pData = FindPackageEntry(uiPackageType, uiIndex, &uiSize, pErrorStr);
+	if(!pData)
+		return false;
+
+	UploadBuffer(eTarget, uiBuffer, uiPackageType, uiIndex, pData, uiSize);
+	return true;
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::LoadVBOs(CPVRTString* pErrorStr)
+	{
+	// The loader may not know how many meshes there are yet, and unused names cost nothing
+	glGenBuffers(SCENE_MAX_MESHES, m_uiVBO);
+	glGenBuffers(SCENE_MAX_MESHES, m_uiVBOIdx);
+	glGenBuffers(SCENE_MAX_MESHES, m_uiDepthVBO);
+	glGenBuffers(SCENE_MAX_MESHES, m_uiDepthVBOIdx);
+
+	// Baked data is already in its final layout
+	if(m_Package.IsOpen())
+		{
+		for(unsigned int i = 0; i < m_Scene.GetNumMeshes(); ++i)
+			{
+			bool bLoaded = UploadPackageBuffer(GL_ARRAY_BUFFER, m_uiVBO[i], enumPACKAGE_Vertices, i, pErrorStr) &&
+						   UploadPackageBuffer(GL_ELEMENT_ARRAY_BUFFER, m_uiVBOIdx[i], enumPACKAGE_Indices, i, pErrorStr);
+			if(bLoaded && m_Scene.UsesMesh(ROLE_BIT(enumMODEL_Statue), i))
+				{
+				bLoaded = UploadPackageBuffer(GL_ARRAY_BUFFER, m_uiDepthVBO[i], enumPACKAGE_DepthVertices, i, pErrorStr) &&
+						  UploadPackageBuffer(GL_ELEMENT_ARRAY_BUFFER, m_uiDepthVBOIdx[i], enumPACKAGE_DepthIndices, i, pErrorStr);
+				}
+			if(!bLoaded)
+				return false;
+
+			if(m_uiCrowd && (int)i == m_Scene.GetRoleNode(enumMODEL_Statue).nMesh)
+				{
+				unsigned int uiSize = 0, uiVertexBytes = 0;
+				const void* pVertices = m_Package.Find(enumPACKAGE_Vertices, i, &uiVertexBytes);
+				const void* pIndices = m_Package.Find(enumPACKAGE_Indices, i, &uiSize);
+				PrepareCrowdMesh(i, pVertices, uiVertexBytes, (const unsigned short*)pIndices, uiSize / sizeof(unsigned short));
+				}
+			}
+
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		return true;
+		}
+
+	// The loader builds the meshes on its worker threads
+	if(m_bLoading)
+		return true;
+
+	for(unsigned int i = 0; i < m_Scene.GetNumMeshes(); ++i)
+		{
+		MeshPayload Payload;
+		BuildMesh(i, &Payload);
+		UploadMesh(i, &Payload);
+		}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	return true;
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::BuildMesh(unsigned int uiMeshIdx, MeshPayload* pPayload) const
+	{
+	// No GL calls in here; it runs on the loader's threads
+	SPODMesh& Mesh = m_Model.pMesh[uiMeshIdx];
+
+	// Compress a copy of the vertices rather than uploading the POD's floats
+	CompactVertexStats Stats;
+	unsigned char* pVertices = CompressMesh(Mesh, &pPayload->Format, &Stats);
+
+	PVRShellOutputDebug("Mesh %u: %u -> %u vertex bytes (%u saved). Max error: position %f, normal %.3f deg, tangent %.3f deg, UV %f\n",
+						uiMeshIdx, Stats.uiOriginalBytes, Stats.uiCompactBytes, Stats.uiOriginalBytes - Stats.uiCompactBytes,
+						Stats.fMaxPosError, Stats.fMaxNrmError, Stats.fMaxTanError, Stats.fMaxUVError);
+
+	// Work on a copy of the indices too; the POD's own data is left untouched
+	unsigned int uiNumIndices = PVRTModelPODCountIndices(Mesh);
+	unsigned short* puIndices = new unsigned short[uiNumIndices];
+	memcpy(puIndices, Mesh.sFaces.pData, uiNumIndices * sizeof(unsigned short));
+
+	// Only indexed triangle lists are re-ordered
+	if(m_bMeshOpt && !Mesh.nNumStrips && Mesh.sFaces.eType == EPODDataUnsignedShort)
+		{
+		VertexCacheStats Before, After;
+		MeasureVertexCache(puIndices, uiNumIndices, Mesh.nNumVertex, &Before);
+
+		double dStartMS = GetTimeMS();
+		unsigned short* puTemp = new unsigned short[uiNumIndices];
+		OptimiseVertexCache(puIndices, puTemp, uiNumIndices, Mesh.nNumVertex);
+		OptimiseOverdraw(puTemp, puIndices, uiNumIndices, Mesh);
+		OptimiseVertexFetch(puIndices, uiNumIndices, pVertices, Mesh.nNumVertex, pPayload->Format.nStride);
+		delete [] puTemp;
+		double dEndMS = GetTimeMS();
+
+		MeasureVertexCache(puIndices, uiNumIndices, Mesh.nNumVertex, &After);
+		PVRShellOutputDebug("Mesh %u: %u triangles. ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (%.2fms)\n",
+							uiMeshIdx, uiNumIndices / 3, Before.fACMR, After.fACMR, Before.fATVR, After.fATVR, dEndMS - dStartMS);
+		}
+
+	pPayload->pVertices		= pVertices;
+	pPayload->uiVertexBytes	= Stats.uiCompactBytes;
+	pPayload->puIndices		= puIndices;
+	pPayload->uiNumIndices	= uiNumIndices;
+
+	// Only the statue casts a shadow, and the shadow pass is the only one that draws the depth streams, so the other
+	// meshes go without. The statue's is given a reduced LOD.
+	pPayload->pnDepthVertices		= NULL;
+	pPayload->uiDepthVertexBytes	= 0;
+	pPayload->puDepthIndices		= NULL;
+	pPayload->uiDepthNumIndices		= 0;
+	if(m_Scene.UsesMesh(ROLE_BIT(enumMODEL_Statue), uiMeshIdx))
+		BuildDepthStream(uiMeshIdx, m_bShadowLOD && (int)uiMeshIdx == m_Scene.GetRoleNode(enumMODEL_Statue).nMesh, pPayload);
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::BuildDepthStream(unsigned int uiMeshIdx, bool bSimplify, MeshPayload* pPayload) const
+	{
+	SPODMesh& Mesh = m_Model.pMesh[uiMeshIdx];
+	const CompactVertexFormat& Format = pPayload->Format;
+
+	// Depth passes only need positions, so vertices split by UV or normal seams can be merged
+	unsigned int uiNumIndices = PVRTModelPODCountIndices(Mesh);
+	unsigned int uiNumTris = uiNumIndices / 3;
+	unsigned short* puIndices = new unsigned short[uiNumIndices];
+	memcpy(puIndices, Mesh.sFaces.pData, uiNumIndices * sizeof(unsigned short));
+
+	PVRTVec3* pvPositions = new PVRTVec3[Mesh.nNumVertex];
+	unsigned int uiNumVertices = WeldPositions(Mesh, puIndices, uiNumIndices, pvPositions);
+	uiNumIndices = RemoveDegenerates(puIndices, uiNumIndices);
+
+	float fError = 0.0f;
+	if(bSimplify)
+		{
+		unsigned int uiBudget = m_uiShadowTris ? m_uiShadowTris : (unsigned int)(uiNumTris * SHADOW_LOD_DEFAULT_RATIO);
+		float fMaxError = SHADOW_LOD_MAX_ERROR * Format.vPosScale.length();
+		uiNumIndices = SimplifyMesh(pvPositions, uiNumVertices, puIndices, uiNumIndices, uiBudget * 3, fMaxError, &fError);
+		}
+
+	if(m_bMeshOpt)
+		{
+		unsigned short* puTemp = new unsigned short[uiNumIndices];
+		OptimiseVertexCache(puIndices, puTemp, uiNumIndices, uiNumVertices);
+		memcpy(puIndices, puTemp, uiNumIndices * sizeof(unsigned short));
+		delete [] puTemp;
+		}
+
+	// Same quantisation as the full vertex data, packed tightly so the shaders' decode uniforms still apply
+	short* pnVertices = new short[uiNumVertices * 4];
+	for(unsigned int v = 0; v < uiNumVertices; ++v)
+		{
+		for(unsigned int c = 0; c < 3; ++c)
+			pnVertices[v * 4 + c] = QuantiseSNorm((pvPositions[v].ptr()[c] - Format.vPosBias.ptr()[c]) / Format.vPosScale.ptr()[c]);
+		pnVertices[v * 4 + 3] = 0;
+		}
+
+	// Collapsed vertices end up unreferenced; the fetch re-order moves them to the end where they're dropped
+	uiNumVertices = OptimiseVertexFetch(puIndices, uiNumIndices, (unsigned char*)pnVertices, uiNumVertices, 4 * sizeof(short));
+
+	PVRShellOutputDebug("Mesh %u depth stream: %u -> %u vertices (%u bytes), %u -> %u triangles, max error %f\n",
+						uiMeshIdx, Mesh.nNumVertex, uiNumVertices, uiNumVertices * 4 * (unsigned int)sizeof(short),
+						uiNumTris, uiNumIndices / 3, fError);
+
+	pPayload->pnDepthVertices		= pnVertices;
+	pPayload->uiDepthVertexBytes	= uiNumVertices * 4 * sizeof(short);
+	pPayload->puDepthIndices		= puIndices;
+	pPayload->uiDepthNumIndices		= uiNumIndices;
+	delete [] pvPositions;
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::UploadMesh(unsigned int uiMeshIdx, MeshPayload* pPayload)
+	{
+	UploadBuffer(GL_ARRAY_BUFFER, m_uiVBO[uiMeshIdx], enumPACKAGE_Vertices, uiMeshIdx, pPayload->pVertices, pPayload->uiVertexBytes);
+	UploadBuffer(GL_ELEMENT_ARRAY_BUFFER, m_uiVBOIdx[uiMeshIdx], enumPACKAGE_Indices, uiMeshIdx, pPayload->puIndices, pPayload->uiNumIndices * sizeof(GLshort));
+	if(pPayload->pnDepthVertices)
+		{
+		UploadBuffer(GL_ARRAY_BUFFER, m_uiDepthVBO[uiMeshIdx], enumPACKAGE_DepthVertices, uiMeshIdx, pPayload->pnDepthVertices, pPayload->uiDepthVertexBytes);
+		UploadBuffer(GL_ELEMENT_ARRAY_BUFFER, m_uiDepthVBOIdx[uiMeshIdx], enumPACKAGE_DepthIndices, uiMeshIdx, pPayload->puDepthIndices, pPayload->uiDepthNumIndices * sizeof(GLshort));
+		}
+
+	m_VertexFormat[uiMeshIdx]		= pPayload->Format;
+	m_uiNumIndices[uiMeshIdx]		= pPayload->uiNumIndices;
+	m_uiDepthNumIndices[uiMeshIdx]	= pPayload->uiDepthNumIndices;
+
+	if(m_uiCrowd && (int)uiMeshIdx == m_Scene.GetRoleNode(enumMODEL_Statue).nMesh)
+		PrepareCrowdMesh(uiMeshIdx, pPayload->pVertices, pPayload->uiVertexBytes, pPayload->puIndices, pPayload->uiNumIndices);
+
+	delete [] pPayload->pVertices;
+	delete [] pPayload->puIndices;
+	delete [] pPayload->pnDepthVertices;
+	delete [] pPayload->puDepthIndices;
+	pPayload->pVertices = NULL;
+	pPayload->puIndices = NULL;
+	pPayload->pnDepthVertices = NULL;
+	pPayload->puDepthIndices = NULL;
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::CreateVAOs()
+	{
+	memset(m_uiVAO, 0, sizeof(m_uiVAO));
+	m_bVAOActive = false;
+
+	if(!m_bVAO || !CPVRTgles2Ext::IsGLExtensionSupported("GL_OES_vertex_array_object"))
+		return;
+
+	// Bake each layout once for every mesh drawn in its role. Binding the VAO through the state cache makes it forget
+	// the old attribute state, so SetMeshAttribs issues everything into the new VAO.
+	m_GLState.SetVertexArrayFunc(m_Extensions.glBindVertexArrayOES);
+	for(unsigned int n = 0; n < m_Scene.GetNumNodes(); ++n)
+		{
+		const SceneNode& Node = m_Scene.GetNode(n);
+		for(unsigned int i = 0; i < MESH_LAYOUT_MAX; ++i)
+			{
+			GLuint& uiVAO = m_uiVAO[Node.nMesh][i];
+			if(c_MeshLayouts[i].nRole != Node.nRole || uiVAO)
+				continue;
+
+			m_Extensions.glGenVertexArraysOES(1, &uiVAO);
+			m_GLState.BindVertexArray(uiVAO);
+			SetMeshAttribs(Node.nMesh, c_MeshLayouts[i].uiFlags);
+			}
+		}
+	m_GLState.BindVertexArray(0);
+
+	m_bVAOActive = true;
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::CreateFBOs(CPVRTString* pErrorStr)
 	{
 	// Get the original FBO ID
 	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &m_nOrigFBO);
 	
-	// --- Create 2 FBOs
-	glGenFramebuffers(enumFB_MAX, m_uiFBO);
-	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+
+	// --- The shadow map, reflection, bloom pyramid and scene targets, and their framebuffers
+	if(!BuildFrameGraph(pErrorStr))
+		return false;
+
+	m_DynRes.Init(m_fDynResBudgetMS, m_FG.uiSceneColour != FG_NONE);
+	ApplyDynamicResolution();
+
+	// --- Done with FBO, so bind the original frame buffer
+	glBindFramebuffer(GL_FRAMEBUFFER, m_nOrigFBO);
+	return true;
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::SetTargetSizes()
+	{
+	// What both renderers' targets are sized from. Needs no context.
+	// Don't let the bottom level get too small to be worth a pass
+	m_uiBloomLevels = PVRT_CLAMP(m_uiBloomLevels, 1u, (unsigned int)BLOOM_MAX_LEVELS);
+	while(m_uiBloomLevels > 1 && (m_uiBloomSize >> (m_uiBloomLevels - 1)) < BLOOM_MIN_SIZE)
+		--m_uiBloomLevels;
+
+	int nWidth = PVRShellGet(prefWidth), nHeight = PVRShellGet(prefHeight);
+	m_nReflWidth	= PVRT_MAX((int)(nWidth * m_fReflScale + 0.5f), 1);
+	m_nReflHeight	= PVRT_MAX((int)(nHeight * m_fReflScale + 0.5f), 1);
+
+	// The pyramid does most of the widening. The Gaussian only has to cover what's left at the bottom level.
+	float fSigma = m_fBloomRadius / (3.0f * (float)(1 << (m_uiBloomLevels - 1)));
+	GenerateBloomKernel(PVRT_MAX(fSigma, 0.5f), &m_BloomKernel);
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::BuildFrameGraph(CPVRTString* pErrorStr)
+	{
+	SetTargetSizes();
+	unsigned int uiBottom = m_uiBloomLevels - 1;
+	int nWidth = PVRShellGet(prefWidth), nHeight = PVRShellGet(prefHeight);
+	memset(&m_FG, 0xFF, sizeof(m_FG));
+
+	// --- Targets. The shadow map is kept from frame to frame (see CShadowScheduler), so it's made outside the graph.
+	m_FG.uiScreen		= m_FrameGraph.ImportResource("screen", enumFGFORMAT_RGBA8, nWidth, nHeight, 0);
+	m_FG.uiScreenDepth	= m_FrameGraph.ImportResource("screen_depth", enumFGFORMAT_Depth24, nWidth, nHeight, 0);		// Counted as 32 bits, whatever the config has
+	m_FG.uiShadowMap	= m_FrameGraph.ImportResource("shadow_map", enumFGFORMAT_Depth24, m_nShadowMapSize, m_nShadowMapSize, m_uiShadowMapTex);
+
+	// A conventional depth range in the reflection (see RenderReflection), so 16 bits will do
+	m_FG.uiReflColour	= m_FrameGraph.AddResource("reflection", enumFGFORMAT_RGBA8, m_nReflWidth, m_nReflHeight, FG_CLEAR);
+	m_FG.uiReflDepth	= m_FrameGraph.AddResource("reflection_depth", enumFGFORMAT_Depth16, m_nReflWidth, m_nReflHeight, FG_CLEAR, 1.0f);
+
+	// Only needed when the scene itself can be scaled. Full size: scaling renders into the bottom left corner, so changing
+	// the scale never reallocates. The scene uses a floating point depth projection, so give it as much precision as the GPU has.
+	if(m_bDynRes && m_bDynResScene)
+		{
+		bool bDepth24 = CPVRTgles2Ext::IsGLExtensionSupported("GL_OES_depth24");
+		m_FG.uiSceneColour	= m_FrameGraph.AddResource("scene", enumFGFORMAT_RGBA8, nWidth, nHeight, 0);
+		m_FG.uiSceneDepth	= m_FrameGraph.AddResource("scene_depth", bDepth24 ? enumFGFORMAT_Depth24 : enumFGFORMAT_Depth16, nWidth, nHeight, 0);
+		}
+
+	// The bloom passes only draw to the footprint in the corner their active size covers. Every pass but the upsamples
+	// clears all of its target as it starts, so the filters see black past the footprint and the corner's edge, and
+	// nothing is loaded.
+	for(unsigned int i = 0; i < m_uiBloomLevels; ++i)
+		m_FG.auiBloom[i] = m_FrameGraph.AddResource(c_pszBloomTargets[i], enumFGFORMAT_RGBA8, m_uiBloomSize >> i, m_uiBloomSize >> i, FG_CORNER);
+	m_FG.uiBloomScratch	= m_FrameGraph.AddResource("bloom_scratch", enumFGFORMAT_RGBA8, m_uiBloomSize >> uiBottom, m_uiBloomSize >> uiBottom, FG_CORNER);
+	m_FG.uiBloomDepth	= m_FrameGraph.AddResource("bloom_depth", enumFGFORMAT_Depth16, m_uiBloomSize, m_uiBloomSize, 0);		// Only the extract pass needs depth
+
+	// --- Passes, in the order they run
+	unsigned int uiSceneTarget = m_FG.uiSceneColour != FG_NONE ? m_FG.uiSceneColour : m_FG.uiScreen;
+	unsigned int uiSceneDepth = m_FG.uiSceneDepth != FG_NONE ? m_FG.uiSceneDepth : m_FG.uiScreenDepth;
+	m_FG.uiShadowPass = m_FrameGraph.AddPass("shadow");
+	m_FrameGraph.Write(m_FG.uiShadowPass, m_FG.uiShadowMap);
+	m_FrameGraph.SetActions(m_FG.uiShadowPass, m_FG.uiShadowMap, enumFGLOAD_Clear, enumFGSTORE_Store);		// All of it, so lookups outside the active corner read as lit
+
+	m_FG.uiReflPass = m_FrameGraph.AddPass("reflection");
+	m_FrameGraph.Write(m_FG.uiReflPass, m_FG.uiReflColour);
+	m_FrameGraph.Write(m_FG.uiReflPass, m_FG.uiReflDepth);
+
+	// Without the offscreen reflection nothing reads the target, and its pass is culled
+	m_FG.uiScenePass = m_FrameGraph.AddPass("scene");
+	m_FrameGraph.Read(m_FG.uiScenePass, m_FG.uiShadowMap);
+	if(m_bReflectionRTT)
+		m_FrameGraph.Read(m_FG.uiScenePass, m_FG.uiReflColour);
+	m_FrameGraph.Write(m_FG.uiScenePass, uiSceneTarget);
+	m_FrameGraph.Write(m_FG.uiScenePass, uiSceneDepth);
+	m_FrameGraph.SetActions(m_FG.uiScenePass, uiSceneTarget, enumFGLOAD_Clear, enumFGSTORE_Auto);
+	m_FrameGraph.SetActions(m_FG.uiScenePass, uiSceneDepth, enumFGLOAD_Clear, enumFGSTORE_Discard);		// Nothing after the scene depth tests
+
+	m_FG.uiBloomExtractPass = m_FrameGraph.AddPass("bloom_extract");
+	m_FrameGraph.Write(m_FG.uiBloomExtractPass, m_FG.auiBloom[0]);
+	m_FrameGraph.Write(m_FG.uiBloomExtractPass, m_FG.uiBloomDepth);
+	m_FrameGraph.SetActions(m_FG.uiBloomExtractPass, m_FG.auiBloom[0], enumFGLOAD_Clear, enumFGSTORE_Auto);
+	m_FrameGraph.SetActions(m_FG.uiBloomExtractPass, m_FG.uiBloomDepth, enumFGLOAD_Clear, enumFGSTORE_Discard);
+	for(unsigned int i = 1; i < m_uiBloomLevels; ++i)
+		{
+		m_FG.auiBloomDownPass[i] = m_FrameGraph.AddPass(c_pszBloomDownPasses[i]);
+		m_FrameGraph.Read(m_FG.auiBloomDownPass[i], m_FG.auiBloom[i - 1]);
+		m_FrameGraph.Write(m_FG.auiBloomDownPass[i], m_FG.auiBloom[i]);
+		m_FrameGraph.SetActions(m_FG.auiBloomDownPass[i], m_FG.auiBloom[i], enumFGLOAD_Clear, enumFGSTORE_Auto);
+		}
+	m_FG.uiBloomBlurHPass = m_FrameGraph.AddPass("bloom_blur_h");
+	m_FrameGraph.Read(m_FG.uiBloomBlurHPass, m_FG.auiBloom[uiBottom]);
+	m_FrameGraph.Write(m_FG.uiBloomBlurHPass, m_FG.uiBloomScratch);
+	m_FrameGraph.SetActions(m_FG.uiBloomBlurHPass, m_FG.uiBloomScratch, enumFGLOAD_Clear, enumFGSTORE_Auto);
+	m_FG.uiBloomBlurVPass = m_FrameGraph.AddPass("bloom_blur_v");
+	m_FrameGraph.Read(m_FG.uiBloomBlurVPass, m_FG.uiBloomScratch);
+	m_FrameGraph.Write(m_FG.uiBloomBlurVPass, m_FG.auiBloom[uiBottom]);
+	m_FrameGraph.SetActions(m_FG.uiBloomBlurVPass, m_FG.auiBloom[uiBottom], enumFGLOAD_Clear, enumFGSTORE_Auto);		// Not a load; the blur covers the footprint
+	for(unsigned int i = uiBottom; i-- > 0;)
+		{
+		// Added on top of what's there
+		m_FG.auiBloomUpPass[i] = m_FrameGraph.AddPass(c_pszBloomUpPasses[i]);
+		m_FrameGraph.Read(m_FG.auiBloomUpPass[i], m_FG.auiBloom[i + 1]);
+		m_FrameGraph.Read(m_FG.auiBloomUpPass[i], m_FG.auiBloom[i]);
+		m_FrameGraph.Write(m_FG.auiBloomUpPass[i], m_FG.auiBloom[i]);
+		}
+
+	m_FG.uiCompositePass = m_FrameGraph.AddPass("bloom_composite");
+	m_FrameGraph.Read(m_FG.uiCompositePass, m_FG.auiBloom[0]);
+	if(m_FG.uiSceneColour != FG_NONE)
+		m_FrameGraph.Read(m_FG.uiCompositePass, m_FG.uiSceneColour);
+	m_FrameGraph.Write(m_FG.uiCompositePass, uiSceneTarget);
+	if(uiSceneTarget == m_FG.uiScreen)
+		{
+		// The screen's depth buffer comes along whether it's used or not, so say it isn't
+		m_FrameGraph.Write(m_FG.uiCompositePass, m_FG.uiScreenDepth);
+		m_FrameGraph.SetActions(m_FG.uiCompositePass, m_FG.uiScreenDepth, enumFGLOAD_DontCare, enumFGSTORE_Discard);
+		}
+
+	if(m_FG.uiSceneColour != FG_NONE)
+		{
+		// Covers the whole screen
+		m_FG.uiUpscalePass = m_FrameGraph.AddPass("upscale");
+		m_FrameGraph.Read(m_FG.uiUpscalePass, m_FG.uiSceneColour);
+		m_FrameGraph.Write(m_FG.uiUpscalePass, m_FG.uiScreen);
+		m_FrameGraph.Write(m_FG.uiUpscalePass, m_FG.uiScreenDepth);
+		m_FrameGraph.SetActions(m_FG.uiUpscalePass, m_FG.uiScreen, enumFGLOAD_DontCare, enumFGSTORE_Store);
+		m_FrameGraph.SetActions(m_FG.uiUpscalePass, m_FG.uiScreenDepth, enumFGLOAD_DontCare, enumFGSTORE_Discard);
+		}
+
+	bool bDiscard = m_bFGDiscard && CPVRTgles2Ext::IsGLExtensionSupported("GL_EXT_discard_framebuffer");
+	m_FrameGraph.SetDiscardFunc(bDiscard ? m_Extensions.glDiscardFramebufferEXT : NULL);
+	if(!m_FrameGraph.Compile(m_bFGAlias, pErrorStr) || !m_FrameGraph.Realise((GLuint)m_nOrigFBO, pErrorStr))
+		return false;
+
+	// The bloom passes work in the bottom left corner of wherever their levels ended up
+	for(unsigned int i = 0; i <= m_uiBloomLevels; ++i)
+		{
+		bool bScratch = i == m_uiBloomLevels;
+		BloomLevel& Level = bScratch ? m_BloomScratch : m_BloomLevels[i];
+		unsigned int uiResource = bScratch ? m_FG.uiBloomScratch : m_FG.auiBloom[i];
+		Level.uiTexture	= m_FrameGraph.GetTexture(uiResource);
+		Level.nWidth	= m_FrameGraph.GetWidth(uiResource);
+		Level.nHeight	= m_FrameGraph.GetHeight(uiResource);
+		}
+
+	PVRShellOutputDebug("Bloom: %u levels from %ux%u, sigma %.2f at the bottom level (%u taps)\n",
+						m_uiBloomLevels, m_uiBloomSize, m_uiBloomSize, m_BloomKernel.fSigma, m_BloomKernel.uiNumTaps * 2 + 1);
+	PVRShellOutputDebug("Frame graph: %u passes (%u culled), %u targets in %u allocations, %.1fKB before aliasing, %.1fKB after\n",
+						m_FrameGraph.GetNumPasses(), m_FrameGraph.GetNumCulled(), m_FrameGraph.GetNumTargets(), m_FrameGraph.GetNumAllocations(),
+						m_FrameGraph.GetUnaliasedBytes() / 1024.0f, m_FrameGraph.GetAliasedBytes() / 1024.0f);
+	for(unsigned int i = 0; i < m_FrameGraph.GetNumResources(); ++i)
+		{
+		const FGResource& Resource = m_FrameGraph.GetResource(i);
+		if(Resource.uiAllocation != FG_NONE)
+			PVRShellOutputDebug("  %-16s %4dx%-4d %-7s in allocation %u (%dx%d)\n", Resource.pszName, Resource.nWidth, Resource.nHeight,
+								c_pszFGFormats[Resource.eFormat], Resource.uiAllocation, m_FrameGraph.GetWidth(i), m_FrameGraph.GetHeight(i));
+		}
+	PVRShellOutputDebug("Load and store actions (%s):\n", m_FrameGraph.HasDiscard() ? "with EXT_discard_framebuffer" : "without discard, so not caring loads and discarding stores");
+	for(unsigned int p = 0; p < m_FrameGraph.GetNumPasses(); ++p)
+		{
+		if(m_FrameGraph.IsCulled(p))
+			continue;
+		const FGPass& Pass = m_FrameGraph.GetPass(p);
+		PVRShellOutputDebug("  %-16s", Pass.pszName);
+		if(Pass.uiColour != FG_NONE)
+			PVRShellOutputDebug(" %s %s/%s", m_FrameGraph.GetResource(Pass.uiColour).pszName, c_pszFGLoads[Pass.aeLoad[0]], c_pszFGStores[Pass.aeStore[0]]);
+		if(Pass.uiDepth != FG_NONE)
+			PVRShellOutputDebug(" %s %s/%s", m_FrameGraph.GetResource(Pass.uiDepth).pszName, c_pszFGLoads[Pass.aeLoad[1]], c_pszFGStores[Pass.aeStore[1]]);
+		PVRShellOutputDebug("\n");
+		}
+	return true;
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::ReleaseFrameGraph()
+	{
+	m_FrameGraph.Release();
+	memset(&m_FG, 0xFF, sizeof(m_FG));
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::IsSceneDirect() const
+	{
+	// With the scene target at full size the scene is drawn straight to the screen (see ApplyDynamicResolution), which the
+	// frame graph's scene and composite passes don't cover. Their targets are bound and cleared the old way, and not counted.
+	return m_FG.uiSceneColour != FG_NONE && m_uiSceneFBO == (GLuint)m_nOrigFBO;
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::UpdateDynamicResolution(double dFrameStartMS)
+	{
+	// Judged on the slower of the GPU's time for the last frame it finished and the CPU's time for the last frame.
+	// Without timer queries it falls back to the time between frames, which does include the GPU holding up the swap,
+	// but under vsync never drops below the refresh interval; so it can see when to scale down but not when to come back up.
+	float fFrameMS;
+	if(m_Profiler.HasGPUTimers())
+		fFrameMS = PVRT_MAX(m_Profiler.GetLastGPUFrameMS(), m_fLastCPUFrameMS);
+	else
+		fFrameMS = m_dLastFrameStartMS > 0.0 ? (float)(dFrameStartMS - m_dLastFrameStartMS) : 0.0f;
+	m_dLastFrameStartMS = dFrameStartMS;
+
+	if(fFrameMS <= 0.0f || !m_DynRes.Update(fFrameMS))
+		return;
+
+	ApplyDynamicResolution();
+	PVRShellOutputDebug("Dynamic resolution: %.2fms against %.2fms; bloom %.3f (%dx%d), shadow %.3f (%dx%d), scene %.3f (%dx%d)\n",
+						fFrameMS, m_DynRes.GetBudgetMS(),
+						m_DynRes.GetScale(enumDYNRES_Bloom), m_BloomLevels[0].nActive, m_BloomLevels[0].nActive,
+						m_DynRes.GetScale(enumDYNRES_Shadow), m_nShadowMapActive, m_nShadowMapActive,
+						m_DynRes.GetScale(enumDYNRES_Scene), m_nSceneWidth, m_nSceneHeight);
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::ApplyDynamicResolution()
+	{
+	// Every target keeps its full size allocation and is drawn into its bottom left corner, so a change costs nothing.
+	m_nShadowMapActive = PVRT_MAX(((int)(m_nShadowMapSize * m_DynRes.GetScale(enumDYNRES_Shadow)) + 4) & ~7, 8);
+
+	// The top bloom level is rounded so that every level below it is still exactly half the one above
+	int nAlign = 1 << (m_uiBloomLevels - 1);
+	int nTop = ((int)(m_uiBloomSize * m_DynRes.GetScale(enumDYNRES_Bloom)) + nAlign / 2) / nAlign * nAlign;
+	nTop = PVRT_CLAMP(nTop, nAlign, (int)m_uiBloomSize);
+	for(unsigned int i = 0; i < m_uiBloomLevels; ++i)
+		m_BloomLevels[i].nActive = nTop >> i;		// The passes clear all of their targets, so nothing's left from the old size
+	m_BloomScratch.nActive = m_BloomLevels[m_uiBloomLevels - 1].nActive;
+
+	int nWidth = PVRShellGet(prefWidth), nHeight = PVRShellGet(prefHeight);
+	float fSceneScale = m_DynRes.GetScale(enumDYNRES_Scene);
+	if(m_FG.uiSceneColour != FG_NONE && fSceneScale < 1.0f)
+		{
+		m_uiSceneFBO	= m_FrameGraph.GetFramebuffer(m_FG.uiScenePass);
+		m_nSceneWidth	= PVRT_MAX((int)(nWidth * fSceneScale + 0.5f), 1);
+		m_nSceneHeight	= PVRT_MAX((int)(nHeight * fSceneScale + 0.5f), 1);
+		}
+	else
+		{
+		m_uiSceneFBO	= (GLuint)m_nOrigFBO;
+		m_nSceneWidth	= nWidth;
+		m_nSceneHeight	= nHeight;
+		}
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::SetBloomTarget(unsigned int uiPass, const PixelRect& Rect)
+	{
+	m_FrameGraph.BeginPass(uiPass, m_GLState);
+	m_GLState.Viewport(Rect.nX, Rect.nY, Rect.nWidth, Rect.nHeight);
+	m_GLState.Scissor(Rect.nX, Rect.nY, Rect.nWidth, Rect.nHeight);
+	m_GLState.Enable(GL_SCISSOR_TEST);
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::DrawBloomQuad(const BloomLevel& Level, const PixelRect& Rect)
+	{
+	// Fills the viewport set by SetBloomTarget
+	PVRTVec2 vTTL, vTBR;
+	GetBloomQuadUVs(Level, Rect, vTTL, vTBR);
+	RenderScreenAlignedTexture(PVRTVec2(-1.0f, 1.0f), PVRTVec2(1.0f, -1.0f), vTTL, vTBR);
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::GetBloomQuadUVs(const BloomLevel& Level, const PixelRect& Rect, PVRTVec2& vTTL, PVRTVec2& vTBR) const
+	{
+	// Every level covers the whole screen, so the same texture coordinates pick out the region in the level being read
+	float fScaleX = 1.0f / Level.nWidth, fScaleY = 1.0f / Level.nHeight;
+	vTTL = PVRTVec2(Rect.nX * fScaleX, (Rect.nY + Rect.nHeight) * fScaleY);
+	vTBR = PVRTVec2((Rect.nX + Rect.nWidth) * fScaleX, Rect.nY * fScaleY);
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::InitApplication()
+	{
+#ifdef PLATFORM_IOS
+	CPVRTResourceFile::SetReadPath((char*)PVRShellGet(prefReadPath));
+#endif
+
+	m_dStartupMS = GetTimeMS();
+
+	ParseCommandLine();
+	if(m_bBake)
+		{
+		PVRShellSet(prefPBufferContext, true);
+		m_pPackageWriter = new CPackageWriter;
+		}
+
+	// The render thread is one of the job system's threads
+	unsigned int uiJobThreads = m_uiJobThreads ? m_uiJobThreads : PVRT_MIN(GetCPUCount(), (unsigned int)JOB_MAX_THREADS);
+	bool bSoft = m_bSoftRaster || m_bRegress;
+	if(m_bJobBench || bSoft)
+		{
+		// These start the job system themselves, the benchmarks for each thread count in turn. None draws anything with
+		// GL, so a window would just get in the way. The software rasterizer doesn't get a context at all; it runs below.
+		PVRShellSet(prefPBufferContext, true);
+		m_uiJobThreads = uiJobThreads;
+		}
+	else
+		m_Jobs.Start(uiJobThreads);
+
+	if(m_bMathBench || m_bMeshBench)
+		PVRShellSet(prefPBufferContext, true);
+
+	if(m_bBenchmark)
+		{
+		// Render to a pbuffer so no window (or display) is required, and don't let vsync cap the frame rate.
+		PVRShellSet(prefPBufferContext, true);
+		PVRShellSet(prefSwapInterval, 0);
+
+		m_pfBenchFrameMS = new float[m_uiBenchFrames];
+		m_Profiler.SetWindowSize(m_uiBenchFrames);		// Keep every timed frame, not just the most recent
+		if(m_uiCrowd)
+			{
+			m_pfBenchCrowdMS = new float[m_uiBenchFrames];
+			m_pfBenchCrowdUpdateMS = new float[m_uiBenchFrames];
+			}
+		}
+
+	// The crowd sweep goes up in factors of 4 to the full crowd, with the timed frames split evenly between the steps
+	if(m_uiCrowd)
+		{
+		m_pvCrowd = new PVRTVec4[m_uiCrowd];
+		m_pvCrowdDraw = new PVRTVec4[m_uiCrowd];
+		m_puCrowdKeys = new unsigned int[m_uiCrowd];
+		m_puCrowdTemp = new unsigned int[m_uiCrowd];
+		m_uiCrowdSteps = 0;
+		for(unsigned int uiCount = 1; m_bCrowdSweep && m_bBenchmark && uiCount < m_uiCrowd && m_uiCrowdSteps < CROWD_MAX_STEPS - 1; uiCount *= 4)
+			m_aCrowdSteps[m_uiCrowdSteps++].uiCount = uiCount;
+		m_aCrowdSteps[m_uiCrowdSteps++].uiCount = m_uiCrowd;
+		for(unsigned int i = 0; i < m_uiCrowdSteps; ++i)
+			m_aCrowdSteps[i].uiDraws = m_aCrowdSteps[i].uiVertices = m_aCrowdSteps[i].uiVisible = 0;
+		}
+	
+	if(m_bUsePackage)
+		{
+		if(!OpenPackage())
+			{
+			PVRShellSet(prefExitMessage, "ERROR: Couldn't load the package\n");
+			return false;
+			}
+		}
+	else if(m_bAsyncLoad && !m_bBake && !bSoft && StartLoading())
+		{
+		// The POD and textures arrive on the loader's threads while RenderScene draws placeholder frames
+		}
+	else if(!LoadPOD())
+		{
+		PVRShellSet(prefExitMessage, "ERROR: Couldn't load the .pod file\n");
+		return false;
+		}
+
+	// Some nice variables
+	m_fAngleY = 0.0f;
+	m_fBloomMulti = 0.3f;
+	m_ulCurrTime = 0;
+	m_fLightAngle = PVRT_PI / 8;	// Offset by 22.5degrees to begin with, so we see the shadow slightly offset from behind the model.
+
+	// The software rasterizer runs here and quits, so the shell never makes a context. Returning false from here skips
+	// QuitApplication, so it's called first.
+	if(bSoft)
+		{
+		CPVRTString ErrorStr;
+		if(!InitSoftRaster(&ErrorStr))
+			PVRShellSet(prefExitMessage, ErrorStr.c_str());
+		else if(m_bRegress && !RunRegression())
+			PVRShellSet(prefExitMessage, "ERROR: Regression: an image doesn't match its golden, or a budget was exceeded. See regress.json\n");
+		else if(!m_bRegress && !RunSoftRaster())
+			PVRShellSet(prefExitMessage, "ERROR: The software rasterizer's frames couldn't be written, or depend on the thread count\n");
+		QuitApplication();
+		return false;
+		}
+
+	return true;
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::StartLoading()
+	{
+	// Leave a core for the GL thread
+	unsigned int uiWorkers = m_uiLoadThreads;
+	if(!uiWorkers)
+		uiWorkers = PVRT_CLAMP(GetCPUCount() - 1, 1u, 4u);
+
+	if(!m_Loader.Start(uiWorkers, m_dStartupMS))
+		return false;
+
+	memset(m_abAssetFailed, 0, sizeof(m_abAssetFailed));
+	memset(m_apTextureFiles, 0, sizeof(m_apTextureFiles));
+	memset(m_tex, 0, sizeof(m_tex));
+	m_uiAssetsUploaded = 0;
+	m_bLoading = true;
+
+	// CancelLoading frees whatever's here, built or not
+	for(unsigned int i = 0; i < SCENE_MAX_MESHES; ++i)
+		{
+		MeshPayload& Payload = m_MeshPayload[i];
+		Payload.pVertices = NULL;
+		Payload.puIndices = NULL;
+		Payload.pnDepthVertices = NULL;
+		Payload.puDepthIndices = NULL;
+		}
+	m_bLoadedAsync = true;
+
+	m_Loader.Submit(enumASSET_Scene, c_szSceneFile, LoadTask, this);
+	for(unsigned int i = 0; i < enumTEXTURE_MAX; ++i)
+		m_Loader.Submit(enumASSET_Texture + i, c_pszTextures[i], LoadTask, this);
+
+	return true;
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::LoadTask(void* pUserData, unsigned int uiAsset)
+	{
+	((MyPVRDemo*)pUserData)->RunLoadTask(uiAsset);
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::RunLoadTask(unsigned int uiAsset)
+	{
+	// Runs on a loader thread. Nothing here may touch GL.
+	if(uiAsset == enumASSET_Scene)
+		{
+		if(!LoadPOD())
+			{
+			m_abAssetFailed[uiAsset] = true;
+			return;
+			}
+
+		// The meshes can only be built once the POD is in
+		for(unsigned int i = 0; i < m_Scene.GetNumMeshes(); ++i)
+			{
+			sprintf(m_aszMeshAssets[i], "Mesh %u", i);
+			m_Loader.Submit(enumASSET_Mesh + i, m_aszMeshAssets[i], LoadTask, this);
+			}
+		}
+	else if(uiAsset < enumASSET_Texture)
+		{
+		BuildMesh(uiAsset - enumASSET_Mesh, &m_MeshPayload[uiAsset - enumASSET_Mesh]);
+		}
+	else
+		{
+		unsigned int uiTexture = uiAsset - enumASSET_Texture;
+		m_apTextureFiles[uiTexture] = new CPVRTResourceFile(c_pszTextures[uiTexture]);
+		m_abAssetFailed[uiAsset] = !m_apTextureFiles[uiTexture]->IsOpen();
+		}
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::UploadAsset(unsigned int uiAsset)
+	{
+	if(m_abAssetFailed[uiAsset])
+		{
+		m_LoadError = CPVRTString("ERROR: Could not load: ") + CPVRTString(m_Loader.GetTiming(uiAsset).pszName);
+		return false;
+		}
+
+	++m_uiAssetsUploaded;
+	if(uiAsset == enumASSET_Scene)
+		{
+		m_uiNumMeshAssets = m_Scene.GetNumMeshes();
+		return true;			// Nothing to upload; it's the meshes that follow
+		}
+
+	if(uiAsset < enumASSET_Texture)
+		{
+		UploadMesh(uiAsset - enumASSET_Mesh, &m_MeshPayload[uiAsset - enumASSET_Mesh]);
+		return true;
+		}
+
+	unsigned int uiTexture = uiAsset - enumASSET_Texture;
+	bool bResult = LoadTexture(uiTexture, m_apTextureFiles[uiTexture]->DataPtr(), &m_LoadError);
+	delete m_apTextureFiles[uiTexture];
+	m_apTextureFiles[uiTexture] = NULL;
+	return bResult;
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::RenderLoadingFrame()
+	{
+	// Upload whatever the workers have finished, without holding the placeholder frame up for too long
+	double dStartMS = GetTimeMS();
+	unsigned int uiAsset;
+	while(GetTimeMS() - dStartMS < LOADER_UPLOAD_BUDGET_MS && m_Loader.PopReady(&uiAsset))
+		{
+		m_Loader.BeginUpload(uiAsset);
+		bool bResult = UploadAsset(uiAsset);
+		m_Loader.EndUpload(uiAsset);
+
+		if(!bResult)
+			{
+			CancelLoading();
+			PVRShellSet(prefExitMessage, m_LoadError.c_str());
+			return false;
+			}
+		}
+
+	// Uploads went straight to GL
+	m_GLState.Invalidate();
+
+	// --- Placeholder frame
+	const unsigned int c_uiNumAssets = 1 + m_uiNumMeshAssets + enumTEXTURE_MAX;		// The meshes are counted once the POD's in
+	m_GLState.BindFramebuffer(m_nOrigFBO);
+	m_GLState.Viewport(0, 0, PVRShellGet(prefWidth), PVRShellGet(prefHeight));
+	m_GLState.ClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	m_Print3D.Print3D(2.0f, 2.0f, 1.0f, PVRTRGBA(255, 255, 255, 255), "Loading... %u/%u", m_uiAssetsUploaded, c_uiNumAssets);
+	m_GLState.BindVertexArray(0);
+	m_GLState.VertexAttribArrays(0);
+	m_GLState.BindBuffer(GL_ARRAY_BUFFER, 0);
+	m_GLState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	m_Print3D.Flush();
+	m_GLState.Invalidate();
+
+	if(!m_uiPlaceholderFrames++)
+		m_fFirstPlaceholderMS = (float)(GetTimeMS() - m_dStartupMS);
+
+	if(m_Loader.IsDone())
+		FinishLoading();
+
+	return true;
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::FinishLoading()
+	{
+	m_Loader.Stop();
+	m_bLoading = false;
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	m_GLState.Invalidate();
+	CreateVAOs();
+
+	PrintLoadTimeline();
+
+	// Don't let the time spent loading show up as one huge step in the animation
+	m_ulCurrTime = PVRShellGetTime();
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::CancelLoading()
+	{
+	// Stopping drains the queue, so every payload is finished (or failed) after this
+	m_Loader.Stop();
+	m_bLoading = false;
+
+	for(unsigned int i = 0; i < SCENE_MAX_MESHES; ++i)
+		{
+		MeshPayload& Payload = m_MeshPayload[i];
+		delete [] Payload.pVertices;
+		delete [] Payload.puIndices;
+		delete [] Payload.pnDepthVertices;
+		delete [] Payload.puDepthIndices;
+		Payload.pVertices = NULL;
+		Payload.puIndices = NULL;
+		Payload.pnDepthVertices = NULL;
+		Payload.puDepthIndices = NULL;
+		}
+
+	for(unsigned int i = 0; i < enumTEXTURE_MAX; ++i)
+		{
+		delete m_apTextureFiles[i];
+		m_apTextureFiles[i] = NULL;
+		}
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::PrintLoadTimeline()
+	{
+	PVRShellOutputDebug("Asset timeline (ms since start-up):\n");
+	PVRShellOutputDebug("  %-24s %6s %8s %8s %8s %8s %8s\n", "Asset", "Thread", "Queued", "Start", "End", "Upload", "Done");
+	for(unsigned int i = 0; i < enumASSET_MAX; ++i)
+		{
+		const AssetTiming& Timing = m_Loader.GetTiming(i);
+		if(!Timing.pszName)
+			continue;
+
+		char szThread[8];
+		if(Timing.nWorker == LOADER_GL_THREAD)
+			strcpy(szThread, "GL");
+		else
+			sprintf(szThread, "%d", Timing.nWorker);
+
+		PVRShellOutputDebug("  %-24s %6s %8.2f %8.2f %8.2f %8.2f %8.2f\n", Timing.pszName, szThread,
+							Timing.dQueuedMS, Timing.dStartMS, Timing.dEndMS, Timing.dUploadStartMS, Timing.dUploadEndMS);
+		}
+
+	double dWallMS = m_Loader.GetWallMS(), dWorkMS = m_Loader.GetWorkMS();
+	PVRShellOutputDebug("Loading took %.2fms for %.2fms of work (%.2fms saved by overlapping). First placeholder frame at %.2fms, %u placeholder frames.\n",
+						dWallMS, dWorkMS, PVRT_MAX(dWorkMS - dWallMS, 0.0), m_fFirstPlaceholderMS, m_uiPlaceholderFrames);
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::LoadPOD()
+	{
+	if (m_Model.ReadFromFile(c_szSceneFile) != PVR_SUCCESS)
+		return false;
+
+	CPVRTString ErrorStr;
+	if(!m_Scene.BuildFromPOD(m_Model, &ErrorStr))
+		{
+		PVRShellOutputDebug("ERROR: %s %s\n", c_szSceneFile, ErrorStr.c_str());
+		return false;
+		}
+
+	// Calculate a bounding box around the statue that we can use later on
+	SPODMesh* pMesh = &m_Model.pMesh[m_Scene.GetRoleNode(enumMODEL_Statue).nMesh];
+	PVRTBOUNDINGBOX bb;
+	ComputeBoundingBox(&bb, pMesh->pInterleaved, pMesh->nNumVertex, 0, pMesh->sVertex.nStride);
+
+	// We need to calculate the longest possible length for our bounding box on the X and Z axis (as we're rotating around Y).
+	float fLen[4];
+	fLen[0] = sqrt(bb.Point[7].x * bb.Point[7].x + bb.Point[7].z * bb.Point[7].z);	// FR quadrant
+	fLen[1] = sqrt(bb.Point[3].x * bb.Point[3].x + bb.Point[3].z * bb.Point[3].z);	// FL quadrant
+	fLen[2] = sqrt(bb.Point[6].x * bb.Point[6].x + bb.Point[6].z * bb.Point[6].z);	// BR quadrant
+	fLen[3] = sqrt(bb.Point[2].x * bb.Point[2].x + bb.Point[2].z * bb.Point[2].z);	// BL quadrant
+	
+	float fLongest = max(fLen[0], fLen[1]);
+	fLongest = max(fLongest, fLen[2]);
+	fLongest = max(fLongest, fLen[3]);
+		
+	// Calculate the top left and bottom right of the bounding box in 2D space
+	m_bbStatueTL = PVRTVec4(-fLongest, bb.Point[3].y, bb.Point[3].z, 1.0f);
+	m_bbStatueBR = PVRTVec4( fLongest, bb.Point[5].y, bb.Point[5].z, 1.0f);
+
+	return true;
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::OpenPackage()
+	{
+	CPVRTString Path = CPVRTString((const char*)PVRShellGet(prefReadPath)) + m_PackageFile;
+	if(!m_Package.Open(Path.c_str()))
+		return false;
+
+	unsigned int uiSize = 0;
+	const PackageScene* pScene = (const PackageScene*)m_Package.Find(enumPACKAGE_Scene, 0, &uiSize);
+	if(!pScene || uiSize != sizeof(PackageScene))
+		{
+		m_Package.Close();
+		return false;
+		}
+
+	// The nodes are stored flattened; only the BVH is rebuilt
+	const SceneNode* pNodes = (const SceneNode*)m_Package.Find(enumPACKAGE_Nodes, 0, &uiSize);
+	if(!pNodes || !m_Scene.Build(pNodes, uiSize / sizeof(SceneNode), pScene->uiNumMeshes))
+		{
+		m_Package.Close();
+		return false;
+		}
+
+	memcpy(m_uiNumIndices, pScene->auNumIndices, sizeof(m_uiNumIndices));
+	memcpy(m_uiDepthNumIndices, pScene->auDepthNumIndices, sizeof(m_uiDepthNumIndices));
+	memcpy(m_VertexFormat, pScene->aFormats, sizeof(m_VertexFormat));
+	m_bbStatueTL = pScene->vStatueTL;
+	m_bbStatueBR = pScene->vStatueBR;
+
+	// The mesh options were fixed when the package was baked
+	m_bMeshOpt		= (m_Package.GetFlags() & PACKAGE_FLAG_MESHOPT) != 0;
+	m_bShadowLOD	= (m_Package.GetFlags() & PACKAGE_FLAG_SHADOWLOD) != 0;
+	return true;
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::WritePackage()
+	{
+	PackageScene Scene;
+	Scene.uiNumMeshes = m_Scene.GetNumMeshes();
+	memcpy(Scene.auNumIndices, m_uiNumIndices, sizeof(m_uiNumIndices));
+	memcpy(Scene.auDepthNumIndices, m_uiDepthNumIndices, sizeof(m_uiDepthNumIndices));
+	memcpy(Scene.aFormats, m_VertexFormat, sizeof(m_VertexFormat));
+	Scene.vStatueTL = m_bbStatueTL;
+	Scene.vStatueBR = m_bbStatueBR;
+	m_pPackageWriter->Add(enumPACKAGE_Scene, 0, &Scene, sizeof(Scene));
+	m_pPackageWriter->Add(enumPACKAGE_Nodes, 0, m_Scene.GetNodes(), m_Scene.GetNumNodes() * sizeof(SceneNode));
+
+	unsigned int uiFlags = (m_bMeshOpt ? PACKAGE_FLAG_MESHOPT : 0) | (m_bShadowLOD ? PACKAGE_FLAG_SHADOWLOD : 0);
+	CPVRTString Path = CPVRTString((const char*)PVRShellGet(prefWritePath)) + m_BakeFile;
+	bool bResult = m_pPackageWriter->Write(Path.c_str(), uiFlags);
+	if(bResult)
+		PVRShellOutputDebug("Baked %s\n", Path.c_str());
+	else
+		PVRShellOutputDebug("ERROR: Couldn't write %s\n", Path.c_str());
+
+	delete m_pPackageWriter;
+	m_pPackageWriter = NULL;
+	return bResult;
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::QuitApplication()
+	{
+	if(m_bLoading)
+		CancelLoading();
+
+	m_Model.Destroy();
+	m_Package.Close();
+	delete m_pPackageWriter;
+	m_pPackageWriter = NULL;
+
+	delete [] m_pfBenchFrameMS;
+	m_pfBenchFrameMS = NULL;
+	delete [] m_pfBenchCrowdMS;
+	m_pfBenchCrowdMS = NULL;
+	delete [] m_pfBenchCrowdUpdateMS;
+	m_pfBenchCrowdUpdateMS = NULL;
+	delete [] m_pvCrowd;
+	m_pvCrowd = NULL;
+	delete [] m_pvCrowdDraw;
+	m_pvCrowdDraw = NULL;
+	delete [] m_puCrowdKeys;
+	m_puCrowdKeys = NULL;
+	delete [] m_puCrowdTemp;
+	m_puCrowdTemp = NULL;
+	delete [] m_pmxCrowdMVP;
+	m_pmxCrowdMVP = NULL;
+	delete [] m_pmxCrowdModelView;
+	m_pmxCrowdModelView = NULL;
+	delete [] m_pvCrowdLightPos;
+	m_pvCrowdLightPos = NULL;
+	ReleaseSoftRaster();
+	m_Jobs.Stop();
+
+	if(m_bDumpTimings)
+		WritePassTimings();
+    return true;
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::ParseCommandLine()
+	{
+	// Options:
+	//   -bench[=frames]	Headless benchmark. Renders 'frames' timed frames on a fixed timestep, then quits.
+	//   -benchout=file		Where to write the benchmark report (relative to the write path).
+	//   -timings			Show the per-pass timing overlay. ACTION1 toggles it at runtime.
+	//   -timingsout[=name]	Write per-pass timings to name.csv and name.json on exit.
+	//   -nostatecache		Issue every GL state call, even redundant ones.
+	//   -novao				Don't use OES_vertex_array_object; set up the vertex layout on every draw.
+	//   -nomeshopt			Upload the POD's triangle and vertex order as-is.
+	//   -shadowtris=N		Triangle budget for the statue's shadow caster LOD.
+	//   -noshadowlod		Cast the shadow from the full resolution statue.
+	//   -shadowsize=N		Resolution of the shadow map.
+	//   -noshadowfit		Use a fixed wide light frustum instead of fitting it to the statue.
+	//   -shadowskip			Reuse the shadow map on frames where nothing it depends on has changed.
+	//   -shadowinterval=N	Let the shadow map go up to N frames between refreshes while the light moves. Implies -shadowskip.
+	//   -shadowangle=deg	Refresh the shadow map when the light has turned by this much. Implies -shadowskip.
+	//   -bake[=file]		Load the scene as normal, write it out as a package (to the write path) and quit.
+	//   -package[=file]	Load the scene from a baked package (in the read path) instead of the POD and .pvr files.
+	//   -syncload			Load the POD and textures on the main thread before the first frame.
+	//   -loadthreads=N		Number of asset loader threads.
+	//   -bloomlevels=N		Number of levels in the bloom pyramid. ACTION2 cycles through them at runtime.
+	//   -bloomsize=N		Resolution of the top bloom level.
+	//   -bloomradius=R		Reach of the bloom's Gaussian, in top level texels.
+	//   -nobloomscissor	Run the bloom passes over the whole render target instead of the statue's footprint.
+	//   -noprogcache		Always compile the shaders from source, and don't write the program cache.
+	//   -progcache=file	Program binary cache file (in the write path).
+	//   -reflscale=S		Resolution of the reflection target, relative to the screen.
+	//   -noreflrtt			Draw the reflection at full resolution under a blended floor instead of offscreen.
+	//   -dynres[=ms]		Scale the bloom and shadow targets down when frames take longer than 'ms'.
+	//   -dynresscene		With -dynres, render the scene offscreen so it can be scaled down too.
+	//   -nocull			Draw every scene node in every view instead of frustum culling them.
+	//   -nocmdsort			Execute the scene's draws in the order they were recorded instead of sorting them by state.
+	//   -noalias			Give every offscreen target its own memory instead of sharing it between passes that don't overlap.
+	//   -nodiscard			Don't tell the driver which targets it needn't load or store, even if EXT_discard_framebuffer is there.
+	//   -crowd=N			Draw N more statues across the floor, to stress draw submission.
+	//   -crowdpath=name	How the crowd is drawn: single, palette or instanced. Defaults to the best available.
+	//   -crowdsweep		With -bench, grow the crowd from 1 statue to N over the run and report each step.
+	//   -jobthreads=N		Threads the per-frame jobs are spread over, including the render thread. Defaults to one per core.
+	//   -jobbench[=runs]	Time the crowd's update on 1 to -jobthreads threads, write the results and quit.
+	//   -mathbench[=runs]	Check the SIMD maths against PVRTools, time both, write the results and quit.
+	//   -meshbench[=runs]	Check the mesh optimiser's output and cache efficiency on every mesh, time it, write the results and quit.
+	//   -softraster[=frames]	Render frames on the CPU at 1 to -jobthreads threads, write them and a scaling report, and quit.
+	//   -regress[=dir]		Render the regression poses on the CPU, check them against the goldens and budgets in 'dir', and quit.
+	//   -regressrecord		With -regress, write the goldens and budgets instead of checking them.
+	int nNumOpts = PVRShellGet(prefCommandLineOptNum);
+	const SCmdLineOpt* pOpts = (const SCmdLineOpt*)PVRShellGet(prefCommandLineOpts);
+
+	for(int i = 0; i < nNumOpts; ++i)
+		{
+		if(strcmp(pOpts[i].pArg, "-bench") == 0)
+			{
+			m_bBenchmark = true;
+			if(pOpts[i].pVal && atoi(pOpts[i].pVal) > 0)
+				m_uiBenchFrames = (unsigned int)atoi(pOpts[i].pVal);
+			}
+		else if(strcmp(pOpts[i].pArg, "-benchout") == 0 && pOpts[i].pVal)
+			{
+			m_BenchReportFile = pOpts[i].pVal;
+			}
+		else if(strcmp(pOpts[i].pArg, "-timings") == 0)
+			{
+			m_bShowTimings = true;
+			}
+		else if(strcmp(pOpts[i].pArg, "-nostatecache") == 0)
+			{
+			m_bStateCache = false;
+			}
+		else if(strcmp(pOpts[i].pArg, "-novao") == 0)
+			{
+			m_bVAO = false;
+			}
+		else if(strcmp(pOpts[i].pArg, "-nomeshopt") == 0)
+			{
+			m_bMeshOpt = false;
+			}
+		else if(strcmp(pOpts[i].pArg, "-shadowtris") == 0 && pOpts[i].pVal && atoi(pOpts[i].pVal) > 0)
+			{
+			m_uiShadowTris = (unsigned int)atoi(pOpts[i].pVal);
+			}
+		else if(strcmp(pOpts[i].pArg, "-noshadowlod") == 0)
+			{
+			m_bShadowLOD = false;
+			}
+		else if(strcmp(pOpts[i].pArg, "-shadowsize") == 0 && pOpts[i].pVal && atoi(pOpts[i].pVal) >= 8)
+			{
+			m_nShadowMapSize = atoi(pOpts[i].pVal);
+			}
+		else if(strcmp(pOpts[i].pArg, "-noshadowfit") == 0)
+			{
+			m_bShadowFit = false;
+			}
+		else if(strcmp(pOpts[i].pArg, "-shadowskip") == 0)
+			{
+			m_bShadowSkip = true;
+			}
+		else if(strcmp(pOpts[i].pArg, "-shadowinterval") == 0 && pOpts[i].pVal && atoi(pOpts[i].pVal) > 0)
+			{
+			m_uiShadowInterval = (unsigned int)atoi(pOpts[i].pVal);
+			m_bShadowSkip = true;
+			}
+		else if(strcmp(pOpts[i].pArg, "-shadowangle") == 0 && pOpts[i].pVal && atof(pOpts[i].pVal) > 0.0)
+			{
+			m_fShadowMaxAngle = (float)atof(pOpts[i].pVal) * PVRT_PI / 180.0f;
+			m_bShadowSkip = true;
+			}
+		else if(strcmp(pOpts[i].pArg, "-syncload") == 0)
+			{
+			m_bAsyncLoad = false;
+			}
+		else if(strcmp(pOpts[i].pArg, "-loadthreads") == 0 && pOpts[i].pVal && atoi(pOpts[i].pVal) > 0)
+			{
+			m_uiLoadThreads = (unsigned int)atoi(pOpts[i].pVal);
+			}
+		else if(strcmp(pOpts[i].pArg, "-bloomlevels") == 0 && pOpts[i].pVal && atoi(pOpts[i].pVal) > 0)
+			{
+			m_uiBloomLevels = (unsigned int)atoi(pOpts[i].pVal);
+			}
+		else if(strcmp(pOpts[i].pArg, "-bloomsize") == 0 && pOpts[i].pVal && atoi(pOpts[i].pVal) > 0)
+			{
+			m_uiBloomSize = (unsigned int)atoi(pOpts[i].pVal);
+			}
+		else if(strcmp(pOpts[i].pArg, "-bloomradius") == 0 && pOpts[i].pVal && atof(pOpts[i].pVal) > 0.0)
+			{
+			m_fBloomRadius = (float)atof(pOpts[i].pVal);
+			}
+		else if(strcmp(pOpts[i].pArg, "-nobloomscissor") == 0)
+			{
+			m_bBloomScissor = false;
+			}
+		else if(strcmp(pOpts[i].pArg, "-noprogcache") == 0)
+			{
+			m_bProgramCache = false;
+			}
+		else if(strcmp(pOpts[i].pArg, "-progcache") == 0 && pOpts[i].pVal && *pOpts[i].pVal)
+			{
+			m_ProgramCacheFile = pOpts[i].pVal;
+			}
+		else if(strcmp(pOpts[i].pArg, "-reflscale") == 0 && pOpts[i].pVal && atof(pOpts[i].pVal) > 0.0 && atof(pOpts[i].pVal) <= 1.0)
+			{
+			m_fReflScale = (float)atof(pOpts[i].pVal);
+			}
+		else if(strcmp(pOpts[i].pArg, "-noreflrtt") == 0)
+			{
+			m_bReflectionRTT = false;
+			}
+		else if(strcmp(pOpts[i].pArg, "-dynres") == 0)
+			{
+			m_bDynRes = true;
+			if(pOpts[i].pVal && atof(pOpts[i].pVal) > 0.0)
+				m_fDynResBudgetMS = (float)atof(pOpts[i].pVal);
+			}
+		else if(strcmp(pOpts[i].pArg, "-dynresscene") == 0)
+			{
+			m_bDynResScene = true;
+			}
+		else if(strcmp(pOpts[i].pArg, "-nocull") == 0)
+			{
+			m_bCulling = false;
+			}
+		else if(strcmp(pOpts[i].pArg, "-nocmdsort") == 0)
+			{
+			m_bCmdSort = false;
+			}
+		else if(strcmp(pOpts[i].pArg, "-noalias") == 0)
+			{
+			m_bFGAlias = false;
+			}
+		else if(strcmp(pOpts[i].pArg, "-nodiscard") == 0)
+			{
+			m_bFGDiscard = false;
+			}
+		else if(strcmp(pOpts[i].pArg, "-crowd") == 0 && pOpts[i].pVal && atoi(pOpts[i].pVal) > 0)
+			{
+			m_uiCrowd = PVRT_MIN((unsigned int)atoi(pOpts[i].pVal), (unsigned int)CROWD_MAX_INSTANCES);
+			}
+		else if(strcmp(pOpts[i].pArg, "-crowdpath") == 0 && pOpts[i].pVal)
+			{
+			for(int j = 0; j < enumCROWD_MAX; ++j)
+				{
+				if(strcmp(pOpts[i].pVal, c_pszCrowdPaths[j]) == 0)
+					m_nCrowdRequest = j;
+				}
+			}
+		else if(strcmp(pOpts[i].pArg, "-crowdsweep") == 0)
+			{
+			m_bCrowdSweep = true;
+			}
+		else if(strcmp(pOpts[i].pArg, "-jobthreads") == 0 && pOpts[i].pVal && atoi(pOpts[i].pVal) > 0)
+			{
+			m_uiJobThreads = PVRT_MIN((unsigned int)atoi(pOpts[i].pVal), (unsigned int)JOB_MAX_THREADS);
+			}
+		else if(strcmp(pOpts[i].pArg, "-jobbench") == 0)
+			{
+			m_bJobBench = true;
+			if(pOpts[i].pVal && atoi(pOpts[i].pVal) > 0)
+				m_uiJobBenchRuns = (unsigned int)atoi(pOpts[i].pVal);
+			}
+		else if(strcmp(pOpts[i].pArg, "-mathbench") == 0)
+			{
+			m_bMathBench = true;
+			if(pOpts[i].pVal && atoi(pOpts[i].pVal) > 0)
+				m_uiMathBenchRuns = (unsigned int)atoi(pOpts[i].pVal);
+			}
+		else if(strcmp(pOpts[i].pArg, "-meshbench") == 0)
+			{
+			m_bMeshBench = true;
+			if(pOpts[i].pVal && atoi(pOpts[i].pVal) > 0)
+				m_uiMeshBenchRuns = (unsigned int)atoi(pOpts[i].pVal);
+			}
+		else if(strcmp(pOpts[i].pArg, "-softraster") == 0)
+			{
+			m_bSoftRaster = true;
+			if(pOpts[i].pVal && atoi(pOpts[i].pVal) > 0)
+				m_uiSoftFrames = (unsigned int)atoi(pOpts[i].pVal);
+			}
+		else if(strcmp(pOpts[i].pArg, "-regress") == 0)
+			{
+			m_bRegress = true;
+			if(pOpts[i].pVal && *pOpts[i].pVal)
+				m_RegressDir = pOpts[i].pVal;
+			else
+				m_RegressDir = CPVRTString((const char*)PVRShellGet(prefReadPath)) + REGRESS_DEFAULT_DIR;
+			char cLast = m_RegressDir.length() ? m_RegressDir.c_str()[m_RegressDir.length() - 1] : '/';
+			if(cLast != '/' && cLast != '\\')
+				m_RegressDir += '/';
+			}
+		else if(strcmp(pOpts[i].pArg, "-regressrecord") == 0)
+			{
+			m_bRegressRecord = true;
+			}
+		else if(strcmp(pOpts[i].pArg, "-bake") == 0 || strcmp(pOpts[i].pArg, "-package") == 0)
+			{
+			// Each has its own file, so a package can be rebaked from another
+			bool bBake = pOpts[i].pArg[1] == 'b';
+			if(bBake)
+				m_bBake = true;
+			else
+				m_bUsePackage = true;
+
+			if(pOpts[i].pVal && *pOpts[i].pVal)
+				(bBake ? m_BakeFile : m_PackageFile) = pOpts[i].pVal;
+			}
+		else if(strcmp(pOpts[i].pArg, "-timingsout") == 0)
+			{
+			m_bDumpTimings = true;
+			if(pOpts[i].pVal && *pOpts[i].pVal)
+				m_TimingsFile = pOpts[i].pVal;
+			}
+		}
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::WriteBenchmarkReport()
+	{
+	unsigned int uiCount = m_uiBenchFrames;
+	m_Profiler.Flush();
+
+	// Sort a copy of the frame times so we can pull out percentiles
+	float* pfSorted = new float[uiCount];
+	memcpy(pfSorted, m_pfBenchFrameMS, sizeof(float) * uiCount);
+	qsort(pfSorted, uiCount, sizeof(float), CompareFloat);
+
+	double dTotal = 0.0;
+	for(unsigned int i = 0; i < uiCount; ++i)
+		dTotal += m_pfBenchFrameMS[i];
+
+	float fMean		= (float)(dTotal / uiCount);
+	float fP95		= Percentile(pfSorted, uiCount, 95.0f);
+	float fP99		= Percentile(pfSorted, uiCount, 99.0f);
+	double dWallMS	= m_dBenchEndMS - m_dBenchStartMS;
+	double dFPS		= dWallMS > 0.0 ? uiCount * 1000.0 / dWallMS : 0.0;
+
+	PVRShellOutputDebug("Benchmark: %u frames, min %.3fms mean %.3fms p95 %.3fms p99 %.3fms max %.3fms, %.1f fps\n",
+						uiCount, pfSorted[0], fMean, fP95, fP99, pfSorted[uiCount - 1], dFPS);
+
+	CPVRTString Path = CPVRTString((const char*)PVRShellGet(prefWritePath)) + m_BenchReportFile;
+	FILE* pFile = fopen(Path.c_str(), "w");
+	if(!pFile)
+		{
+		PVRShellOutputDebug("ERROR: Could not write benchmark report: %s\n", Path.c_str());
+		delete [] pfSorted;
+		return false;
+		}
+
+	fprintf(pFile, "{\n");
+	fprintf(pFile, "\t\"renderer\": \"%s\",\n", (const char*)glGetString(GL_RENDERER));
+	fprintf(pFile, "\t\"width\": %d,\n", PVRShellGet(prefWidth));
+	fprintf(pFile, "\t\"height\": %d,\n", PVRShellGet(prefHeight));
+	fprintf(pFile, "\t\"fixed_dt\": %f,\n", BENCH_FIXED_DT);
+	fprintf(pFile, "\t\"warmup_frames\": %d,\n", BENCH_WARMUP_FRAMES);
+	fprintf(pFile, "\t\"frames\": %u,\n", uiCount);
+	fprintf(pFile, "\t\"frame_ms\": { \"min\": %.4f, \"mean\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f },\n",
+			pfSorted[0], fMean, fP95, fP99, pfSorted[uiCount - 1]);
+	fprintf(pFile, "\t\"wall_ms\": %.4f,\n", dWallMS);
+	fprintf(pFile, "\t\"fps\": %.4f,\n", dFPS);
+	fprintf(pFile, "\t\"gpu_timers\": %s,\n", m_Profiler.HasGPUTimers() ? "true" : "false");
+	fprintf(pFile, "\t\"state_cache\": %s,\n", m_bStateCache ? "true" : "false");
+	fprintf(pFile, "\t\"vao\": %s,\n", m_bVAOActive ? "true" : "false");
+	fprintf(pFile, "\t\"mesh_opt\": %s,\n", m_bMeshOpt ? "true" : "false");
+	int nStatueMesh = m_Scene.GetRoleNode(enumMODEL_Statue).nMesh;
+	fprintf(pFile, "\t\"bloom_scissor\": %s,\n", m_bBloomScissor ? "true" : "false");
+	fprintf(pFile, "\t\"bloom\": { \"levels\": %u, \"size\": %u, \"radius\": %.2f, \"sigma\": %.4f, \"taps\": %u },\n",
+			m_uiBloomLevels, m_uiBloomSize, m_fBloomRadius, m_BloomKernel.fSigma, m_BloomKernel.uiNumTaps * 2 + 1);
+	if(m_bDynRes)
+		{
+		fprintf(pFile, "\t\"dynamic_resolution\": { \"budget_ms\": %.4f, \"changes\": %u", m_DynRes.GetBudgetMS(), m_DynRes.GetChanges());
+		for(int i = 0; i < enumDYNRES_MAX; ++i)
+			fprintf(pFile, ", \"%s\": %.4f", c_pszDynResTargets[i], m_DynRes.GetScale((enumDYNRES)i));
+		fprintf(pFile, " },\n");
+		}
+	if(m_bReflectionRTT)
+		fprintf(pFile, "\t\"reflection\": { \"offscreen\": true, \"width\": %d, \"height\": %d },\n", m_nReflWidth, m_nReflHeight);
+	else
+		fprintf(pFile, "\t\"reflection\": { \"offscreen\": false },\n");
+	fprintf(pFile, "\t\"culling\": { \"enabled\": %s, \"nodes\": %u, \"meshes\": %u",
+			m_bCulling ? "true" : "false", m_Scene.GetNumNodes(), m_Scene.GetNumMeshes());
+	for(int v = 0; v < enumVIEW_MAX; ++v)
+		{
+		// Per cull of that view. The light's view is only culled when the shadow map is rendered.
+		float fCulls = (float)PVRT_MAX(m_Scene.GetCulls(v), 1u);
+		fprintf(pFile, ", \"%s\": { \"culls\": %u, \"drawn\": %.2f, \"culled\": %.2f, \"tests\": %.2f }", c_pszViewNames[v],
+				m_Scene.GetCulls(v), m_Scene.GetDrawn(v) / fCulls, m_Scene.GetCulled(v) / fCulls, m_Scene.GetTests(v) / fCulls);
+		}
+	fprintf(pFile, " },\n");
+	fprintf(pFile, "\t\"command_buffer\": { \"sorted\": %s", m_bCmdSort ? "true" : "false");
+	for(int i = 0; i < enumCMDSTAT_MAX; ++i)
+		fprintf(pFile, ", \"%s\": %.2f", c_pszCmdStats[i], m_Commands.GetTotalStat(i) / (float)uiCount);		// Per timed frame
+	fprintf(pFile, " },\n");
+	fprintf(pFile, "\t\"frame_graph\": { \"aliasing\": %s, \"passes\": %u, \"culled\": %u, \"targets\": %u, \"allocations\": %u, "
+			"\"bytes_unaliased\": %u, \"bytes_aliased\": %u },\n", m_bFGAlias ? "true" : "false", m_FrameGraph.GetNumPasses(),
+			m_FrameGraph.GetNumCulled(), m_FrameGraph.GetNumTargets(), m_FrameGraph.GetNumAllocations(),
+			m_FrameGraph.GetUnaliasedBytes(), m_FrameGraph.GetAliasedBytes());
+
+	// Per timed frame. Every pass that ran, and what it would have moved loading and storing all of its attachments.
+	double dLoaded = 0.0, dStored = 0.0;
+	fprintf(pFile, "\t\"bandwidth\": { \"discard\": %s, \"passes\": [", m_FrameGraph.HasDiscard() ? "true" : "false");
+	for(unsigned int p = 0, uiListed = 0; p < m_FrameGraph.GetNumPasses(); ++p)
+		{
+		if(m_FrameGraph.IsCulled(p))
+			continue;
+		dLoaded += m_FrameGraph.GetPassBytesLoaded(p);
+		dStored += m_FrameGraph.GetPassBytesStored(p);
+		fprintf(pFile, "%s\n\t\t{ \"name\": \"%s\", \"runs\": %.2f, \"bytes_loaded\": %.0f, \"bytes_stored\": %.0f }", uiListed++ ? "," : "",
+				m_FrameGraph.GetPass(p).pszName, m_FrameGraph.GetPassRuns(p) / (float)uiCount,
+				m_FrameGraph.GetPassBytesLoaded(p) / uiCount, m_FrameGraph.GetPassBytesStored(p) / uiCount);
+		}
+	fprintf(pFile, " ],\n\t\t\"bytes_loaded\": %.0f, \"bytes_stored\": %.0f, \"bytes_load_store_all\": %.0f },\n",
+			dLoaded / uiCount, dStored / uiCount, m_FrameGraph.GetTotalBytesAll() / uiCount);
+	if(m_uiCrowd)
+		{
+		fprintf(pFile, "\t\"crowd\": { \"instances\": %u, \"path\": \"%s\", \"mesh_vertices\": %u, \"mesh_tris\": %u, \"steps\": [",
+				m_uiCrowd, c_pszCrowdPaths[m_nCrowdPath], m_uiCrowdMeshVertices, m_uiNumIndices[nStatueMesh] / 3);
+		float* pfStep = new float[uiCount];
+		for(unsigned int s = 0; s < m_uiCrowdSteps; ++s)
+			{
+			// The step's timed frames, less the first few after the crowd grew, while the driver settles
+			unsigned int uiFirst = (s * uiCount + m_uiCrowdSteps - 1) / m_uiCrowdSteps;
+			unsigned int uiEnd = ((s + 1) * uiCount + m_uiCrowdSteps - 1) / m_uiCrowdSteps;
+			if(s && uiEnd - uiFirst > 2 * CROWD_SWEEP_SETTLE)
+				uiFirst += CROWD_SWEEP_SETTLE;
+
+			unsigned int uiFrames = uiEnd - uiFirst;
+			double dFrameTotal = 0.0, dSubmitTotal = 0.0, dUpdateTotal = 0.0;
+			for(unsigned int i = uiFirst; i < uiEnd; ++i)
+				{
+				pfStep[i - uiFirst] = m_pfBenchFrameMS[i];
+				dFrameTotal += m_pfBenchFrameMS[i];
+				dSubmitTotal += m_pfBenchCrowdMS[i];
+				dUpdateTotal += m_pfBenchCrowdUpdateMS[i];
+				}
+			qsort(pfStep, uiFrames, sizeof(float), CompareFloat);
+
+			const CrowdStep& Step = m_aCrowdSteps[s];
+			float fFrames = (float)PVRT_MAX(uiFrames, 1u);
+			fprintf(pFile, "%s\n\t\t{ \"instances\": %u, \"frames\": %u, \"visible\": %u, \"draws\": %u, \"vertices\": %u, \"frame_ms\": { \"mean\": %.4f, \"p95\": %.4f }, \"update_ms\": %.4f, \"submit_ms\": %.4f }",
+					s ? "," : "", Step.uiCount, uiFrames, Step.uiVisible, Step.uiDraws, Step.uiVertices, dFrameTotal / fFrames, Percentile(pfStep, uiFrames, 95.0f),
+					dUpdateTotal / fFrames, dSubmitTotal / fFrames);
+			}
+		fprintf(pFile, "\n\t\t] },\n");
+		delete [] pfStep;
+		}
+
+	// Per timed frame. The render thread is thread 0.
+	unsigned int uiJobs = 0, uiSteals = 0;
+	for(unsigned int t = 0; t < m_Jobs.GetNumThreads(); ++t)
+		{
+		uiJobs += m_Jobs.GetJobs(t);
+		uiSteals += m_Jobs.GetSteals(t);
+		}
+	fprintf(pFile, "\t\"jobs\": { \"threads\": %u, \"jobs\": %.2f, \"steals\": %.2f },\n", m_Jobs.GetNumThreads(), uiJobs / (float)uiCount, uiSteals / (float)uiCount);
+	fprintf(pFile, "\t\"shadow_caster_tris\": { \"full\": %u, \"depth\": %u },\n",
+			m_uiNumIndices[nStatueMesh] / 3, m_uiDepthNumIndices[nStatueMesh] / 3);
+	fprintf(pFile, "\t\"shadow_map\": { \"size\": %d, \"fit\": %s, \"caster_coverage\": %.4f, \"hidden_frames\": %u },\n",
+			m_nShadowMapSize, m_bShadowFit ? "true" : "false", m_dBenchShadowCoverage / uiCount, m_uiBenchShadowHidden);
+	fprintf(pFile, "\t\"shadow_updates\": { \"rendered\": %u, \"reused\": %u, \"interval\": %u, \"max_angle_deg\": %.2f },\n",
+			m_bShadowSkip ? m_ShadowScheduler.GetRendered() : uiCount, m_bShadowSkip ? m_ShadowScheduler.GetSkipped() : 0,
+			m_uiShadowInterval, m_fShadowMaxAngle * 180.0f / PVRT_PI);
+	unsigned int uiOriginalBytes = 0, uiCompactBytes = 0;
+	for(unsigned int i = 0; i < m_Scene.GetNumMeshes(); ++i)
+		{
+		uiOriginalBytes	+= m_Model.pMesh[i].nNumVertex * m_Model.pMesh[i].sVertex.nStride;
+		uiCompactBytes	+= m_Model.pMesh[i].nNumVertex * m_VertexFormat[i].nStride;
+		}
+	fprintf(pFile, "\t\"vertex_bytes\": { \"original\": %u, \"compact\": %u, \"saved\": %u },\n", uiOriginalBytes, uiCompactBytes,
+			uiOriginalBytes - uiCompactBytes);
+	fprintf(pFile, "\t\"package\": %s,\n", m_Package.IsOpen() ? "true" : "false");
+	fprintf(pFile, "\t\"time_to_first_frame_ms\": %.4f,\n", m_fFirstFrameMS);
+	fprintf(pFile, "\t\"shader_setup\": { \"ms\": %.4f, \"start\": \"%s\", \"cached\": %u, \"compiled\": %u },\n",
+			m_fShaderSetupMS, GetShaderStartType(), m_uiProgramsCached, m_uiProgramsCompiled);
+	if(m_bLoadedAsync)
+		{
+		fprintf(pFile, "\t\"async_load\": ");
+		m_Loader.WriteJSON(pFile, "\t");
+		fprintf(pFile, ",\n");
+		}
+	fprintf(pFile, "\t\"gl_state_calls_per_frame\": { \"issued\": %.1f, \"filtered\": %.1f },\n",
+			m_dBenchGLIssued / uiCount, m_dBenchGLFiltered / uiCount);
+	fprintf(pFile, "\t\"passes\": ");
+	m_Profiler.WriteJSON(pFile, "\t");
+	fprintf(pFile, ",\n");
+	fprintf(pFile, "\t\"per_frame_ms\": [");
+	for(unsigned int i = 0; i < uiCount; ++i)
+		fprintf(pFile, "%s%.4f", i ? ", " : "", m_pfBenchFrameMS[i]);
+	fprintf(pFile, "]\n");
+	fprintf(pFile, "}\n");
+	fclose(pFile);
+
+	delete [] pfSorted;
+	return true;
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::WritePassTimings()
+	{
+	CPVRTString Base = CPVRTString((const char*)PVRShellGet(prefWritePath)) + m_TimingsFile;
+
+	FILE* pFile = fopen((Base + ".csv").c_str(), "w");
+	if(!pFile)
+		{
+		PVRShellOutputDebug("ERROR: Could not write pass timings: %s.csv\n", Base.c_str());
+		return false;
+		}
+	m_Profiler.WriteCSV(pFile);
+	fclose(pFile);
+
+	pFile = fopen((Base + ".json").c_str(), "w");
+	if(!pFile)
+		{
+		PVRShellOutputDebug("ERROR: Could not write pass timings: %s.json\n", Base.c_str());
+		return false;
+		}
+	m_Profiler.WriteJSON(pFile, "");
+	fprintf(pFile, "\n");
+	fclose(pFile);
+	return true;
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::RenderTimingsOverlay()
+	{
+	// Sorting the windows every frame is wasteful, so only refresh the numbers every so often.
+	if(m_uiOverlayFrame++ % PROFILE_OVERLAY_UPDATE == 0)
+		{
+		for(int t = 0; t < enumTIMER_MAX; ++t)
+			for(int p = 0; p < enumPASS_MAX; ++p)
+				m_OverlayStats[t][p] = m_Profiler.GetPercentiles((enumPASS)p, (enumTIMER)t);
+		}
+
+	const unsigned int c_uiColour = PVRTRGBA(255, 255, 0, 255);
+	const float c_fLineHeight = 4.0f;
+	float fY = 2.0f;
+
+	m_Print3D.Print3D(2.0f, fY, 0.5f, c_uiColour, "Pass             CPU p50/p95/p99 (ms)   GPU p50/p95/p99 (ms)");
+	fY += c_fLineHeight;
+	for(int p = 0; p < enumPASS_MAX; ++p)
+		{
+		const PassPercentiles& CPU = m_OverlayStats[enumTIMER_CPU][p];
+		const PassPercentiles& GPU = m_OverlayStats[enumTIMER_GPU][p];
+		if(m_Profiler.HasGPUTimers() && p != enumPASS_Frame)
+			m_Print3D.Print3D(2.0f, fY, 0.5f, c_uiColour, "%-16s %6.2f %6.2f %6.2f   %6.2f %6.2f %6.2f",
+							  c_pszPassNames[p], CPU.fP50, CPU.fP95, CPU.fP99, GPU.fP50, GPU.fP95, GPU.fP99);
+		else
+			m_Print3D.Print3D(2.0f, fY, 0.5f, c_uiColour, "%-16s %6.2f %6.2f %6.2f        -",
+							  c_pszPassNames[p], CPU.fP50, CPU.fP95, CPU.fP99);
+		fY += c_fLineHeight;
+		}
+	m_Print3D.Print3D(2.0f, fY, 0.5f, c_uiColour, "GL state calls: %u issued, %u filtered", m_uiGLIssued, m_uiGLFiltered);
+	fY += c_fLineHeight;
+	m_Print3D.Print3D(2.0f, fY, 0.5f, c_uiColour, "Nodes drawn/culled: camera %u/%u, reflection %u/%u, light %u/%u",
+					  m_Scene.GetNumVisible(enumVIEW_Camera), m_Scene.GetLastCulled(enumVIEW_Camera),
+					  m_Scene.GetNumVisible(enumVIEW_Reflection), m_Scene.GetLastCulled(enumVIEW_Reflection),
+					  m_Scene.GetNumVisible(enumVIEW_Light), m_Scene.GetLastCulled(enumVIEW_Light));
+	fY += c_fLineHeight;
+	m_Print3D.Print3D(2.0f, fY, 0.5f, c_uiColour, "Commands (%s): %u draws, %u program, %u texture, %u state changes", m_bCmdSort ? "sorted" : "unsorted",
+					  m_Commands.GetFrameStat(enumCMDSTAT_Draws), m_Commands.GetFrameStat(enumCMDSTAT_Programs),
+					  m_Commands.GetFrameStat(enumCMDSTAT_Textures), m_Commands.GetFrameStat(enumCMDSTAT_States));
+	fY += c_fLineHeight;
+	m_Print3D.Print3D(2.0f, fY, 0.5f, c_uiColour, "Tile bandwidth: %.2fMB loaded, %.2fMB stored, of %.2fMB%s",
+					  m_FrameGraph.GetFrameBytesLoaded() / (1024.0 * 1024.0), m_FrameGraph.GetFrameBytesStored() / (1024.0 * 1024.0),
+					  m_FrameGraph.GetFrameBytesAll() / (1024.0 * 1024.0), m_FrameGraph.HasDiscard() ? "" : " (no discard)");
+	fY += c_fLineHeight;
+	if(m_bShadowSkip)
+		{
+		m_Print3D.Print3D(2.0f, fY, 0.5f, c_uiColour, "Shadow map: %u rendered, %u reused", m_ShadowScheduler.GetRendered(), m_ShadowScheduler.GetSkipped());
+		fY += c_fLineHeight;
+		}
+	if(m_uiCrowd)
+		m_Print3D.Print3D(2.0f, fY, 0.5f, c_uiColour, "Crowd (%s): %u/%u statues, %u draws, %u vertices, %.2fms update on %u threads, %.2fms submit",
+						  c_pszCrowdPaths[m_nCrowdPath], m_uiCrowdVisible, m_uiCrowdActive, m_uiCrowdDraws, m_uiCrowdVertices, m_fCrowdUpdateMS,
+						  m_Jobs.GetNumThreads(), m_fCrowdSubmitMS);
+
+	// Print3D sets up its own arrays, so don't leave ours enabled pointing into our buffers (or let it modify our VAOs).
+	m_GLState.BindVertexArray(0);
+	m_GLState.VertexAttribArrays(0);
+	m_GLState.BindBuffer(GL_ARRAY_BUFFER, 0);
+	m_GLState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	m_Print3D.Flush();
+
+	// Print3D changes GL state behind the cache's back
+	m_GLState.Invalidate();
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::InitView()
+	{
+	CPVRTString ErrorStr;
+
+	m_Extensions.LoadExtensions();
+	InitCrowd();				// Picks the crowd's draw path, which decides what LoadVBOs and LoadShaders build
+
+	bool bResult = LoadVBOs(&ErrorStr);
+	bResult = bResult && LoadTextures(&ErrorStr);
+
+	// Shaders have to be compiled on the GL thread, but the loader's workers carry on in the meantime
+	double dShaderStartMS = GetTimeMS();
+	bResult &= LoadShaders(&ErrorStr);
+	if(m_bLoading)
+		m_Loader.RecordGLWork(enumASSET_Shaders, "Shaders", dShaderStartMS, GetTimeMS());
+
+	bResult &= CreateFBOs(&ErrorStr);
+	
+	if(!bResult)
+		{
+		PVRShellSet(prefExitMessage, ErrorStr.c_str());
+		return false;
+		}
+
+	m_bRotated = PVRShellGet(prefIsRotated) && PVRShellGet(prefFullScreen);
+
+	if(m_Print3D.SetTextures(0, PVRShellGet(prefWidth), PVRShellGet(prefHeight), m_bRotated) != PVR_SUCCESS)
+		{
+		PVRShellSet(prefExitMessage, "ERROR: Cannot initialise Print3D\n");
+		return false;
+		}
+
+	m_Profiler.InitGPUTimers();
+	SetUpViews();
+
+	// --- Set GL states
+	glCullFace(GL_BACK);
+	glEnable(GL_CULL_FACE);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_GEQUAL);
+	glClearDepthf(0.0f);
+	glClearColor(0,0,0,1);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	// Everything above (and the loading code) went straight to GL
+	m_GLState.SetFiltering(m_bStateCache);
+	m_GLState.Invalidate();
+	m_GLState.InvalidateUniforms();
+
+	// The VAOs need the meshes, so wait for FinishLoading if they're still on their way
+	if(!m_bLoading)
+		CreateVAOs();
+
+	// Everything has been loaded the normal way; write it out
+	if(m_pPackageWriter && !WritePackage())
+		{
+		PVRShellSet(prefExitMessage, "ERROR: Couldn't write the package\n");
+		return false;
+		}
+
+	return true;
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::SetUpViews()
+	{
+	// No GL in here, so the software rasterizer's runs use it too. m_bRotated has to be set first.
+	// --- Set up light position, projection and view
+	m_vLightPos   = PVRTVec3(0, 125, 200);
+	m_mxLightProjWide = PVRTMat4::PerspectiveFovRH(PVRT_PI / 4, 1.0f, 10.0f, 1000.0f, PVRTMat4::OGL, m_bRotated);
+	m_mxLightProj = m_mxLightProjWide;
+	m_mxLightView = PVRTMat4::LookAtRH(m_vLightPos, PVRTVec3(0,25,0), PVRTVec3(0,1,0));
+	m_mxShadowViewProj = m_mxLightProj * m_mxLightView;
+	m_nShadowMapRendered = m_nShadowMapActive;
+	m_ShadowScheduler.SetPolicy(m_uiShadowInterval, m_fShadowMaxAngle);
+	m_ShadowScheduler.Invalidate();				// The shadow map is new
+	m_mxLightBias = PVRTMat4(0.5f, 0.0f, 0.0f, 0.0f,
+							 0.0f, 0.5f, 0.0f, 0.0f,
+							 0.0f, 0.0f, 0.5f, 0.0f,
+							 0.5f, 0.5f, 0.5f, 1.0f);
+
+	// --- Set up Camera projection and view
+	float fAspect = PVRShellGet(prefWidth) / (float)PVRShellGet(prefHeight);
+	m_mxProjection = PVRTMat4::PerspectiveFovFloatDepthRH(0.75f, fAspect, CAMERA_NEAR, PVRTMat4::OGL, m_bRotated);
+	m_mxCam = PVRTMat4::LookAtRH(PVRTVec3(0, 55, 150), PVRTVec3(0, 35, 0), PVRTVec3(0, 1, 0));
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::ReleaseView()
+	{
+	// If the context goes before loading's finished, the next InitView just loads the rest synchronously
+	if(m_bLoading)
+		CancelLoading();
+
+	m_Print3D.ReleaseTextures();
+	m_Profiler.ReleaseGPUTimers();
+
+	glDeleteTextures(enumTEXTURE_MAX, m_tex);
+
+	// --- Delete program and shader objects
+	for(int i = 0; i < enumEFFECT_MAX; ++i)
+		{	
+		glDeleteProgram(GetEffectShader(i)->uiID);
+		glDeleteShader(m_uiVertShader[i]);
+		glDeleteShader(m_uiFragShader[i]);
+		}
+
+	// --- Delete vertex array objects
+	if(m_bVAOActive)
+		{
+		m_GLState.BindVertexArray(0);
+		m_Extensions.glDeleteVertexArraysOES(SCENE_MAX_MESHES * MESH_LAYOUT_MAX, &m_uiVAO[0][0]);		// Skips the zeros
+		m_bVAOActive = false;
+		}
+	m_GLState.SetVertexArrayFunc(NULL);
+
+	// --- Delete buffer objects
+	glDeleteBuffers(SCENE_MAX_MESHES, m_uiVBO);
+	glDeleteBuffers(SCENE_MAX_MESHES, m_uiVBOIdx);
+	glDeleteBuffers(SCENE_MAX_MESHES, m_uiDepthVBO);
+	glDeleteBuffers(SCENE_MAX_MESHES, m_uiDepthVBOIdx);
+	glDeleteBuffers(1, &m_uiCrowdInstanceVBO);
+	glDeleteBuffers(1, &m_uiCrowdVBO);
+	glDeleteBuffers(1, &m_uiCrowdVBOIdx);
+	glDeleteBuffers(1, &m_uiCrowdPaletteVBO);
+
+	// --- Delete FBO
+	ReleaseFrameGraph();
+
+	return true;
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::RenderScene()
+	{
+	double dFrameStartMS = GetTimeMS();
+
+	if(m_bBake)
+		return false;			// Baking is done by the end of InitView
+
+	if(m_bLoading)
+		return RenderLoadingFrame();
+
+	if(m_bJobBench)
+		{
+		RunJobBenchmark();
+		return false;			// Nothing to draw
+		}
+
+	if(m_bMathBench)
+		{
+		if(!RunMathBenchmark())
+			PVRShellSet(prefExitMessage, "ERROR: The SIMD maths doesn't match PVRTools\n");
+		return false;
+		}
+
+	if(m_bMeshBench)
+		{
+		if(!RunMeshBenchmark())
+			PVRShellSet(prefExitMessage, "ERROR: The mesh optimiser changed a mesh's triangles or made its vertex cache use worse\n");
+		return false;
+		}
+
+
+	if(m_bBenchmark && m_uiBenchFrame == BENCH_WARMUP_FRAMES)
+		{
+		m_Profiler.Reset();				// Don't let warm-up frames into the pass timings
+		m_ShadowScheduler.ResetCounters();
+		m_Scene.ResetCounters();
+		m_Commands.ResetCounters();
+		m_FrameGraph.ResetCounters();
+		m_Jobs.ResetCounters();
+		}
+	m_Profiler.BeginFrame();
+	m_Commands.BeginFrame();
+	m_FrameGraph.BeginFrame();
+
+	if(PVRShellIsKeyPressed(PVRShellKeyNameACTION1))
+		m_bShowTimings = !m_bShowTimings;
+
+	// Cycle the number of bloom levels
+	if(PVRShellIsKeyPressed(PVRShellKeyNameACTION2))
+		{
+		CPVRTString ErrorStr;
+		ReleaseFrameGraph();
+		m_uiBloomLevels = m_uiBloomLevels % BLOOM_MAX_LEVELS + 1;
+		if(!BuildFrameGraph(&ErrorStr))
+			{
+			PVRShellSet(prefExitMessage, ErrorStr.c_str());
+			return false;
+			}
+		ApplyDynamicResolution();
+		m_GLState.Invalidate();				// Creating the targets changed bindings behind the cache's back
+		}
+
+	// --- Pick this frame's resolutions from the last frame's times
+	if(m_bDynRes)
+		UpdateDynamicResolution(dFrameStartMS);
+
+	m_GLState.ResetCounters();
+
+	// --- Work out DT. Benchmark mode steps on a fixed timestep so every run renders the same frames.
+	unsigned long ulPrevTime = m_ulCurrTime;
+	m_ulCurrTime = PVRShellGetTime();
+	if(m_bBenchmark)
+		m_fDT = BENCH_FIXED_DT;
+	else
+		m_fDT = ((float)m_ulCurrTime - (float)ulPrevTime) * 0.001f;
+
+	// --- Set the states every pass relies on. Cheap when nothing has changed them.
+	m_GLState.Enable(GL_CULL_FACE);
+	m_GLState.CullFace(GL_BACK);
+	m_GLState.DepthFunc(GL_GEQUAL);
+
+	PVRTMat4 mxCam = m_mxCam * PVRTMat4::RotationY(m_fAngleY);
+	PVRTMat4 mxModel = PVRTMat4::Identity();
+
+	// --- Find what the camera can see, and its reflection when that's drawn under the floor. RenderReflection and
+	// RenderShadowScene cull for their own views.
+	m_Scene.Cull(enumVIEW_Camera, m_mxProjection * mxCam, ROLE_ALL, m_bCulling);
+	if(!m_bReflectionRTT)
+		m_Scene.Cull(enumVIEW_Reflection, m_mxProjection * mxCam * PVRTMat4::Scale(1, -1, 1), ROLE_BIT(enumMODEL_Statue) | ROLE_BIT(enumMODEL_Church), m_bCulling);
+
+	PVRTVec3 vLightPos;
+	bool bShadowVisible = UpdateLight(mxCam, vLightPos);
+
+	// How much of the map the statue gets, for the benchmark report
+	PVRTVec2 vCasterMin, vCasterMax;
+	m_fShadowCoverage = 0.0f;
+	if(GetStatueScreenBounds(m_mxLightProj * m_mxLightView, vCasterMin, vCasterMax))
+		m_fShadowCoverage = (vCasterMax.x - vCasterMin.x) * (vCasterMax.y - vCasterMin.y) * 0.25f;
+
+	// --- Render the scene from the light's POV, unless the shadow map can be reused
+		{
+		CPassTimerScope Timer(m_Profiler, enumPASS_Shadow);
+		PVRTVec3 vLightDir = vLightPos;
+		vLightDir.normalize();
+		PVRTMat4 mxCaster = mxModel * m_Scene.GetRoleNode(enumMODEL_Statue).mxWorld;
+		if(!m_bShadowSkip || m_ShadowScheduler.Update(m_mxLightView, m_mxLightProj, &mxCaster, 1, vLightDir, m_nShadowMapActive))
+			{
+			m_mxShadowViewProj = m_mxLightProj * m_mxLightView;
+			m_nShadowMapRendered = m_nShadowMapActive;
+			RenderShadowScene(bShadowVisible);
+			}
+		}
+
+	// --- Render the reflection offscreen, before the scene, so the scene's target is only bound once
+	if(!m_FrameGraph.IsCulled(m_FG.uiReflPass))
+		{
+		CPassTimerScope Timer(m_Profiler, enumPASS_Reflection);
+		RenderReflection(mxModel, mxCam, vLightPos);
+		}
 
-	// --- Create a render depth buffer
-	glGenRenderbuffers(1, &m_uiFBODepth);
-	glBindRenderbuffer(GL_RENDERBUFFER, m_uiFBODepth);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, RTT_SIZE, RTT_SIZE);
+	// --- Clear buffers
+	if(IsSceneDirect())
+		{
+		m_GLState.BindFramebuffer(m_uiSceneFBO);
+		m_GLState.ClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		}
+	else
+		m_FrameGraph.BeginPass(m_FG.uiScenePass, m_GLState);
+	m_GLState.Viewport(0, 0, m_nSceneWidth, m_nSceneHeight);
+
+	m_GLState.Enable(GL_DEPTH_TEST);
+	m_GLState.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	// --- Draw the statue, the church and the floor (with shadow). Without the offscreen target the reflections are
+	// drawn under the floor too, mirrored, and the floor is blended over them.
+		{
+		CPassTimerScope Timer(m_Profiler, enumPASS_Scene);
+		RecordStatue(mxModel, mxCam, m_mxProjection, vLightPos, enumEFFECT_Model, enumVIEW_Camera, GL_BACK);
+		if(!m_bReflectionRTT)
+			RecordStatue(PVRTMat4::Scale(1,-1,1) * mxModel, mxCam, m_mxProjection, vLightPos, enumEFFECT_Model, enumVIEW_Reflection, GL_FRONT);
+		RecordChurch(mxCam);
+		ExecuteCommands();
+		}
+
+	// --- Draw the crowd. The sweep splits the timed frames evenly between its steps.
+	if(m_uiCrowd)
+		{
+		CPassTimerScope Timer(m_Profiler, enumPASS_Crowd);
+		m_uiCrowdStep = 0;
+		if(m_bBenchmark && m_uiBenchFrame >= BENCH_WARMUP_FRAMES)
+			m_uiCrowdStep = (m_uiBenchFrame - BENCH_WARMUP_FRAMES) * m_uiCrowdSteps / m_uiBenchFrames;
+		m_uiCrowdActive = m_aCrowdSteps[m_uiCrowdStep].uiCount;
+		RenderCrowd(mxCam, vLightPos);
+		}
+	if(!IsSceneDirect())
+		m_FrameGraph.EndPass(m_FG.uiScenePass, m_GLState);
+
+	// --- Render the bloom effect
+	RenderBloom(mxModel, mxCam, vLightPos);
+
+	// --- Scale a reduced resolution scene up to the screen
+	if(m_uiSceneFBO != (GLuint)m_nOrigFBO)
+		{
+		CPassTimerScope Timer(m_Profiler, enumPASS_Upscale);
+		int nWidth = PVRShellGet(prefWidth), nHeight = PVRShellGet(prefHeight);
+		m_FrameGraph.BeginPass(m_FG.uiUpscalePass, m_GLState);
+		m_GLState.Viewport(0, 0, nWidth, nHeight);
+		m_GLState.Disable(GL_DEPTH_TEST);
+		m_GLState.UseProgram(m_SATexShader.uiID);
+		m_GLState.BindTexture(GL_TEXTURE0, m_FrameGraph.GetTexture(m_FG.uiSceneColour));
+		RenderScreenAlignedTexture(PVRTVec2(-1.0f, 1.0f), PVRTVec2(1.0f, -1.0f),
+								   PVRTVec2(0.0f, m_nSceneHeight / (float)nHeight), PVRTVec2(m_nSceneWidth / (float)nWidth, 0.0f));
+		m_FrameGraph.EndPass(m_FG.uiUpscalePass, m_GLState);
+		}
+
+	// --- Increment the camera angle
+	m_fAngleY += 0.5f * m_fDT;
+
+	// --- Increment the light angle
+	m_fLightAngle += 0.5f * m_fDT;
+
+	m_Profiler.EndFrame();
+	m_fLastCPUFrameMS = (float)(GetTimeMS() - dFrameStartMS);
+	m_uiGLIssued	= m_GLState.GetIssued();
+	m_uiGLFiltered	= m_GLState.GetFiltered();
+	if(m_bShowTimings)
+		RenderTimingsOverlay();
+
+	if(m_fFirstFrameMS == 0.0f)
+		{
+		glFinish();
+		m_fFirstFrameMS = (float)(GetTimeMS() - m_dStartupMS);
+		PVRShellOutputDebug("Time to first frame: %.2fms (from %s)\n", m_fFirstFrameMS, m_Package.IsOpen() ? "package" : "POD");
+		}
+
+	if(m_bBenchmark)
+		{
+		// Wait for the GPU so the frame time covers the whole frame, not just command submission.
+		glFinish();
+		double dFrameEndMS = GetTimeMS();
+
+		if(m_uiBenchFrame >= BENCH_WARMUP_FRAMES)
+			{
+			unsigned int uiTimed = m_uiBenchFrame - BENCH_WARMUP_FRAMES;
+			if(uiTimed == 0)
+				m_dBenchStartMS = dFrameStartMS;
+
+			m_pfBenchFrameMS[uiTimed] = (float)(dFrameEndMS - dFrameStartMS);
+			m_dBenchEndMS = dFrameEndMS;
+			m_dBenchGLIssued	+= m_uiGLIssued;
+			m_dBenchGLFiltered	+= m_uiGLFiltered;
+			m_dBenchShadowCoverage	+= m_fShadowCoverage;
+			m_uiBenchShadowHidden	+= bShadowVisible ? 0 : 1;
+			if(m_uiCrowd)
+				{
+				m_pfBenchCrowdMS[uiTimed] = m_fCrowdSubmitMS;
+				m_pfBenchCrowdUpdateMS[uiTimed] = m_fCrowdUpdateMS;
+				m_aCrowdSteps[m_uiCrowdStep].uiVisible	= m_uiCrowdVisible;
+				m_aCrowdSteps[m_uiCrowdStep].uiDraws	= m_uiCrowdDraws;
+				m_aCrowdSteps[m_uiCrowdStep].uiVertices	= m_uiCrowdVertices;
+				}
+
+			if(uiTimed + 1 == m_uiBenchFrames)
+				{
+				WriteBenchmarkReport();
+				return false;		// Done. Quit the demo.
+				}
+			}
+		++m_uiBenchFrame;
+		}
+
+	return true;
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::UpdateLight(const PVRTMat4& mxCam, PVRTVec3& vLightPos)
+	{
+	// Calculate a new light matrix. Returns false when none of the statue's shadow is in view.
+	vLightPos = PVRTVec4(m_vLightPos, 1.0f) * PVRTMat4::RotationY(m_fLightAngle);
+	bool bShadowVisible = true;
+	if(!m_bShadowFit || !FitLightProjection(vLightPos, mxCam, bShadowVisible))
+		{
+		m_mxLightView = PVRTMat4::LookAtRH(vLightPos, PVRTVec3(0,25,0), PVRTVec3(0,1,0));
+		m_mxLightProj = m_mxLightProjWide;
+		}
+	return bShadowVisible;
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::FitLightProjection(const PVRTVec3& vLightPos, const PVRTMat4& mxCam, bool& bVisible)
+	{
+	// Fits the light's frustum around the statue (the only shadow caster), trimmed to the part of the church the camera can
+	// see. Returns false if it can't be fitted, and sets bVisible to false when none of the statue's shadow is in view.
+	float fRadius = m_bbStatueBR.x;
+	PVRTVec3 avCaster[8];
+	for(unsigned int i = 0; i < 8; ++i)
+		avCaster[i] = PVRTVec3((i & 1) ? fRadius : -fRadius, (i & 2) ? m_bbStatueBR.y : m_bbStatueTL.y, (i & 4) ? fRadius : -fRadius);
+
+	PVRTVec3 vCentre(0.0f, (m_bbStatueTL.y + m_bbStatueBR.y) * 0.5f, 0.0f);
+	PVRTVec3 vDir = vCentre - vLightPos;
+	vDir.normalize();
+	PVRTMat4 mxLightView = PVRTMat4::LookAtRH(vLightPos, vCentre, PVRTVec3(0,1,0));
+
+	// Only the statue is drawn into the map, and ChurchShader.fsh reads any depth from 0.5 up as full shadow. Putting the near
+	// plane at half the closest corner's distance keeps the whole statue above that, and the rest of the range for precision.
+	float fNearest = 0.0f, fFarthest = 0.0f;
+	for(unsigned int i = 0; i < 8; ++i)
+		{
+		float fDist = (avCaster[i] - vLightPos).dot(vDir);
+		fNearest	= i ? PVRT_MIN(fNearest, fDist) : fDist;
+		fFarthest	= i ? PVRT_MAX(fFarthest, fDist) : fDist;
+		}
+	if(fNearest <= 0.0f)
+		return false;			// The light is inside the statue's bounds
+
+	float fNear = fNearest * 0.5f, fFar = fFarthest * 1.01f;
+	PVRTMat4 mxBaseProj = PVRTMat4::PerspectiveFovRH(SHADOW_FIT_FOV, 1.0f, fNear, fFar, PVRTMat4::OGL, m_bRotated);
+	PVRTMat4 mxBaseViewProj = mxBaseProj * mxLightView;
+
+	// --- The statue's bounds in the light's clip space
+	PVRTVec2 vMin(1e30f, 1e30f), vMax(-1e30f, -1e30f);
+	for(unsigned int i = 0; i < 8; ++i)
+		{
+		PVRTVec4 vClip = mxBaseViewProj * PVRTVec4(avCaster[i], 1.0f);
+		float fX = vClip.x / vClip.w, fY = vClip.y / vClip.w;
+		vMin.x = PVRT_MIN(vMin.x, fX);	vMax.x = PVRT_MAX(vMax.x, fX);
+		vMin.y = PVRT_MIN(vMin.y, fY);	vMax.y = PVRT_MAX(vMax.y, fY);
+		}
+
+	// --- Trim to the receivers the camera can see: the church's bounds, clipped to the sides of the view frustum and the
+	// front of the light. Shadows only fall on the church and floor, and nothing outside these bounds can be seen in them.
+	PVRTVec4 avPlanes[5];
+	GetFrustumSidePlanes(m_mxProjection * mxCam, avPlanes);
+	avPlanes[4] = PVRTVec4(vDir.x, vDir.y, vDir.z, -vLightPos.dot(vDir) - fNear);
+
+	PVRTVec3 vRecvMin, vRecvMax;
+	GetChurchBounds(vRecvMin, vRecvMax);
+
+	PVRTVec2 vRecvLightMin(1e30f, 1e30f), vRecvLightMax(-1e30f, -1e30f);
+	for(int nFace = 0; nFace < 6; ++nFace)
+		{
+		// Face nFace / 2 is the axis it's perpendicular to, nFace & 1 which side
+		int nAxis = nFace >> 1, nU = (nAxis + 1) % 3, nV = (nAxis + 2) % 3;
+		PVRTVec3 avPoly[2][SHADOW_FIT_MAX_VERTS];
+		for(int v = 0; v < 4; ++v)
+			{
+			float* pfPos = avPoly[0][v].ptr();
+			pfPos[nAxis]	= (nFace & 1) ? vRecvMax.ptr()[nAxis] : vRecvMin.ptr()[nAxis];
+			pfPos[nU]		= (v == 1 || v == 2) ? vRecvMax.ptr()[nU] : vRecvMin.ptr()[nU];
+			pfPos[nV]		= (v >= 2) ? vRecvMax.ptr()[nV] : vRecvMin.ptr()[nV];
+			}
+
+		unsigned int uiNum = 4;
+		for(int p = 0; p < 5 && uiNum; ++p)
+			uiNum = ClipPolygon(avPoly[p & 1], uiNum, avPlanes[p], avPoly[(p + 1) & 1]);
+
+		for(unsigned int v = 0; v < uiNum; ++v)
+			{
+			PVRTVec4 vClip = mxBaseViewProj * PVRTVec4(avPoly[1][v], 1.0f);
+			float fX = vClip.x / vClip.w, fY = vClip.y / vClip.w;
+			vRecvLightMin.x = PVRT_MIN(vRecvLightMin.x, fX);	vRecvLightMax.x = PVRT_MAX(vRecvLightMax.x, fX);
+			vRecvLightMin.y = PVRT_MIN(vRecvLightMin.y, fY);	vRecvLightMax.y = PVRT_MAX(vRecvLightMax.y, fY);
+			}
+		}
+
+	vMin.x = PVRT_MAX(vMin.x, vRecvLightMin.x);	vMax.x = PVRT_MIN(vMax.x, vRecvLightMax.x);
+	vMin.y = PVRT_MAX(vMin.y, vRecvLightMin.y);	vMax.y = PVRT_MIN(vMax.y, vRecvLightMax.y);
+	bVisible = vMin.x < vMax.x && vMin.y < vMax.y;
+	if(!bVisible)
+		{
+		vMin = PVRTVec2(-1.0f, -1.0f);			// Nothing's drawn, but keep the matrices sensible
+		vMax = PVRTVec2(1.0f, 1.0f);
+		}
+
+	// --- Snap the crop. The size is rounded up to a few fixed steps, leaving room for the margin and the origin's rounding, and
+	// the origin snapped to whole texels at that size. While the light holds still, the texels then stay put on the receivers
+	// as the camera moves instead of crawling along with the trimmed bounds.
+	float fMarginScale = 1.0f / (1.0f - (2 * SHADOW_FIT_MARGIN + 1) / (float)m_nShadowMapActive);
+	PVRTVec2 vSize((float)ceil((vMax.x - vMin.x) * fMarginScale / SHADOW_FIT_SIZE_STEP) * SHADOW_FIT_SIZE_STEP,
+				   (float)ceil((vMax.y - vMin.y) * fMarginScale / SHADOW_FIT_SIZE_STEP) * SHADOW_FIT_SIZE_STEP);
+	PVRTVec2 vTexel(vSize.x / m_nShadowMapActive, vSize.y / m_nShadowMapActive);
+	vMin.x = ((float)floor(vMin.x / vTexel.x) - SHADOW_FIT_MARGIN) * vTexel.x;
+	vMin.y = ((float)floor(vMin.y / vTexel.y) - SHADOW_FIT_MARGIN) * vTexel.y;
+	vMax = vMin + vSize;
+
+	// Stretch the crop to fill the map, as the bloom extract does
+	PVRTMat4 mxCrop = PVRTMat4::Translation(-(vMin.x + vMax.x) / vSize.x, -(vMin.y + vMax.y) / vSize.y, 0.0f) *
+					  PVRTMat4::Scale(2.0f / vSize.x, 2.0f / vSize.y, 1.0f);
+
+	m_mxLightView = mxLightView;
+	m_mxLightProj = mxCrop * mxBaseProj;
+	return true;
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::GetChurchBounds(PVRTVec3& vMin, PVRTVec3& vMax) const
+	{
+	// The church, floor and any other scenery together, in world space
+	m_Scene.GetBounds(ROLE_BIT(enumMODEL_Floor) | ROLE_BIT(enumMODEL_Church), vMin, vMax);
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::RecordReflection(const PVRTMat4& mxModel, const PVRTMat4& mxCam, const PVRTVec3& vLightPos)
+	{
+	// The reflected statue and church, drawn once into their own reduced resolution target which the floor samples.
+	// The target has its own depth buffer, so this pass uses a conventional depth range with a finite far plane that
+	// takes in the whole reflected church: the oblique clip plane needs one.
+	PVRTMat4 mxMirror = PVRTMat4::Scale(1, -1, 1);
+	PVRTMat4 mxReflView = mxCam * mxMirror;
+	PVRTVec3 vMin, vMax;
+	GetChurchBounds(vMin, vMax);
+	float fFar = CAMERA_NEAR * 2.0f;
+	for(unsigned int i = 0; i < 8; ++i)
+		{
+		PVRTVec4 vView = mxReflView * PVRTVec4((i & 1) ? vMax.x : vMin.x, (i & 2) ? vMax.y : vMin.y, (i & 4) ? vMax.z : vMin.z, 1.0f);
+		fFar = PVRT_MAX(fFar, -vView.z * 1.01f);
+		}
+
+	// Same x, y and w rows as the camera's, so the floor can find its texel with m_mxProjection
+	PVRTMat4 mxReflProj = m_mxProjection;
+	mxReflProj.f[2] = mxReflProj.f[6] = 0.0f;
+	mxReflProj.f[10] = (fFar + CAMERA_NEAR) / (CAMERA_NEAR - fFar);
+	mxReflProj.f[14] = 2.0f * fFar * CAMERA_NEAR / (CAMERA_NEAR - fFar);
+
+	// Clip everything that was below the floor before mirroring. The plane is y <= offset, moved into view space.
+	PVRTMat4 mxInvCam;
+	Mat4InverseAffine(mxInvCam, mxCam);
+	const float* fi = mxInvCam.f;
+	PVRTVec4 vWorldPlane(0.0f, -1.0f, 0.0f, REFL_CLIP_OFFSET);
+	PVRTVec4 vViewPlane(fi[0] * vWorldPlane.x + fi[1] * vWorldPlane.y + fi[2] * vWorldPlane.z + fi[3] * vWorldPlane.w,
+						fi[4] * vWorldPlane.x + fi[5] * vWorldPlane.y + fi[6] * vWorldPlane.z + fi[7] * vWorldPlane.w,
+						fi[8] * vWorldPlane.x + fi[9] * vWorldPlane.y + fi[10] * vWorldPlane.z + fi[11] * vWorldPlane.w,
+						fi[12] * vWorldPlane.x + fi[13] * vWorldPlane.y + fi[14] * vWorldPlane.z + fi[15] * vWorldPlane.w);
+	mxReflProj = ObliqueClipProjection(mxReflProj, vViewPlane);
+
+	// The oblique near plane culls whatever's under the floor too
+	m_Scene.Cull(enumVIEW_Reflection, mxReflProj * mxReflView, ROLE_BIT(enumMODEL_Statue) | ROLE_BIT(enumMODEL_Church), m_bCulling);
+
+	// --- Statue and church. Mirroring flips the winding.
+	RecordStatue(mxMirror * mxModel, mxCam, mxReflProj, vLightPos, enumEFFECT_Model, enumVIEW_Reflection, GL_FRONT);
+	DrawPacket Packet;
+	Packet.Init(enumEFFECT_ChurchRefl, GL_FRONT, false, FLAG_VRT | FLAG_TEX0 | FLAG_TEX1);
+	Packet.auiTextures[0] = CMD_TEXTURE(enumTEXTURE_ChurchWalls);
+	Packet.auiTextures[2] = CMD_TEXTURE(enumTEXTURE_ChurchLightmap);
+	Packet.Uniform(enumUNIFORM_Projection, mxReflProj.ptr(), 16);
+	RecordChurchNodes(Packet, mxReflView, enumVIEW_Reflection, enumMODEL_Church, enumCMDLAYER_Opaque);
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::RenderReflection(const PVRTMat4& mxModel, const PVRTMat4& mxCam, const PVRTVec3& vLightPos)
+	{
+	RecordReflection(mxModel, mxCam, vLightPos);
+
+	m_FrameGraph.BeginPass(m_FG.uiReflPass, m_GLState);		// Cleared, depth to 1
+	m_GLState.Viewport(0, 0, m_nReflWidth, m_nReflHeight);
+	m_GLState.Enable(GL_DEPTH_TEST);
+	m_GLState.DepthFunc(GL_LEQUAL);
+	ExecuteCommands();
+	m_FrameGraph.EndPass(m_FG.uiReflPass, m_GLState);
+
+	m_GLState.DepthFunc(GL_GEQUAL);
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::RenderShadowScene(bool bCasters)
+	{
+	// --- Bind the shadow map FBO. Its depth is cleared; there's no colour to clear.
+	m_FrameGraph.BeginPass(m_FG.uiShadowPass, m_GLState);
+	m_GLState.Enable(GL_DEPTH_TEST);
+	m_GLState.Viewport(0, 0, m_nShadowMapActive, m_nShadowMapActive);
+
+	// No shadow lands anywhere the camera can see; the clear is all that's needed
+	if(bCasters)
+		{
+		m_Scene.Cull(enumVIEW_Light, m_mxShadowViewProj, ROLE_BIT(enumMODEL_Statue), m_bCulling);		// Only the statue casts
+		m_GLState.ColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);			// Turn off colour writing
+
+		m_GLState.UseProgram(m_SimpleShader.uiID);
+		for(unsigned int i = 0; i < m_Scene.GetNumVisible(enumVIEW_Light); ++i)
+			{
+			// Create MVP using the light's matrix properties
+			unsigned int uiNode = m_Scene.GetVisible(enumVIEW_Light, i);
+			PVRTMat4 mxMVP = m_mxShadowViewProj * m_Scene.GetNode(uiNode).mxWorld;
+			m_GLState.UniformMatrix4fv(m_SimpleShader.uiMVP, mxMVP.ptr());
+			DrawMesh(&m_SimpleShader, uiNode, FLAG_VRT | FLAG_DEPTH);
+			}
+
+		m_GLState.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);				// We can turn colour writing back on.
+		}
+	m_FrameGraph.EndPass(m_FG.uiShadowPass, m_GLState);
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::GetBloomRegions(const PVRTMat4& mxModel, const PVRTMat4& mxCam, BloomRegions& Regions) const
+	{
+	// --- Work out where the statue lands on screen, from the camera it was actually drawn with
+	PVRTVec2 vMin(-1.0f, -1.0f), vMax(1.0f, 1.0f);
+	if(m_bBloomScissor && !GetStatueScreenBounds(m_mxProjection * mxCam * mxModel, vMin, vMax))
+		return false;			// Off screen; nothing to bloom
+
+	// How far the bloom spreads, in NDC: the Gaussian and the resampling filters' reach at the bottom level, scaled up to
+	// level 0, plus the composite's bilinear lookup. Every level works on the footprint grown by twice that, so nothing
+	// the composite reads depends on texels left outside the region by earlier frames.
+	unsigned int uiBottom = m_uiBloomLevels - 1;
+	const BloomLevel& Top = m_BloomLevels[0];
+	float fSpread = ((2 * m_BloomKernel.uiNumTaps + 4) * (float)(1 << uiBottom) + 2.0f) * 2.0f / Top.nActive;
+	PVRTVec2 vCompMin = vMin - PVRTVec2(fSpread, fSpread), vCompMax = vMax + PVRTVec2(fSpread, fSpread);
+	PVRTVec2 vWorkMin = vCompMin - PVRTVec2(fSpread, fSpread), vWorkMax = vCompMax + PVRTVec2(fSpread, fSpread);
+
+	PixelRect* aRects = Regions.aRects;
+	for(unsigned int i = 0; i < m_uiBloomLevels; ++i)
+		aRects[i] = NDCToPixels(vWorkMin, vWorkMax, m_BloomLevels[i].nActive, m_BloomLevels[i].nActive, 1);
+	if(!aRects[uiBottom].nWidth || !aRects[uiBottom].nHeight)
+		return false;
+
+	// Stretch the region to fill the tight viewport
+	PVRTVec2 vRegionMin(aRects[0].nX * 2.0f / Top.nActive - 1.0f, aRects[0].nY * 2.0f / Top.nActive - 1.0f);
+	PVRTVec2 vRegionMax((aRects[0].nX + aRects[0].nWidth) * 2.0f / Top.nActive - 1.0f, (aRects[0].nY + aRects[0].nHeight) * 2.0f / Top.nActive - 1.0f);
+	PVRTVec2 vSize = vRegionMax - vRegionMin;
+	Regions.mxCrop = PVRTMat4::Translation(-(vRegionMin.x + vRegionMax.x) / vSize.x, -(vRegionMin.y + vRegionMax.y) / vSize.y, 0.0f) *
+					 PVRTMat4::Scale(2.0f / vSize.x, 2.0f / vSize.y, 1.0f);
+
+	// Composite the footprint only, snapped outwards to whole screen pixels
+	int nWidth = m_nSceneWidth, nHeight = m_nSceneHeight;
+	const PixelRect& ScreenRect = Regions.Composite = NDCToPixels(vCompMin, vCompMax, nWidth, nHeight, 0);
+	float fTopU = Top.nActive / (float)Top.nWidth, fTopV = Top.nActive / (float)Top.nHeight;
+	Regions.vCompositeTTL = PVRTVec2(ScreenRect.nX * fTopU / nWidth, (ScreenRect.nY + ScreenRect.nHeight) * fTopV / nHeight);
+	Regions.vCompositeTBR = PVRTVec2((ScreenRect.nX + ScreenRect.nWidth) * fTopU / nWidth, ScreenRect.nY * fTopV / nHeight);
+	return true;
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::RenderBloom(const PVRTMat4& mxModel, const PVRTMat4& mxCam, const PVRTVec3& vLightPos)
+	{
+	BloomRegions Regions;
+	if(!GetBloomRegions(mxModel, mxCam, Regions))
+		return;
+	const PixelRect* aRects = Regions.aRects;
+	unsigned int uiBottom = m_uiBloomLevels - 1;
+
+	m_Profiler.Begin(enumPASS_BloomExtract);
+
+	// --- Bind an empty frame buffer. It's cleared as the pass begins, as are all the targets up to the upsample.
+	SetBloomTarget(m_FG.uiBloomExtractPass, aRects[0]);
+	m_GLState.Enable(GL_DEPTH_TEST);
+
+	// --- Render the statue with Bloom Stage 1 Shader. This basically renders the statue with the normal map
+	// and uses a texture lookup to effectively high-pass filter the resultant output.
+	RecordStatue(mxModel, mxCam, Regions.mxCrop * m_mxProjection, vLightPos, enumEFFECT_Bloom1, enumVIEW_Camera, GL_BACK);		// The crop only narrows the camera's view
+	ExecuteCommands();
+	m_FrameGraph.EndPass(m_FG.uiBloomExtractPass, m_GLState);
+
+	m_Profiler.End(enumPASS_BloomExtract);
+
+	// --- DOWNSAMPLE. Each level is half the size of the one above.
+	m_Profiler.Begin(enumPASS_BloomDownsample);
+	m_GLState.UseProgram(m_BloomDownShader.uiID);
+	for(unsigned int i = 1; i < m_uiBloomLevels; ++i)
+		{
+		SetBloomTarget(m_FG.auiBloomDownPass[i], aRects[i]);
+		m_GLState.BindTexture(GL_TEXTURE0, m_BloomLevels[i - 1].uiTexture);
+		m_GLState.Uniform2f(m_BloomDownShader.uiTexelOffset, 1.0f / m_BloomLevels[i - 1].nWidth, 1.0f / m_BloomLevels[i - 1].nHeight);
+		DrawBloomQuad(m_BloomLevels[i], aRects[i]);
+		m_FrameGraph.EndPass(m_FG.auiBloomDownPass[i], m_GLState);
+		}
+	m_Profiler.End(enumPASS_BloomDownsample);
+
+	// --- BLUR PASSES. A separable Gaussian over the bottom level only, so its cost doesn't depend on the radius.
+	const BloomLevel& Bottom = m_BloomLevels[uiBottom];
+	m_Profiler.Begin(enumPASS_BloomBlurH);
+	m_GLState.UseProgram(m_BloomBlurShader.uiID);
+	glUniform2fv(m_BloomBlurShader.uiTaps, BLOOM_MAX_TAPS, m_BloomKernel.afTaps);		// Arrays don't go through the state cache
+
+	// Horizontal blur
+	SetBloomTarget(m_FG.uiBloomBlurHPass, aRects[uiBottom]);
+	m_GLState.BindTexture(GL_TEXTURE0, Bottom.uiTexture);
+	m_GLState.Uniform2f(m_BloomBlurShader.uiTexelOffset, 1.0f / Bottom.nWidth, 0.0f);
+	DrawBloomQuad(m_BloomScratch, aRects[uiBottom]);
+	m_FrameGraph.EndPass(m_FG.uiBloomBlurHPass, m_GLState);
+	m_Profiler.End(enumPASS_BloomBlurH);
+
+	// Vertical blur
+	m_Profiler.Begin(enumPASS_BloomBlurV);
+	SetBloomTarget(m_FG.uiBloomBlurVPass, aRects[uiBottom]);
+	m_GLState.BindTexture(GL_TEXTURE0, m_BloomScratch.uiTexture);
+	m_GLState.Uniform2f(m_BloomBlurShader.uiTexelOffset, 0.0f, 1.0f / m_BloomScratch.nHeight);
+	DrawBloomQuad(Bottom, aRects[uiBottom]);
+	m_FrameGraph.EndPass(m_FG.uiBloomBlurVPass, m_GLState);
+	m_Profiler.End(enumPASS_BloomBlurV);
+
+	// --- UPSAMPLE. Each level is added on top of the one above, which still holds its downsampled copy.
+	m_Profiler.Begin(enumPASS_BloomUpsample);
+	m_GLState.UseProgram(m_BloomUpShader.uiID);
+	m_GLState.Enable(GL_BLEND);
+	m_GLState.BlendFunc(GL_ONE, GL_ONE);
+	for(unsigned int i = uiBottom; i-- > 0;)
+		{
+		SetBloomTarget(m_FG.auiBloomUpPass[i], aRects[i]);
+		m_GLState.BindTexture(GL_TEXTURE0, m_BloomLevels[i + 1].uiTexture);
+		m_GLState.Uniform2f(m_BloomUpShader.uiTexelOffset, 1.0f / m_BloomLevels[i + 1].nWidth, 1.0f / m_BloomLevels[i + 1].nHeight);
+		DrawBloomQuad(m_BloomLevels[i], aRects[i]);
+		m_FrameGraph.EndPass(m_FG.auiBloomUpPass[i], m_GLState);
+		}
+	m_Profiler.End(enumPASS_BloomUpsample);
+
+
+	// --- OVERLAY PASS
+	m_Profiler.Begin(enumPASS_BloomComposite);
+	if(IsSceneDirect())
+		m_GLState.BindFramebuffer(m_uiSceneFBO);		// Done. Back to the scene.
+	else
+		m_FrameGraph.BeginPass(m_FG.uiCompositePass, m_GLState);
+
+	// Composite the footprint only
+	const PixelRect& ScreenRect = Regions.Composite;
+	m_GLState.Viewport(ScreenRect.nX, ScreenRect.nY, ScreenRect.nWidth, ScreenRect.nHeight);
+	m_GLState.Scissor(ScreenRect.nX, ScreenRect.nY, ScreenRect.nWidth, ScreenRect.nHeight);
+
+	// --- Render the texture to a screen aligned quad over the original mode. Blending is still additive.
+	m_GLState.UseProgram(m_SATexShader.uiID);
+	m_GLState.BindTexture(GL_TEXTURE0, m_BloomLevels[0].uiTexture);
+	RenderScreenAlignedTexture(PVRTVec2(-1.0f, 1.0f), PVRTVec2(1.0f, -1.0f), Regions.vCompositeTTL, Regions.vCompositeTBR);
+	m_GLState.Disable(GL_BLEND);
+	m_GLState.Disable(GL_SCISSOR_TEST);
+	m_GLState.Viewport(0, 0, m_nSceneWidth, m_nSceneHeight);
+	if(!IsSceneDirect())
+		m_FrameGraph.EndPass(m_FG.uiCompositePass, m_GLState);
+
+	m_Profiler.End(enumPASS_BloomComposite);
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::GetStatueScreenBounds(const PVRTMat4& mxMVP, PVRTVec2& vMin, PVRTVec2& vMax) const
+	{
+	// The statue spins about Y, so bound it with a box that holds it at any angle. Returns false if it's off screen.
+	float fRadius = m_bbStatueBR.x;
+	PVRTVec3 avCorners[8];
+	for(unsigned int i = 0; i < 8; ++i)
+		avCorners[i] = PVRTVec3((i & 1) ? fRadius : -fRadius, (i & 2) ? m_bbStatueBR.y : m_bbStatueTL.y, (i & 4) ? fRadius : -fRadius);
+
+	// Straddles the camera plane; just use the whole screen
+	if(!ProjectBounds(mxMVP, avCorners, 8, vMin, vMax))
+		{
+		vMin = PVRTVec2(-1.0f, -1.0f);
+		vMax = PVRTVec2(1.0f, 1.0f);
+		return true;
+		}
+
+	vMin.x = PVRT_MAX(vMin.x, -1.0f);	vMax.x = PVRT_MIN(vMax.x, 1.0f);
+	vMin.y = PVRT_MAX(vMin.y, -1.0f);	vMax.y = PVRT_MIN(vMax.y, 1.0f);
+	return vMin.x < vMax.x && vMin.y < vMax.y;
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::RecordStatue(const PVRTMat4& mxModel, const PVRTMat4& mxCam, const PVRTMat4& mxProjection, const PVRTVec3& vLightPos, unsigned int uiEffect, unsigned int uiView, GLenum eCullFace)
+	{
+	PVRTMat4 mxView;
+	Mat4Multiply(mxView, mxCam, mxModel);
+
+	DrawPacket Packet;
+	Packet.Init(uiEffect, eCullFace, false, FLAG_VRT | FLAG_TEX0 | FLAG_NRM | FLAG_TAN);
+	Packet.auiTextures[0] = CMD_TEXTURE(enumTEXTURE_StatueNormals);
+	if(uiEffect == enumEFFECT_Bloom1)
+		Packet.auiTextures[1] = CMD_TEXTURE(enumTEXTURE_BloomMap);
+	for(unsigned int i = 0; i < m_Scene.GetNumVisible(uiView); ++i)
+		{
+		unsigned int uiNode = m_Scene.GetVisible(uiView, i);
+		const SceneNode& Node = m_Scene.GetNode(uiNode);
+		if(Node.nRole != enumMODEL_Statue)
+			continue;
+
+		PVRTMat4 mxModelView, mxMVP, mxWorldInv;
+		Mat4Multiply(mxModelView, mxView, Node.mxWorld);
+		Mat4Multiply(mxMVP, mxProjection, mxModelView);
+		Mat4InverseAffine(mxWorldInv, Node.mxWorld);
+		PVRTVec3 vLightPosModel = mxWorldInv * PVRTVec4(vLightPos, 1.0f);		// Light position in the node's space
+		Packet.nNode = uiNode;
+		Packet.uiNumUniforms = 0;
+		Packet.Uniform(enumUNIFORM_LightPos, vLightPosModel.ptr(), 3);
+		Packet.Uniform(enumUNIFORM_MVP, mxMVP.ptr(), 16);
+		Packet.Uniform(enumUNIFORM_ModelView, mxModelView.ptr(), 16);
+		if(uiEffect == enumEFFECT_Bloom1)
+			Packet.Uniform1f(enumUNIFORM_BloomMulti, m_fBloomMulti / m_uiBloomLevels);	// Every bloom level adds its own copy on the way back up
+		m_Commands.Add(Packet, enumCMDLAYER_Opaque, GetViewDepth(mxView, Node.vCentre));
+		}
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::InitCrowd()
+	{
+	m_pfnDrawElementsInstanced = NULL;
+	m_pfnVertexAttribDivisor = NULL;
+	m_uiCrowdPlaced = 0;
+	m_uiCrowdBatch = 0;
+	if(!m_uiCrowd)
+		return;
+
+	// Instanced arrays come as EXT or ANGLE, with the same entry points bar the suffix
+	const char* const c_apszInstancing[][3] =
+		{
+		{ "GL_EXT_instanced_arrays",	"glDrawElementsInstancedEXT",	"glVertexAttribDivisorEXT" },
+		{ "GL_ANGLE_instanced_arrays",	"glDrawElementsInstancedANGLE",	"glVertexAttribDivisorANGLE" },
+		};
+	for(unsigned int i = 0; i < ELEMENTS_IN_ARRAY(c_apszInstancing) && !m_pfnVertexAttribDivisor; ++i)
+		{
+		if(!CPVRTgles2Ext::IsGLExtensionSupported(c_apszInstancing[i][0]))
+			continue;
+
+		m_pfnDrawElementsInstanced	= (PFNDEMODRAWELEMENTSINSTANCEDPROC)eglGetProcAddress(c_apszInstancing[i][1]);
+		m_pfnVertexAttribDivisor	= (PFNDEMOVERTEXATTRIBDIVISORPROC)eglGetProcAddress(c_apszInstancing[i][2]);
+		if(!m_pfnDrawElementsInstanced)
+			m_pfnVertexAttribDivisor = NULL;
+		}
+
+	bool bInstancing = m_pfnVertexAttribDivisor != NULL;
+	m_nCrowdPath = m_nCrowdRequest;
+	if(m_nCrowdPath < 0)
+		{
+		m_nCrowdPath = bInstancing ? enumCROWD_Instanced : enumCROWD_Palette;
+		}
+	else if(m_nCrowdPath == enumCROWD_Instanced && !bInstancing)
+		{
+		PVRShellOutputDebug("WARNING: Instanced arrays aren't supported; drawing the crowd from a palette instead\n");
+		m_nCrowdPath = enumCROWD_Palette;
+		}
+
+	// Drawing one at a time needs each statue's matrices, which the update fills in
+	if(m_nCrowdPath == enumCROWD_Single && !m_pmxCrowdMVP)
+		{
+		m_pmxCrowdMVP = new PVRTMat4[m_uiCrowd];
+		m_pmxCrowdModelView = new PVRTMat4[m_uiCrowd];
+		m_pvCrowdLightPos = new PVRTVec3[m_uiCrowd];
+		}
+
+	glGenBuffers(1, &m_uiCrowdInstanceVBO);
+	glGenBuffers(1, &m_uiCrowdVBO);
+	glGenBuffers(1, &m_uiCrowdVBOIdx);
+	glGenBuffers(1, &m_uiCrowdPaletteVBO);
+	PVRShellOutputDebug("Crowd: %u statues, %s path, updated on %u threads\n", m_uiCrowd, c_pszCrowdPaths[m_nCrowdPath], m_Jobs.GetNumThreads());
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::PrepareCrowdMesh(unsigned int uiMeshIdx, const void* pVertices, unsigned int uiVertexBytes, const unsigned short* puIndices, unsigned int uiNumIndices)
+	{
+	// Called with the statue's final vertices and indices as they're uploaded
+	m_uiCrowdMeshVertices = uiVertexBytes / m_VertexFormat[uiMeshIdx].nStride;
+	if(m_nCrowdPath != enumCROWD_Palette || !m_uiCrowdMeshVertices)
+		return;
+
+	// The palette path draws a batch of statues from copies of the mesh, with each copy's vertices tagged with the palette
+	// entry that places it. 16 bit indices limit how many copies fit.
+	unsigned int uiBatch = PVRT_MIN((unsigned int)CROWD_PALETTE_SIZE, 65536 / m_uiCrowdMeshVertices);
+	unsigned char* pCopies = new unsigned char[uiVertexBytes * uiBatch];
+	unsigned char* pPalette = new unsigned char[m_uiCrowdMeshVertices * uiBatch];
+	unsigned short* puCopies = new unsigned short[uiNumIndices * uiBatch];
+	for(unsigned int k = 0; k < uiBatch; ++k)
+		{
+		memcpy(pCopies + k * uiVertexBytes, pVertices, uiVertexBytes);
+		memset(pPalette + k * m_uiCrowdMeshVertices, (int)k, m_uiCrowdMeshVertices);
+		for(unsigned int i = 0; i < uiNumIndices; ++i)
+			puCopies[k * uiNumIndices + i] = (unsigned short)(puIndices[i] + k * m_uiCrowdMeshVertices);
+		}
+
+	// Not part of the package; they're rebuilt from the statue's buffers on every run
+	glBindBuffer(GL_ARRAY_BUFFER, m_uiCrowdVBO);
+	glBufferData(GL_ARRAY_BUFFER, uiVertexBytes * uiBatch, pCopies, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, m_uiCrowdPaletteVBO);
+	glBufferData(GL_ARRAY_BUFFER, m_uiCrowdMeshVertices * uiBatch, pPalette, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_uiCrowdVBOIdx);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, uiNumIndices * uiBatch * sizeof(unsigned short), puCopies, GL_STATIC_DRAW);
+
+	delete [] pCopies;
+	delete [] pPalette;
+	delete [] puCopies;
+	m_uiCrowdBatch = uiBatch;
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::SetCrowdUpdate(CrowdUpdate* pUpdate, const PVRTVec4* pvInstances, const PVRTMat4& mxCam, const PVRTVec3& vLightPos) const
+	{
+	// Everything but the outputs. The sphere is loose, as the statue turns about Y.
+	float fHalfHeight = (m_bbStatueBR.y - m_bbStatueTL.y) * 0.5f;
+	pUpdate->pvInstances	= pvInstances;
+	pUpdate->mxCam			= mxCam;
+	pUpdate->mxProjection	= m_mxProjection;
+	pUpdate->vLightPos		= vLightPos;
+	pUpdate->uiNumPlanes	= m_bCulling ? GetFrustumPlanes(m_mxProjection * mxCam, pUpdate->avPlanes) : 0;
+	pUpdate->vCentre		= PVRTVec3(0.0f, m_bbStatueTL.y + fHalfHeight, 0.0f);
+	pUpdate->fRadius		= (float)sqrt(m_bbStatueBR.x * m_bbStatueBR.x * 2.0f + fHalfHeight * fHalfHeight);
+	}
+
+// ---------------------------------------------------------------
+void MyPVRDemo::RenderCrowd(const PVRTMat4& mxCam, const PVRTVec3& vLightPos)
+	{
+	// Only the camera's view gets the crowd: no shadows, reflections or bloom, so its cost is all in the update and the draws
+	double dStartMS = GetTimeMS();
+	m_uiCrowdDraws = 0;
+	m_uiCrowdVertices = 0;
+
+	// Placed whenever the sweep changes its size. The floor's bounds aren't known until the scene's in.
+	if(m_uiCrowdPlaced != m_uiCrowdActive)
+		{
+		PVRTVec3 vFloorMin(0.0f, 0.0f, 0.0f), vFloorMax(0.0f, 0.0f, 0.0f);
+		m_Scene.GetBounds(ROLE_BIT(enumMODEL_Floor), vFloorMin, vFloorMax);
+		PlaceCrowd(m_pvCrowd, m_uiCrowdActive, m_bbStatueBR.x, vFloorMin, vFloorMax);
+		m_uiCrowdPlaced = m_uiCrowdActive;
+		}
+
+	// --- Cull, transform and key the statues across the job system, then sort them front to back here
+	CrowdUpdate Update;
+	SetCrowdUpdate(&Update, m_pvCrowd, mxCam, vLightPos);
+	Update.puKeys		= m_puCrowdKeys;
+	Update.pmxMVP		= m_pmxCrowdMVP;			// NULL unless drawing one at a time
+	Update.pmxModelView	= m_pmxCrowdModelView;
+	Update.pvLightPos	= m_pvCrowdLightPos;
+	m_Jobs.ParallelFor(UpdateCrowd, &Update, m_uiCrowdActive, JOB_DEFAULT_GRAIN);
+	m_uiCrowdVisible = SortCrowdKeys(m_puCrowdKeys, m_puCrowdTemp, m_uiCrowdActive);
+
+	double dSubmitStartMS = GetTimeMS();
+	m_fCrowdUpdateMS = (float)(dSubmitStartMS - dStartMS);
+
+	int nMeshIdx = m_Scene.GetRoleNode(enumMODEL_Statue).nMesh;
+	const GLuint c_uiFlags = FLAG_VRT | FLAG_TEX0 | FLAG_NRM | FLAG_TAN;
+	m_GLState.BindTexture(GL_TEXTURE0, m_tex[enumTEXTURE_StatueNormals]);
+
+	// --- One statue at a time, the baseline the batched paths are measured against
+	if(m_nCrowdPath == enumCROWD_Single)
+		{
+		m_GLState.UseProgram(m_StatueShader.uiID);
+		for(unsigned int i = 0; i < m_uiCrowdVisible; ++i)
+			{
+			unsigned int uiStatue = m_puCrowdKeys[i] & CROWD_KEY_INDEX_MASK;
+			m_GLState.Uniform3fv(m_StatueShader.uiLightPos, m_pvCrowdLightPos[uiStatue].ptr());
+			m_GLState.UniformMatrix4fv(m_StatueShader.uiMVP, m_pmxCrowdMVP[uiStatue].ptr());
+			m_GLState.UniformMatrix4fv(m_StatueShader.uiModelView, m_pmxCrowdModelView[uiStatue].ptr());
+			DrawMesh(&m_StatueShader, m_Scene.GetRoleNodeIndex(enumMODEL_Statue), c_uiFlags);
+			}
+		m_uiCrowdDraws = m_uiCrowdVisible;
+		m_uiCrowdVertices = m_uiCrowdVisible * m_uiCrowdMeshVertices;
+		m_fCrowdSubmitMS = (float)(GetTimeMS() - dSubmitStartMS);
+		return;
+		}
+
+	// The batched paths read the visible statues in order, from one array
+	for(unsigned int i = 0; i < m_uiCrowdVisible; ++i)
+		m_pvCrowdDraw[i] = m_pvCrowd[m_puCrowdKeys[i] & CROWD_KEY_INDEX_MASK];
+
+	// --- The batched paths place the statues in the shader, so the matrices are the camera's and the light's in world space
+	const CrowdShader* pShader = m_nCrowdPath == enumCROWD_Palette ? &m_CrowdPaletteShader : &m_CrowdInstancedShader;
+	const CompactVertexFormat& Format = m_VertexFormat[nMeshIdx];
+	PVRTMat4 mxMVP = m_mxProjection * mxCam;
+	m_GLState.UseProgram(pShader->uiID);
+	m_GLState.UniformMatrix4fv(pShader->uiMVP, mxMVP.ptr());
+	m_GLState.UniformMatrix4fv(pShader->uiModelView, mxCam.ptr());
+	m_GLState.Uniform3fv(pShader->uiLightPos, vLightPos.ptr());
+	m_GLState.Uniform3fv(pShader->uiPosScale, Format.vPosScale.ptr());
+	m_GLState.Uniform3fv(pShader->uiPosBias, Format.vPosBias.ptr());
+	m_GLState.Uniform4fv(pShader->uiUVScaleBias[0], Format.vUVScaleBias[0].ptr());
+
+	const unsigned int c_uiAttribs = (1 << enumATTRIBUTE_POSITION) | (1 << enumATTRIBUTE_TEXCOORD0) | (1 << enumATTRIBUTE_NORMAL) |
+									 (1 << enumATTRIBUTE_TANGENT) | (1 << enumATTRIBUTE_INSTANCE);
+	m_GLState.BindVertexArray(0);
+
+	if(m_nCrowdPath == enumCROWD_Palette && m_uiCrowdBatch)
+		{
+		// The copies have the statue's layout
+		SetMeshAttribs(m_uiCrowdVBO, m_uiCrowdVBOIdx, Format, c_uiFlags);
+		m_GLState.VertexAttribArrays(c_uiAttribs);
+		m_GLState.BindBuffer(GL_ARRAY_BUFFER, m_uiCrowdPaletteVBO);
+		m_GLState.VertexAttribPointer(enumATTRIBUTE_INSTANCE, 1, GL_UNSIGNED_BYTE, GL_FALSE, 0, 0);
+
+		// A short last batch just draws fewer of the copies
+		for(unsigned int i = 0; i < m_uiCrowdVisible; i += m_uiCrowdBatch)
+			{
+			unsigned int uiCount = PVRT_MIN(m_uiCrowdBatch, m_uiCrowdVisible - i);
+			glUniform4fv(pShader->uiInstances, uiCount, m_pvCrowdDraw[i].ptr());		// Arrays don't go through the state cache
+			glDrawElements(GL_TRIANGLES, uiCount * m_uiNumIndices[nMeshIdx], GL_UNSIGNED_SHORT, 0);
+			++m_uiCrowdDraws;
+			}
+		}
+	else if(m_nCrowdPath == enumCROWD_Instanced && m_uiCrowdVisible)
+		{
+		// Respecified every frame, as culling changes what's in it
+		SetMeshAttribs(nMeshIdx, c_uiFlags);
+		m_GLState.VertexAttribArrays(c_uiAttribs);
+		m_GLState.BindBuffer(GL_ARRAY_BUFFER, m_uiCrowdInstanceVBO);
+		glBufferData(GL_ARRAY_BUFFER, m_uiCrowdVisible * sizeof(PVRTVec4), m_pvCrowdDraw, GL_STREAM_DRAW);
+		m_GLState.VertexAttribPointer(enumATTRIBUTE_INSTANCE, 4, GL_FLOAT, GL_FALSE, 0, 0);
+
+		m_pfnVertexAttribDivisor(enumATTRIBUTE_INSTANCE, 1);
+		m_pfnDrawElementsInstanced(GL_TRIANGLES, m_uiNumIndices[nMeshIdx], GL_UNSIGNED_SHORT, 0, m_uiCrowdVisible);
+		m_pfnVertexAttribDivisor(enumATTRIBUTE_INSTANCE, 0);		// Nothing else expects one
+		m_uiCrowdDraws = 1;
+		}
+
+	m_uiCrowdVertices = m_uiCrowdVisible * m_uiCrowdMeshVertices;
+	m_fCrowdSubmitMS = (float)(GetTimeMS() - dSubmitStartMS);
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::RunJobBenchmark()
+	{
+	// The crowd's update for a full crowd from the start camera, with every output on, as the single path has it.
+	// Runs on the render thread too, so it's timed just as RenderCrowd would see it.
+	const unsigned int c_uiCount = CROWD_MAX_INSTANCES;
+	PVRTVec4* pvInstances		= new PVRTVec4[c_uiCount];
+	unsigned int* puKeys		= new unsigned int[c_uiCount];
+	unsigned int* puTemp		= new unsigned int[c_uiCount];
+	PVRTMat4* pmxMVP			= new PVRTMat4[c_uiCount];
+	PVRTMat4* pmxModelView		= new PVRTMat4[c_uiCount];
+	PVRTVec3* pvLightPos		= new PVRTVec3[c_uiCount];
+	float* pfUpdate				= new float[m_uiJobBenchRuns];
+	float* pfSort				= new float[m_uiJobBenchRuns];
+
+	PVRTVec3 vFloorMin(0.0f, 0.0f, 0.0f), vFloorMax(0.0f, 0.0f, 0.0f);
+	m_Scene.GetBounds(ROLE_BIT(enumMODEL_Floor), vFloorMin, vFloorMax);
+	PlaceCrowd(pvInstances, c_uiCount, m_bbStatueBR.x, vFloorMin, vFloorMax);
+
+	CrowdUpdate Update;
+	SetCrowdUpdate(&Update, pvInstances, m_mxCam, PVRTVec4(m_vLightPos, 1.0f) * PVRTMat4::RotationY(m_fLightAngle));
+	Update.puKeys		= puKeys;
+	Update.pmxMVP		= pmxMVP;
+	Update.pmxModelView	= pmxModelView;
+	Update.pvLightPos	= pvLightPos;
+
+	struct Result
+		{
+		unsigned int	uiThreads;
+		float			fMinMS;
+		float			fMedianMS;
+		float			fSortMS;
+		float			fSteals;
+		float			fJobs;
+		};
+	Result aResults[JOB_MAX_THREADS];
+	unsigned int uiNumResults = 0, uiVisible = 0;
+
+	PVRShellOutputDebug("Job scaling: %u statues, %u runs, %u cores\n", c_uiCount, m_uiJobBenchRuns, GetCPUCount());
+	for(unsigned int t = 1; t <= m_uiJobThreads; ++t)
+		{
+		if(!m_Jobs.Start(t))
+			{
+			PVRShellOutputDebug("WARNING: Only %u of %u job threads started\n", m_Jobs.GetNumThreads(), t);
+			break;
+			}
+
+		for(unsigned int r = 0; r < JOB_BENCH_WARMUP_RUNS; ++r)
+			m_Jobs.ParallelFor(UpdateCrowd, &Update, c_uiCount, JOB_DEFAULT_GRAIN);
+		m_Jobs.ResetCounters();
+
+		for(unsigned int r = 0; r < m_uiJobBenchRuns; ++r)
+			{
+			double dStartMS = GetTimeMS();
+			m_Jobs.ParallelFor(UpdateCrowd, &Update, c_uiCount, JOB_DEFAULT_GRAIN);
+			double dSortMS = GetTimeMS();
+			uiVisible = SortCrowdKeys(puKeys, puTemp, c_uiCount);
+			pfUpdate[r] = (float)(dSortMS - dStartMS);
+			pfSort[r] = (float)(GetTimeMS() - dSortMS);
+			}
+		qsort(pfUpdate, m_uiJobBenchRuns, sizeof(float), CompareFloat);
+		qsort(pfSort, m_uiJobBenchRuns, sizeof(float), CompareFloat);
+
+		Result& Res = aResults[uiNumResults++];
+		Res.uiThreads	= t;
+		Res.fMinMS		= pfUpdate[0];
+		Res.fMedianMS	= Percentile(pfUpdate, m_uiJobBenchRuns, 50.0f);
+		Res.fSortMS		= Percentile(pfSort, m_uiJobBenchRuns, 50.0f);
+		Res.fSteals		= 0.0f;
+		Res.fJobs		= 0.0f;
+		for(unsigned int i = 0; i < t; ++i)
+			{
+			Res.fSteals += m_Jobs.GetSteals(i);
+			Res.fJobs += m_Jobs.GetJobs(i);
+			}
+		Res.fSteals /= m_uiJobBenchRuns;
+		Res.fJobs /= m_uiJobBenchRuns;
+
+		PVRShellOutputDebug("  %2u threads: median %.3fms (min %.3fms), %.0f statues/ms, %.2fx, %.1f jobs, %.1f steals, sort %.3fms\n",
+							t, Res.fMedianMS, Res.fMinMS, c_uiCount / PVRT_MAX(Res.fMedianMS, 0.001f), aResults[0].fMedianMS / PVRT_MAX(Res.fMedianMS, 0.001f),
+							Res.fJobs, Res.fSteals, Res.fSortMS);
+		}
+	m_Jobs.Stop();
+
+	delete [] pvInstances;
+	delete [] puKeys;
+	delete [] puTemp;
+	delete [] pmxMVP;
+	delete [] pmxModelView;
+	delete [] pvLightPos;
+	delete [] pfUpdate;
+	delete [] pfSort;
+
+	CPVRTString Path = CPVRTString((const char*)PVRShellGet(prefWritePath)) + JOB_BENCH_REPORT;
+	FILE* pFile = fopen(Path.c_str(), "w");
+	if(!pFile)
+		{
+		PVRShellOutputDebug("ERROR: Could not write job scaling report: %s\n", Path.c_str());
+		return false;
+		}
+
+	fprintf(pFile, "{\n");
+	fprintf(pFile, "\t\"statues\": %u,\n", c_uiCount);
+	fprintf(pFile, "\t\"visible\": %u,\n", uiVisible);
+	fprintf(pFile, "\t\"grain\": %u,\n", JOB_DEFAULT_GRAIN);
+	fprintf(pFile, "\t\"runs\": %u,\n", m_uiJobBenchRuns);
+	fprintf(pFile, "\t\"cores\": %u,\n", GetCPUCount());
+	fprintf(pFile, "\t\"threads\": [");
+	for(unsigned int i = 0; i < uiNumResults; ++i)
+		{
+		const Result& Res = aResults[i];
+		fprintf(pFile, "%s\n\t\t{ \"threads\": %u, \"update_ms\": { \"min\": %.4f, \"median\": %.4f }, \"statues_per_ms\": %.1f, \"speedup\": %.3f, \"jobs\": %.2f, \"steals\": %.2f, \"sort_ms\": %.4f }",
+				i ? "," : "", Res.uiThreads, Res.fMinMS, Res.fMedianMS, c_uiCount / PVRT_MAX(Res.fMedianMS, 0.001f),
+				aResults[0].fMedianMS / PVRT_MAX(Res.fMedianMS, 0.001f), Res.fJobs, Res.fSteals, Res.fSortMS);
+		}
+	fprintf(pFile, "\n\t]\n");
+	fprintf(pFile, "}\n");
+	fclose(pFile);
+	return true;
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::RunMathBenchmark()
+	{
+	// Each kernel is checked against PVRTools first, then both are timed turn about so they see the same conditions
+	MathBench Bench;
+	InitMathBench(Bench, m_mxProjection * m_mxCam);
+
+	float afError[enumMATHKERNEL_MAX], afScalarMS[enumMATHKERNEL_MAX], afSIMDMS[enumMATHKERNEL_MAX];
+	float* pfScalar = new float[m_uiMathBenchRuns];
+	float* pfSIMD = new float[m_uiMathBenchRuns];
+	bool bPassed = true;
+
+	PVRShellOutputDebug("Math: %s, %u runs\n", c_pszMathSIMD, m_uiMathBenchRuns);
+	for(unsigned int k = 0; k < enumMATHKERNEL_MAX; ++k)
+		{
+		unsigned int uiFloats = RunMathKernel(k, false, Bench);
+		RunMathKernel(k, true, Bench);
+		afError[k] = GetMathError(Bench.apfOut[0], Bench.apfOut[1], uiFloats);
+		bPassed = bPassed && afError[k] <= MATH_BENCH_TOLERANCE;
+
+		for(unsigned int r = 0; r < m_uiMathBenchRuns; ++r)
+			{
+			double dStartMS = GetTimeMS();
+			RunMathKernel(k, false, Bench);
+			double dSIMDStartMS = GetTimeMS();
+			RunMathKernel(k, true, Bench);
+			pfScalar[r] = (float)(dSIMDStartMS - dStartMS);
+			pfSIMD[r] = (float)(GetTimeMS() - dSIMDStartMS);
+			}
+		qsort(pfScalar, m_uiMathBenchRuns, sizeof(float), CompareFloat);
+		qsort(pfSIMD, m_uiMathBenchRuns, sizeof(float), CompareFloat);
+		afScalarMS[k] = Percentile(pfScalar, m_uiMathBenchRuns, 50.0f);
+		afSIMDMS[k] = Percentile(pfSIMD, m_uiMathBenchRuns, 50.0f);
+
+		PVRShellOutputDebug("  %-16s %s error %g, PVRTools %.4fms, SIMD %.4fms, %.2fx\n", c_pszMathKernels[k],
+							afError[k] <= MATH_BENCH_TOLERANCE ? "ok  " : "FAIL", afError[k], afScalarMS[k], afSIMDMS[k],
+							afScalarMS[k] / PVRT_MAX(afSIMDMS[k], 0.0001f));
+		}
+
+	delete [] pfScalar;
+	delete [] pfSIMD;
+	ReleaseMathBench(Bench);
+
+	CPVRTString Path = CPVRTString((const char*)PVRShellGet(prefWritePath)) + MATH_BENCH_REPORT;
+	FILE* pFile = fopen(Path.c_str(), "w");
+	if(!pFile)
+		{
+		PVRShellOutputDebug("ERROR: Could not write math report: %s\n", Path.c_str());
+		return bPassed;
+		}
 
-	for(int i = 0; i < enumFB_MAX; i++)
+	fprintf(pFile, "{\n");
+	fprintf(pFile, "\t\"simd\": \"%s\",\n", c_pszMathSIMD);
+	fprintf(pFile, "\t\"count\": %u,\n", MATH_BENCH_COUNT);
+	fprintf(pFile, "\t\"runs\": %u,\n", m_uiMathBenchRuns);
+	fprintf(pFile, "\t\"tolerance\": %g,\n", MATH_BENCH_TOLERANCE);
+	fprintf(pFile, "\t\"passed\": %s,\n", bPassed ? "true" : "false");
+	fprintf(pFile, "\t\"kernels\": [");
+	for(unsigned int k = 0; k < enumMATHKERNEL_MAX; ++k)
 		{
-		glBindFramebuffer(GL_FRAMEBUFFER, m_uiFBO[i]);
-		glEnable(GL_DEPTH_TEST);
-		glEnable(GL_CULL_FACE);
-		glCullFace(GL_BACK);
+		fprintf(pFile, "%s\n\t\t{ \"name\": \"%s\", \"error\": %g, \"exact\": %s, \"pvrtools_ms\": %.5f, \"simd_ms\": %.5f, \"speedup\": %.3f }",
+				k ? "," : "", c_pszMathKernels[k], afError[k], afError[k] == 0.0f ? "true" : "false", afScalarMS[k], afSIMDMS[k],
+				afScalarMS[k] / PVRT_MAX(afSIMDMS[k], 0.0001f));
+		}
+	fprintf(pFile, "\n\t]\n");
+	fprintf(pFile, "}\n");
+	fclose(pFile);
+	return bPassed;
+	}
+
+// ---------------------------------------------------------------
+bool MyPVRDemo::RunMeshBenchmark()
+	{
+	// BuildMesh's three passes over each mesh's own indices, with no GL involved. The result has to draw the same
+	// triangles, and the vertex cache mustn't do any worse than it did on the original order.
+	struct Result
+		{
+		bool				bOptimised;				// Only indexed triangle lists are
+		unsigned int		uiTris;
+		unsigned int		uiVertices;
+		VertexCacheStats	Before;
+		VertexCacheStats	After;
+		bool				bValid;
+		float				fMedianMS;
+		};
+	Result aResults[SCENE_MAX_MESHES];
+	unsigned int uiNumMeshes = m_Scene.GetNumMeshes();
+	float* pfMS = new float[m_uiMeshBenchRuns];
+	bool bPassed = true;
+
+	PVRShellOutputDebug("Mesh optimiser: %u meshes, %u runs\n", uiNumMeshes, m_uiMeshBenchRuns);
+	for(unsigned int i = 0; i < uiNumMeshes; ++i)
+		{
+		const SPODMesh& Mesh = m_Model.pMesh[i];
+		Result& Res = aResults[i];
+		memset(&Res, 0, sizeof(Res));
+		Res.bOptimised = !Mesh.nNumStrips && Mesh.sFaces.eType == EPODDataUnsignedShort;
+		if(!Res.bOptimised)
+			continue;
+
+		unsigned int uiNumIndices = PVRTModelPODCountIndices(Mesh);
+		const unsigned short* puOriginal = (const unsigned short*)Mesh.sFaces.pData;
+		unsigned short* puIndices = new unsigned short[uiNumIndices];
+		unsigned short* puTemp = new unsigned short[uiNumIndices];
+		unsigned int* puVertexIDs = new unsigned int[Mesh.nNumVertex];
+		MeasureVertexCache(puOriginal, uiNumIndices, Mesh.nNumVertex, &Res.Before);
+
+		// The vertex fetch re-order moves whatever's in the vertex data, so give it each vertex's original number to move
+		for(unsigned int r = 0; r < m_uiMeshBenchRuns; ++r)
+			{
+			for(unsigned int v = 0; v < Mesh.nNumVertex; ++v)
+				puVertexIDs[v] = v;
+
+			double dStartMS = GetTimeMS();
+			OptimiseVertexCache(puOriginal, puTemp, uiNumIndices, Mesh.nNumVertex);
+			OptimiseOverdraw(puTemp, puIndices, uiNumIndices, Mesh);
+			OptimiseVertexFetch(puIndices, uiNumIndices, (unsigned char*)puVertexIDs, Mesh.nNumVertex, sizeof(unsigned int));
+			pfMS[r] = (float)(GetTimeMS() - dStartMS);
+			}
+		qsort(pfMS, m_uiMeshBenchRuns, sizeof(float), CompareFloat);
+
+		MeasureVertexCache(puIndices, uiNumIndices, Mesh.nNumVertex, &Res.After);
+		Res.uiTris		= uiNumIndices / 3;
+		Res.uiVertices	= Mesh.nNumVertex;
+		Res.bValid		= CheckOptimisedMesh(puOriginal, puIndices, uiNumIndices, puVertexIDs, Mesh.nNumVertex);
+		Res.fMedianMS	= Percentile(pfMS, m_uiMeshBenchRuns, 50.0f);
+		bool bMeshPassed = Res.bValid && Res.After.fACMR <= Res.Before.fACMR;
+		bPassed = bPassed && bMeshPassed;
+
+		PVRShellOutputDebug("  Mesh %u: %s %u triangles, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, %.3fms%s\n", i, bMeshPassed ? "ok  " : "FAIL",
+							Res.uiTris, Res.Before.fACMR, Res.After.fACMR, Res.Before.fATVR, Res.After.fATVR, Res.fMedianMS,
+							Res.bValid ? "" : ", triangles differ from the original");
+
+		delete [] puIndices;
+		delete [] puTemp;
+		delete [] puVertexIDs;
+		}
+	delete [] pfMS;
+
+	CPVRTString Path = CPVRTString((const char*)PVRShellGet(prefWritePath)) + MESH_BENCH_REPORT;
+	FILE* pFile = fopen(Path.c_str(), "w");
+	if(!pFile)
+		{
+		PVRShellOutputDebug("ERROR: Could not write mesh report: %s\n", Path.c_str());
+		return bPassed;
+		}
+
+	fprintf(pFile, "{\n");
+	fprintf(pFile, "\t\"fifo_cache_size\": %d,\n", MESHOPT_FIFO_CACHE_SIZE);
+	fprintf(pFile, "\t\"runs\": %u,\n", m_uiMeshBenchRuns);
+	fprintf(pFile, "\t\"passed\": %s,\n", bPassed ? "true" : "false");
+	fprintf(pFile, "\t\"meshes\": [");
+	for(unsigned int i = 0; i < uiNumMeshes; ++i)
+		{
+		const Result& Res = aResults[i];
+		if(!Res.bOptimised)
+			{
+			fprintf(pFile, "%s\n\t\t{ \"mesh\": %u, \"optimised\": false }", i ? "," : "", i);
+			continue;
+			}
+		fprintf(pFile, "%s\n\t\t{ \"mesh\": %u, \"optimised\": true, \"triangles\": %u, \"vertices\": %u, \"valid\": %s, "
+					   "\"acmr\": { \"before\": %.4f, \"after\": %.4f }, \"atvr\": { \"before\": %.4f, \"after\": %.4f }, \"optimise_ms\": %.4f }",
+				i ? "," : "", i, Res.uiTris, Res.uiVertices, Res.bValid ? "true" : "false", Res.Before.fACMR, Res.After.fACMR,
+				Res.Before.fATVR, Res.After.fATVR, Res.fMedianMS);
+		}
+	fprintf(pFile, "\n\t]\n");
+	fprintf(pFile, "}\n");
+	fclose(pFile);
+	return bPassed;
+	}
+
+// ---------------------------------------------------------------
+const SoftTexture* MyPVRDemo::GetSoftTexture(unsigned int uiTexture) const
+	{
+	// GetCmdTexture for the software rasterizer
+	switch(uiTexture)
+		{
+		case enumCMDTEXTURE_None:		return NULL;
+		case enumCMDTEXTURE_ShadowMap:	return &m_SoftTargets.ShadowMap;
+		case enumCMDTEXTURE_Reflection:	return &m_SoftTargets.Reflection;
+		default:						return &m_aSoftTextures[uiTexture - enumCMDTEXTURE_File];
+		}
+	}
 
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_uiRTT[i], 0);
+// ---------------------------------------------------------------
+void MyPVRDemo::SetSoftBuffer(unsigned int uiPackageType, unsigned int uiIndex, const void* pData, unsigned int uiSize)
+	{
+	SoftBuffer& Buffer = m_aSoftBuffers[uiIndex][uiPackageType - enumPACKAGE_Vertices];
+	delete [] Buffer.pData;
+	Buffer.pData = new unsigned char[uiSize];
+	Buffer.uiSize = uiSize;
+	memcpy(Buffer.pData, pData, uiSize);
+	}
 
-		// Attach depth buffer to the first frame buffer
-		if(i == 0)
-			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_uiFBODepth);
+// ---------------------------------------------------------------
+bool MyPVRDemo::LoadSoftMeshes(CPVRTString* pErrorStr)
+	{
+	// LoadVBOs for the software rasterizer: the same data, kept in memory instead of given to GL
+	for(unsigned int i = 0; i < m_Scene.GetNumMeshes(); ++i)
+		{
+		if(!m_Package.IsOpen())
+			{
+			MeshPayload Payload;
+			BuildMesh(i, &Payload);
+			SetSoftBuffer(enumPACKAGE_Vertices, i, Payload.pVertices, Payload.uiVertexBytes);
+			SetSoftBuffer(enumPACKAGE_Indices, i, Payload.puIndices, Payload.uiNumIndices * sizeof(unsigned short));
+			if(Payload.pnDepthVertices)
+				{
+				SetSoftBuffer(enumPACKAGE_DepthVertices, i, Payload.pnDepthVertices, Payload.uiDepthVertexBytes);
+				SetSoftBuffer(enumPACKAGE_DepthIndices, i, Payload.puDepthIndices, Payload.uiDepthNumIndices * sizeof(unsigned short));
+				}
+			m_VertexFormat[i]		= Payload.Format;
+			m_uiNumIndices[i]		= Payload.uiNumIndices;
+			m_uiDepthNumIndices[i]	= Payload.uiDepthNumIndices;
+
+			delete [] Payload.pVertices;
+			delete [] Payload.puIndices;
+			delete [] Payload.pnDepthVertices;
+			delete [] Payload.puDepthIndices;
+			continue;
+			}
 
-		if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		// Baked data is already in its final layout, and OpenPackage has the formats and index counts
+		unsigned int uiLast = m_Scene.UsesMesh(ROLE_BIT(enumMODEL_Statue), i) ? enumPACKAGE_DepthIndices : enumPACKAGE_Indices;
+		for(unsigned int uiType = enumPACKAGE_Vertices; uiType <= uiLast; ++uiType)
 			{
-			*pErrorStr = "ERROR: Could not create framebuffer object";
-			return false;
+			unsigned int uiSize = 0;
+			const void* pData = FindPackageEntry(uiType, i, &uiSize, pErrorStr);
+			if(!pData)
+				return false;
+			SetSoftBuffer(uiType, i, pData, uiSize);
 			}
 		}
+	return true;
+	}
 
-	// --- Create a framebuffer for the shadow map
-	glGenFramebuffers(1, &m_uiShadowMapFBO);
-	glBindFramebuffer(GL_FRAMEBUFFER, m_uiShadowMapFBO);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_uiShadowMapTex, 0);
-	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+// ---------------------------------------------------------------
+bool MyPVRDemo::LoadSoftTextures(CPVRTString* pErrorStr)
+	{
+	// LoadTextures for the software rasterizer, decoding the same .pvr files
+	for(unsigned int i = 0; i < enumTEXTURE_MAX; ++i)
 		{
-		*pErrorStr = "ERROR: Could not create framebuffer object";
-		return false;
+		bool bClamp = i == enumTEXTURE_BloomMap;
+		bool bDecoded;
+		if(m_Package.IsOpen())
+			{
+			const void* pData = m_Package.Find(enumPACKAGE_Texture, i, NULL);
+			if(!pData)
+				{
+				*pErrorStr = CPVRTString("ERROR: ") + m_PackageFile + CPVRTString(" has no entry for: ") + CPVRTString(c_pszTextures[i]);
+				return false;
+				}
+			bDecoded = LoadSoftTexture(pData, bClamp, &m_aSoftTextures[i]);
+			}
+		else
+			{
+			CPVRTResourceFile File(c_pszTextures[i]);
+			bDecoded = File.IsOpen() && LoadSoftTexture(File.DataPtr(), bClamp, &m_aSoftTextures[i]);
+			}
+		if(!bDecoded)
+			{
+			*pErrorStr = CPVRTString("ERROR: Could not decode for the software rasterizer: ") + CPVRTString(c_pszTextures[i]);
+			return false;
+			}
 		}
-
-
-	// --- Done with FBO, so bind the original frame buffer
-	glBindFramebuffer(GL_FRAMEBUFFER, m_nOrigFBO);
 	return true;
 	}
 
 // ---------------------------------------------------------------
-bool MyPVRDemo::InitApplication()
+void MyPVRDemo::SetSoftSizes()
 	{
-#ifdef PLATFORM_IOS
-	CPVRTResourceFile::SetReadPath((char*)PVRShellGet(prefReadPath));
-#endif
-	
-	if (m_Model.ReadFromFile(c_szSceneFile) != PVR_SUCCESS)
+	// What BuildFrameGraph and ApplyDynamicResolution give the GL path, at full size. Bloom levels are exactly their size,
+	// with nothing rounded up by the frame graph's allocations.
+	SetTargetSizes();
+	m_nSceneWidth		= PVRShellGet(prefWidth);
+	m_nSceneHeight		= PVRShellGet(prefHeight);
+	m_nShadowMapActive	= m_nShadowMapSize;
+	for(unsigned int i = 0; i <= m_uiBloomLevels; ++i)
 		{
-		PVRShellSet(prefExitMessage, "ERROR: Couldn't load the .pod file\n");
-		return false;
+		bool bScratch = i == m_uiBloomLevels;
+		BloomLevel& Level = bScratch ? m_BloomScratch : m_BloomLevels[i];
+		Level.uiTexture	= 0;
+		Level.nWidth	= Level.nHeight = Level.nActive = m_uiBloomSize >> (bScratch ? m_uiBloomLevels - 1 : i);
 		}
+	}
 
-	assert(enumMODEL_MAX == m_Model.nNumMesh);
-
-	// Calculate a bounding box around the statue that we can use later on
-	SPODMesh* pMesh = &m_Model.pMesh[m_Model.pNode[enumMODEL_Statue].nIdx];
-	PVRTBOUNDINGBOX bb;
-	PVRTBoundingBoxComputeInterleaved(&bb, pMesh->pInterleaved, pMesh->nNumVertex, 0, pMesh->sVertex.nStride);
-
-	// We need to calculate the longest possible length for our bounding box on the X and Z axis (as we're rotating around Y).
-	float fLen[4];
-	fLen[0] = sqrt(bb.Point[7].x * bb.Point[7].x + bb.Point[7].z * bb.Point[7].z);	// FR quadrant
-	fLen[1] = sqrt(bb.Point[3].x * bb.Point[3].x + bb.Point[3].z * bb.Point[3].z);	// FL quadrant
-	fLen[2] = sqrt(bb.Point[6].x * bb.Point[6].x + bb.Point[6].z * bb.Point[6].z);	// BR quadrant
-	fLen[3] = sqrt(bb.Point[2].x * bb.Point[2].x + bb.Point[2].z * bb.Point[2].z);	// BL quadrant
-	
-	float fLongest = max(fLen[0], fLen[1]);
-	fLongest = max(fLongest, fLen[2]);
-	fLongest = max(fLongest, fLen[3]);
-		
-	// Calculate the top left and bottom right of the bounding box in 2D space
-	m_bbStatueTL = PVRTVec4(-fLongest, bb.Point[3].y, bb.Point[3].z, 1.0f);
-	m_bbStatueBR = PVRTVec4( fLongest, bb.Point[5].y, bb.Point[5].z, 1.0f);
-
-	// Some nice variables
-	m_fAngleY = 0.0f;
-	m_fBloomMulti = 0.3f;
-	m_ulCurrTime = 0;
-	m_fLightAngle = PVRT_PI / 8;	// Offset by 22.5degrees to begin with, so we see the shadow slightly offset from behind the model.
-
-	m_fTexelOffset = 1.0f / RTT_SIZE;
-	float w1 = 0.0555555f;
-	float w2 = 0.2777777f;
-	float intraTexelOffset = (w2 / (w1 + w2)) * m_fTexelOffset;		// Weight between 2 texels so that hardware filtering will
-																	// interpolate the texels for us. Effectively reducing a 5x5 kernel
-																	// to a 3x3.
-	m_fTexelOffset += intraTexelOffset;
+// ---------------------------------------------------------------
+bool MyPVRDemo::InitSoftRaster(CPVRTString* pErrorStr)
+	{
+	// InitView for the software rasterizer. Called from InitApplication, before there's a context, and makes none.
+	if(!LoadSoftMeshes(pErrorStr) || !LoadSoftTextures(pErrorStr))
+		return false;
 
+	SetSoftSizes();
+	m_bRotated = false;
+	SetUpViews();
 	return true;
 	}
 
 // ---------------------------------------------------------------
-bool MyPVRDemo::QuitApplication()
+void MyPVRDemo::CreateSoftTargets()
 	{
-	m_Model.Destroy();
-    return true;
+	// The sizes SetSoftSizes gave the targets. Creating them clears them.
+	SoftTargets& Targets = m_SoftTargets;
+	CreateSoftTarget(&Targets.Scene, m_nSceneWidth, m_nSceneHeight, false);
+	CreateSoftTarget(&Targets.SceneDepth, m_nSceneWidth, m_nSceneHeight, true);
+	CreateSoftTarget(&Targets.ShadowMap, m_nShadowMapSize, m_nShadowMapSize, true);
+	CreateSoftTarget(&Targets.Reflection, m_nReflWidth, m_nReflHeight, false);
+	CreateSoftTarget(&Targets.ReflectionDepth, m_nReflWidth, m_nReflHeight, true);
+	for(unsigned int i = 0; i < m_uiBloomLevels; ++i)
+		CreateSoftTarget(&Targets.aBloom[i], m_BloomLevels[i].nWidth, m_BloomLevels[i].nHeight, false);
+	CreateSoftTarget(&Targets.BloomScratch, m_BloomScratch.nWidth, m_BloomScratch.nHeight, false);
+	CreateSoftTarget(&Targets.BloomDepth, m_BloomLevels[0].nWidth, m_BloomLevels[0].nHeight, true);
 	}
 
 // ---------------------------------------------------------------
-bool MyPVRDemo::InitView()
+void MyPVRDemo::ReleaseSoftRaster()
 	{
-	CPVRTString ErrorStr;
-
-	LoadVBOs();
-	bool bResult = true;
-	bResult &= LoadTextures(&ErrorStr);
-	bResult &= LoadShaders(&ErrorStr);
-	bResult &= CreateFBOs(&ErrorStr);
-	
-	if(!bResult)
+	SoftTargets& Targets = m_SoftTargets;
+	SoftTexture* apTargets[] = { &Targets.Scene, &Targets.SceneDepth, &Targets.ShadowMap, &Targets.Reflection, &Targets.ReflectionDepth,
+								 &Targets.BloomScratch, &Targets.BloomDepth };
+	for(unsigned int i = 0; i < ELEMENTS_IN_ARRAY(apTargets); ++i)
+		ReleaseSoftTexture(apTargets[i]);
+	for(unsigned int i = 0; i < BLOOM_MAX_LEVELS; ++i)
+		ReleaseSoftTexture(&Targets.aBloom[i]);
+	for(unsigned int i = 0; i < enumTEXTURE_MAX; ++i)
+		ReleaseSoftTexture(&m_aSoftTextures[i]);
+
+	for(unsigned int i = 0; i < SCENE_MAX_MESHES; ++i)
 		{
-		PVRShellSet(prefExitMessage, ErrorStr.c_str());
-		return false;
+		for(unsigned int j = 0; j < SOFT_MESH_BUFFERS; ++j)
+			{
+			delete [] m_aSoftBuffers[i][j].pData;
+			m_aSoftBuffers[i][j].pData = NULL;
+			}
 		}
-
-	m_bRotated = PVRShellGet(prefIsRotated) && PVRShellGet(prefFullScreen);
-
-	// --- Set up light position, projection and view
-	m_vLightPos   = PVRTVec3(0, 125, 200);
-	m_mxLightProj = PVRTMat4::PerspectiveFovRH(PVRT_PI / 4, 1.0f, 10.0f, 1000.0f, PVRTMat4::OGL, m_bRotated);
-	m_mxLightView = PVRTMat4::LookAtRH(m_vLightPos, PVRTVec3(0,25,0), PVRTVec3(0,1,0));
-	m_mxLightBias = PVRTMat4(0.5f, 0.0f, 0.0f, 0.0f,
-							 0.0f, 0.5f, 0.0f, 0.0f,
-							 0.0f, 0.0f, 0.5f, 0.0f,
-							 0.5f, 0.5f, 0.5f, 1.0f);
-
-	// --- Set up Camera projection and view
-	float fAspect = PVRShellGet(prefWidth) / (float)PVRShellGet(prefHeight);
-	m_mxProjection = PVRTMat4::PerspectiveFovFloatDepthRH(0.75f, fAspect, 10.0f, PVRTMat4::OGL, m_bRotated);
-	m_mxCam = PVRTMat4::LookAtRH(PVRTVec3(0, 55, 150), PVRTVec3(0, 35, 0), PVRTVec3(0, 1, 0));
-
-	// --- Set GL states
-	glCullFace(GL_BACK);
-	glEnable(GL_CULL_FACE);
-	glEnable(GL_DEPTH_TEST);
-	glDepthFunc(GL_GEQUAL);
-	glClearDepthf(0.0f);
-	glClearColor(0,0,0,1);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-	return true;
+	m_SoftRaster.Release();
 	}
 
 // ---------------------------------------------------------------
-bool MyPVRDemo::ReleaseView()
+void MyPVRDemo::ExecuteSoftCommands(const SoftState& BaseState)
 	{
-	glDeleteTextures(enumTEXTURE_MAX, m_tex);
+	// ExecuteCommands for the software rasterizer: the same packets, in the same order, through the C++ effects.
+	// BaseState has the pass's viewport and depth test; the packets set the rest.
+	m_Commands.Sort(m_bCmdSort);
+	for(unsigned int i = 0; i < m_Commands.GetNumPackets(); ++i)
+		{
+		const DrawPacket& Packet = m_Commands.GetPacket(i);
+		const SceneNode& Node = m_Scene.GetNode(Packet.nNode);
+		const SoftBuffer* pBuffers = m_aSoftBuffers[Node.nMesh];
+		const CompactVertexFormat& Format = m_VertexFormat[Node.nMesh];
+
+		SoftState State = BaseState;
+		State.eCullFace	= Packet.eCullFace;
+		State.eBlend	= Packet.bBlend ? enumSOFTBLEND_Alpha : enumSOFTBLEND_None;
+
+		const SoftTexture* apTextures[SOFT_MAX_TEXTURES];
+		for(unsigned int u = 0; u < SOFT_MAX_TEXTURES; ++u)
+			apTextures[u] = GetSoftTexture(Packet.auiTextures[u]);
+
+		const SoftProgram* pProgram;
+		const void* pConstants;
+		unsigned int uiConstantBytes;
+		SoftStatueConstants Statue;
+		SoftChurchConstants Church;
+		const float* pfValue;
+		if(Packet.uiEffect == enumEFFECT_Model || Packet.uiEffect == enumEFFECT_Bloom1)
+			{
+			Statue.mxMVP = Statue.mxModelView = PVRTMat4::Identity();
+			Statue.vLightPos = PVRTVec3(0.0f, 0.0f, 0.0f);
+			Statue.fBloomMulti = 0.0f;
+			if((pfValue = Packet.FindUniform(enumUNIFORM_MVP)) != NULL)			memcpy(Statue.mxMVP.f, pfValue, 16 * sizeof(float));
+			if((pfValue = Packet.FindUniform(enumUNIFORM_ModelView)) != NULL)	memcpy(Statue.mxModelView.f, pfValue, 16 * sizeof(float));
+			if((pfValue = Packet.FindUniform(enumUNIFORM_LightPos)) != NULL)	memcpy(Statue.vLightPos.ptr(), pfValue, 3 * sizeof(float));
+			if((pfValue = Packet.FindUniform(enumUNIFORM_BloomMulti)) != NULL)	Statue.fBloomMulti = *pfValue;
+			memcpy(Statue.vDiffuse.ptr(), c_StatueConstants[0].afValue, 3 * sizeof(float));
+			memcpy(Statue.vSpecular.ptr(), c_StatueConstants[1].afValue, 3 * sizeof(float));
+			Statue.fShininess = c_StatueConstants[2].afValue[0];
+			Statue.Format		= Format;
+
+			pProgram		= &c_SoftPrograms[Packet.uiEffect == enumEFFECT_Bloom1 ? enumSOFTPROGRAM_Bloom1 : enumSOFTPROGRAM_Statue];
+			pConstants		= &Statue;
+			uiConstantBytes	= sizeof(Statue);
+			}
+		else
+			{
+			// The church shader, its floor and reflection variants
+			switch(Packet.uiEffect)
+				{
+				case enumEFFECT_ChurchRefl:	pProgram = &c_SoftPrograms[enumSOFTPROGRAM_ChurchRefl];	break;
+				case enumEFFECT_Floor:		pProgram = &c_SoftPrograms[enumSOFTPROGRAM_Floor];		break;
+				default:					pProgram = &c_SoftPrograms[enumSOFTPROGRAM_Church];		break;
+				}
+
+			Church.mxModelView = Church.mxProjection = Church.mxTexProjection = Church.mxReflProjection = PVRTMat4::Identity();
+			Church.fAlpha = 1.0f;
+			if((pfValue = Packet.FindUniform(enumUNIFORM_ModelView)) != NULL)		memcpy(Church.mxModelView.f, pfValue, 16 * sizeof(float));
+			if((pfValue = Packet.FindUniform(enumUNIFORM_Projection)) != NULL)		memcpy(Church.mxProjection.f, pfValue, 16 * sizeof(float));
+			if((pfValue = Packet.FindUniform(enumUNIFORM_TexProjection)) != NULL)	memcpy(Church.mxTexProjection.f, pfValue, 16 * sizeof(float));
+			if((pfValue = Packet.FindUniform(enumUNIFORM_ReflProjection)) != NULL)	memcpy(Church.mxReflProjection.f, pfValue, 16 * sizeof(float));
+			if((pfValue = Packet.FindUniform(enumUNIFORM_Alpha)) != NULL)			Church.fAlpha = *pfValue;
+			Church.bShadow		= pProgram != &c_SoftPrograms[enumSOFTPROGRAM_ChurchRefl];
+			Church.bReflection	= pProgram == &c_SoftPrograms[enumSOFTPROGRAM_Floor];
+			Church.Format		= Format;
+
+			pConstants		= &Church;
+			uiConstantBytes	= sizeof(Church);
+			}
 
-	// --- Delete program and shader objects
-	glDeleteProgram(m_StatueShader.uiID);
-	for(int i = 0; i < enumEFFECT_MAX; ++i)
-		{	
-		glDeleteShader(m_uiVertShader[i]);
-		glDeleteShader(m_uiFragShader[i]);
+		const SoftBuffer& Vertices = pBuffers[enumPACKAGE_Vertices - enumPACKAGE_Vertices];
+		const SoftBuffer& Indices = pBuffers[enumPACKAGE_Indices - enumPACKAGE_Vertices];
+		m_SoftRaster.Draw(pProgram, pConstants, uiConstantBytes, apTextures, State, Vertices.pData, Format.nStride, Vertices.uiSize / Format.nStride,
+						  (const unsigned short*)Indices.pData, m_uiNumIndices[Node.nMesh]);
 		}
+	m_Commands.Clear();
+	}
 
-	// --- Delete buffer objects
-	glDeleteBuffers(enumMODEL_MAX, m_uiVBO);
-	glDeleteBuffers(enumMODEL_MAX, m_uiVBOIdx);
-
-	// --- Delete FBO
-	glDeleteFramebuffers(enumFB_MAX, m_uiFBO);
-	glDeleteRenderbuffers(1, &m_uiFBODepth);
+// ---------------------------------------------------------------
+void MyPVRDemo::DrawSoftQuad(unsigned int uiProgram, const SoftTexture* pSource, const PixelRect& Rect, const PVRTVec2& vTTL, const PVRTVec2& vTBR,
+							 float fTexelX, float fTexelY, unsigned int eBlend)
+	{
+	// RenderScreenAlignedTexture's quad, filling Rect
+	SoftQuadConstants Constants;
+	const float c_aafCorners[4][4] =
+		{
+		{ -1.0f, -1.0f, vTTL.x, vTBR.y },		// Bottom Left
+		{  1.0f, -1.0f, vTBR.x, vTBR.y },		// Bottom Right
+		{ -1.0f,  1.0f, vTTL.x, vTTL.y },		// Top Left
+		{  1.0f,  1.0f, vTBR.x, vTTL.y },		// Top Right
+		};
+	memcpy(Constants.aafCorners, c_aafCorners, sizeof(c_aafCorners));
+	Constants.afTexelOffset[0] = fTexelX;
+	Constants.afTexelOffset[1] = fTexelY;
+	memcpy(Constants.afTaps, m_BloomKernel.afTaps, sizeof(Constants.afTaps));
+
+	SoftState State;
+	State.Viewport		= Rect;
+	State.Scissor		= Rect;
+	State.eCullFace		= GL_NONE;
+	State.eDepthFunc	= GL_ALWAYS;
+	State.bDepthWrite	= false;
+	State.eBlend		= eBlend;
+	const SoftTexture* apTextures[SOFT_MAX_TEXTURES] = { pSource, NULL, NULL, NULL };
+	m_SoftRaster.Draw(&c_SoftPrograms[uiProgram], &Constants, sizeof(Constants), apTextures, State, c_aucSoftQuadVertices, 1, 4,
+					  c_auSoftQuadIndices, ELEMENTS_IN_ARRAY(c_auSoftQuadIndices));
+	}
 
-	return true;
+// ---------------------------------------------------------------
+void MyPVRDemo::DrawSoftBloomQuad(unsigned int uiProgram, const SoftTexture* pSource, const BloomLevel& Level, const PixelRect& Rect, float fTexelX, float fTexelY, unsigned int eBlend)
+	{
+	// DrawBloomQuad for the software rasterizer
+	PVRTVec2 vTTL, vTBR;
+	GetBloomQuadUVs(Level, Rect, vTTL, vTBR);
+	DrawSoftQuad(uiProgram, pSource, Rect, vTTL, vTBR, fTexelX, fTexelY, eBlend);
 	}
 
 // ---------------------------------------------------------------
-bool MyPVRDemo::RenderScene()
+void MyPVRDemo::RenderSoftBloom(const PVRTMat4& mxModel, const PVRTMat4& mxCam, const PVRTVec3& vLightPos)
 	{
-	// --- Work out DT
-	unsigned long ulPrevTime = m_ulCurrTime;
-	m_ulCurrTime = PVRShellGetTime();
-	m_fDT = ((float)m_ulCurrTime - (float)ulPrevTime) * 0.001f;
+	// RenderBloom's passes, into the CPU's copies of the pyramid
+	BloomRegions Regions;
+	if(!GetBloomRegions(mxModel, mxCam, Regions))
+		return;
+	const PixelRect* aRects = Regions.aRects;
+	unsigned int uiBottom = m_uiBloomLevels - 1;
+	SoftTargets& Targets = m_SoftTargets;
+	const float c_afBlack[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	const float c_fClearDepth = 0.0f;
+
+	// --- Extract
+	SoftState State;
+	State.Viewport		= aRects[0];
+	State.Scissor		= aRects[0];
+	State.eCullFace		= GL_BACK;
+	State.eDepthFunc	= GL_GEQUAL;
+	State.bDepthWrite	= true;
+	State.eBlend		= enumSOFTBLEND_None;
+	m_SoftRaster.BeginPass(c_pszPassNames[enumPASS_BloomExtract], &Targets.aBloom[0], &Targets.BloomDepth);
+	m_SoftRaster.Clear(aRects[0], c_afBlack, &c_fClearDepth);
+	RecordStatue(mxModel, mxCam, Regions.mxCrop * m_mxProjection, vLightPos, enumEFFECT_Bloom1, enumVIEW_Camera, GL_BACK);
+	ExecuteSoftCommands(State);
+	m_SoftRaster.EndPass();
+
+	// --- Downsample
+	for(unsigned int i = 1; i < m_uiBloomLevels; ++i)
+		{
+		m_SoftRaster.BeginPass(c_pszPassNames[enumPASS_BloomDownsample], &Targets.aBloom[i], NULL);
+		m_SoftRaster.Clear(aRects[i], c_afBlack, NULL);
+		DrawSoftBloomQuad(enumSOFTPROGRAM_BloomDown, &Targets.aBloom[i - 1], m_BloomLevels[i], aRects[i],
+						  1.0f / m_BloomLevels[i - 1].nWidth, 1.0f / m_BloomLevels[i - 1].nHeight, enumSOFTBLEND_None);
+		m_SoftRaster.EndPass();
+		}
 
-	// Calculate a new light matrix
-	PVRTVec3 vLightPos = PVRTVec4(m_vLightPos, 1.0f) * PVRTMat4::RotationY(m_fLightAngle);
-	m_mxLightView = PVRTMat4::LookAtRH(vLightPos, PVRTVec3(0,25,0), PVRTVec3(0,1,0));
+	// --- Blur the bottom level, across then down
+	const BloomLevel& Bottom = m_BloomLevels[uiBottom];
+	m_SoftRaster.BeginPass(c_pszPassNames[enumPASS_BloomBlurH], &Targets.BloomScratch, NULL);
+	m_SoftRaster.Clear(aRects[uiBottom], c_afBlack, NULL);
+	DrawSoftBloomQuad(enumSOFTPROGRAM_BloomBlur, &Targets.aBloom[uiBottom], m_BloomScratch, aRects[uiBottom], 1.0f / Bottom.nWidth, 0.0f, enumSOFTBLEND_None);
+	m_SoftRaster.EndPass();
 
-	// --- Render the scene from the light's POV
-	RenderShadowScene();
+	m_SoftRaster.BeginPass(c_pszPassNames[enumPASS_BloomBlurV], &Targets.aBloom[uiBottom], NULL);
+	m_SoftRaster.Clear(aRects[uiBottom], c_afBlack, NULL);
+	DrawSoftBloomQuad(enumSOFTPROGRAM_BloomBlur, &Targets.BloomScratch, Bottom, aRects[uiBottom], 0.0f, 1.0f / m_BloomScratch.nHeight, enumSOFTBLEND_None);
+	m_SoftRaster.EndPass();
 
-	// --- Clear buffers
-	glViewport(0, 0, PVRShellGet(prefWidth), PVRShellGet(prefHeight));
-	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	// --- Upsample, adding each level onto the one above
+	for(unsigned int i = uiBottom; i-- > 0;)
+		{
+		m_SoftRaster.BeginPass(c_pszPassNames[enumPASS_BloomUpsample], &Targets.aBloom[i], NULL);
+		DrawSoftBloomQuad(enumSOFTPROGRAM_BloomUp, &Targets.aBloom[i + 1], m_BloomLevels[i], aRects[i],
+						  1.0f / m_BloomLevels[i + 1].nWidth, 1.0f / m_BloomLevels[i + 1].nHeight, enumSOFTBLEND_Add);
+		m_SoftRaster.EndPass();
+		}
 
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	// --- Composite over the scene
+	m_SoftRaster.BeginPass(c_pszPassNames[enumPASS_BloomComposite], &Targets.Scene, NULL);
+	DrawSoftQuad(enumSOFTPROGRAM_ScreenAlignedTex, &Targets.aBloom[0], Regions.Composite, Regions.vCompositeTTL, Regions.vCompositeTBR, 0.0f, 0.0f, enumSOFTBLEND_Add);
+	m_SoftRaster.EndPass();
+	}
 
+// ---------------------------------------------------------------
+void MyPVRDemo::RenderSoftFrame()
+	{
+	// RenderScene's passes on the CPU. The draws are recorded by the same code as the GL path's, so both render the same
+	// frame, bar the crowd and resolution scaling. The shadow map is redrawn every frame.
 	PVRTMat4 mxCam = m_mxCam * PVRTMat4::RotationY(m_fAngleY);
 	PVRTMat4 mxModel = PVRTMat4::Identity();
+	m_Scene.Cull(enumVIEW_Camera, m_mxProjection * mxCam, ROLE_ALL, m_bCulling);
+	if(!m_bReflectionRTT)
+		m_Scene.Cull(enumVIEW_Reflection, m_mxProjection * mxCam * PVRTMat4::Scale(1, -1, 1), ROLE_BIT(enumMODEL_Statue) | ROLE_BIT(enumMODEL_Church), m_bCulling);
+
+	PVRTVec3 vLightPos;
+	bool bShadowVisible = UpdateLight(mxCam, vLightPos);
+	m_mxShadowViewProj = m_mxLightProj * m_mxLightView;
+	m_nShadowMapRendered = m_nShadowMapActive;
+
+	SoftTargets& Targets = m_SoftTargets;
+	const float c_afBlack[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	const float c_fFar = 0.0f, c_fReflFar = 1.0f;		// The scene's depth is reversed; the reflection's isn't
+	SoftState State;
+	State.eCullFace		= GL_BACK;
+	State.eDepthFunc	= GL_GEQUAL;
+	State.bDepthWrite	= true;
+	State.eBlend		= enumSOFTBLEND_None;
+
+	// --- Shadow map. Only the statue casts, and only depth is written.
+	PixelRect ShadowRect = { 0, 0, m_nShadowMapSize, m_nShadowMapSize };
+	m_SoftRaster.BeginPass(c_pszPassNames[enumPASS_Shadow], NULL, &Targets.ShadowMap);
+	m_SoftRaster.Clear(ShadowRect, NULL, &c_fFar);
+	if(bShadowVisible)
+		{
+		ShadowRect.nWidth = ShadowRect.nHeight = m_nShadowMapActive;
+		State.Viewport = State.Scissor = ShadowRect;
+		m_Scene.Cull(enumVIEW_Light, m_mxShadowViewProj, ROLE_BIT(enumMODEL_Statue), m_bCulling);
+		for(unsigned int i = 0; i < m_Scene.GetNumVisible(enumVIEW_Light); ++i)
+			{
+			const SceneNode& Node = m_Scene.GetNode(m_Scene.GetVisible(enumVIEW_Light, i));
+			SoftSimpleConstants Constants;
+			Constants.mxMVP = m_mxShadowViewProj * Node.mxWorld;
+			Constants.Format = m_VertexFormat[Node.nMesh];
+			Constants.Format.nPosOffset = 0;
+
+			const SoftBuffer& Vertices = m_aSoftBuffers[Node.nMesh][enumPACKAGE_DepthVertices - enumPACKAGE_Vertices];
+			const SoftBuffer& Indices = m_aSoftBuffers[Node.nMesh][enumPACKAGE_DepthIndices - enumPACKAGE_Vertices];
+			m_SoftRaster.Draw(&c_SoftPrograms[enumSOFTPROGRAM_Simple], &Constants, sizeof(Constants), NULL, State, Vertices.pData, 4 * sizeof(short),
+							  Vertices.uiSize / (4 * sizeof(short)), (const unsigned short*)Indices.pData, m_uiDepthNumIndices[Node.nMesh]);
+			}
+		}
+	m_SoftRaster.EndPass();
 
-	// --- Draw the Statue
-	glUseProgram(m_StatueShader.uiID);
-	glBindTexture(GL_TEXTURE_2D, m_tex[enumTEXTURE_StatueNormals]);
-	RenderStatue(mxModel, mxCam, vLightPos, &m_StatueShader);
-
-	// --- Draw the Statue reflected
-	glCullFace(GL_FRONT);
-	PVRTMat4 mxModelRefl = PVRTMat4::Scale(1,-1,1) * mxModel;
-	RenderStatue(mxModelRefl, mxCam, vLightPos, &m_StatueShader);
-	glCullFace(GL_BACK);
-
-	// --- Draw the Floor (with shadow)
-	RenderCurch(mxCam);
-
-	// --- Render the bloom effect
-	RenderBloom(mxModel, mxCam, vLightPos);
-
-	// --- Increment the camera angle
-	m_fAngleY += 0.5f * m_fDT;
+	// --- Reflection
+	if(m_bReflectionRTT)
+		{
+		RecordReflection(mxModel, mxCam, vLightPos);
+		PixelRect ReflRect = { 0, 0, m_nReflWidth, m_nReflHeight };
+		State.Viewport = State.Scissor = ReflRect;
+		State.eDepthFunc = GL_LEQUAL;
+		m_SoftRaster.BeginPass(c_pszPassNames[enumPASS_Reflection], &Targets.Reflection, &Targets.ReflectionDepth);
+		m_SoftRaster.Clear(ReflRect, c_afBlack, &c_fReflFar);
+		ExecuteSoftCommands(State);
+		m_SoftRaster.EndPass();
+		State.eDepthFunc = GL_GEQUAL;
+		}
 
-	// --- Increment the light angle
-	m_fLightAngle += 0.5f * m_fDT;
-	return true;
+	// --- The statue, the church and the floor
+	PixelRect SceneRect = { 0, 0, m_nSceneWidth, m_nSceneHeight };
+	State.Viewport = State.Scissor = SceneRect;
+	m_SoftRaster.BeginPass(c_pszPassNames[enumPASS_Scene], &Targets.Scene, &Targets.SceneDepth);
+	m_SoftRaster.Clear(SceneRect, c_afBlack, &c_fFar);
+	RecordStatue(mxModel, mxCam, m_mxProjection, vLightPos, enumEFFECT_Model, enumVIEW_Camera, GL_BACK);
+	if(!m_bReflectionRTT)
+		RecordStatue(PVRTMat4::Scale(1,-1,1) * mxModel, mxCam, m_mxProjection, vLightPos, enumEFFECT_Model, enumVIEW_Reflection, GL_FRONT);
+	RecordChurch(mxCam);
+	ExecuteSoftCommands(State);
+	m_SoftRaster.EndPass();
+
+	RenderSoftBloom(mxModel, mxCam, vLightPos);
 	}
 
 // ---------------------------------------------------------------
-void MyPVRDemo::RenderShadowScene()
+bool MyPVRDemo::RunSoftRaster()
 	{
-	// --- Bind the shadow map FBO
-	glBindFramebuffer(GL_FRAMEBUFFER, m_uiShadowMapFBO);
-	glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);			// Turn off colour writing
-
-	glUseProgram(m_SimpleShader.uiID);
-	// Create MVP using the light's matrix properties
-	PVRTMat4 mxMVP = m_mxLightProj * m_mxLightView * PVRTMat4::Identity();
-	glUniformMatrix4fv(m_SimpleShader.uiMVP, 1, GL_FALSE, mxMVP.ptr());
-	DrawMesh(enumMODEL_Statue, FLAG_VRT);
+	// The same frames at each thread count from 1 up: a turn of the camera and the light in m_uiSoftFrames steps. The images
+	// are written from the single threaded run, and every other run has to match it bit for bit.
+	m_SoftRaster.SetJobSystem(&m_Jobs);
+	CPVRTString WritePath((const char*)PVRShellGet(prefWritePath));
+	float fStartAngleY = m_fAngleY, fStartLightAngle = m_fLightAngle;
+	float fStep = PVRT_TWO_PI / m_uiSoftFrames;
+	unsigned int* puChecksums = new unsigned int[m_uiSoftFrames];
+	float* pfFrameMS = new float[m_uiSoftFrames];
+
+	struct Result
+		{
+		unsigned int	uiThreads;
+		float			fMinMS;
+		float			fMedianMS;
+		bool			bMatches;
+		unsigned int	uiNumPasses;
+		SoftPassStats	aPasses[SOFT_MAX_PASS_STATS];
+		};
+	Result aResults[JOB_MAX_THREADS];
+	unsigned int uiNumResults = 0;
+	bool bWritten = true, bMatches = true;
+
+	PVRShellOutputDebug("Software rasterizer: %dx%d, %u frames, %u cores, %s\n", m_nSceneWidth, m_nSceneHeight, m_uiSoftFrames, GetCPUCount(), c_pszMathSIMD);
+	for(unsigned int t = 1; t <= m_uiJobThreads; ++t)
+		{
+		if(!m_Jobs.Start(t))
+			{
+			PVRShellOutputDebug("WARNING: Only %u of %u job threads started\n", m_Jobs.GetNumThreads(), t);
+			break;
+			}
 
-	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);				// We can turn colour writing back on.
+		// Fresh targets, so nothing left by the last run can make this one differ
+		CreateSoftTargets();
+		m_SoftRaster.ResetCounters();
+		Result& Res = aResults[uiNumResults++];
+		Res.uiThreads	= t;
+		Res.bMatches	= true;
+		for(unsigned int f = 0; f < m_uiSoftFrames; ++f)
+			{
+			m_fAngleY		= fStartAngleY + f * fStep;
+			m_fLightAngle	= fStartLightAngle + f * fStep;
+			double dStartMS = GetTimeMS();
+			RenderSoftFrame();
+			pfFrameMS[f] = (float)(GetTimeMS() - dStartMS);
+
+			unsigned int uiChecksum = HashSoftTexture(m_SoftTargets.Scene);
+			if(t > 1)
+				{
+				Res.bMatches = Res.bMatches && uiChecksum == puChecksums[f];
+				continue;
+				}
+
+			puChecksums[f] = uiChecksum;
+			char szName[64];
+			sprintf(szName, SOFT_IMAGE_NAME, f);
+			CPVRTString Path = WritePath + szName;
+			if(!WriteSoftTGA(Path.c_str(), m_SoftTargets.Scene))
+				{
+				PVRShellOutputDebug("ERROR: Could not write %s\n", Path.c_str());
+				bWritten = false;
+				}
+			}
+		qsort(pfFrameMS, m_uiSoftFrames, sizeof(float), CompareFloat);
+		Res.fMinMS		= pfFrameMS[0];
+		Res.fMedianMS	= Percentile(pfFrameMS, m_uiSoftFrames, 50.0f);
+		Res.uiNumPasses	= m_SoftRaster.GetNumPassStats();
+		for(unsigned int p = 0; p < Res.uiNumPasses; ++p)
+			Res.aPasses[p] = m_SoftRaster.GetPassStats(p);
+		bMatches = bMatches && Res.bMatches;
+
+		PVRShellOutputDebug("  %2u threads: median %.2fms (min %.2fms), %.2fx%s\n", t, Res.fMedianMS, Res.fMinMS,
+							aResults[0].fMedianMS / PVRT_MAX(Res.fMedianMS, 0.001f), Res.bMatches ? "" : ", DIFFERS from 1 thread");
+		}
+	m_Jobs.Stop();
+	m_fAngleY = fStartAngleY;
+	m_fLightAngle = fStartLightAngle;
+	delete [] puChecksums;
+	delete [] pfFrameMS;
+
+	CPVRTString Path = WritePath + SOFT_REPORT;
+	FILE* pFile = fopen(Path.c_str(), "w");
+	if(!pFile)
+		{
+		PVRShellOutputDebug("ERROR: Could not write software rasterizer report: %s\n", Path.c_str());
+		return false;
+		}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, m_nOrigFBO);		// Done. Use the original framebuffer.
-	glViewport(0, 0, PVRShellGet(prefWidth), PVRShellGet(prefHeight));
+	// Pass figures are per frame
+	fprintf(pFile, "{\n");
+	fprintf(pFile, "\t\"width\": %d,\n", m_nSceneWidth);
+	fprintf(pFile, "\t\"height\": %d,\n", m_nSceneHeight);
+	fprintf(pFile, "\t\"frames\": %u,\n", m_uiSoftFrames);
+	fprintf(pFile, "\t\"cores\": %u,\n", GetCPUCount());
+	fprintf(pFile, "\t\"simd\": \"%s\",\n", c_pszMathSIMD);
+	fprintf(pFile, "\t\"tile_size\": %d,\n", SOFT_TILE_SIZE);
+	fprintf(pFile, "\t\"images\": \"%s\",\n", SOFT_IMAGE_NAME);
+	fprintf(pFile, "\t\"deterministic\": %s,\n", bMatches ? "true" : "false");
+	fprintf(pFile, "\t\"threads\": [");
+	for(unsigned int i = 0; i < uiNumResults; ++i)
+		{
+		const Result& Res = aResults[i];
+		fprintf(pFile, "%s\n\t\t{ \"threads\": %u, \"frame_ms\": { \"min\": %.3f, \"median\": %.3f }, \"speedup\": %.3f, \"matches\": %s, \"passes\": [",
+				i ? "," : "", Res.uiThreads, Res.fMinMS, Res.fMedianMS, aResults[0].fMedianMS / PVRT_MAX(Res.fMedianMS, 0.001f), Res.bMatches ? "true" : "false");
+		for(unsigned int p = 0; p < Res.uiNumPasses; ++p)
+			{
+			const SoftPassStats& Pass = Res.aPasses[p];
+			float fFrames = (float)m_uiSoftFrames;
+			fprintf(pFile, "%s\n\t\t\t{ \"name\": \"%s\", \"ms\": %.3f, \"vertex_ms\": %.3f, \"setup_ms\": %.3f, \"bin_ms\": %.3f, \"raster_ms\": %.3f, "
+						   "\"draws\": %.1f, \"triangles\": %.1f, \"rasterized\": %.1f, \"binned\": %.1f, \"tiles\": %.1f, \"fragments\": %.0f }",
+					p ? "," : "", Pass.pszName, (Pass.dVertexMS + Pass.dSetupMS + Pass.dBinMS + Pass.dRasterMS) / fFrames,
+					Pass.dVertexMS / fFrames, Pass.dSetupMS / fFrames, Pass.dBinMS / fFrames, Pass.dRasterMS / fFrames,
+					Pass.uiDraws / fFrames, Pass.uiTriangles / fFrames, Pass.uiRasterized / fFrames, Pass.uiBinned / fFrames,
+					Pass.uiTiles / fFrames, Pass.dFragments / fFrames);
+			}
+		fprintf(pFile, "\n\t\t\t] }");
+		}
+	fprintf(pFile, "\n\t]\n");
+	fprintf(pFile, "}\n");
+	fclose(pFile);
+	return bWritten && bMatches;
 	}
 
 // ---------------------------------------------------------------
-void MyPVRDemo::RenderBloom(const PVRTMat4& mxModel, const PVRTMat4& mxCam, const PVRTVec3& vLightPos)
+bool MyPVRDemo::RunRegression()
 	{
-	// --- Bind an empty frame buffer.
-	glBindFramebuffer(GL_FRAMEBUFFER, m_uiFBO[enumFB_1]);
-	glViewport(0, 0, RTT_SIZE, RTT_SIZE);
-	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	// Renders c_aRegressPoses on the software rasterizer REGRESS_RUNS times. The first sweep's images are checked against
+	// the goldens, and every sweep is timed, keeping each pass's best. Every frame is written to the write path, with a
+	// diff for any that fail, so a change that's meant can be copied over the goldens, or rerecorded with -regressrecord.
+	m_SoftRaster.SetJobSystem(&m_Jobs);
+	if(!m_Jobs.Start(m_uiJobThreads))
+		PVRShellOutputDebug("WARNING: Only %u of %u job threads started\n", m_Jobs.GetNumThreads(), m_uiJobThreads);
+	CreateSoftTargets();
+
+	CPVRTString WritePath((const char*)PVRShellGet(prefWritePath));
+	const unsigned int c_uiNumPoses = ELEMENTS_IN_ARRAY(c_aRegressPoses);
+	float fStartAngleY = m_fAngleY, fStartLightAngle = m_fLightAngle;
+	SoftTexture Golden, Diff;
+	InitSoftTexture(&Golden);
+	InitSoftTexture(&Diff);
+	RegressImageDiff aImages[c_uiNumPoses];
+	bool abImagePassed[c_uiNumPoses];
+	bool bPassed = true;
+
+	unsigned int uiNumPasses = 0;
+	SoftPassStats aPasses[SOFT_MAX_PASS_STATS];
+	float afBestMS[SOFT_MAX_PASS_STATS];
+	unsigned int auiCounts[enumCMDSTAT_MAX];
+
+	PVRShellOutputDebug("Regression: %u poses, %dx%d, %u threads, goldens in %s\n", c_uiNumPoses, m_nSceneWidth, m_nSceneHeight,
+						m_Jobs.GetNumThreads(), m_RegressDir.c_str());
+	if(m_bRegressRecord && !CreateRegressDir(m_RegressDir.c_str()))
+		PVRShellOutputDebug("ERROR: Could not create %s\n", m_RegressDir.c_str());		// The writes below fail and say so
+	for(unsigned int r = 0; r < REGRESS_RUNS; ++r)
+		{
+		m_SoftRaster.ResetCounters();
+		m_Commands.ResetCounters();
+		for(unsigned int p = 0; p < c_uiNumPoses; ++p)
+			{
+			m_fAngleY		= c_aRegressPoses[p].fAngleY;
+			m_fLightAngle	= c_aRegressPoses[p].fLightAngle;
+			RenderSoftFrame();
+			if(r)
+				continue;
+
+			char szName[64];
+			sprintf(szName, REGRESS_OUTPUT_NAME, p);
+			CPVRTString Path = WritePath + szName;
+			if(!WriteSoftTGA(Path.c_str(), m_SoftTargets.Scene))
+				PVRShellOutputDebug("WARNING: Could not write %s\n", Path.c_str());
+
+			sprintf(szName, REGRESS_IMAGE_NAME, p);
+			CPVRTString GoldenPath = m_RegressDir + szName;
+			aImages[p].uiChanged = 0;
+			aImages[p].fMaxDistance = 0.0f;
+			abImagePassed[p] = true;
+			if(m_bRegressRecord)
+				{
+				abImagePassed[p] = WriteSoftTGA(GoldenPath.c_str(), m_SoftTargets.Scene);
+				if(!abImagePassed[p])
+					PVRShellOutputDebug("ERROR: Could not write golden image: %s\n", GoldenPath.c_str());
+				}
+			else if(!ReadSoftTGA(GoldenPath.c_str(), &Golden))
+				{
+				PVRShellOutputDebug("ERROR: Could not read golden image: %s\n", GoldenPath.c_str());
+				abImagePassed[p] = false;
+				}
+			else if(Golden.nWidth != m_nSceneWidth || Golden.nHeight != m_nSceneHeight)
+				{
+				PVRShellOutputDebug("ERROR: %s is %dx%d, but the scene is %dx%d\n", GoldenPath.c_str(), Golden.nWidth, Golden.nHeight,
+									m_nSceneWidth, m_nSceneHeight);
+				abImagePassed[p] = false;
+				}
+			else
+				{
+				CompareSoftImages(Golden, m_SoftTargets.Scene, &Diff, aImages[p]);
+				abImagePassed[p] = aImages[p].uiChanged <= REGRESS_AREA_TOLERANCE * m_nSceneWidth * m_nSceneHeight;
+				if(!abImagePassed[p])
+					{
+					sprintf(szName, REGRESS_DIFF_NAME, p);
+					Path = WritePath + szName;
+					WriteSoftTGA(Path.c_str(), Diff);
+					PVRShellOutputDebug("  Pose %u: %u pixels changed (%.3f%%), up to %.3f away. Diff in %s\n", p, aImages[p].uiChanged,
+										100.0f * aImages[p].uiChanged / (m_nSceneWidth * m_nSceneHeight), aImages[p].fMaxDistance, Path.c_str());
+					}
+				}
+			bPassed = bPassed && abImagePassed[p];
+			}
 
-	// --- Render the statue with Bloom Stage 1 Shader. This basically renders the statue with the normal map
-	// and uses a texture lookup to effectively high-pass filter the resultant output.
-	glUseProgram(m_Bloom1Shader.uiID);
-	glUniform1f(m_Bloom1Shader.uiBloomMulti, m_fBloomMulti);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, m_tex[enumTEXTURE_StatueNormals]);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, m_tex[enumTEXTURE_BloomMap]);
-	RenderStatue(mxModel, mxCam, vLightPos, &m_Bloom1Shader);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glActiveTexture(GL_TEXTURE0);
-
-	// --- BLUR PASSES
-	glUseProgram(m_BloomBlurShader.uiID);
+		// Each pass's best time per frame over the runs. The counts are the same every run.
+		uiNumPasses = m_SoftRaster.GetNumPassStats();
+		for(unsigned int i = 0; i < uiNumPasses; ++i)
+			{
+			const SoftPassStats& Pass = m_SoftRaster.GetPassStats(i);
+			float fMS = (float)((Pass.dVertexMS + Pass.dSetupMS + Pass.dBinMS + Pass.dRasterMS) / c_uiNumPoses);
+			if(!r)
+				aPasses[i] = Pass;
+			afBestMS[i] = r ? PVRT_MIN(afBestMS[i], fMS) : fMS;
+			}
+		for(unsigned int i = 0; i < enumCMDSTAT_MAX && !r; ++i)
+			auiCounts[i] = m_Commands.GetTotalStat(i);
+		}
+	m_Jobs.Stop();
+	m_fAngleY = fStartAngleY;
+	m_fLightAngle = fStartLightAngle;
+	ReleaseSoftTexture(&Golden);
+	ReleaseSoftTexture(&Diff);
+
+	// --- The numbers, against the budgets recorded with the goldens. The times only on the machine they were recorded on.
+	RegressMachine Machine, Recorded;
+	Machine.nWidth		= m_nSceneWidth;
+	Machine.nHeight		= m_nSceneHeight;
+	Machine.uiThreads	= m_Jobs.GetNumThreads();
+	Machine.uiCores		= GetCPUCount();
+	strncpy(Machine.szSIMD, c_pszMathSIMD, sizeof(Machine.szSIMD) - 1);
+	Machine.szSIMD[sizeof(Machine.szSIMD) - 1] = 0;
+
+	RegressBudget aBudgets[REGRESS_MAX_BUDGETS];
+	CPVRTString BudgetPath = m_RegressDir + REGRESS_BUDGETS;
+	bool bRecorded = false;
+	unsigned int uiNumBudgets = m_bRegressRecord ? 0 : ReadRegressBudgets(BudgetPath.c_str(), aBudgets, REGRESS_MAX_BUDGETS,
+																		   &Recorded, &bRecorded);
+	bool bTimeBudgets = bRecorded && Recorded.nWidth == Machine.nWidth && Recorded.nHeight == Machine.nHeight &&
+						Recorded.uiThreads == Machine.uiThreads && Recorded.uiCores == Machine.uiCores &&
+						strcmp(Recorded.szSIMD, Machine.szSIMD) == 0;
+	if(!m_bRegressRecord && !uiNumBudgets)
+		{
+		PVRShellOutputDebug("ERROR: Could not read budgets: %s\n", BudgetPath.c_str());
+		bPassed = false;
+		}
+	else if(!m_bRegressRecord && !bRecorded)
+		PVRShellOutputDebug("WARNING: %s doesn't say what it was recorded on. Skipping its times.\n", BudgetPath.c_str());
+	else if(!m_bRegressRecord && !bTimeBudgets)
+		PVRShellOutputDebug("WARNING: Times budgeted at %dx%d on %u threads (%u cores, %s), but this is %dx%d on %u threads (%u cores, %s). "
+							"Skipping them.\n", Recorded.nWidth, Recorded.nHeight, Recorded.uiThreads, Recorded.uiCores, Recorded.szSIMD,
+							Machine.nWidth, Machine.nHeight, Machine.uiThreads, Machine.uiCores, Machine.szSIMD);
+
+	RegressCheck aChecks[SOFT_MAX_PASS_STATS * 2 + enumCMDSTAT_MAX];
+	unsigned int uiNumChecks = 0;
+	for(unsigned int i = 0; i < uiNumPasses; ++i)
+		{
+		RegressCheck& Time = aChecks[uiNumChecks++];
+		sprintf(Time.szName, "%s.ms", aPasses[i].pszName);
+		Time.fValue = afBestMS[i];
+		CheckRegressBudget(Time, aBudgets, bTimeBudgets ? uiNumBudgets : 0, true);
+		Time.bSkipped = !m_bRegressRecord && uiNumBudgets && !bTimeBudgets;
+
+		RegressCheck& Draws = aChecks[uiNumChecks++];
+		sprintf(Draws.szName, "%s.draws", aPasses[i].pszName);
+		Draws.fValue = (float)aPasses[i].uiDraws / c_uiNumPoses;
+		CheckRegressBudget(Draws, aBudgets, uiNumBudgets, false);
+		}
+	for(unsigned int i = 0; i < enumCMDSTAT_MAX; ++i)
+		{
+		RegressCheck& Count = aChecks[uiNumChecks++];
+		sprintf(Count.szName, "frame.%s", c_pszCmdStats[i]);
+		Count.fValue = (float)auiCounts[i] / c_uiNumPoses;
+		CheckRegressBudget(Count, aBudgets, uiNumBudgets, false);
+		}
 
-	// Horizontal blur
-	glBindFramebuffer(GL_FRAMEBUFFER, m_uiFBO[enumFB_2]);
-	glViewport(0, 0, RTT_SIZE, RTT_SIZE);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glBindTexture(GL_TEXTURE_2D, m_uiRTT[enumFB_1]);
+	for(unsigned int i = 0; i < uiNumChecks; ++i)
+		{
+		const RegressCheck& Check = aChecks[i];
+		bPassed = bPassed && Check.bPassed;
+		if(!Check.bPassed)
+			PVRShellOutputDebug("  %s: %.3f, over its budget of %.3f by %+.3f\n", Check.szName, Check.fValue, Check.pBudget->fValue,
+								Check.fValue - Check.pBudget->fValue);
+		else if(!Check.pBudget && !Check.bSkipped && !m_bRegressRecord && uiNumBudgets)
+			PVRShellOutputDebug("WARNING: No budget for %s\n", Check.szName);
+		}
+
+	if(m_bRegressRecord)
+		{
+		FILE* pFile = fopen(BudgetPath.c_str(), "w");
+		if(!pFile)
+			{
+			PVRShellOutputDebug("ERROR: Could not write budgets: %s\n", BudgetPath.c_str());
+			return false;
+			}
+		fprintf(pFile, REGRESS_MACHINE_WRITE, Machine.nWidth, Machine.nHeight, Machine.uiThreads, Machine.uiCores, Machine.szSIMD);
+		for(unsigned int i = 0; i < uiNumChecks; ++i)
+			fprintf(pFile, "%s %.3f\n", aChecks[i].szName, aChecks[i].fValue);
+		fclose(pFile);
+		}
 
-	glUniform2f(m_BloomBlurShader.uiTexelOffset, m_fTexelOffset, 0.0f);
-	RenderScreenAlignedTexture(PVRTVec2(-1.0f, 1.0f), PVRTVec2(1.0f, -1.0f), PVRTVec2(0.0f, 1.0f), PVRTVec2(1.0f, 0.0f));
+	CPVRTString Path = WritePath + REGRESS_REPORT;
+	FILE* pFile = fopen(Path.c_str(), "w");
+	if(!pFile)
+		{
+		PVRShellOutputDebug("ERROR: Could not write regression report: %s\n", Path.c_str());
+		return false;
+		}
 
-	// Vertical blur
-	glBindFramebuffer(GL_FRAMEBUFFER, m_uiFBO[enumFB_1]);
-	glViewport(0, 0, RTT_SIZE, RTT_SIZE);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glBindTexture(GL_TEXTURE_2D, m_uiRTT[enumFB_2]);
+	fprintf(pFile, "{\n");
+	fprintf(pFile, "\t\"goldens\": \"%s\",\n", m_RegressDir.c_str());
+	fprintf(pFile, "\t\"recorded\": %s,\n", m_bRegressRecord ? "true" : "false");
+	fprintf(pFile, "\t\"width\": %d,\n", m_nSceneWidth);
+	fprintf(pFile, "\t\"height\": %d,\n", m_nSceneHeight);
+	fprintf(pFile, "\t\"pixel_tolerance\": %.3f,\n", REGRESS_PIXEL_TOLERANCE);
+	fprintf(pFile, "\t\"area_tolerance\": %.4f,\n", REGRESS_AREA_TOLERANCE);
+	fprintf(pFile, "\t\"machine\": { \"threads\": %u, \"cores\": %u, \"simd\": \"%s\" },\n", Machine.uiThreads, Machine.uiCores,
+			Machine.szSIMD);
+	if(bRecorded)
+		fprintf(pFile, "\t\"budget_machine\": { \"width\": %d, \"height\": %d, \"threads\": %u, \"cores\": %u, \"simd\": \"%s\" },\n",
+				Recorded.nWidth, Recorded.nHeight, Recorded.uiThreads, Recorded.uiCores, Recorded.szSIMD);
+	else
+		fprintf(pFile, "\t\"budget_machine\": null,\n");
+	fprintf(pFile, "\t\"time_budgets\": %s,\n", bTimeBudgets ? "true" : "false");
+	fprintf(pFile, "\t\"images\": [");
+	for(unsigned int p = 0; p < c_uiNumPoses; ++p)
+		{
+		fprintf(pFile, "%s\n\t\t{ \"pose\": %u, \"angle_y\": %.4f, \"light_angle\": %.4f, \"changed_pixels\": %u, \"max_distance\": %.4f, \"passed\": %s }",
+				p ? "," : "", p, c_aRegressPoses[p].fAngleY, c_aRegressPoses[p].fLightAngle, aImages[p].uiChanged, aImages[p].fMaxDistance,
+				abImagePassed[p] ? "true" : "false");
+		}
+	fprintf(pFile, "\n\t],\n");
+	fprintf(pFile, "\t\"budgets\": [");
+	for(unsigned int i = 0; i < uiNumChecks; ++i)
+		{
+		const RegressCheck& Check = aChecks[i];
+		fprintf(pFile, "%s\n\t\t{ \"name\": \"%s\", \"value\": %.3f", i ? "," : "", Check.szName, Check.fValue);
+		if(Check.pBudget)
+			fprintf(pFile, ", \"budget\": %.3f, \"delta\": %.3f", Check.pBudget->fValue, Check.fValue - Check.pBudget->fValue);
+		else if(Check.bSkipped)
+			fprintf(pFile, ", \"budget\": null, \"skipped\": true");
+		else
+			fprintf(pFile, ", \"budget\": null");
+		fprintf(pFile, ", \"passed\": %s }", Check.bPassed ? "true" : "false");
+		}
+	fprintf(pFile, "\n\t],\n");
+	fprintf(pFile, "\t\"passed\": %s\n", bPassed ? "true" : "false");
+	fprintf(pFile, "}\n");
+	fclose(pFile);
 
-	glUniform2f(m_BloomBlurShader.uiTexelOffset, 0.0f, m_fTexelOffset);
-	RenderScreenAlignedTexture(PVRTVec2(-1.0f, 1.0f), PVRTVec2(1.0f, -1.0f), PVRTVec2(0.0f, 1.0f), PVRTVec2(1.0f, 0.0f));
+	PVRShellOutputDebug("Regression %s\n", bPassed ? (m_bRegressRecord ? "goldens recorded" : "passed") : "FAILED");
+	return bPassed;
+	}
 
+// ---------------------------------------------------------------
+void MyPVRDemo::RecordChurch(const PVRTMat4& mxCam)
+	{
+	float fShadowScale = m_nShadowMapRendered / (float)m_nShadowMapSize;	// The shadow map only fills this much of its texture
+	PVRTMat4 mxInvCam;
+	Mat4InverseAffine(mxInvCam, mxCam);
+	PVRTMat4 mxTexProj = PVRTMat4::Scale(fShadowScale, fShadowScale, 1.0f) * m_mxLightBias * m_mxShadowViewProj * mxInvCam;
+	const GLuint c_uiFlags = FLAG_VRT | FLAG_TEX0 | FLAG_TEX1;
+	DrawPacket Packet;
+
+	// --- Draw the church reflected under the floor. Not needed when RenderReflection has already drawn it offscreen.
+	if(!m_bReflectionRTT)
+		{
+		Packet.Init(enumEFFECT_ChurchRefl, GL_FRONT, false, c_uiFlags);
+		Packet.auiTextures[0] = CMD_TEXTURE(enumTEXTURE_ChurchWalls);		// Base map
+		Packet.auiTextures[2] = CMD_TEXTURE(enumTEXTURE_ChurchLightmap);	// Light map
+		Packet.Uniform(enumUNIFORM_Projection, m_mxProjection.ptr(), 16);
+		RecordChurchNodes(Packet, mxCam * PVRTMat4::Scale(1, -1, 1), enumVIEW_Reflection, enumMODEL_Church, enumCMDLAYER_Opaque);	// Reflected ModelView matrix
+		}
 
-	// --- OVERLAY PASS
-	glBindFramebuffer(GL_FRAMEBUFFER, m_nOrigFBO);		// Done. Use the original framebuffer.
-	glViewport(0, 0, PVRShellGet(prefWidth), PVRShellGet(prefHeight));
-
-	// --- Render the texture to a screen aligned quad over the original mode. NOTE: We should use scissor or bounding rect instead.
-	glUseProgram(m_SATexShader.uiID);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_ONE, GL_ONE);				// Additive blending
-	glBindTexture(GL_TEXTURE_2D, m_uiRTT[enumFB_1]);
-
-	// This needs to be recalculated whenever either of the following change:
-	PVRTMat4 mxMVP = m_mxProjection * m_mxCam * mxModel;
-	PVRTVec4 vTL = mxMVP * m_bbStatueTL;
-	PVRTVec4 vBR = mxMVP * m_bbStatueBR;
-	vTL /= vTL.w;
-	vBR /= vBR.w;
-
-	if(m_bRotated)
-		{
-		float fTmp = vBR.y;			// Swap coordinates around if the screen is rotated.
-		vBR.y = vTL.y;
-		vTL.y = fTmp;
-		}
-	PVRTVec2 vTTL(vTL.x * 0.5f + 0.5f, vTL.y * 0.5f + 0.5f);
-	PVRTVec2 vTBR(vBR.x * 0.5f + 0.5f, vBR.y * 0.5f + 0.5f);
-	
-	RenderScreenAlignedTexture(PVRTVec2(vTL.x, vTL.y), PVRTVec2(vBR.x, vBR.y), vTTL, vTBR);
-	glDisable(GL_BLEND);
+	// --- Draw the church walls with the Church shader, which utilises the Shadow Map in texture unit 1. No alpha.
+	Packet.Init(enumEFFECT_Church, GL_BACK, false, c_uiFlags);
+	Packet.auiTextures[0] = CMD_TEXTURE(enumTEXTURE_ChurchWalls);
+	Packet.auiTextures[1] = enumCMDTEXTURE_ShadowMap;
+	Packet.auiTextures[2] = CMD_TEXTURE(enumTEXTURE_ChurchLightmap);
+	Packet.Uniform(enumUNIFORM_Projection, m_mxProjection.ptr(), 16);
+	Packet.Uniform(enumUNIFORM_TexProjection, mxTexProj.ptr(), 16);
+	Packet.Uniform1f(enumUNIFORM_Alpha, 1.0f);
+	RecordChurchNodes(Packet, mxCam, enumVIEW_Camera, enumMODEL_Church, enumCMDLAYER_Opaque);
+
+	// --- Draw the floor. With the offscreen target it's opaque, with the reflection mixed in by the shader. Otherwise it's
+	// the church shader again, blended over the reflection, so it goes after everything opaque.
+	Packet.Init(m_bReflectionRTT ? enumEFFECT_Floor : enumEFFECT_Church, GL_BACK, !m_bReflectionRTT, c_uiFlags);
+	Packet.auiTextures[0] = CMD_TEXTURE(enumTEXTURE_Floor);
+	Packet.auiTextures[1] = enumCMDTEXTURE_ShadowMap;
+	Packet.auiTextures[2] = CMD_TEXTURE(enumTEXTURE_FloorLightmap);
+	Packet.Uniform(enumUNIFORM_Projection, m_mxProjection.ptr(), 16);
+	Packet.Uniform(enumUNIFORM_TexProjection, mxTexProj.ptr(), 16);
+	Packet.Uniform1f(enumUNIFORM_Alpha, FLOOR_ALPHA);
+	if(m_bReflectionRTT)
+		{
+		// The reflection was drawn with the camera's projection (bar depth), so the same projection finds each pixel's texel
+		PVRTMat4 mxReflTexProj = m_mxLightBias * m_mxProjection;
+		Packet.auiTextures[3] = enumCMDTEXTURE_Reflection;
+		Packet.Uniform(enumUNIFORM_ReflProjection, mxReflTexProj.ptr(), 16);
+		}
+	RecordChurchNodes(Packet, mxCam, enumVIEW_Camera, enumMODEL_Floor, m_bReflectionRTT ? enumCMDLAYER_Opaque : enumCMDLAYER_Blended);
 	}
 
 // ---------------------------------------------------------------
-void MyPVRDemo::RenderStatue(const PVRTMat4& mxModel, const PVRTMat4& mxCam, const PVRTVec3& vLightPos, const StatueShader* pShader)
+void MyPVRDemo::RecordChurchNodes(const DrawPacket& Template, const PVRTMat4& mxView, unsigned int uiView, int nRole, unsigned int uiLayer)
 	{
-	PVRTMat4 mxModelView = mxCam * mxModel;
-	PVRTMat4 mxMVP = m_mxProjection * mxModelView;
-	PVRTVec3 vLightPosModel = vLightPos;		// Light position in World space
-	glUniform3fv(pShader->uiLightPos, 1, vLightPosModel.ptr());
-	glUniformMatrix4fv(pShader->uiMVP, 1, GL_FALSE, mxMVP.ptr());
-	glUniformMatrix4fv(pShader->uiModelView, 1, GL_FALSE, mxModelView.ptr());
-	DrawMesh(enumMODEL_Statue, FLAG_VRT | FLAG_TEX0 | FLAG_NRM | FLAG_TAN);
+	// The church, floor and scenery all use the church shader's vertex layout. The template has the rest of the packet.
+	for(unsigned int i = 0; i < m_Scene.GetNumVisible(uiView); ++i)
+		{
+		unsigned int uiNode = m_Scene.GetVisible(uiView, i);
+		const SceneNode& Node = m_Scene.GetNode(uiNode);
+		if(Node.nRole != nRole)
+			continue;
+
+		PVRTMat4 mxModelView = mxView * Node.mxWorld;
+		DrawPacket Packet = Template;
+		Packet.nNode = uiNode;
+		Packet.Uniform(enumUNIFORM_ModelView, mxModelView.ptr(), 16);
+		m_Commands.Add(Packet, uiLayer, GetViewDepth(mxView, Node.vCentre));
+		}
 	}
 
 // ---------------------------------------------------------------
-void MyPVRDemo::RenderCurch(const PVRTMat4& mxCam)
+void MyPVRDemo::ExecuteCommands()
 	{
-	PVRTMat4 mxModel = PVRTMat4::Identity();
-	PVRTMat4 mxModelView = mxCam * mxModel;
-	PVRTMat4 mxTexProj = m_mxLightBias * m_mxLightProj * m_mxLightView * mxCam.inverse();
-
-	// --- Draw the floor reflected first, so we don't have to swap between GPU programs
-	glUseProgram(m_ChurchReflShader.uiID);
-	// Base map
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, m_tex[enumTEXTURE_ChurchWalls]);
-	// Light map
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, m_tex[enumTEXTURE_ChurchLightmap]);
-
-	glCullFace(GL_FRONT);
-	PVRTMat4 mxReflChurchView = mxCam * PVRTMat4::Scale(1, -1, 1);
-	glUniformMatrix4fv(m_ChurchReflShader.uiProjection, 1, GL_FALSE, m_mxProjection.ptr());
-	glUniformMatrix4fv(m_ChurchReflShader.uiModelView, 1, GL_FALSE, mxReflChurchView.ptr());	// Reflected ModelView matrix
-	DrawMesh(enumMODEL_Church, FLAG_VRT | FLAG_TEX0 | FLAG_TEX1);
-	glCullFace(GL_BACK);
+	m_Commands.Sort(m_bCmdSort);
+	for(unsigned int i = 0; i < m_Commands.GetNumPackets(); ++i)
+		{
+		const DrawPacket& Packet = m_Commands.GetPacket(i);
+		const GenericShader* pShader = GetEffectShader(Packet.uiEffect);
+		const GLint* pnUniforms = m_anUniforms[Packet.uiEffect];
+		m_GLState.UseProgram(pShader->uiID);
+		for(unsigned int u = 0; u < CMD_TEXTURE_UNITS; ++u)
+			{
+			if(Packet.auiTextures[u] != enumCMDTEXTURE_None)
+				m_GLState.BindTexture(GL_TEXTURE0 + u, GetCmdTexture(Packet.auiTextures[u]));
+			}
+		m_GLState.CullFace(Packet.eCullFace);
+		if(Packet.bBlend)
+			m_GLState.Enable(GL_BLEND);
+		else
+			m_GLState.Disable(GL_BLEND);
 
-	// --- Activate the Church shader which utilises the Shadow Map.
-	glUseProgram(m_ChurchShader.uiID);
-	
-	
-	// --- Use the Shadow Map texture in texture unit 1
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, m_uiShadowMapTex);
-	
-	// --- Upload projection matrices
-	glUniformMatrix4fv(m_ChurchShader.uiProjection, 1, GL_FALSE, m_mxProjection.ptr());	
-	glUniformMatrix4fv(m_ChurchShader.uiTexProjection, 1, GL_FALSE, mxTexProj.ptr());
-	glUniform1f(m_ChurchShader.uiAlpha, 1.0f);	// Set no alpha while we draw the walls.
-
-	// --- Draw church walls	 (Textures are already bound)
-	// Draw the walls as normal
-	glUniformMatrix4fv(m_ChurchShader.uiModelView, 1, GL_FALSE, mxModelView.ptr());		// Standard ModelView matrix
-	DrawMesh(enumMODEL_Church, FLAG_VRT | FLAG_TEX0 | FLAG_TEX1);
-
-	// --- Draw floor
-	glEnable(GL_BLEND);
-	// Base map
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, m_tex[enumTEXTURE_Floor]);
-	// Light map
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, m_tex[enumTEXTURE_FloorLightmap]);
-	
-	// Draw the floor
-	glUniform1f(m_ChurchShader.uiAlpha, FLOOR_ALPHA);
-	glUniformMatrix4fv(m_ChurchShader.uiModelView, 1, GL_FALSE, mxModelView.ptr());		// Standard ModelView matrix
-	DrawMesh(enumMODEL_Floor, FLAG_VRT | FLAG_TEX0 | FLAG_TEX1);
+		for(unsigned int u = 0; u < Packet.uiNumUniforms; ++u)
+			{
+			const CmdUniform& Uniform = Packet.aUniforms[u];
+			GLint nLocation = pnUniforms[Uniform.uiUniform];
+			switch(Uniform.uiFloats)
+				{
+				case 1:		m_GLState.Uniform1f(nLocation, Uniform.afValue[0]);		break;
+				case 3:		m_GLState.Uniform3fv(nLocation, Uniform.afValue);			break;
+				case 4:		m_GLState.Uniform4fv(nLocation, Uniform.afValue);			break;
+				case 16:	m_GLState.UniformMatrix4fv(nLocation, Uniform.afValue);		break;
+				default:	ASSERT(!"Unsupported uniform size");
+				}
+			}
+		DrawMesh(pShader, Packet.nNode, Packet.uiFlags);
+		}
+	m_Commands.Clear();
+
+	// Leave the states the rest of the frame expects
+	m_GLState.CullFace(GL_BACK);
+	m_GLState.Disable(GL_BLEND);
+	}
 
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glDisable(GL_BLEND);
+// ---------------------------------------------------------------
+GLuint MyPVRDemo::GetCmdTexture(unsigned int uiTexture) const
+	{
+	// The GL texture for a packet's texture unit
+	switch(uiTexture)
+		{
+		case enumCMDTEXTURE_ShadowMap:	return m_uiShadowMapTex;
+		case enumCMDTEXTURE_Reflection:	return m_FrameGraph.GetTexture(m_FG.uiReflColour);
+		default:						return m_tex[uiTexture - enumCMDTEXTURE_File];
+		}
 	}
 
 // ---------------------------------------------------------------
 void MyPVRDemo::RenderScreenAlignedTexture(const PVRTVec2& vTL, const PVRTVec2& vBR, const PVRTVec2& vTTL, const PVRTVec2& vTBR)
 	{
-	glDisable(GL_DEPTH_TEST);
-	
-	glEnableVertexAttribArray(enumATTRIBUTE_POSITION);
-	glEnableVertexAttribArray(enumATTRIBUTE_TEXCOORD0);
+	// Callers that need depth testing turn it back on themselves, so back-to-back quads don't toggle it.
+	m_GLState.Disable(GL_DEPTH_TEST);
+
+	m_GLState.BindVertexArray(0);
+	m_GLState.BindBuffer(GL_ARRAY_BUFFER, 0);			// Client side arrays
+	m_GLState.VertexAttribArrays((1 << enumATTRIBUTE_POSITION) | (1 << enumATTRIBUTE_TEXCOORD0));
 
 	const float c_fVertex[] = {	vTL.x, vBR.y,		// Bottom Left
 								vBR.x, vBR.y,		// Bottom Right
@@ -866,48 +7410,93 @@ void MyPVRDemo::RenderScreenAlignedTexture(const PVRTVec2& vTL, const PVRTVec2&
 								vTTL.x, vTTL.y,		// Top Left
 								vTBR.x, vTTL.y };	// Top Right
 
-	glVertexAttribPointer(enumATTRIBUTE_POSITION, 2, GL_FLOAT, GL_FALSE, 0, c_fVertex);
-	glVertexAttribPointer(enumATTRIBUTE_TEXCOORD0, 2, GL_FLOAT, GL_FALSE, 0, c_fUVs);	
+	m_GLState.VertexAttribPointer(enumATTRIBUTE_POSITION, 2, GL_FLOAT, GL_FALSE, 0, c_fVertex);
+	m_GLState.VertexAttribPointer(enumATTRIBUTE_TEXCOORD0, 2, GL_FLOAT, GL_FALSE, 0, c_fUVs);
 
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-	glDisableVertexAttribArray(enumATTRIBUTE_POSITION);
-	glDisableVertexAttribArray(enumATTRIBUTE_TEXCOORD0);
-	
-	glEnable(GL_DEPTH_TEST);
 	}
 
 // ---------------------------------------------------------------
-void MyPVRDemo::DrawMesh(int nModelIdx, GLuint uiFlags)
+void MyPVRDemo::DrawMesh(const GenericShader* pShader, int nNodeIdx, GLuint uiFlags)
 	{
-	int nMeshIdx = m_Model.pNode[nModelIdx].nIdx;
-	SPODMesh* pMesh = &m_Model.pMesh[nMeshIdx];
-
-	glBindBuffer(GL_ARRAY_BUFFER, m_uiVBO[nMeshIdx]);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_uiVBOIdx[nMeshIdx]);
+	const SceneNode& Node = m_Scene.GetNode(nNodeIdx);
+	int nMeshIdx = Node.nMesh;
+
+	// Tell the shader how to decode this mesh's compressed vertices
+	const CompactVertexFormat& Format = m_VertexFormat[nMeshIdx];
+	m_GLState.Uniform3fv(pShader->uiPosScale, Format.vPosScale.ptr());
+	m_GLState.Uniform3fv(pShader->uiPosBias, Format.vPosBias.ptr());
+	if(uiFlags & FLAG_TEX0)	m_GLState.Uniform4fv(pShader->uiUVScaleBias[0], Format.vUVScaleBias[0].ptr());
+	if(uiFlags & FLAG_TEX1)	m_GLState.Uniform4fv(pShader->uiUVScaleBias[1], Format.vUVScaleBias[1].ptr());
+
+	// Use the baked layout if there is one, otherwise set it up by hand.
+	GLuint uiVAO = 0;
+	if(m_bVAOActive)
+		{
+		for(unsigned int i = 0; i < MESH_LAYOUT_MAX; ++i)
+			{
+			if(c_MeshLayouts[i].nRole == Node.nRole && c_MeshLayouts[i].uiFlags == uiFlags)
+				{
+				uiVAO = m_uiVAO[nMeshIdx][i];
+				break;
+				}
+			}
+		ASSERT(uiVAO);			// Missing from c_MeshLayouts
+		}
 
-	if(uiFlags & FLAG_VRT)	glEnableVertexAttribArray(enumATTRIBUTE_POSITION);
-	if(uiFlags & FLAG_NRM)	glEnableVertexAttribArray(enumATTRIBUTE_NORMAL);
-	if(uiFlags & FLAG_TEX0)	glEnableVertexAttribArray(enumATTRIBUTE_TEXCOORD0);
-	if(uiFlags & FLAG_TEX1)	glEnableVertexAttribArray(enumATTRIBUTE_TEXCOORD0 + 1);
-	if(uiFlags & FLAG_TAN)	glEnableVertexAttribArray(enumATTRIBUTE_TANGENT);	
+	if(uiVAO)
+		{
+		m_GLState.BindVertexArray(uiVAO);
+		}
+	else
+		{
+		m_GLState.BindVertexArray(0);
+		SetMeshAttribs(nMeshIdx, uiFlags);
+		}
 
-	if(uiFlags & FLAG_VRT)	glVertexAttribPointer(enumATTRIBUTE_POSITION, 3, GL_FLOAT, GL_FALSE, pMesh->sVertex.nStride, pMesh->sVertex.pData);
-	if(uiFlags & FLAG_NRM)	glVertexAttribPointer(enumATTRIBUTE_NORMAL, 3, GL_FLOAT, GL_FALSE, pMesh->sNormals.nStride, pMesh->sNormals.pData);
-	if(uiFlags & FLAG_TEX0)	glVertexAttribPointer(enumATTRIBUTE_TEXCOORD0, 2, GL_FLOAT, GL_FALSE, pMesh->psUVW[0].nStride, pMesh->psUVW[0].pData);
-	if(uiFlags & FLAG_TEX1)	glVertexAttribPointer(enumATTRIBUTE_TEXCOORD0 + 1, 2, GL_FLOAT, GL_FALSE, pMesh->psUVW[1].nStride, pMesh->psUVW[1].pData);
-	if(uiFlags & FLAG_TAN)	glVertexAttribPointer(enumATTRIBUTE_TANGENT, 3, GL_FLOAT, GL_FALSE, pMesh->sTangents.nStride, pMesh->sTangents.pData);
+	GLsizei nNumIndices = (uiFlags & FLAG_DEPTH) ? m_uiDepthNumIndices[nMeshIdx] : m_uiNumIndices[nMeshIdx];
+	glDrawElements(GL_TRIANGLES, nNumIndices, GL_UNSIGNED_SHORT, 0);
+	}
 
-	glDrawElements(GL_TRIANGLES, pMesh->nNumFaces*3, GL_UNSIGNED_SHORT, 0);
+// ---------------------------------------------------------------
+void MyPVRDemo::SetMeshAttribs(int nMeshIdx, GLuint uiFlags)
+	{
+	// The depth stream is just tightly packed positions
+	if(uiFlags & FLAG_DEPTH)
+		{
+		ASSERT(uiFlags == (FLAG_VRT | FLAG_DEPTH));
+		m_GLState.BindBuffer(GL_ARRAY_BUFFER, m_uiDepthVBO[nMeshIdx]);
+		m_GLState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_uiDepthVBOIdx[nMeshIdx]);
+		m_GLState.VertexAttribArrays(1 << enumATTRIBUTE_POSITION);
+		m_GLState.VertexAttribPointer(enumATTRIBUTE_POSITION, 3, GL_SHORT, GL_TRUE, 4 * sizeof(short), 0);
+		return;
+		}
 
-	if(uiFlags & FLAG_VRT)	glDisableVertexAttribArray(enumATTRIBUTE_POSITION);
-	if(uiFlags & FLAG_NRM)	glDisableVertexAttribArray(enumATTRIBUTE_NORMAL);
-	if(uiFlags & FLAG_TEX0)	glDisableVertexAttribArray(enumATTRIBUTE_TEXCOORD0);
-	if(uiFlags & FLAG_TEX1)	glDisableVertexAttribArray(enumATTRIBUTE_TEXCOORD0 + 1);
-	if(uiFlags & FLAG_TAN)	glDisableVertexAttribArray(enumATTRIBUTE_TANGENT);
+	SetMeshAttribs(m_uiVBO[nMeshIdx], m_uiVBOIdx[nMeshIdx], m_VertexFormat[nMeshIdx], uiFlags);
+	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+// ---------------------------------------------------------------
+// Any buffers in the compact layout: a mesh's own, or copies of them such as the crowd's
+void MyPVRDemo::SetMeshAttribs(GLuint uiVBO, GLuint uiVBOIdx, const CompactVertexFormat& Format, GLuint uiFlags)
+	{
+	m_GLState.BindBuffer(GL_ARRAY_BUFFER, uiVBO);
+	m_GLState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, uiVBOIdx);
+
+	// Arrays are left enabled and buffers left bound after the draw; the state cache only changes what differs next time.
+	unsigned int uiAttribs = 0;
+	if(uiFlags & FLAG_VRT)	uiAttribs |= 1 << enumATTRIBUTE_POSITION;
+	if(uiFlags & FLAG_NRM)	uiAttribs |= 1 << enumATTRIBUTE_NORMAL;
+	if(uiFlags & FLAG_TEX0)	uiAttribs |= 1 << enumATTRIBUTE_TEXCOORD0;
+	if(uiFlags & FLAG_TEX1)	uiAttribs |= 1 << (enumATTRIBUTE_TEXCOORD0 + 1);
+	if(uiFlags & FLAG_TAN)	uiAttribs |= 1 << enumATTRIBUTE_TANGENT;
+	m_GLState.VertexAttribArrays(uiAttribs);
+
+	// See CompressMesh for the layout
+	if(uiFlags & FLAG_VRT)	m_GLState.VertexAttribPointer(enumATTRIBUTE_POSITION, 3, GL_SHORT, GL_TRUE, Format.nStride, (const void*)(size_t)Format.nPosOffset);
+	if(uiFlags & FLAG_NRM)	m_GLState.VertexAttribPointer(enumATTRIBUTE_NORMAL, 2, GL_SHORT, GL_TRUE, Format.nStride, (const void*)(size_t)Format.nNrmOffset);
+	if(uiFlags & FLAG_TEX0)	m_GLState.VertexAttribPointer(enumATTRIBUTE_TEXCOORD0, 2, GL_UNSIGNED_SHORT, GL_TRUE, Format.nStride, (const void*)(size_t)Format.anUVOffset[0]);
+	if(uiFlags & FLAG_TEX1)	m_GLState.VertexAttribPointer(enumATTRIBUTE_TEXCOORD0 + 1, 2, GL_UNSIGNED_SHORT, GL_TRUE, Format.nStride, (const void*)(size_t)Format.anUVOffset[1]);
+	if(uiFlags & FLAG_TAN)	m_GLState.VertexAttribPointer(enumATTRIBUTE_TANGENT, 2, GL_SHORT, GL_TRUE, Format.nStride, (const void*)(size_t)Format.nTanOffset);
 	}
 
 // ---------------------------------------------------------------
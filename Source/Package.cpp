@@ -0,0 +1,178 @@
+#include "Package.h"
+
+// ---------------------------------------------------------------
+bool CMappedFile::Open(const char* pszFilename)
+	{
+	Close();
+
+#if defined(_WIN32)
+	m_hFile = CreateFileA(pszFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(m_hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	m_uiSize = (size_t)GetFileSize(m_hFile, NULL);
+	m_hMapping = CreateFileMappingA(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(m_hMapping)
+		m_pData = (const unsigned char*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+
+	if(!m_pData)
+		{
+		if(m_hMapping)
+			CloseHandle(m_hMapping);
+		CloseHandle(m_hFile);
+		m_uiSize = 0;
+		return false;
+		}
+#else
+	int nFile = open(pszFilename, O_RDONLY);
+	if(nFile < 0)
+		return false;
+
+	struct stat sStat;
+	if(fstat(nFile, &sStat) == 0 && sStat.st_size > 0)
+		{
+		void* pMapping = mmap(NULL, (size_t)sStat.st_size, PROT_READ, MAP_PRIVATE, nFile, 0);
+		if(pMapping != MAP_FAILED)
+			{
+			m_pData = (const unsigned char*)pMapping;
+			m_uiSize = (size_t)sStat.st_size;
+			}
+		}
+	close(nFile);			// The mapping keeps the file alive
+
+	if(!m_pData)
+		return false;
+#endif
+
+	return true;
+	}
+
+// ---------------------------------------------------------------
+void CMappedFile::Close()
+	{
+	if(!m_pData)
+		return;
+
+#if defined(_WIN32)
+	UnmapViewOfFile(m_pData);
+	CloseHandle(m_hMapping);
+	CloseHandle(m_hFile);
+#else
+	munmap((void*)m_pData, m_uiSize);
+#endif
+
+	m_pData = NULL;
+	m_uiSize = 0;
+	}
+
+// ---------------------------------------------------------------
+bool CPackage::Open(const char* pszFilename)
+	{
+	Close();
+	if(!m_File.Open(pszFilename))
+		return false;
+
+	const PackageHeader* pHeader = (const PackageHeader*)m_File.GetData();
+	size_t uiSize = m_File.GetSize();
+	if(uiSize < sizeof(PackageHeader) || pHeader->uiMagic != PACKAGE_MAGIC || pHeader->uiVersion != PACKAGE_VERSION ||
+	   uiSize < sizeof(PackageHeader) + pHeader->uiNumEntries * sizeof(PackageEntry))
+		{
+		m_File.Close();
+		return false;
+		}
+
+	// Check every blob is inside the file so Find() doesn't have to
+	const PackageEntry* pEntries = (const PackageEntry*)(pHeader + 1);
+	for(unsigned int i = 0; i < pHeader->uiNumEntries; ++i)
+		{
+		if(pEntries[i].uiOffset > uiSize || pEntries[i].uiSize > uiSize - pEntries[i].uiOffset)
+			{
+			m_File.Close();
+			return false;
+			}
+		}
+
+	m_pHeader = pHeader;
+	m_pEntries = pEntries;
+	return true;
+	}
+
+// ---------------------------------------------------------------
+const void* CPackage::Find(unsigned int uiType, unsigned int uiIndex, unsigned int* puSize) const
+	{
+	for(unsigned int i = 0; i < m_pHeader->uiNumEntries; ++i)
+		{
+		if(m_pEntries[i].uiType == uiType && m_pEntries[i].uiIndex == uiIndex)
+			{
+			if(puSize)
+				*puSize = m_pEntries[i].uiSize;
+			return m_File.GetData() + m_pEntries[i].uiOffset;
+			}
+		}
+	return NULL;
+	}
+
+// ---------------------------------------------------------------
+CPackageWriter::~CPackageWriter()
+	{
+	for(unsigned int i = 0; i < m_Blobs.GetSize(); ++i)
+		delete [] m_Blobs[i];
+	}
+
+// ---------------------------------------------------------------
+void CPackageWriter::Add(unsigned int uiType, unsigned int uiIndex, const void* pData, unsigned int uiSize)
+	{
+	PackageEntry Entry;
+	Entry.uiType	= uiType;
+	Entry.uiIndex	= uiIndex;
+	Entry.uiOffset	= 0;			// Filled in by Write()
+	Entry.uiSize	= uiSize;
+	m_Entries.Append(Entry);
+
+	unsigned char* pCopy = new unsigned char[uiSize];
+	memcpy(pCopy, pData, uiSize);
+	m_Blobs.Append(pCopy);
+	}
+
+// ---------------------------------------------------------------
+bool CPackageWriter::Write(const char* pszFilename, unsigned int uiFlags) const
+	{
+	FILE* pFile = fopen(pszFilename, "wb");
+	if(!pFile)
+		return false;
+
+	PackageHeader Header;
+	Header.uiMagic		= PACKAGE_MAGIC;
+	Header.uiVersion	= PACKAGE_VERSION;
+	Header.uiNumEntries	= m_Entries.GetSize();
+	Header.uiFlags		= uiFlags;
+
+	// Lay the blobs out after the table of contents
+	unsigned int uiOffset = sizeof(PackageHeader) + Header.uiNumEntries * sizeof(PackageEntry);
+	PackageEntry* pEntries = new PackageEntry[Header.uiNumEntries];
+	for(unsigned int i = 0; i < Header.uiNumEntries; ++i)
+		{
+		uiOffset = (uiOffset + PACKAGE_ALIGN - 1) & ~(PACKAGE_ALIGN - 1);
+		pEntries[i] = m_Entries[i];
+		pEntries[i].uiOffset = uiOffset;
+		uiOffset += pEntries[i].uiSize;
+		}
+
+	bool bResult = fwrite(&Header, sizeof(Header), 1, pFile) == 1;
+	if(Header.uiNumEntries)
+		bResult &= fwrite(pEntries, sizeof(PackageEntry), Header.uiNumEntries, pFile) == Header.uiNumEntries;
+
+	const unsigned char acPadding[PACKAGE_ALIGN] = { 0 };
+	for(unsigned int i = 0; i < Header.uiNumEntries && bResult; ++i)
+		{
+		long nPadding = (long)pEntries[i].uiOffset - ftell(pFile);
+		if(nPadding > 0)
+			bResult &= fwrite(acPadding, 1, (size_t)nPadding, pFile) == (size_t)nPadding;
+		if(pEntries[i].uiSize)
+			bResult &= fwrite(m_Blobs[i], pEntries[i].uiSize, 1, pFile) == 1;
+		}
+
+	delete [] pEntries;
+	fclose(pFile);
+	return bResult;
+	}
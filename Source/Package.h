@@ -0,0 +1,84 @@
+#ifndef _PACKAGE_H_
+#define _PACKAGE_H_
+
+#include "Common.h"
+
+// A package is a single file of blobs, each tagged with a type and an index, laid out so they can be used straight out
+// of a read-only mapping of the file.
+//
+// Layout: PackageHeader, PackageEntry[uiNumEntries], then the blobs, each starting on a PACKAGE_ALIGN boundary.
+// Bump PACKAGE_VERSION whenever what goes in a blob changes, so stale packages are turned away.
+#define PACKAGE_MAGIC				0x4B505644		// "DVPK"
+#define PACKAGE_VERSION				3
+#define PACKAGE_ALIGN				16
+
+struct PackageHeader
+	{
+	unsigned int		uiMagic;
+	unsigned int		uiVersion;
+	unsigned int		uiNumEntries;
+	unsigned int		uiFlags;
+	};
+
+struct PackageEntry
+	{
+	unsigned int		uiType;
+	unsigned int		uiIndex;
+	unsigned int		uiOffset;		// From the start of the file
+	unsigned int		uiSize;
+	};
+
+// Read-only memory mapping of a whole file
+class CMappedFile
+	{
+	private:
+		const unsigned char*	m_pData;
+		size_t					m_uiSize;
+#if defined(_WIN32)
+		HANDLE					m_hFile;
+		HANDLE					m_hMapping;
+#endif
+
+	public:
+		CMappedFile() : m_pData(NULL), m_uiSize(0) {}
+		~CMappedFile() { Close(); }
+
+		bool Open(const char* pszFilename);
+		void Close();
+		const unsigned char* GetData() const	{ return m_pData; }
+		size_t GetSize() const					{ return m_uiSize; }
+	};
+
+// A mapped package, validated on open
+class CPackage
+	{
+	private:
+		CMappedFile				m_File;
+		const PackageHeader*	m_pHeader;
+		const PackageEntry*		m_pEntries;
+
+	public:
+		CPackage() : m_pHeader(NULL), m_pEntries(NULL) {}
+
+		bool Open(const char* pszFilename);
+		void Close()							{ m_File.Close(); m_pHeader = NULL; m_pEntries = NULL; }
+		bool IsOpen() const						{ return m_pHeader != NULL; }
+		unsigned int GetFlags() const			{ return m_pHeader->uiFlags; }
+		const void* Find(unsigned int uiType, unsigned int uiIndex, unsigned int* puSize) const;
+	};
+
+// Collects blobs during a normal load and writes them out as a package
+class CPackageWriter
+	{
+	private:
+		CPVRTArray<PackageEntry>	m_Entries;
+		CPVRTArray<unsigned char*>	m_Blobs;
+
+	public:
+		~CPackageWriter();
+
+		void Add(unsigned int uiType, unsigned int uiIndex, const void* pData, unsigned int uiSize);
+		bool Write(const char* pszFilename, unsigned int uiFlags) const;
+	};
+
+#endif // _PACKAGE_H_
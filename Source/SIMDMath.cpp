@@ -0,0 +1,220 @@
+#include "SIMDMath.h"
+
+#if defined(MATH_SSE)
+// ---------------------------------------------------------------
+inline __m128 Cross3(__m128 a, __m128 b)
+	{
+	// w comes out as a.w * b.w - a.w * b.w, which is 0 for the columns of an affine matrix
+	__m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)), bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 aZXY = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2)), bZXY = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 0, 2));
+	return _mm_sub_ps(_mm_mul_ps(aYZX, bZXY), _mm_mul_ps(aZXY, bYZX));
+	}
+
+// ---------------------------------------------------------------
+inline __m128 Dot3(__m128 a, __m128 b)
+	{
+	// In every lane
+	__m128 vMul = _mm_mul_ps(a, b);
+	__m128 vSum = _mm_add_ss(vMul, _mm_shuffle_ps(vMul, vMul, _MM_SHUFFLE(1, 1, 1, 1)));
+	vSum = _mm_add_ss(vSum, _mm_shuffle_ps(vMul, vMul, _MM_SHUFFLE(2, 2, 2, 2)));
+	return _mm_shuffle_ps(vSum, vSum, _MM_SHUFFLE(0, 0, 0, 0));
+	}
+#endif
+
+// ---------------------------------------------------------------
+void Mat4Multiply(PVRTMat4& mxOut, const PVRTMat4& mxA, const PVRTMat4& mxB)
+	{
+#if defined(MATH_SSE)
+	__m128 a0 = _mm_loadu_ps(&mxA.f[0]), a1 = _mm_loadu_ps(&mxA.f[4]), a2 = _mm_loadu_ps(&mxA.f[8]), a3 = _mm_loadu_ps(&mxA.f[12]);
+	__m128 avOut[4];
+	for(int c = 0; c < 4; ++c)
+		{
+		const float* pfB = &mxB.f[c * 4];
+		__m128 vCol = _mm_mul_ps(a0, _mm_set1_ps(pfB[0]));
+		vCol = _mm_add_ps(vCol, _mm_mul_ps(a1, _mm_set1_ps(pfB[1])));
+		vCol = _mm_add_ps(vCol, _mm_mul_ps(a2, _mm_set1_ps(pfB[2])));
+		avOut[c] = _mm_add_ps(vCol, _mm_mul_ps(a3, _mm_set1_ps(pfB[3])));
+		}
+	for(int c = 0; c < 4; ++c)
+		_mm_storeu_ps(&mxOut.f[c * 4], avOut[c]);
+#elif defined(MATH_NEON)
+	float32x4_t a0 = vld1q_f32(&mxA.f[0]), a1 = vld1q_f32(&mxA.f[4]), a2 = vld1q_f32(&mxA.f[8]), a3 = vld1q_f32(&mxA.f[12]);
+	float32x4_t avOut[4];
+	for(int c = 0; c < 4; ++c)
+		{
+		float32x4_t vB = vld1q_f32(&mxB.f[c * 4]);
+		float32x4_t vCol = vmulq_lane_f32(a0, vget_low_f32(vB), 0);
+		vCol = vmlaq_lane_f32(vCol, a1, vget_low_f32(vB), 1);
+		vCol = vmlaq_lane_f32(vCol, a2, vget_high_f32(vB), 0);
+		avOut[c] = vmlaq_lane_f32(vCol, a3, vget_high_f32(vB), 1);
+		}
+	for(int c = 0; c < 4; ++c)
+		vst1q_f32(&mxOut.f[c * 4], avOut[c]);
+#else
+	mxOut = mxA * mxB;
+#endif
+	}
+
+// ---------------------------------------------------------------
+void Mat4InverseAffine(PVRTMat4& mxOut, const PVRTMat4& mxIn)
+	{
+#if defined(MATH_SSE)
+	// The rows of the 3x3's inverse are the cross products of its columns, over its determinant
+	__m128 c0 = _mm_loadu_ps(&mxIn.f[0]), c1 = _mm_loadu_ps(&mxIn.f[4]), c2 = _mm_loadu_ps(&mxIn.f[8]), vT = _mm_loadu_ps(&mxIn.f[12]);
+	__m128 r0 = Cross3(c1, c2), r1 = Cross3(c2, c0), r2 = Cross3(c0, c1), r3 = _mm_setzero_ps();
+	__m128 vInvDet = _mm_div_ps(_mm_set1_ps(1.0f), Dot3(c0, r0));
+	r0 = _mm_mul_ps(r0, vInvDet);
+	r1 = _mm_mul_ps(r1, vInvDet);
+	r2 = _mm_mul_ps(r2, vInvDet);
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+	// The translation is taken back out through the inverted 3x3
+	__m128 vInvT = _mm_mul_ps(r0, _mm_shuffle_ps(vT, vT, _MM_SHUFFLE(0, 0, 0, 0)));
+	vInvT = _mm_add_ps(vInvT, _mm_mul_ps(r1, _mm_shuffle_ps(vT, vT, _MM_SHUFFLE(1, 1, 1, 1))));
+	vInvT = _mm_add_ps(vInvT, _mm_mul_ps(r2, _mm_shuffle_ps(vT, vT, _MM_SHUFFLE(2, 2, 2, 2))));
+	r3 = _mm_sub_ps(_mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f), vInvT);
+
+	_mm_storeu_ps(&mxOut.f[0], r0);
+	_mm_storeu_ps(&mxOut.f[4], r1);
+	_mm_storeu_ps(&mxOut.f[8], r2);
+	_mm_storeu_ps(&mxOut.f[12], r3);
+#else
+	// NEON has no shuffles cheap enough to beat the scalar cofactors
+	mxOut = mxIn.inverse();
+#endif
+	}
+
+// ---------------------------------------------------------------
+void TransformPoints(const PVRTMat4& mx, const PVRTVec3* pvIn, unsigned int uiCount, PVRTVec4* pvOut)
+	{
+#if defined(MATH_SSE)
+	__m128 c0 = _mm_loadu_ps(&mx.f[0]), c1 = _mm_loadu_ps(&mx.f[4]), c2 = _mm_loadu_ps(&mx.f[8]), c3 = _mm_loadu_ps(&mx.f[12]);
+	for(unsigned int i = 0; i < uiCount; ++i)
+		{
+		__m128 vOut = _mm_mul_ps(c0, _mm_set1_ps(pvIn[i].x));
+		vOut = _mm_add_ps(vOut, _mm_mul_ps(c1, _mm_set1_ps(pvIn[i].y)));
+		vOut = _mm_add_ps(vOut, _mm_mul_ps(c2, _mm_set1_ps(pvIn[i].z)));
+		_mm_storeu_ps(pvOut[i].ptr(), _mm_add_ps(vOut, c3));
+		}
+#elif defined(MATH_NEON)
+	float32x4_t c0 = vld1q_f32(&mx.f[0]), c1 = vld1q_f32(&mx.f[4]), c2 = vld1q_f32(&mx.f[8]), c3 = vld1q_f32(&mx.f[12]);
+	for(unsigned int i = 0; i < uiCount; ++i)
+		{
+		float32x4_t vOut = vmulq_n_f32(c0, pvIn[i].x);
+		vOut = vmlaq_n_f32(vOut, c1, pvIn[i].y);
+		vOut = vmlaq_n_f32(vOut, c2, pvIn[i].z);
+		vst1q_f32(pvOut[i].ptr(), vaddq_f32(vOut, c3));
+		}
+#else
+	for(unsigned int i = 0; i < uiCount; ++i)
+		pvOut[i] = mx * PVRTVec4(pvIn[i], 1.0f);
+#endif
+	}
+
+// ---------------------------------------------------------------
+bool ProjectBounds(const PVRTMat4& mxViewProj, const PVRTVec3* pvPoints, unsigned int uiCount, PVRTVec2& vMin, PVRTVec2& vMax)
+	{
+#if defined(MATH_SSE)
+	__m128 c0 = _mm_loadu_ps(&mxViewProj.f[0]), c1 = _mm_loadu_ps(&mxViewProj.f[4]), c2 = _mm_loadu_ps(&mxViewProj.f[8]), c3 = _mm_loadu_ps(&mxViewProj.f[12]);
+	__m128 vLo = _mm_set1_ps(1e30f), vHi = _mm_set1_ps(-1e30f), vZero = _mm_setzero_ps();
+	for(unsigned int i = 0; i < uiCount; ++i)
+		{
+		__m128 vClip = _mm_mul_ps(c0, _mm_set1_ps(pvPoints[i].x));
+		vClip = _mm_add_ps(vClip, _mm_mul_ps(c1, _mm_set1_ps(pvPoints[i].y)));
+		vClip = _mm_add_ps(vClip, _mm_mul_ps(c2, _mm_set1_ps(pvPoints[i].z)));
+		vClip = _mm_add_ps(vClip, c3);
+
+		__m128 vW = _mm_shuffle_ps(vClip, vClip, _MM_SHUFFLE(3, 3, 3, 3));
+		if(_mm_comile_ss(vW, vZero))
+			return false;
+		__m128 vNDC = _mm_div_ps(vClip, vW);
+		vLo = _mm_min_ps(vLo, vNDC);
+		vHi = _mm_max_ps(vHi, vNDC);
+		}
+
+	float afLo[4], afHi[4];
+	_mm_storeu_ps(afLo, vLo);
+	_mm_storeu_ps(afHi, vHi);
+	vMin = PVRTVec2(afLo[0], afLo[1]);
+	vMax = PVRTVec2(afHi[0], afHi[1]);
+	return true;
+#else
+	vMin = PVRTVec2(1e30f, 1e30f);
+	vMax = PVRTVec2(-1e30f, -1e30f);
+	for(unsigned int i = 0; i < uiCount; ++i)
+		{
+		PVRTVec4 vClip;
+		TransformPoints(mxViewProj, &pvPoints[i], 1, &vClip);
+		if(vClip.w <= 0.0f)
+			return false;
+
+		float fX = vClip.x / vClip.w, fY = vClip.y / vClip.w;
+		vMin.x = PVRT_MIN(vMin.x, fX);	vMax.x = PVRT_MAX(vMax.x, fX);
+		vMin.y = PVRT_MIN(vMin.y, fY);	vMax.y = PVRT_MAX(vMax.y, fY);
+		}
+	return true;
+#endif
+	}
+
+// ---------------------------------------------------------------
+void ComputeBoundingBox(PVRTBOUNDINGBOX* pBox, const unsigned char* pData, int i32NumVertices, int i32Offset, int i32Stride)
+	{
+	float afMin[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, afMax[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	if(i32NumVertices > 0)
+		{
+		const unsigned char* pPos = pData + i32Offset;
+		const float* pfLast = (const float*)(pPos + (i32NumVertices - 1) * i32Stride);
+#if defined(MATH_SSE)
+		// A full register load reads a float past each position, which is still inside the next vertex, so
+		// only the last one is loaded on its own. Two pairs of bounds keep consecutive loads independent.
+		__m128 vLast = _mm_setr_ps(pfLast[0], pfLast[1], pfLast[2], 0.0f);
+		__m128 vLo0 = vLast, vHi0 = vLast, vLo1 = vLast, vHi1 = vLast;
+		int i = 0;
+		for(; i + 2 < i32NumVertices; i += 2)
+			{
+			__m128 vPos0 = _mm_loadu_ps((const float*)(pPos + i * i32Stride));
+			__m128 vPos1 = _mm_loadu_ps((const float*)(pPos + (i + 1) * i32Stride));
+			vLo0 = _mm_min_ps(vLo0, vPos0);	vHi0 = _mm_max_ps(vHi0, vPos0);
+			vLo1 = _mm_min_ps(vLo1, vPos1);	vHi1 = _mm_max_ps(vHi1, vPos1);
+			}
+		for(; i + 1 < i32NumVertices; ++i)
+			{
+			__m128 vPos = _mm_loadu_ps((const float*)(pPos + i * i32Stride));
+			vLo0 = _mm_min_ps(vLo0, vPos);	vHi0 = _mm_max_ps(vHi0, vPos);
+			}
+		_mm_storeu_ps(afMin, _mm_min_ps(vLo0, vLo1));
+		_mm_storeu_ps(afMax, _mm_max_ps(vHi0, vHi1));
+#elif defined(MATH_NEON)
+		float afLast[4] = { pfLast[0], pfLast[1], pfLast[2], 0.0f };
+		float32x4_t vLo = vld1q_f32(afLast), vHi = vLo;
+		for(int i = 0; i + 1 < i32NumVertices; ++i)
+			{
+			float32x4_t vPos = vld1q_f32((const float*)(pPos + i * i32Stride));
+			vLo = vminq_f32(vLo, vPos);
+			vHi = vmaxq_f32(vHi, vPos);
+			}
+		vst1q_f32(afMin, vLo);
+		vst1q_f32(afMax, vHi);
+#else
+		for(int a = 0; a < 3; ++a)
+			afMin[a] = afMax[a] = pfLast[a];
+		for(int i = 0; i + 1 < i32NumVertices; ++i)
+			{
+			const float* pfPos = (const float*)(pPos + i * i32Stride);
+			for(int a = 0; a < 3; ++a)
+				{
+				afMin[a] = PVRT_MIN(afMin[a], pfPos[a]);
+				afMax[a] = PVRT_MAX(afMax[a], pfPos[a]);
+				}
+			}
+#endif
+		}
+
+	// Corner i takes its x from bit 2, y from bit 1 and z from bit 0, max when set
+	for(unsigned int i = 0; i < 8; ++i)
+		{
+		pBox->Point[i].x = (i & 4) ? afMax[0] : afMin[0];
+		pBox->Point[i].y = (i & 2) ? afMax[1] : afMin[1];
+		pBox->Point[i].z = (i & 1) ? afMax[2] : afMin[2];
+		}
+	}
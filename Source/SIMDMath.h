@@ -0,0 +1,34 @@
+#ifndef _SIMDMATH_H_
+#define _SIMDMATH_H_
+
+#include "Common.h"
+
+// SIMD versions of the PVRTools maths on the per-frame and per-instance paths. PVRTMat4 is column-major, so each
+// column is one register and a vector goes through as a sum of columns, in the same order PVRTools adds them.
+// Targets with neither SSE nor NEON (or built with MATH_SCALAR) get plain C++.
+
+#if defined(MATH_SSE)
+const char* const c_pszMathSIMD = "sse";
+#elif defined(MATH_NEON)
+const char* const c_pszMathSIMD = "neon";
+#else
+const char* const c_pszMathSIMD = "none";
+#endif
+
+// mxOut = mxA * mxB. mxOut can be either of them.
+void Mat4Multiply(PVRTMat4& mxOut, const PVRTMat4& mxA, const PVRTMat4& mxB);
+
+// The inverse of a matrix whose bottom row is 0 0 0 1, which is all PVRTMat4::inverse() handles too
+void Mat4InverseAffine(PVRTMat4& mxOut, const PVRTMat4& mxIn);
+
+// pvOut[i] = mx * (pvIn[i], 1)
+void TransformPoints(const PVRTMat4& mx, const PVRTVec3* pvIn, unsigned int uiCount, PVRTVec4* pvOut);
+
+// Bounds the points' x and y once they're through mxViewProj and the perspective divide. Returns false, with the
+// bounds unset, if any of them is on or behind the eye plane.
+bool ProjectBounds(const PVRTMat4& mxViewProj, const PVRTVec3* pvPoints, unsigned int uiCount, PVRTVec2& vMin, PVRTVec2& vMax);
+
+// The box around the float3 at i32Offset in each of the interleaved vertices, laid out as PVRTBoundingBoxComputeInterleaved lays it out
+void ComputeBoundingBox(PVRTBOUNDINGBOX* pBox, const unsigned char* pData, int i32NumVertices, int i32Offset, int i32Stride);
+
+#endif // _SIMDMATH_H_
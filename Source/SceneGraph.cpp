@@ -0,0 +1,359 @@
+#include "SceneGraph.h"
+#include "SIMDMath.h"
+
+// Mesh node names and the roles they're drawn in. A node matches an entry its name starts with, so the scene can be
+// split into several nodes per role.
+struct RoleName
+	{
+	const char*			pszPrefix;
+	int					nRole;
+	};
+
+const RoleName c_RoleNames[] =
+	{
+	{ "Statue",		enumMODEL_Statue },
+	{ "Floor",		enumMODEL_Floor },
+	{ "Church",		enumMODEL_Church },
+	{ "Chuch",		enumMODEL_Church },		// As it's spelt in statuescene.POD
+	};
+
+// ---------------------------------------------------------------
+int GetRoleFromName(const char* pszName)
+	{
+	for(unsigned int i = 0; pszName && i < ELEMENTS_IN_ARRAY(c_RoleNames); ++i)
+		{
+		if(strncmp(pszName, c_RoleNames[i].pszPrefix, strlen(c_RoleNames[i].pszPrefix)) == 0)
+			return c_RoleNames[i].nRole;
+		}
+	return -1;
+	}
+
+// ---------------------------------------------------------------
+unsigned int GetFrustumPlanes(const PVRTMat4& mxViewProj, PVRTVec4* pPlanes)
+	{
+	const float* f = mxViewProj.f;			// Column major
+	unsigned int uiPlanes = 0;
+	for(int i = 0; i < 6; ++i)
+		{
+		int nRow = i >> 1;
+		float fSign = (i & 1) ? -1.0f : 1.0f;
+		PVRTVec4 vPlane(f[3] + fSign * f[nRow], f[7] + fSign * f[4 + nRow], f[11] + fSign * f[8 + nRow], f[15] + fSign * f[12 + nRow]);
+		float fLength = (float)sqrt(vPlane.x * vPlane.x + vPlane.y * vPlane.y + vPlane.z * vPlane.z);
+		if(fLength < 1e-6f)
+			continue;
+		pPlanes[uiPlanes++] = vPlane / fLength;
+		}
+	return uiPlanes;
+	}
+
+// ---------------------------------------------------------------
+bool CSceneGraph::BuildFromPOD(const CPVRTModelPOD& Model, CPVRTString* pErrorStr)
+	{
+	char szError[256];
+
+	// Mesh nodes come first in a POD. The per-mesh arrays are fixed size.
+	if(Model.nNumMeshNode < enumMODEL_MAX || Model.nNumMeshNode > SCENE_MAX_NODES || Model.nNumMesh > SCENE_MAX_MESHES)
+		{
+		sprintf(szError, "needs %d to %d mesh nodes and at most %d meshes", enumMODEL_MAX, SCENE_MAX_NODES, SCENE_MAX_MESHES);
+		*pErrorStr = szError;
+		return false;
+		}
+
+	SceneNode* pNodes = new SceneNode[Model.nNumMeshNode];
+	for(unsigned int i = 0; i < Model.nNumMeshNode; ++i)
+		{
+		const SPODNode& PODNode = Model.pNode[i];
+		int nRole = GetRoleFromName(PODNode.pszName);
+		if(PODNode.nIdx < 0 || PODNode.nIdx >= (int)Model.nNumMesh || nRole < 0)
+			{
+			sprintf(szError, "has mesh node %u (%.64s), which isn't a statue, floor or church", i, PODNode.pszName ? PODNode.pszName : "unnamed");
+			*pErrorStr = szError;
+			delete [] pNodes;
+			return false;
+			}
+
+		SceneNode& Node = pNodes[i];
+		Node.nMesh		= PODNode.nIdx;
+		Node.nRole		= nRole;
+		Node.mxWorld	= Model.GetWorldMatrix(PODNode);		// Takes in the parents
+
+		// Bound the mesh, then the box around its corners once they're placed in the world
+		const SPODMesh& Mesh = Model.pMesh[Node.nMesh];
+		PVRTBOUNDINGBOX bb;
+		ComputeBoundingBox(&bb, Mesh.pInterleaved, Mesh.nNumVertex, (int)(size_t)Mesh.sVertex.pData, Mesh.sVertex.nStride);
+		PVRTVec4 avWorld[8];
+		TransformPoints(Node.mxWorld, (const PVRTVec3*)bb.Point, 8, avWorld);
+		for(unsigned int c = 0; c < 8; ++c)
+			{
+			PVRTVec3 vPos(avWorld[c].x, avWorld[c].y, avWorld[c].z);
+			for(int a = 0; a < 3; ++a)
+				{
+				Node.vMin.ptr()[a] = c ? PVRT_MIN(Node.vMin.ptr()[a], vPos.ptr()[a]) : vPos.ptr()[a];
+				Node.vMax.ptr()[a] = c ? PVRT_MAX(Node.vMax.ptr()[a], vPos.ptr()[a]) : vPos.ptr()[a];
+				}
+			}
+		Node.vCentre = (Node.vMin + Node.vMax) * 0.5f;
+		Node.fRadius = (Node.vMax - Node.vCentre).length();
+		}
+
+	bool bResult = Build(pNodes, Model.nNumMeshNode, Model.nNumMesh);
+	delete [] pNodes;
+	if(!bResult)
+		*pErrorStr = "needs exactly one statue node, and at least one floor and one church node";
+	return bResult;
+	}
+
+// ---------------------------------------------------------------
+bool CSceneGraph::Build(const SceneNode* pNodes, unsigned int uiNumNodes, unsigned int uiNumMeshes)
+	{
+	if(uiNumNodes < enumMODEL_MAX || uiNumNodes > SCENE_MAX_NODES || uiNumMeshes > SCENE_MAX_MESHES)
+		return false;
+
+	unsigned int auiRoleCount[enumMODEL_MAX], auiRoleFirst[enumMODEL_MAX];
+	memset(auiRoleCount, 0, sizeof(auiRoleCount));
+	for(unsigned int i = 0; i < uiNumNodes; ++i)
+		{
+		if(pNodes[i].nMesh < 0 || pNodes[i].nMesh >= (int)uiNumMeshes || pNodes[i].nRole < 0 || pNodes[i].nRole >= enumMODEL_MAX)
+			return false;
+		if(!auiRoleCount[pNodes[i].nRole]++)
+			auiRoleFirst[pNodes[i].nRole] = i;
+		}
+
+	// Every role is drawn, and the shadow, the crowd and the statue's bounds all assume there's only the one statue
+	if(auiRoleCount[enumMODEL_Statue] != 1 || !auiRoleCount[enumMODEL_Floor] || !auiRoleCount[enumMODEL_Church])
+		return false;
+
+	for(unsigned int i = 0; i < uiNumNodes; ++i)
+		{
+		m_aNodes[i] = pNodes[i];
+		m_auiOrder[i] = i;
+		}
+	memcpy(m_auiRoleCount, auiRoleCount, sizeof(m_auiRoleCount));
+	memcpy(m_auiRoleFirst, auiRoleFirst, sizeof(m_auiRoleFirst));
+	m_uiNumNodes	= uiNumNodes;
+	m_uiNumMeshes	= uiNumMeshes;
+
+	m_uiNumBVHNodes = 1;
+	BuildBVH(0, 0, uiNumNodes);
+	memset(m_auiNumVisible, 0, sizeof(m_auiNumVisible));
+	return true;
+	}
+
+// ---------------------------------------------------------------
+// Fills in m_aBVH[uiIndex] over m_auiOrder[uiFirst, uiFirst + uiCount), splitting at the median centre along the
+// longest axis of the centres' bounds until the leaves are small enough.
+void CSceneGraph::BuildBVH(unsigned int uiIndex, unsigned int uiFirst, unsigned int uiCount)
+	{
+	BVHNode& BVH = m_aBVH[uiIndex];
+	PVRTVec3 vCentreMin, vCentreMax;
+	for(unsigned int i = 0; i < uiCount; ++i)
+		{
+		const SceneNode& Node = m_aNodes[m_auiOrder[uiFirst + i]];
+		for(int a = 0; a < 3; ++a)
+			{
+			BVH.vMin.ptr()[a]		= i ? PVRT_MIN(BVH.vMin.ptr()[a], Node.vMin.ptr()[a]) : Node.vMin.ptr()[a];
+			BVH.vMax.ptr()[a]		= i ? PVRT_MAX(BVH.vMax.ptr()[a], Node.vMax.ptr()[a]) : Node.vMax.ptr()[a];
+			vCentreMin.ptr()[a]	= i ? PVRT_MIN(vCentreMin.ptr()[a], Node.vCentre.ptr()[a]) : Node.vCentre.ptr()[a];
+			vCentreMax.ptr()[a]	= i ? PVRT_MAX(vCentreMax.ptr()[a], Node.vCentre.ptr()[a]) : Node.vCentre.ptr()[a];
+			}
+		}
+
+	if(uiCount <= SCENE_BVH_LEAF_SIZE)
+		{
+		BVH.uiFirst = uiFirst;
+		BVH.uiCount = uiCount;
+		return;
+		}
+
+	PVRTVec3 vExtent = vCentreMax - vCentreMin;
+	int nAxis = (vExtent.x >= vExtent.y && vExtent.x >= vExtent.z) ? 0 : (vExtent.y >= vExtent.z ? 1 : 2);
+
+	// It only runs at load time, over a few hundred nodes at most, so a plain insertion sort does
+	unsigned int* puOrder = &m_auiOrder[uiFirst];
+	for(unsigned int i = 1; i < uiCount; ++i)
+		{
+		unsigned int uiNode = puOrder[i];
+		float fKey = m_aNodes[uiNode].vCentre.ptr()[nAxis];
+		unsigned int j = i;
+		for(; j > 0 && m_aNodes[puOrder[j - 1]].vCentre.ptr()[nAxis] > fKey; --j)
+			puOrder[j] = puOrder[j - 1];
+		puOrder[j] = uiNode;
+		}
+
+	// The children sit next to each other
+	unsigned int uiLeft = m_uiNumBVHNodes;
+	m_uiNumBVHNodes += 2;
+	ASSERT(m_uiNumBVHNodes <= SCENE_BVH_MAX_NODES);
+	BVH.uiFirst = uiLeft;
+	BVH.uiCount = 0;
+
+	unsigned int uiHalf = uiCount / 2;
+	BuildBVH(uiLeft, uiFirst, uiHalf);
+	BuildBVH(uiLeft + 1, uiFirst + uiHalf, uiCount - uiHalf);
+	}
+
+// ---------------------------------------------------------------
+// Fills in the view's visible list. Only nodes with a role in uiRoles are considered. Without bCull they're all kept.
+void CSceneGraph::Cull(unsigned int uiView, const PVRTMat4& mxViewProj, unsigned int uiRoles, bool bCull)
+	{
+	m_auiNumVisible[uiView] = 0;
+	if(!bCull)
+		{
+		AddVisible(uiView, 0, m_uiNumNodes, uiRoles);
+		}
+	else
+		{
+		PVRTVec4 avPlanes[6];
+		unsigned int uiPlanes = GetFrustumPlanes(mxViewProj, avPlanes);
+		CullBVH(uiView, 0, avPlanes, uiPlanes, (1u << uiPlanes) - 1, uiRoles);
+		}
+
+	unsigned int uiCandidates = 0;
+	for(int r = 0; r < enumMODEL_MAX; ++r)
+		if(uiRoles & ROLE_BIT(r))
+			uiCandidates += m_auiRoleCount[r];
+
+	m_auiLastCulled[uiView] = uiCandidates - m_auiNumVisible[uiView];
+	m_auiDrawn[uiView]	+= m_auiNumVisible[uiView];
+	m_auiCulled[uiView]	+= m_auiLastCulled[uiView];
+	++m_auiCulls[uiView];
+	}
+
+// ---------------------------------------------------------------
+// Tests the box against the planes still in uiMask. Planes it's wholly inside are dropped for the children, and once
+// none are left the whole subtree is visible without testing any more.
+void CSceneGraph::CullBVH(unsigned int uiView, unsigned int uiBVHNode, const PVRTVec4* pPlanes, unsigned int uiPlanes, unsigned int uiMask, unsigned int uiRoles)
+	{
+	const BVHNode& BVH = m_aBVH[uiBVHNode];
+	if(uiMask)
+		{
+		++m_auiTests[uiView];
+		for(unsigned int p = 0; p < uiPlanes; ++p)
+			{
+			if(!(uiMask & (1u << p)))
+				continue;
+
+			// The corners furthest along and furthest against the plane's normal
+			const PVRTVec4& vPlane = pPlanes[p];
+			float fMost = vPlane.w, fLeast = vPlane.w;
+			for(int a = 0; a < 3; ++a)
+				{
+				float fNormal = vPlane.ptr()[a];
+				fMost	+= fNormal * (fNormal >= 0.0f ? BVH.vMax.ptr()[a] : BVH.vMin.ptr()[a]);
+				fLeast	+= fNormal * (fNormal >= 0.0f ? BVH.vMin.ptr()[a] : BVH.vMax.ptr()[a]);
+				}
+			if(fMost < 0.0f)
+				return;					// Wholly outside
+			if(fLeast >= 0.0f)
+				uiMask &= ~(1u << p);	// Wholly inside
+			}
+		}
+
+	if(!uiMask)
+		{
+		// Everything below is in, so just gather the leaves
+		if(BVH.uiCount)
+			AddVisible(uiView, BVH.uiFirst, BVH.uiCount, uiRoles);
+		else
+			{
+			CullBVH(uiView, BVH.uiFirst, pPlanes, uiPlanes, 0, uiRoles);
+			CullBVH(uiView, BVH.uiFirst + 1, pPlanes, uiPlanes, 0, uiRoles);
+			}
+		return;
+		}
+
+	if(!BVH.uiCount)
+		{
+		CullBVH(uiView, BVH.uiFirst, pPlanes, uiPlanes, uiMask, uiRoles);
+		CullBVH(uiView, BVH.uiFirst + 1, pPlanes, uiPlanes, uiMask, uiRoles);
+		return;
+		}
+
+	// A leaf the frustum cuts through. Try each node's sphere, then its box.
+	for(unsigned int i = 0; i < BVH.uiCount; ++i)
+		{
+		unsigned int uiNode = m_auiOrder[BVH.uiFirst + i];
+		const SceneNode& Node = m_aNodes[uiNode];
+		if(!(uiRoles & ROLE_BIT(Node.nRole)))
+			continue;
+
+		++m_auiTests[uiView];
+		bool bVisible = true;
+		for(unsigned int p = 0; p < uiPlanes && bVisible; ++p)
+			{
+			if(!(uiMask & (1u << p)))
+				continue;
+
+			const PVRTVec4& vPlane = pPlanes[p];
+			float fDist = vPlane.x * Node.vCentre.x + vPlane.y * Node.vCentre.y + vPlane.z * Node.vCentre.z + vPlane.w;
+			if(fDist >= Node.fRadius)
+				continue;
+			if(fDist < -Node.fRadius)
+				{
+				bVisible = false;
+				break;
+				}
+
+			// The sphere straddles the plane, so try the box's corner furthest along it
+			float fMost = vPlane.w;
+			for(int a = 0; a < 3; ++a)
+				fMost += vPlane.ptr()[a] * (vPlane.ptr()[a] >= 0.0f ? Node.vMax.ptr()[a] : Node.vMin.ptr()[a]);
+			bVisible = fMost >= 0.0f;
+			}
+
+		if(bVisible)
+			m_auiVisible[uiView][m_auiNumVisible[uiView]++] = uiNode;
+		}
+	}
+
+// ---------------------------------------------------------------
+void CSceneGraph::AddVisible(unsigned int uiView, unsigned int uiFirst, unsigned int uiCount, unsigned int uiRoles)
+	{
+	for(unsigned int i = 0; i < uiCount; ++i)
+		{
+		unsigned int uiNode = m_auiOrder[uiFirst + i];
+		if(uiRoles & ROLE_BIT(m_aNodes[uiNode].nRole))
+			m_auiVisible[uiView][m_auiNumVisible[uiView]++] = uiNode;
+		}
+	}
+
+// ---------------------------------------------------------------
+// World space bounds of the nodes with a role in uiRoles
+void CSceneGraph::GetBounds(unsigned int uiRoles, PVRTVec3& vMin, PVRTVec3& vMax) const
+	{
+	bool bFirst = true;
+	for(unsigned int i = 0; i < m_uiNumNodes; ++i)
+		{
+		const SceneNode& Node = m_aNodes[i];
+		if(!(uiRoles & ROLE_BIT(Node.nRole)))
+			continue;
+
+		for(int a = 0; a < 3; ++a)
+			{
+			vMin.ptr()[a] = bFirst ? Node.vMin.ptr()[a] : PVRT_MIN(vMin.ptr()[a], Node.vMin.ptr()[a]);
+			vMax.ptr()[a] = bFirst ? Node.vMax.ptr()[a] : PVRT_MAX(vMax.ptr()[a], Node.vMax.ptr()[a]);
+			}
+		bFirst = false;
+		}
+	}
+
+// ---------------------------------------------------------------
+// Whether any node in one of the roles draws the mesh
+bool CSceneGraph::UsesMesh(unsigned int uiRoles, unsigned int uiMesh) const
+	{
+	for(unsigned int i = 0; i < m_uiNumNodes; ++i)
+		{
+		if((uiRoles & ROLE_BIT(m_aNodes[i].nRole)) && m_aNodes[i].nMesh == (int)uiMesh)
+			return true;
+		}
+	return false;
+	}
+
+// ---------------------------------------------------------------
+void CSceneGraph::ResetCounters()
+	{
+	memset(m_auiCulls, 0, sizeof(m_auiCulls));
+	memset(m_auiDrawn, 0, sizeof(m_auiDrawn));
+	memset(m_auiCulled, 0, sizeof(m_auiCulled));
+	memset(m_auiTests, 0, sizeof(m_auiTests));
+	}
@@ -0,0 +1,127 @@
+#ifndef _SCENEGRAPH_H_
+#define _SCENEGRAPH_H_
+
+#include "Common.h"
+
+// The POD's mesh nodes, flattened into world space and bounded, with a BVH over them so each view only visits the parts
+// of the scene it can see. Each node's role comes from its name, and a POD with a node the demo has no role for is turned
+// away rather than drawn as something it isn't. The effects are written for one statue, so there must be exactly one.
+#define SCENE_MAX_MESHES		32					// Per-mesh arrays are this big. A POD with more is turned away.
+#define SCENE_MAX_NODES			256					// Mesh nodes
+#define SCENE_BVH_LEAF_SIZE		4					// Most scene nodes in a BVH leaf
+#define SCENE_BVH_MAX_NODES		(2 * SCENE_MAX_NODES)
+
+// What a mesh node is drawn as. Taken from the start of the node's name, see GetRoleFromName.
+enum enumMODEL
+	{
+	enumMODEL_Statue,
+	enumMODEL_Floor,
+	enumMODEL_Church,
+	enumMODEL_MAX,
+	};
+
+#define ROLE_BIT(nRole)			(1u << (nRole))
+#define ROLE_ALL				(ROLE_BIT(enumMODEL_MAX) - 1)
+
+enum enumVIEW
+	{
+	enumVIEW_Camera,
+	enumVIEW_Reflection,
+	enumVIEW_Light,
+	enumVIEW_MAX,
+	};
+
+const char* const c_pszViewNames[enumVIEW_MAX] =
+	{
+	"camera",
+	"reflection",
+	"light",
+	};
+
+// Returns the role for a mesh node called pszName, or -1 if it doesn't have one
+int GetRoleFromName(const char* pszName);
+
+// A mesh node. Baked into packages as it is.
+struct SceneNode
+	{
+	int					nMesh;
+	int					nRole;				// enumMODEL
+	PVRTMat4			mxWorld;
+	PVRTVec3			vMin;				// World space bounds
+	PVRTVec3			vMax;
+	PVRTVec3			vCentre;			// Bounding sphere, around the box
+	float				fRadius;
+	};
+
+struct BVHNode
+	{
+	PVRTVec3			vMin;
+	PVRTVec3			vMax;
+	unsigned int		uiFirst;			// A leaf's first entry in the node order, otherwise the left child. The right one follows it.
+	unsigned int		uiCount;			// Scene nodes in a leaf, 0 for the others
+	};
+
+// The frustum's planes, as (a, b, c, d) with ax + by + cz + d >= 0 inside. Normalised, so spheres can be tested too.
+// A plane at infinity (the camera's far plane) comes out with no normal, and is left out. Returns how many there are.
+unsigned int GetFrustumPlanes(const PVRTMat4& mxViewProj, PVRTVec4* pPlanes);
+
+class CSceneGraph
+	{
+	private:
+		SceneNode				m_aNodes[SCENE_MAX_NODES];
+		unsigned int			m_uiNumNodes;
+		unsigned int			m_uiNumMeshes;
+		unsigned int			m_auiRoleCount[enumMODEL_MAX];
+		unsigned int			m_auiRoleFirst[enumMODEL_MAX];		// Lowest numbered node in each role
+		BVHNode					m_aBVH[SCENE_BVH_MAX_NODES];
+		unsigned int			m_uiNumBVHNodes;
+		unsigned int			m_auiOrder[SCENE_MAX_NODES];		// Scene nodes, grouped by leaf
+
+		// Per view, from its last Cull
+		unsigned int			m_auiVisible[enumVIEW_MAX][SCENE_MAX_NODES];
+		unsigned int			m_auiNumVisible[enumVIEW_MAX];
+		unsigned int			m_auiLastCulled[enumVIEW_MAX];
+
+		// Per view, since ResetCounters
+		unsigned int			m_auiCulls[enumVIEW_MAX];
+		unsigned int			m_auiDrawn[enumVIEW_MAX];
+		unsigned int			m_auiCulled[enumVIEW_MAX];
+		unsigned int			m_auiTests[enumVIEW_MAX];			// Bounds tested against the frustum
+
+		void BuildBVH(unsigned int uiIndex, unsigned int uiFirst, unsigned int uiCount);
+		void CullBVH(unsigned int uiView, unsigned int uiBVHNode, const PVRTVec4* pPlanes, unsigned int uiPlanes, unsigned int uiMask, unsigned int uiRoles);
+		void AddVisible(unsigned int uiView, unsigned int uiFirst, unsigned int uiCount, unsigned int uiRoles);
+
+	public:
+		CSceneGraph() : m_uiNumNodes(0), m_uiNumMeshes(0), m_uiNumBVHNodes(0)
+			{
+			memset(m_auiRoleCount, 0, sizeof(m_auiRoleCount));
+			memset(m_auiRoleFirst, 0, sizeof(m_auiRoleFirst));
+			memset(m_auiNumVisible, 0, sizeof(m_auiNumVisible));
+			memset(m_auiLastCulled, 0, sizeof(m_auiLastCulled));
+			ResetCounters();
+			}
+
+		bool BuildFromPOD(const CPVRTModelPOD& Model, CPVRTString* pErrorStr);
+		bool Build(const SceneNode* pNodes, unsigned int uiNumNodes, unsigned int uiNumMeshes);
+		void Cull(unsigned int uiView, const PVRTMat4& mxViewProj, unsigned int uiRoles, bool bCull);
+		void GetBounds(unsigned int uiRoles, PVRTVec3& vMin, PVRTVec3& vMax) const;
+		bool UsesMesh(unsigned int uiRoles, unsigned int uiMesh) const;
+		void ResetCounters();
+
+		unsigned int GetNumNodes() const						{ return m_uiNumNodes; }
+		unsigned int GetNumMeshes() const						{ return m_uiNumMeshes; }
+		const SceneNode& GetNode(unsigned int uiNode) const		{ return m_aNodes[uiNode]; }
+		unsigned int GetRoleNodeIndex(int nRole) const			{ return m_auiRoleFirst[nRole]; }
+		const SceneNode& GetRoleNode(int nRole) const			{ return m_aNodes[m_auiRoleFirst[nRole]]; }
+		const SceneNode* GetNodes() const						{ return m_aNodes; }
+		unsigned int GetNumVisible(unsigned int uiView) const	{ return m_auiNumVisible[uiView]; }
+		unsigned int GetVisible(unsigned int uiView, unsigned int i) const	{ return m_auiVisible[uiView][i]; }
+		unsigned int GetLastCulled(unsigned int uiView) const	{ return m_auiLastCulled[uiView]; }
+		unsigned int GetCulls(unsigned int uiView) const		{ return m_auiCulls[uiView]; }
+		unsigned int GetDrawn(unsigned int uiView) const		{ return m_auiDrawn[uiView]; }
+		unsigned int GetCulled(unsigned int uiView) const		{ return m_auiCulled[uiView]; }
+		unsigned int GetTests(unsigned int uiView) const		{ return m_auiTests[uiView]; }
+	};
+
+#endif // _SCENEGRAPH_H_
@@ -0,0 +1,1017 @@
+#include "SoftRaster.h"
+
+// ---------------------------------------------------------------
+void InitSoftTexture(SoftTexture* pTexture)
+	{
+	memset(pTexture, 0, sizeof(*pTexture));
+	}
+
+// ---------------------------------------------------------------
+void ReleaseSoftTexture(SoftTexture* pTexture)
+	{
+	for(unsigned int i = 0; i < pTexture->uiNumLevels; ++i)
+		delete [] pTexture->apuLevels[i];
+	delete [] pTexture->pfDepth;
+	InitSoftTexture(pTexture);
+	}
+
+// ---------------------------------------------------------------
+void CreateSoftTarget(SoftTexture* pTexture, int nWidth, int nHeight, bool bDepth)
+	{
+	ReleaseSoftTexture(pTexture);
+	pTexture->nWidth	= nWidth;
+	pTexture->nHeight	= nHeight;
+	pTexture->bClamp	= true;
+	if(bDepth)
+		{
+		pTexture->pfDepth = new float[nWidth * nHeight];
+		memset(pTexture->pfDepth, 0, nWidth * nHeight * sizeof(float));
+		}
+	else
+		{
+		pTexture->uiNumLevels = 1;
+		pTexture->apuLevels[0] = new unsigned int[nWidth * nHeight];
+		memset(pTexture->apuLevels[0], 0, nWidth * nHeight * sizeof(unsigned int));
+		}
+	}
+
+// ---------------------------------------------------------------
+bool LoadSoftTexture(const void* pPVR, bool bClamp, SoftTexture* pTexture)
+	{
+	ReleaseSoftTexture(pTexture);
+	const PVR_Texture_Header* pHeader = (const PVR_Texture_Header*)pPVR;
+	unsigned int uiType = pHeader->dwpfFlags & PVRTEX_PIXELTYPE;
+	if(uiType != OGL_PVRTC4 && uiType != OGL_PVRTC2 && uiType != OGL_RGBA_8888)
+		return false;
+
+	bool b2Bit = uiType == OGL_PVRTC2;
+	unsigned int uiLevels = (pHeader->dwpfFlags & PVRTEX_MIPMAP) ? pHeader->dwMipMapCount + 1 : 1;
+	pTexture->nWidth		= (int)pHeader->dwWidth;
+	pTexture->nHeight		= (int)pHeader->dwHeight;
+	pTexture->uiNumLevels	= PVRT_MIN(uiLevels, (unsigned int)SOFT_MAX_LEVELS);
+	pTexture->bClamp		= bClamp;
+
+	const unsigned char* pData = (const unsigned char*)pPVR + pHeader->dwHeaderSize;
+	for(unsigned int i = 0; i < pTexture->uiNumLevels; ++i)
+		{
+		int nWidth = PVRT_MAX(pTexture->nWidth >> i, 1), nHeight = PVRT_MAX(pTexture->nHeight >> i, 1);
+		pTexture->apuLevels[i] = new unsigned int[nWidth * nHeight];
+		if(uiType == OGL_RGBA_8888)
+			{
+			memcpy(pTexture->apuLevels[i], pData, nWidth * nHeight * 4);
+			pData += nWidth * nHeight * 4;
+			}
+		else
+			{
+			// PVRTC levels are stored at least 2 x 2 blocks big, blocks being 8 x 4 texels at 2 bits and 4 x 4 at 4
+			PVRTDecompressPVRTC(pData, b2Bit ? 1 : 0, nWidth, nHeight, (unsigned char*)pTexture->apuLevels[i]);
+			pData += b2Bit ? PVRT_MAX(nWidth, 16) * PVRT_MAX(nHeight, 8) / 4 : PVRT_MAX(nWidth, 8) * PVRT_MAX(nHeight, 8) / 2;
+			}
+		}
+	return true;
+	}
+
+// ---------------------------------------------------------------
+// The two texels either side of fCoord (in texels, centres on the halves) along an axis nSize long, and the weight of the second
+inline float GetSoftTexels(float fCoord, int nSize, bool bClamp, int* pnTexels)
+	{
+	float fFloor = (float)floor(fCoord - 0.5f);
+	int nTexel = (int)fFloor;
+	pnTexels[0] = nTexel;
+	pnTexels[1] = nTexel + 1;
+	for(unsigned int i = 0; i < 2; ++i)
+		{
+		if(bClamp)
+			pnTexels[i] = PVRT_CLAMP(pnTexels[i], 0, nSize - 1);
+		else
+			pnTexels[i] = ((pnTexels[i] % nSize) + nSize) % nSize;
+		}
+	return fCoord - 0.5f - fFloor;
+	}
+
+// ---------------------------------------------------------------
+// GL_LINEAR filtering within one level. pfOut gets RGBA, 0 to 1.
+void SampleSoftLevel(const SoftTexture& Texture, unsigned int uiLevel, float fU, float fV, float* pfOut)
+	{
+	int nWidth = PVRT_MAX(Texture.nWidth >> uiLevel, 1), nHeight = PVRT_MAX(Texture.nHeight >> uiLevel, 1);
+	int anX[2], anY[2];
+	float fX = GetSoftTexels(fU * nWidth, nWidth, Texture.bClamp, anX);
+	float fY = GetSoftTexels(fV * nHeight, nHeight, Texture.bClamp, anY);
+
+	const unsigned int* puTexels = Texture.apuLevels[uiLevel];
+	unsigned int auiTexels[4] = { puTexels[anY[0] * nWidth + anX[0]], puTexels[anY[0] * nWidth + anX[1]],
+								  puTexels[anY[1] * nWidth + anX[0]], puTexels[anY[1] * nWidth + anX[1]] };
+	float afWeights[4] = { (1.0f - fX) * (1.0f - fY), fX * (1.0f - fY), (1.0f - fX) * fY, fX * fY };
+	for(unsigned int c = 0; c < 4; ++c)
+		{
+		float fSum = 0.0f;
+		for(unsigned int i = 0; i < 4; ++i)
+			fSum += ((auiTexels[i] >> (c * 8)) & 0xFF) * afWeights[i];
+		pfOut[c] = fSum * (1.0f / 255.0f);
+		}
+	}
+
+// ---------------------------------------------------------------
+void SampleSoftTexture(const SoftTexture& Texture, float fU, float fV, const float* pfDX, const float* pfDY, float* pfOut)
+	{
+	float fLOD = 0.0f;
+	if(pfDX && Texture.uiNumLevels > 1)
+		{
+		float fUX = pfDX[0] * Texture.nWidth, fVX = pfDX[1] * Texture.nHeight;
+		float fUY = pfDY[0] * Texture.nWidth, fVY = pfDY[1] * Texture.nHeight;
+		float fRho2 = PVRT_MAX(fUX * fUX + fVX * fVX, fUY * fUY + fVY * fVY);
+		if(fRho2 > 1.0f)
+			fLOD = PVRT_MIN((float)log(fRho2) * 0.72134752f, (float)(Texture.uiNumLevels - 1));		// log2 of the square root
+		}
+
+	unsigned int uiLevel = (unsigned int)fLOD;
+	float fBlend = fLOD - uiLevel;
+	SampleSoftLevel(Texture, uiLevel, fU, fV, pfOut);
+	if(fBlend > 0.0f && uiLevel + 1 < Texture.uiNumLevels)
+		{
+		float afNext[4];
+		SampleSoftLevel(Texture, uiLevel + 1, fU, fV, afNext);
+		for(unsigned int c = 0; c < 4; ++c)
+			pfOut[c] += (afNext[c] - pfOut[c]) * fBlend;
+		}
+	}
+
+// ---------------------------------------------------------------
+float SampleSoftDepth(const SoftTexture& Texture, float fU, float fV)
+	{
+	int anX[2], anY[2];
+	float fX = GetSoftTexels(fU * Texture.nWidth, Texture.nWidth, true, anX);
+	float fY = GetSoftTexels(fV * Texture.nHeight, Texture.nHeight, true, anY);
+	const float* pfRow0 = Texture.pfDepth + anY[0] * Texture.nWidth, *pfRow1 = Texture.pfDepth + anY[1] * Texture.nWidth;
+	float fTop = pfRow1[anX[0]] + (pfRow1[anX[1]] - pfRow1[anX[0]]) * fX;
+	float fBottom = pfRow0[anX[0]] + (pfRow0[anX[1]] - pfRow0[anX[0]]) * fX;
+	return fBottom + (fTop - fBottom) * fY;
+	}
+
+// ---------------------------------------------------------------
+inline unsigned int PackSoftColour(const float* pfColour)
+	{
+	unsigned int uiPacked = 0;
+	for(unsigned int c = 0; c < 4; ++c)
+		uiPacked |= (unsigned int)(PVRT_CLAMP(pfColour[c], 0.0f, 1.0f) * 255.0f + 0.5f) << (c * 8);
+	return uiPacked;
+	}
+
+// ---------------------------------------------------------------
+unsigned int HashSoftTexture(const SoftTexture& Texture)
+	{
+	const unsigned char* pData = Texture.uiNumLevels ? (const unsigned char*)Texture.apuLevels[0] : (const unsigned char*)Texture.pfDepth;
+	unsigned int uiHash = 2166136261u;
+	for(unsigned int i = 0, uiSize = Texture.nWidth * Texture.nHeight * 4; i < uiSize; ++i)
+		uiHash = (uiHash ^ pData[i]) * 16777619u;
+	return uiHash;
+	}
+
+// ---------------------------------------------------------------
+bool WriteSoftTGA(const char* pszPath, const SoftTexture& Texture)
+	{
+	FILE* pFile = fopen(pszPath, "wb");
+	if(!pFile)
+		return false;
+
+	unsigned char aucHeader[18];
+	memset(aucHeader, 0, sizeof(aucHeader));
+	aucHeader[2]	= 2;						// Uncompressed true colour
+	aucHeader[12]	= (unsigned char)(Texture.nWidth & 0xFF);
+	aucHeader[13]	= (unsigned char)(Texture.nWidth >> 8);
+	aucHeader[14]	= (unsigned char)(Texture.nHeight & 0xFF);
+	aucHeader[15]	= (unsigned char)(Texture.nHeight >> 8);
+	aucHeader[16]	= 32;
+	aucHeader[17]	= 8;						// Alpha bits, and a bottom left origin
+	bool bWritten = fwrite(aucHeader, sizeof(aucHeader), 1, pFile) == 1;
+
+	unsigned char* pucRow = new unsigned char[Texture.nWidth * 4];
+	for(int y = 0; y < Texture.nHeight && bWritten; ++y)
+		{
+		const unsigned int* puTexels = Texture.apuLevels[0] + y * Texture.nWidth;
+		for(int x = 0; x < Texture.nWidth; ++x)
+			{
+			pucRow[x * 4 + 0] = (unsigned char)(puTexels[x] >> 16);		// BGRA
+			pucRow[x * 4 + 1] = (unsigned char)(puTexels[x] >> 8);
+			pucRow[x * 4 + 2] = (unsigned char)puTexels[x];
+			pucRow[x * 4 + 3] = (unsigned char)(puTexels[x] >> 24);
+			}
+		bWritten = fwrite(pucRow, Texture.nWidth * 4, 1, pFile) == 1;
+		}
+	delete [] pucRow;
+	fclose(pFile);
+	return bWritten;
+	}
+
+// ---------------------------------------------------------------
+// Grows an array of PODs to hold at least uiCount, keeping the first uiUsed
+template<typename T> void SoftGrow(T*& pArray, unsigned int uiUsed, unsigned int& uiMax, unsigned int uiCount)
+	{
+	if(uiCount <= uiMax)
+		return;
+
+	unsigned int uiNewMax = PVRT_MAX(uiCount, uiMax * 2);
+	T* pNew = new T[uiNewMax];
+	if(uiUsed)
+		memcpy(pNew, pArray, uiUsed * sizeof(T));
+	delete [] pArray;
+	pArray = pNew;
+	uiMax = uiNewMax;
+	}
+
+// ---------------------------------------------------------------
+// Which of the four pixels from fX (a pixel centre) along the row at fY are inside all three edges, a bit each. Pixel
+// centres exactly on an edge are only inside for top-left edges, so triangles that share an edge never both draw a pixel.
+inline unsigned int SoftEdgeMask(const float (*pafEdge)[3], unsigned int uiTopLeft, float fX, float fY)
+	{
+#if defined(MATH_SSE)
+	__m128 vX = _mm_add_ps(_mm_set1_ps(fX), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+	__m128 vZero = _mm_setzero_ps();
+	__m128 vInside = _mm_cmpeq_ps(vZero, vZero);
+	for(unsigned int e = 0; e < 3; ++e)
+		{
+		__m128 vEdge = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(pafEdge[e][0]), vX), _mm_set1_ps(pafEdge[e][1] * fY + pafEdge[e][2]));
+		vInside = _mm_and_ps(vInside, (uiTopLeft & (1 << e)) ? _mm_cmpge_ps(vEdge, vZero) : _mm_cmpgt_ps(vEdge, vZero));
+		}
+	return (unsigned int)_mm_movemask_ps(vInside);
+#elif defined(MATH_NEON)
+	static const float c_afLanes[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+	static const unsigned int c_auiBits[4] = { 1, 2, 4, 8 };
+	float32x4_t vX = vaddq_f32(vdupq_n_f32(fX), vld1q_f32(c_afLanes));
+	float32x4_t vZero = vdupq_n_f32(0.0f);
+	uint32x4_t vInside = vdupq_n_u32(0xFFFFFFFF);
+	for(unsigned int e = 0; e < 3; ++e)
+		{
+		float32x4_t vEdge = vaddq_f32(vmulq_n_f32(vX, pafEdge[e][0]), vdupq_n_f32(pafEdge[e][1] * fY + pafEdge[e][2]));
+		vInside = vandq_u32(vInside, (uiTopLeft & (1 << e)) ? vcgeq_f32(vEdge, vZero) : vcgtq_f32(vEdge, vZero));
+		}
+	uint32x4_t vBits = vandq_u32(vInside, vld1q_u32(c_auiBits));
+	uint32x2_t vSum = vadd_u32(vget_low_u32(vBits), vget_high_u32(vBits));
+	return vget_lane_u32(vpadd_u32(vSum, vSum), 0);
+#else
+	unsigned int uiMask = 0;
+	for(unsigned int i = 0; i < 4; ++i)
+		{
+		bool bInside = true;
+		for(unsigned int e = 0; e < 3; ++e)
+			{
+			float fEdge = pafEdge[e][0] * (fX + (float)i) + (pafEdge[e][1] * fY + pafEdge[e][2]);
+			bInside = bInside && ((uiTopLeft & (1 << e)) ? fEdge >= 0.0f : fEdge > 0.0f);
+			}
+		uiMask |= (bInside ? 1 : 0) << i;
+		}
+	return uiMask;
+#endif
+	}
+
+// ---------------------------------------------------------------
+inline unsigned int BlendSoftColour(const float* pfSrc, unsigned int uiDst, unsigned int eBlend)
+	{
+	if(eBlend == enumSOFTBLEND_None)
+		return PackSoftColour(pfSrc);
+
+	float afOut[4];
+	for(unsigned int c = 0; c < 4; ++c)
+		{
+		float fDst = ((uiDst >> (c * 8)) & 0xFF) * (1.0f / 255.0f);
+		afOut[c] = (eBlend == enumSOFTBLEND_Add) ? pfSrc[c] + fDst : pfSrc[c] * pfSrc[3] + fDst * (1.0f - pfSrc[3]);
+		}
+	return PackSoftColour(afOut);
+	}
+
+// ---------------------------------------------------------------
+CSoftRasterizer::CSoftRasterizer()
+	: m_pJobs(NULL), m_pszPass(NULL), m_pColour(NULL), m_pDepth(NULL), m_nWidth(0), m_nHeight(0), m_nTilesX(0), m_nTilesY(0),
+	  m_bClearColour(false), m_bClearDepth(false), m_uiClearColour(0), m_fClearDepth(0.0f),
+	  m_pDraws(NULL), m_uiNumDraws(0), m_uiMaxDraws(0), m_pucConstants(NULL), m_uiConstantBytes(0), m_uiMaxConstantBytes(0),
+	  m_pVertices(NULL), m_uiNumVertices(0), m_uiMaxVertices(0), m_pTriangles(NULL), m_uiNumTriangles(0), m_uiMaxTriangles(0),
+	  m_puBinned(NULL), m_uiMaxBinned(0), m_puBinStart(NULL), m_puBinEnd(NULL), m_puTileJobs(NULL), m_uiNumTileJobs(0), m_uiMaxTiles(0),
+	  m_uiNumStats(0)
+	{
+	}
+
+// ---------------------------------------------------------------
+void CSoftRasterizer::Release()
+	{
+	delete [] m_pDraws;
+	delete [] m_pucConstants;
+	delete [] m_pVertices;
+	delete [] m_pTriangles;
+	delete [] m_puBinned;
+	delete [] m_puBinStart;
+	delete [] m_puBinEnd;
+	delete [] m_puTileJobs;
+	m_pDraws = NULL;			m_uiMaxDraws = 0;
+	m_pucConstants = NULL;		m_uiMaxConstantBytes = 0;
+	m_pVertices = NULL;			m_uiMaxVertices = 0;
+	m_pTriangles = NULL;		m_uiMaxTriangles = 0;
+	m_puBinned = NULL;			m_uiMaxBinned = 0;
+	m_puBinStart = m_puBinEnd = m_puTileJobs = NULL;
+	m_uiMaxTiles = 0;
+	}
+
+// ---------------------------------------------------------------
+// Either target may be NULL, but not both. They must be the same size if there are two.
+void CSoftRasterizer::BeginPass(const char* pszName, SoftTexture* pColour, SoftTexture* pDepth)
+	{
+	ASSERT(!m_pszPass && (pColour || pDepth));
+	m_pszPass		= pszName;
+	m_pColour		= pColour;
+	m_pDepth		= pDepth;
+	m_nWidth		= pColour ? pColour->nWidth : pDepth->nWidth;
+	m_nHeight		= pColour ? pColour->nHeight : pDepth->nHeight;
+	m_nTilesX		= (m_nWidth + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+	m_nTilesY		= (m_nHeight + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+	m_bClearColour	= false;
+	m_bClearDepth	= false;
+	m_uiNumDraws = m_uiConstantBytes = m_uiNumVertices = m_uiNumTriangles = 0;
+	}
+
+// ---------------------------------------------------------------
+// Clears Rect before anything is drawn, tile by tile with the rest of the pass. NULL leaves that target alone.
+void CSoftRasterizer::Clear(const PixelRect& Rect, const float* pfColour, const float* pfDepth)
+	{
+	ASSERT(m_pszPass && !m_uiNumDraws);
+	m_ClearRect		= Rect;
+	m_bClearColour	= pfColour && m_pColour;
+	m_bClearDepth	= pfDepth && m_pDepth;
+	m_uiClearColour	= pfColour ? PackSoftColour(pfColour) : 0;
+	m_fClearDepth	= pfDepth ? *pfDepth : 0.0f;
+	}
+
+// ---------------------------------------------------------------
+// Indexed triangles. The constants are copied; the vertices, indices and textures have to last until EndPass.
+void CSoftRasterizer::Draw(const SoftProgram* pProgram, const void* pConstants, unsigned int uiConstantBytes, const SoftTexture* const* ppTextures, const SoftState& State,
+						   const void* pVertices, unsigned int uiStride, unsigned int uiNumVertices, const unsigned short* puIndices, unsigned int uiNumIndices)
+	{
+	ASSERT(m_pszPass && pProgram->uiNumVaryings <= SOFT_MAX_VARYINGS);
+	unsigned int uiConstants = (m_uiConstantBytes + 15) & ~15;
+	SoftGrow(m_pucConstants, m_uiConstantBytes, m_uiMaxConstantBytes, uiConstants + uiConstantBytes);
+	memcpy(m_pucConstants + uiConstants, pConstants, uiConstantBytes);
+	m_uiConstantBytes = uiConstants + uiConstantBytes;
+
+	SoftGrow(m_pDraws, m_uiNumDraws, m_uiMaxDraws, m_uiNumDraws + 1);
+	DrawCall& Call = m_pDraws[m_uiNumDraws++];
+	Call.pProgram		= pProgram;
+	Call.uiConstants	= uiConstants;
+	for(unsigned int i = 0; i < SOFT_MAX_TEXTURES; ++i)
+		Call.apTextures[i] = ppTextures ? ppTextures[i] : NULL;
+	Call.State			= State;
+	Call.pucVertices	= (const unsigned char*)pVertices;
+	Call.uiStride		= uiStride;
+	Call.puIndices		= puIndices;
+	Call.uiFirstVertex	= m_uiNumVertices;
+	Call.uiNumVertices	= uiNumVertices;
+	Call.uiFirstTriangle	= m_uiNumTriangles;
+	Call.uiNumTriangles	= uiNumIndices / 3;
+	m_uiNumVertices		+= uiNumVertices;
+	m_uiNumTriangles	+= uiNumIndices / 3;
+	}
+
+// ---------------------------------------------------------------
+// The last draw whose vertices (or triangles) start at or before uiIndex
+unsigned int CSoftRasterizer::FindDraw(unsigned int uiIndex, bool bTriangle) const
+	{
+	unsigned int uiLow = 0, uiHigh = m_uiNumDraws - 1;
+	while(uiLow < uiHigh)
+		{
+		unsigned int uiMid = (uiLow + uiHigh + 1) / 2;
+		unsigned int uiFirst = bTriangle ? m_pDraws[uiMid].uiFirstTriangle : m_pDraws[uiMid].uiFirstVertex;
+		if(uiFirst <= uiIndex)
+			uiLow = uiMid;
+		else
+			uiHigh = uiMid - 1;
+		}
+	return uiLow;
+	}
+
+// ---------------------------------------------------------------
+void CSoftRasterizer::VertexJob(void* pUserData, unsigned int uiBegin, unsigned int uiEnd, unsigned int /*uiThread*/)
+	{
+	CSoftRasterizer* pRaster = (CSoftRasterizer*)pUserData;
+	unsigned int uiDraw = pRaster->FindDraw(uiBegin, false);
+	for(unsigned int i = uiBegin; i < uiEnd; ++i)
+		{
+		while(i >= pRaster->m_pDraws[uiDraw].uiFirstVertex + pRaster->m_pDraws[uiDraw].uiNumVertices)
+			++uiDraw;
+
+		const DrawCall& Call = pRaster->m_pDraws[uiDraw];
+		Vertex& Out = pRaster->m_pVertices[i];
+		Call.pProgram->pfnVertex(pRaster->m_pucConstants + Call.uiConstants, Call.pucVertices + (i - Call.uiFirstVertex) * Call.uiStride,
+								 Out.afPosition, Out.afVaryings);
+		}
+	}
+
+// ---------------------------------------------------------------
+void CSoftRasterizer::SetupJob(void* pUserData, unsigned int uiBegin, unsigned int uiEnd, unsigned int /*uiThread*/)
+	{
+	CSoftRasterizer* pRaster = (CSoftRasterizer*)pUserData;
+	unsigned int uiDraw = pRaster->FindDraw(uiBegin, true);
+	for(unsigned int i = uiBegin; i < uiEnd; ++i)
+		{
+		while(i >= pRaster->m_pDraws[uiDraw].uiFirstTriangle + pRaster->m_pDraws[uiDraw].uiNumTriangles)
+			++uiDraw;
+		pRaster->SetupTriangle(i, uiDraw);
+		}
+	}
+
+// ---------------------------------------------------------------
+void CSoftRasterizer::SetupTriangle(unsigned int uiTriangle, unsigned int uiDraw)
+	{
+	Triangle& Tri = m_pTriangles[uiTriangle];
+	Tri.uiDraw = uiDraw;
+	Tri.nX0 = Tri.nY0 = Tri.nX1 = Tri.nY1 = 0;
+
+	const DrawCall& Call = m_pDraws[uiDraw];
+	const unsigned short* puIndex = Call.puIndices + (uiTriangle - Call.uiFirstTriangle) * 3;
+	const Vertex* apVerts[3] = { &m_pVertices[Call.uiFirstVertex + puIndex[0]], &m_pVertices[Call.uiFirstVertex + puIndex[1]],
+								 &m_pVertices[Call.uiFirstVertex + puIndex[2]] };
+
+	// --- Throw away triangles wholly outside one of the clip planes. What's left is only partly outside, and the
+	// rasterizer's edge and depth tests take care of the rest.
+	for(unsigned int p = 0; p < 6; ++p)
+		{
+		unsigned int uiOutside = 0;
+		for(unsigned int v = 0; v < 3; ++v)
+			{
+			const float* pfPos = apVerts[v]->afPosition;
+			uiOutside += ((p & 1) ? pfPos[3] - pfPos[p >> 1] : pfPos[3] + pfPos[p >> 1]) < 0.0f ? 1 : 0;
+			}
+		if(uiOutside == 3)
+			return;
+		}
+
+	// --- Columns of the triangle's 2D homogeneous matrix: each vertex through the viewport transform, without the divide
+	const PixelRect& Viewport = Call.State.Viewport;
+	float aafCol[3][3];
+	bool bInFront = true;
+	for(unsigned int v = 0; v < 3; ++v)
+		{
+		const float* pfPos = apVerts[v]->afPosition;
+		aafCol[v][0] = (pfPos[0] + pfPos[3]) * 0.5f * Viewport.nWidth + Viewport.nX * pfPos[3];
+		aafCol[v][1] = (pfPos[1] + pfPos[3]) * 0.5f * Viewport.nHeight + Viewport.nY * pfPos[3];
+		aafCol[v][2] = pfPos[3];
+		bInFront = bInFront && pfPos[3] > 0.0f;
+		}
+
+	// Its inverse's rows are the edge functions, which are the columns' cross products over the determinant
+	float aafAdj[3][3];
+	for(unsigned int e = 0; e < 3; ++e)
+		{
+		const float* pfA = aafCol[(e + 1) % 3], *pfB = aafCol[(e + 2) % 3];
+		aafAdj[e][0] = pfA[1] * pfB[2] - pfA[2] * pfB[1];
+		aafAdj[e][1] = pfA[2] * pfB[0] - pfA[0] * pfB[2];
+		aafAdj[e][2] = pfA[0] * pfB[1] - pfA[1] * pfB[0];
+		}
+	float fDet = aafCol[0][0] * aafAdj[0][0] + aafCol[0][1] * aafAdj[0][1] + aafCol[0][2] * aafAdj[0][2];
+	if(fDet == 0.0f)
+		return;
+
+	// Anticlockwise is front facing, as glFrontFace defaults to. The determinant's sign is the winding, w's signs included.
+	bool bFront = fDet > 0.0f;
+	if((Call.State.eCullFace == GL_BACK && !bFront) || (Call.State.eCullFace == GL_FRONT && bFront))
+		return;
+
+	float fInvDet = 1.0f / fDet;
+	Tri.uiTopLeft = 0;
+	for(unsigned int e = 0; e < 3; ++e)
+		{
+		for(unsigned int c = 0; c < 3; ++c)
+			Tri.aafEdge[e][c] = aafAdj[e][c] * fInvDet;
+		if(Tri.aafEdge[e][0] > 0.0f || (Tri.aafEdge[e][0] == 0.0f && Tri.aafEdge[e][1] > 0.0f))
+			Tri.uiTopLeft |= 1 << e;
+		}
+
+	unsigned int uiNumVaryings = Call.pProgram->uiNumVaryings;
+	for(unsigned int c = 0; c < 3; ++c)
+		{
+		Tri.afInvW[c] = Tri.aafEdge[0][c] + Tri.aafEdge[1][c] + Tri.aafEdge[2][c];
+		Tri.afDepth[c] = 0.0f;
+		for(unsigned int v = 0; v < uiNumVaryings; ++v)
+			Tri.aafVaryings[v][c] = 0.0f;
+		for(unsigned int e = 0; e < 3; ++e)
+			{
+			Tri.afDepth[c] += Tri.aafEdge[e][c] * apVerts[e]->afPosition[2];
+			for(unsigned int v = 0; v < uiNumVaryings; ++v)
+				Tri.aafVaryings[v][c] += Tri.aafEdge[e][c] * apVerts[e]->afVaryings[v];
+			}
+		}
+
+	// --- Pixels it might cover: the viewport and scissor, narrowed to the projected vertices when they're all in front of
+	// the camera. A triangle that crosses w = 0 can reach anywhere on screen.
+	const PixelRect& Scissor = Call.State.Scissor;
+	int nX0 = PVRT_MAX(PVRT_MAX(Viewport.nX, Scissor.nX), 0);
+	int nY0 = PVRT_MAX(PVRT_MAX(Viewport.nY, Scissor.nY), 0);
+	int nX1 = PVRT_MIN(PVRT_MIN(Viewport.nX + Viewport.nWidth, Scissor.nX + Scissor.nWidth), m_nWidth);
+	int nY1 = PVRT_MIN(PVRT_MIN(Viewport.nY + Viewport.nHeight, Scissor.nY + Scissor.nHeight), m_nHeight);
+	if(bInFront)
+		{
+		float fMinX = (float)nX1, fMinY = (float)nY1, fMaxX = (float)nX0, fMaxY = (float)nY0;
+		for(unsigned int v = 0; v < 3; ++v)
+			{
+			float fX = aafCol[v][0] / aafCol[v][2], fY = aafCol[v][1] / aafCol[v][2];
+			fMinX = PVRT_MIN(fMinX, fX);	fMaxX = PVRT_MAX(fMaxX, fX);
+			fMinY = PVRT_MIN(fMinY, fY);	fMaxY = PVRT_MAX(fMaxY, fY);
+			}
+		nX0 = PVRT_MAX(nX0, (int)floor(PVRT_MAX(fMinX, (float)nX0)));
+		nY0 = PVRT_MAX(nY0, (int)floor(PVRT_MAX(fMinY, (float)nY0)));
+		nX1 = PVRT_MIN(nX1, (int)ceil(PVRT_MIN(fMaxX, (float)nX1)));
+		nY1 = PVRT_MIN(nY1, (int)ceil(PVRT_MIN(fMaxY, (float)nY1)));
+		}
+	if(nX0 < nX1 && nY0 < nY1)
+		{
+		Tri.nX0 = nX0;	Tri.nY0 = nY0;
+		Tri.nX1 = nX1;	Tri.nY1 = nY1;
+		}
+	}
+
+// ---------------------------------------------------------------
+// Lists each tile's triangles in draw order, and the tiles there's anything to do in. Serial, and cheap next to the rest:
+// a pass over the triangles counts each tile's, and a second fills them in. Returns the number of triangle and tile pairs.
+unsigned int CSoftRasterizer::Bin()
+	{
+	unsigned int uiNumTiles = m_nTilesX * m_nTilesY;
+	if(uiNumTiles > m_uiMaxTiles)
+		{
+		delete [] m_puBinStart;
+		delete [] m_puBinEnd;
+		delete [] m_puTileJobs;
+		m_puBinStart	= new unsigned int[uiNumTiles];
+		m_puBinEnd		= new unsigned int[uiNumTiles];
+		m_puTileJobs	= new unsigned int[uiNumTiles];
+		m_uiMaxTiles	= uiNumTiles;
+		}
+	memset(m_puBinEnd, 0, uiNumTiles * sizeof(unsigned int));
+
+	unsigned int uiBinned = 0;
+	for(unsigned int uiPass = 0; uiPass < 2; ++uiPass)
+		{
+		for(unsigned int i = 0; i < m_uiNumTriangles; ++i)
+			{
+			const Triangle& Tri = m_pTriangles[i];
+			if(Tri.nX0 >= Tri.nX1)
+				continue;
+
+			int nTileX0 = Tri.nX0 / SOFT_TILE_SIZE, nTileX1 = (Tri.nX1 - 1) / SOFT_TILE_SIZE;
+			int nTileY0 = Tri.nY0 / SOFT_TILE_SIZE, nTileY1 = (Tri.nY1 - 1) / SOFT_TILE_SIZE;
+			bool bTest = nTileX0 != nTileX1 || nTileY0 != nTileY1;
+			for(int nTileY = nTileY0; nTileY <= nTileY1; ++nTileY)
+				{
+				for(int nTileX = nTileX0; nTileX <= nTileX1; ++nTileX)
+					{
+					// Skip tiles every edge's most inside pixel centre is still outside of
+					if(bTest)
+						{
+						float fX0 = nTileX * SOFT_TILE_SIZE + 0.5f, fX1 = PVRT_MIN((nTileX + 1) * SOFT_TILE_SIZE, m_nWidth) - 0.5f;
+						float fY0 = nTileY * SOFT_TILE_SIZE + 0.5f, fY1 = PVRT_MIN((nTileY + 1) * SOFT_TILE_SIZE, m_nHeight) - 0.5f;
+						bool bOutside = false;
+						for(unsigned int e = 0; e < 3 && !bOutside; ++e)
+							{
+							const float* pfEdge = Tri.aafEdge[e];
+							bOutside = pfEdge[0] * (pfEdge[0] > 0.0f ? fX1 : fX0) + pfEdge[1] * (pfEdge[1] > 0.0f ? fY1 : fY0) + pfEdge[2] < 0.0f;
+							}
+						if(bOutside)
+							continue;
+						}
+
+					unsigned int uiTile = nTileY * m_nTilesX + nTileX;
+					if(uiPass)
+						m_puBinned[m_puBinEnd[uiTile]++] = i;
+					else
+						++m_puBinEnd[uiTile];
+					}
+				}
+			}
+
+		if(uiPass)
+			break;
+
+		// Turn the counts into ranges
+		uiBinned = 0;
+		for(unsigned int t = 0; t < uiNumTiles; ++t)
+			{
+			m_puBinStart[t] = uiBinned;
+			uiBinned += m_puBinEnd[t];
+			m_puBinEnd[t] = m_puBinStart[t];
+			}
+		SoftGrow(m_puBinned, 0, m_uiMaxBinned, uiBinned);
+		}
+
+	// Tiles with triangles, or a clear
+	m_uiNumTileJobs = 0;
+	for(unsigned int t = 0; t < uiNumTiles; ++t)
+		{
+		int nX = (t % m_nTilesX) * SOFT_TILE_SIZE, nY = (t / m_nTilesX) * SOFT_TILE_SIZE;
+		bool bCleared = (m_bClearColour || m_bClearDepth) &&
+						nX < m_ClearRect.nX + m_ClearRect.nWidth && nX + SOFT_TILE_SIZE > m_ClearRect.nX &&
+						nY < m_ClearRect.nY + m_ClearRect.nHeight && nY + SOFT_TILE_SIZE > m_ClearRect.nY;
+		if(bCleared || m_puBinEnd[t] > m_puBinStart[t])
+			m_puTileJobs[m_uiNumTileJobs++] = t;
+		}
+	return uiBinned;
+	}
+
+// ---------------------------------------------------------------
+void CSoftRasterizer::TileJob(void* pUserData, unsigned int uiBegin, unsigned int uiEnd, unsigned int uiThread)
+	{
+	CSoftRasterizer* pRaster = (CSoftRasterizer*)pUserData;
+	for(unsigned int i = uiBegin; i < uiEnd; ++i)
+		pRaster->RasterTile(pRaster->m_puTileJobs[i], uiThread);
+	}
+
+// ---------------------------------------------------------------
+void CSoftRasterizer::RasterTile(unsigned int uiTile, unsigned int uiThread)
+	{
+	int nX0 = (uiTile % m_nTilesX) * SOFT_TILE_SIZE, nY0 = (uiTile / m_nTilesX) * SOFT_TILE_SIZE;
+	int nX1 = PVRT_MIN(nX0 + SOFT_TILE_SIZE, m_nWidth), nY1 = PVRT_MIN(nY0 + SOFT_TILE_SIZE, m_nHeight);
+
+	// The tile's part of the clear first
+	if(m_bClearColour || m_bClearDepth)
+		{
+		int nClearX0 = PVRT_MAX(nX0, m_ClearRect.nX), nClearX1 = PVRT_MIN(nX1, m_ClearRect.nX + m_ClearRect.nWidth);
+		int nClearY0 = PVRT_MAX(nY0, m_ClearRect.nY), nClearY1 = PVRT_MIN(nY1, m_ClearRect.nY + m_ClearRect.nHeight);
+		for(int y = nClearY0; y < nClearY1; ++y)
+			{
+			for(int x = nClearX0; x < nClearX1; ++x)
+				{
+				if(m_bClearColour)	m_pColour->apuLevels[0][y * m_nWidth + x] = m_uiClearColour;
+				if(m_bClearDepth)	m_pDepth->pfDepth[y * m_nWidth + x] = m_fClearDepth;
+				}
+			}
+		}
+
+	for(unsigned int i = m_puBinStart[uiTile]; i < m_puBinEnd[uiTile]; ++i)
+		{
+		const Triangle& Tri = m_pTriangles[m_puBinned[i]];
+		RasterTriangle(Tri, PVRT_MAX(nX0, Tri.nX0), PVRT_MAX(nY0, Tri.nY0), PVRT_MIN(nX1, Tri.nX1), PVRT_MIN(nY1, Tri.nY1), uiThread);
+		}
+	}
+
+// ---------------------------------------------------------------
+void CSoftRasterizer::RasterTriangle(const Triangle& Tri, int nX0, int nY0, int nX1, int nY1, unsigned int uiThread)
+	{
+	const DrawCall& Call = m_pDraws[Tri.uiDraw];
+	const SoftProgram& Program = *Call.pProgram;
+	const void* pConstants = m_pucConstants + Call.uiConstants;
+	bool bDepthTest = m_pDepth && Call.State.eDepthFunc != GL_ALWAYS;
+	bool bGreater = Call.State.eDepthFunc == GL_GEQUAL;
+	float* pfDepth = (m_pDepth && (bDepthTest || Call.State.bDepthWrite)) ? m_pDepth->pfDepth : NULL;
+	unsigned int* puColour = (m_pColour && Program.pfnFragment) ? m_pColour->apuLevels[0] : NULL;
+
+	float afVaryings[SOFT_MAX_VARYINGS], afDX[SOFT_MAX_VARYINGS], afDY[SOFT_MAX_VARYINGS];
+	SoftFragment Fragment;
+	Fragment.pfVaryings	= afVaryings;
+	Fragment.pfDX		= afDX;
+	Fragment.pfDY		= afDY;
+	Fragment.ppTextures	= Call.apTextures;
+
+	unsigned int uiFragments = 0;
+	for(int y = nY0; y < nY1; ++y)
+		{
+		float fY = y + 0.5f;
+		for(int x = nX0; x < nX1; x += 4)
+			{
+			unsigned int uiMask = SoftEdgeMask(Tri.aafEdge, Tri.uiTopLeft, x + 0.5f, fY);
+			if(nX1 - x < 4)
+				uiMask &= (1 << (nX1 - x)) - 1;
+
+			for(unsigned int uiLane = 0; uiMask; ++uiLane, uiMask >>= 1)
+				{
+				if(!(uiMask & 1))
+					continue;
+
+				// Behind the camera, or in front of the near plane or past the far one
+				float fX = x + uiLane + 0.5f;
+				float fInvW = Tri.afInvW[0] * fX + Tri.afInvW[1] * fY + Tri.afInvW[2];
+				float fZ = Tri.afDepth[0] * fX + Tri.afDepth[1] * fY + Tri.afDepth[2];
+				if(fInvW <= 0.0f || fZ < -1.0f || fZ > 1.0f)
+					continue;
+
+				unsigned int uiPixel = y * m_nWidth + x + uiLane;
+				if(pfDepth)
+					{
+					float fDepth = fZ * 0.5f + 0.5f;
+					if(bDepthTest && (bGreater ? fDepth < pfDepth[uiPixel] : fDepth > pfDepth[uiPixel]))
+						continue;
+					if(Call.State.bDepthWrite)
+						pfDepth[uiPixel] = fDepth;
+					}
+				++uiFragments;
+				if(!puColour)
+					continue;
+
+				// Each varying over w, divided by 1 / w. The derivatives come from the same planes by the quotient rule.
+				float fW = 1.0f / fInvW;
+				for(unsigned int v = 0; v < Program.uiNumVaryings; ++v)
+					afVaryings[v] = (Tri.aafVaryings[v][0] * fX + Tri.aafVaryings[v][1] * fY + Tri.aafVaryings[v][2]) * fW;
+				for(unsigned int v = 0; v < Program.uiNumGradients; ++v)
+					{
+					afDX[v] = (Tri.aafVaryings[v][0] - afVaryings[v] * Tri.afInvW[0]) * fW;
+					afDY[v] = (Tri.aafVaryings[v][1] - afVaryings[v] * Tri.afInvW[1]) * fW;
+					}
+
+				float afColour[4];
+				Program.pfnFragment(pConstants, Fragment, afColour);
+				puColour[uiPixel] = BlendSoftColour(afColour, puColour[uiPixel], Call.State.eBlend);
+				}
+			}
+		}
+	m_aThreadStats[uiThread].dFragments += uiFragments;
+	}
+
+// ---------------------------------------------------------------
+SoftPassStats& CSoftRasterizer::GetStats(const char* pszName)
+	{
+	for(unsigned int i = 0; i < m_uiNumStats; ++i)
+		{
+		if(strcmp(m_aStats[i].pszName, pszName) == 0)
+			return m_aStats[i];
+		}
+
+	// Passes past the last slot share it
+	if(m_uiNumStats == SOFT_MAX_PASS_STATS)
+		return m_aStats[SOFT_MAX_PASS_STATS - 1];
+	SoftPassStats& Stats = m_aStats[m_uiNumStats++];
+	memset(&Stats, 0, sizeof(Stats));
+	Stats.pszName = pszName;
+	return Stats;
+	}
+
+// ---------------------------------------------------------------
+// Runs the pass: vertices, triangle setup and tiles in parallel, binning in between
+void CSoftRasterizer::EndPass()
+	{
+	ASSERT(m_pszPass && m_pJobs);
+	SoftGrow(m_pVertices, 0, m_uiMaxVertices, m_uiNumVertices);
+	SoftGrow(m_pTriangles, 0, m_uiMaxTriangles, m_uiNumTriangles);
+	for(unsigned int i = 0; i < JOB_MAX_THREADS; ++i)
+		m_aThreadStats[i].dFragments = 0.0;
+
+	double dVertexMS = GetTimeMS();
+	if(m_uiNumVertices)
+		m_pJobs->ParallelFor(VertexJob, this, m_uiNumVertices, SOFT_VERTEX_GRAIN);
+	double dSetupMS = GetTimeMS();
+	if(m_uiNumTriangles)
+		m_pJobs->ParallelFor(SetupJob, this, m_uiNumTriangles, SOFT_TRIANGLE_GRAIN);
+	double dBinMS = GetTimeMS();
+	unsigned int uiBinned = Bin();
+	double dRasterMS = GetTimeMS();
+	if(m_uiNumTileJobs)
+		m_pJobs->ParallelFor(TileJob, this, m_uiNumTileJobs, 1);
+	double dEndMS = GetTimeMS();
+
+	SoftPassStats& Stats = GetStats(m_pszPass);
+	++Stats.uiRuns;
+	Stats.uiDraws		+= m_uiNumDraws;
+	Stats.uiTriangles	+= m_uiNumTriangles;
+	Stats.uiBinned		+= uiBinned;
+	Stats.uiTiles		+= m_uiNumTileJobs;
+	Stats.dVertexMS		+= dSetupMS - dVertexMS;
+	Stats.dSetupMS		+= dBinMS - dSetupMS;
+	Stats.dBinMS		+= dRasterMS - dBinMS;
+	Stats.dRasterMS		+= dEndMS - dRasterMS;
+	for(unsigned int i = 0; i < m_uiNumTriangles; ++i)
+		Stats.uiRasterized += m_pTriangles[i].nX0 < m_pTriangles[i].nX1 ? 1 : 0;
+	for(unsigned int i = 0; i < JOB_MAX_THREADS; ++i)
+		Stats.dFragments += m_aThreadStats[i].dFragments;
+
+	m_pszPass = NULL;
+	}
+
+// ------------------------------------- The effects, in C++. Each takes its uniforms from a constants struct.
+
+// ---------------------------------------------------------------
+// The compressed vertex attributes, decoded as the vertex shaders do it. See CompressMesh.
+inline void DecodeSoftPosition(const CompactVertexFormat& Format, const unsigned char* pVertex, float* pfOut)
+	{
+	const short* pnPos = (const short*)(pVertex + Format.nPosOffset);
+	for(unsigned int c = 0; c < 3; ++c)
+		pfOut[c] = DecodeSNorm(pnPos[c]) * Format.vPosScale.ptr()[c] + Format.vPosBias.ptr()[c];
+	}
+
+inline void DecodeSoftUV(const CompactVertexFormat& Format, unsigned int uiSet, const unsigned char* pVertex, float* pfOut)
+	{
+	const unsigned short* puUV = (const unsigned short*)(pVertex + Format.anUVOffset[uiSet]);
+	for(unsigned int c = 0; c < 2; ++c)
+		pfOut[c] = puUV[c] / 65535.0f * Format.vUVScaleBias[uiSet].ptr()[c] + Format.vUVScaleBias[uiSet].ptr()[c + 2];
+	}
+
+// ---------------------------------------------------------------
+// mx * (x, y, z, w), column major as GL has it
+inline void SoftTransform(const PVRTMat4& mx, const float* pfIn, float fW, float* pfOut)
+	{
+	const float* f = mx.f;
+	for(unsigned int r = 0; r < 4; ++r)
+		pfOut[r] = f[r] * pfIn[0] + f[4 + r] * pfIn[1] + f[8 + r] * pfIn[2] + f[12 + r] * fW;
+	}
+
+// ---------------------------------------------------------------
+// SimpleShader.vsh. It has no varyings.
+void SoftSimpleVertex(const void* pConstants, const unsigned char* pVertex, float* pfPosition, float* /*pfVaryings*/)
+	{
+	const SoftSimpleConstants& Constants = *(const SoftSimpleConstants*)pConstants;
+	float afPos[3];
+	DecodeSoftPosition(Constants.Format, pVertex, afPos);
+	SoftTransform(Constants.mxMVP, afPos, 1.0f, pfPosition);
+	}
+
+// ---------------------------------------------------------------
+// StatueShader.vsh and StatueBloom1.vsh. Varyings: TexCoord, L in tangent space, and vHalfVector for the statue shader.
+void SoftStatueVertex(const void* pConstants, const unsigned char* pVertex, float* pfPosition, float* pfVaryings)
+	{
+	const SoftStatueConstants& Constants = *(const SoftStatueConstants*)pConstants;
+	const CompactVertexFormat& Format = Constants.Format;
+	float afPos[3], afEyePos[4];
+	PVRTVec3 vNormal, vTangent;
+	DecodeSoftPosition(Format, pVertex, afPos);
+	OctDecode((const short*)(pVertex + Format.nNrmOffset), vNormal.ptr());
+	OctDecode((const short*)(pVertex + Format.nTanOffset), vTangent.ptr());
+	SoftTransform(Constants.mxMVP, afPos, 1.0f, pfPosition);
+	SoftTransform(Constants.mxModelView, afPos, 1.0f, afEyePos);
+	DecodeSoftUV(Format, 0, pVertex, pfVaryings);
+
+	PVRTVec3 vEyeDir = -PVRTVec3(afEyePos[0], afEyePos[1], afEyePos[2]).normalized();
+	PVRTVec3 vLightDir = (Constants.vLightPos - PVRTVec3(afPos[0], afPos[1], afPos[2])).normalized();
+	PVRTVec3 vBitangent = vNormal.cross(vTangent);
+	PVRTVec3 vL(vLightDir.dot(vTangent), vLightDir.dot(vBitangent), vLightDir.dot(vNormal));
+	PVRTVec3 vHalf = (vL + vEyeDir).normalized();
+	pfVaryings[2] = vL.x;		pfVaryings[3] = vL.y;		pfVaryings[4] = vL.z;
+	pfVaryings[5] = vHalf.x;	pfVaryings[6] = vHalf.y;	pfVaryings[7] = vHalf.z;
+	}
+
+// ---------------------------------------------------------------
+// The normal map's normal, and N.L with it
+inline float GetSoftStatueLighting(const SoftFragment& Fragment, PVRTVec3& vNormal)
+	{
+	const float* pfV = Fragment.pfVaryings;
+	float afTexel[4];
+	SampleSoftTexture(*Fragment.ppTextures[0], pfV[0], pfV[1], Fragment.pfDX, Fragment.pfDY, afTexel);
+	vNormal = PVRTVec3(afTexel[0] * 2.0f - 1.0f, afTexel[1] * 2.0f - 1.0f, afTexel[2] * 2.0f - 1.0f).normalized();
+	return PVRT_MAX(vNormal.dot(PVRTVec3(pfV[2], pfV[3], pfV[4]).normalized()), 0.0f);
+	}
+
+// ---------------------------------------------------------------
+// StatueShader.fsh
+void SoftStatueFragment(const void* pConstants, const SoftFragment& Fragment, float* pfColour)
+	{
+	const SoftStatueConstants& Constants = *(const SoftStatueConstants*)pConstants;
+	PVRTVec3 vNormal;
+	float fNdotL = GetSoftStatueLighting(Fragment, vNormal);
+	float fSpecular = 0.0f;
+	if(fNdotL > 0.0f)
+		{
+		const float* pfV = Fragment.pfVaryings;
+		fSpecular = (float)pow(PVRT_MAX(vNormal.dot(PVRTVec3(pfV[5], pfV[6], pfV[7])), 0.0f), Constants.fShininess);
+		}
+	for(unsigned int c = 0; c < 3; ++c)
+		pfColour[c] = fNdotL * Constants.vDiffuse.ptr()[c] + fSpecular * Constants.vSpecular.ptr()[c];
+	pfColour[3] = 1.0f;
+	}
+
+// ---------------------------------------------------------------
+// StatueBloom1.fsh. The bloom map is read at level 0, where GL would pick the level from N.L's derivatives.
+void SoftBloom1Fragment(const void* pConstants, const SoftFragment& Fragment, float* pfColour)
+	{
+	const SoftStatueConstants& Constants = *(const SoftStatueConstants*)pConstants;
+	PVRTVec3 vNormal;
+	float fNdotL = GetSoftStatueLighting(Fragment, vNormal);
+	SampleSoftTexture(*Fragment.ppTextures[1], fNdotL, 0.0f, NULL, NULL, pfColour);
+	for(unsigned int c = 0; c < 4; ++c)
+		pfColour[c] *= Constants.fBloomMulti;
+	}
+
+// ---------------------------------------------------------------
+// ChurchShader.vsh, with and without USE_SHADOW_MAP and USE_REFLECTION. Varyings: both texture coordinates, then the
+// shadow map's and the reflection's projected coordinates.
+void SoftChurchVertex(const void* pConstants, const unsigned char* pVertex, float* pfPosition, float* pfVaryings)
+	{
+	const SoftChurchConstants& Constants = *(const SoftChurchConstants*)pConstants;
+	float afPos[3], afViewPos[4];
+	DecodeSoftPosition(Constants.Format, pVertex, afPos);
+	SoftTransform(Constants.mxModelView, afPos, 1.0f, afViewPos);
+	SoftTransform(Constants.mxProjection, afViewPos, afViewPos[3], pfPosition);
+	DecodeSoftUV(Constants.Format, 0, pVertex, pfVaryings);
+	DecodeSoftUV(Constants.Format, 1, pVertex, pfVaryings + 2);
+	if(Constants.bShadow)
+		SoftTransform(Constants.mxTexProjection, afViewPos, afViewPos[3], pfVaryings + 4);
+	if(Constants.bReflection)
+		SoftTransform(Constants.mxReflProjection, afViewPos, afViewPos[3], pfVaryings + 8);
+	}
+
+// ---------------------------------------------------------------
+// ChurchShader.fsh, likewise
+void SoftChurchFragment(const void* pConstants, const SoftFragment& Fragment, float* pfColour)
+	{
+	const SoftChurchConstants& Constants = *(const SoftChurchConstants*)pConstants;
+	const float* pfV = Fragment.pfVaryings;
+	float afTexel[4], afLightmap[4];
+	SampleSoftTexture(*Fragment.ppTextures[0], pfV[0], pfV[1], Fragment.pfDX, Fragment.pfDY, afTexel);
+	SampleSoftTexture(*Fragment.ppTextures[2], pfV[2], pfV[3], Fragment.pfDX + 2, Fragment.pfDY + 2, afLightmap);
+	for(unsigned int c = 0; c < 3; ++c)
+		pfColour[c] = afTexel[c] * afLightmap[c];
+	pfColour[3] = 1.0f;
+	if(!Constants.bShadow)
+		return;
+
+	float fShadow = PVRT_MAX(1.0f - SampleSoftDepth(*Fragment.ppTextures[1], pfV[4] / pfV[7], pfV[5] / pfV[7]), 0.5f);
+	for(unsigned int c = 0; c < 3; ++c)
+		pfColour[c] *= fShadow;
+	if(!Constants.bReflection)
+		{
+		pfColour[3] = Constants.fAlpha;
+		return;
+		}
+
+	float afReflection[4];
+	SampleSoftTexture(*Fragment.ppTextures[3], pfV[8] / pfV[11], pfV[9] / pfV[11], NULL, NULL, afReflection);
+	for(unsigned int c = 0; c < 3; ++c)
+		pfColour[c] = afReflection[c] + (pfColour[c] - afReflection[c]) * Constants.fAlpha;
+	}
+
+// ---------------------------------------------------------------
+// BloomBlur.vsh and ScreenAlignedTexture.vsh. The varying is the texture coordinate.
+void SoftQuadVertex(const void* pConstants, const unsigned char* pVertex, float* pfPosition, float* pfVaryings)
+	{
+	const float* pfCorner = ((const SoftQuadConstants*)pConstants)->aafCorners[*pVertex];
+	pfPosition[0] = pfCorner[0];
+	pfPosition[1] = pfCorner[1];
+	pfPosition[2] = 0.0f;
+	pfPosition[3] = 1.0f;
+	pfVaryings[0] = pfCorner[2];
+	pfVaryings[1] = pfCorner[3];
+	}
+
+// ---------------------------------------------------------------
+// ScreenAlignedTexture.fsh
+void SoftSATexFragment(const void* /*pConstants*/, const SoftFragment& Fragment, float* pfColour)
+	{
+	SampleSoftTexture(*Fragment.ppTextures[0], Fragment.pfVaryings[0], Fragment.pfVaryings[1], NULL, NULL, pfColour);
+	}
+
+// ---------------------------------------------------------------
+// Adds a tap of the source to pfColour
+inline void AddSoftTap(const SoftFragment& Fragment, float fU, float fV, float fWeight, float* pfColour)
+	{
+	float afTexel[4];
+	SampleSoftTexture(*Fragment.ppTextures[0], Fragment.pfVaryings[0] + fU, Fragment.pfVaryings[1] + fV, NULL, NULL, afTexel);
+	for(unsigned int c = 0; c < 3; ++c)
+		pfColour[c] += afTexel[c] * fWeight;
+	}
+
+// ---------------------------------------------------------------
+// BloomBlur.fsh with DOWNSAMPLE
+void SoftBloomDownFragment(const void* pConstants, const SoftFragment& Fragment, float* pfColour)
+	{
+	const float* pfTexel = ((const SoftQuadConstants*)pConstants)->afTexelOffset;
+	pfColour[0] = pfColour[1] = pfColour[2] = 0.0f;
+	pfColour[3] = 1.0f;
+	AddSoftTap(Fragment, 0.0f, 0.0f, 0.5f, pfColour);
+	for(unsigned int i = 0; i < 4; ++i)
+		AddSoftTap(Fragment, (i & 1) ? pfTexel[0] : -pfTexel[0], (i & 2) ? pfTexel[1] : -pfTexel[1], 0.125f, pfColour);
+	}
+
+// ---------------------------------------------------------------
+// BloomBlur.fsh with UPSAMPLE
+void SoftBloomUpFragment(const void* pConstants, const SoftFragment& Fragment, float* pfColour)
+	{
+	const float* pfTexel = ((const SoftQuadConstants*)pConstants)->afTexelOffset;
+	pfColour[0] = pfColour[1] = pfColour[2] = 0.0f;
+	pfColour[3] = 1.0f;
+	AddSoftTap(Fragment, -pfTexel[0], 0.0f, 1.0f / 12.0f, pfColour);
+	AddSoftTap(Fragment,  pfTexel[0], 0.0f, 1.0f / 12.0f, pfColour);
+	AddSoftTap(Fragment, 0.0f, -pfTexel[1], 1.0f / 12.0f, pfColour);
+	AddSoftTap(Fragment, 0.0f,  pfTexel[1], 1.0f / 12.0f, pfColour);
+	for(unsigned int i = 0; i < 4; ++i)
+		AddSoftTap(Fragment, (i & 1) ? pfTexel[0] * 0.5f : -pfTexel[0] * 0.5f, (i & 2) ? pfTexel[1] * 0.5f : -pfTexel[1] * 0.5f, 2.0f / 12.0f, pfColour);
+	}
+
+// ---------------------------------------------------------------
+// BloomBlur.fsh: one direction of the Gaussian
+void SoftBloomBlurFragment(const void* pConstants, const SoftFragment& Fragment, float* pfColour)
+	{
+	const SoftQuadConstants& Constants = *(const SoftQuadConstants*)pConstants;
+	const float* pfTexel = Constants.afTexelOffset;
+	pfColour[0] = pfColour[1] = pfColour[2] = 0.0f;
+	pfColour[3] = 1.0f;
+	AddSoftTap(Fragment, 0.0f, 0.0f, Constants.afTaps[1], pfColour);
+	for(unsigned int i = 1; i < SOFT_MAX_TAPS; ++i)
+		{
+		const float* pfTap = &Constants.afTaps[i * 2];
+		AddSoftTap(Fragment, pfTexel[0] * pfTap[0], pfTexel[1] * pfTap[0], pfTap[1], pfColour);
+		AddSoftTap(Fragment, -pfTexel[0] * pfTap[0], -pfTexel[1] * pfTap[0], pfTap[1], pfColour);
+		}
+	}
+
+const SoftProgram c_SoftPrograms[enumSOFTPROGRAM_MAX] =
+	{
+	{ "Simple",				SoftSimpleVertex,	NULL,					0,	0 },
+	{ "Statue",				SoftStatueVertex,	SoftStatueFragment,		8,	2 },
+	{ "Bloom1",				SoftStatueVertex,	SoftBloom1Fragment,		5,	2 },
+	{ "Church",				SoftChurchVertex,	SoftChurchFragment,		8,	4 },
+	{ "ChurchRefl",			SoftChurchVertex,	SoftChurchFragment,		4,	4 },
+	{ "Floor",				SoftChurchVertex,	SoftChurchFragment,		12,	4 },
+	{ "ScreenAlignedTex",	SoftQuadVertex,		SoftSATexFragment,		2,	0 },
+	{ "BloomDown",			SoftQuadVertex,		SoftBloomDownFragment,	2,	0 },
+	{ "BloomUp",			SoftQuadVertex,		SoftBloomUpFragment,	2,	0 },
+	{ "BloomBlur",			SoftQuadVertex,		SoftBloomBlurFragment,	2,	0 },
+	};
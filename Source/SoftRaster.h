@@ -0,0 +1,283 @@
+#ifndef _SOFTRASTER_H_
+#define _SOFTRASTER_H_
+
+#include "JobSystem.h"
+#include "CompactVertex.h"
+
+// A CPU backend, for machines with no usable GPU and as a reference. It draws the same packets the GL path does, through
+// C++ versions of the GPUPrograms shaders. Each pass is deferred to EndPass and then run the way a tile based GPU would:
+// the vertices are shaded and the triangles set up across the job system's threads, the triangles are binned into
+// SOFT_TILE_SIZE tiles in the order they were drawn, and each tile is rasterized by one job. A pixel is only ever written
+// by the job with its tile, in draw order, so the image is the same whatever the thread count.
+// Triangles are rasterized in 2D homogeneous coordinates (Olano and Greer), so nothing is clipped: the near and far
+// planes become a per-pixel test on depth, as GL's clipping would have it. Coverage is tested four pixels at a time.
+#define SOFT_TILE_SIZE			32
+#define SOFT_MAX_VARYINGS		12
+#define SOFT_MAX_TEXTURES		4
+#define SOFT_MAX_LEVELS			14			// Mip levels, so up to 8192 texels across
+#define SOFT_MAX_PASS_STATS		16
+#define SOFT_VERTEX_GRAIN		256
+#define SOFT_TRIANGLE_GRAIN		128
+
+// A texture or a render target. Colour is RGBA8, packed as PVRTRGBA does it, and rows run bottom up as GL has them.
+struct SoftTexture
+	{
+	int				nWidth;							// Of level 0
+	int				nHeight;
+	unsigned int	uiNumLevels;					// Of colour. 0 for a depth target.
+	unsigned int*	apuLevels[SOFT_MAX_LEVELS];
+	float*			pfDepth;						// Window space depth, 0 to 1
+	bool			bClamp;							// GL_CLAMP_TO_EDGE rather than GL_REPEAT
+	};
+
+void InitSoftTexture(SoftTexture* pTexture);
+
+void ReleaseSoftTexture(SoftTexture* pTexture);
+
+// One level of colour, or depth, cleared to 0. Targets are sampled with clamping, as the frame graph sets them up.
+void CreateSoftTarget(SoftTexture* pTexture, int nWidth, int nHeight, bool bDepth);
+
+// Decodes a .pvr file and its mip chain. Only what the demo ships is handled: PVRTC, and RGBA8888 for anything else.
+bool LoadSoftTexture(const void* pPVR, bool bClamp, SoftTexture* pTexture);
+
+// GL_LINEAR_MIPMAP_LINEAR, with the level picked from the texture coordinates' screen space derivatives. Without
+// derivatives, or with one level, it's GL_LINEAR on level 0.
+void SampleSoftTexture(const SoftTexture& Texture, float fU, float fV, const float* pfDX, const float* pfDY, float* pfOut);
+
+// GL_LINEAR filtering of a depth target, as texture2D reads a depth texture with no compare mode
+float SampleSoftDepth(const SoftTexture& Texture, float fU, float fV);
+
+// FNV-1a over level 0, to tell whether two renders match
+unsigned int HashSoftTexture(const SoftTexture& Texture);
+
+// Writes level 0 as an uncompressed 32 bit TGA. TGA rows go bottom up too, so nothing needs flipping.
+bool WriteSoftTGA(const char* pszPath, const SoftTexture& Texture);
+
+enum enumSOFTBLEND
+	{
+	enumSOFTBLEND_None,
+	enumSOFTBLEND_Alpha,				// GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA
+	enumSOFTBLEND_Add,					// GL_ONE, GL_ONE
+	};
+
+// The fixed function state a draw is made with. There's always a scissor; make it the viewport when none is wanted.
+struct SoftState
+	{
+	PixelRect		Viewport;
+	PixelRect		Scissor;
+	GLenum			eCullFace;			// GL_BACK, GL_FRONT or GL_NONE
+	GLenum			eDepthFunc;			// GL_GEQUAL, GL_LEQUAL or GL_ALWAYS. No depth target is GL_ALWAYS.
+	bool			bDepthWrite;
+	unsigned int	eBlend;				// enumSOFTBLEND
+	};
+
+// What a fragment program is given for its pixel
+struct SoftFragment
+	{
+	const float*				pfVaryings;		// Perspective correct, as GLSL's are
+	const float*				pfDX;			// Screen space derivatives of the program's first uiNumGradients varyings
+	const float*				pfDY;
+	const SoftTexture* const*	ppTextures;		// By texture unit
+	};
+
+typedef void (*PFNSOFTVERTEX)(const void* pConstants, const unsigned char* pVertex, float* pfPosition, float* pfVaryings);
+typedef void (*PFNSOFTFRAGMENT)(const void* pConstants, const SoftFragment& Fragment, float* pfColour);
+
+// A C++ version of one of the effects
+struct SoftProgram
+	{
+	const char*			pszName;
+	PFNSOFTVERTEX		pfnVertex;
+	PFNSOFTFRAGMENT		pfnFragment;			// NULL writes depth only, like a colour mask of GL_FALSE
+	unsigned int		uiNumVaryings;
+	unsigned int		uiNumGradients;
+	};
+
+// Totals for one pass name since ResetCounters. A pass may be run more than once a frame.
+struct SoftPassStats
+	{
+	const char*		pszName;
+	unsigned int	uiRuns;
+	unsigned int	uiDraws;
+	unsigned int	uiTriangles;			// Drawn
+	unsigned int	uiRasterized;			// Left after culling and clipping
+	unsigned int	uiBinned;				// Triangle and tile pairs
+	unsigned int	uiTiles;				// Tile jobs
+	double			dFragments;				// Pixels that passed the depth test
+	double			dVertexMS;
+	double			dSetupMS;
+	double			dBinMS;
+	double			dRasterMS;
+	};
+
+class CSoftRasterizer
+	{
+	private:
+		struct DrawCall
+			{
+			const SoftProgram*		pProgram;
+			unsigned int			uiConstants;			// Offset into m_pucConstants
+			const SoftTexture*		apTextures[SOFT_MAX_TEXTURES];
+			SoftState				State;
+			const unsigned char*	pucVertices;
+			unsigned int			uiStride;
+			const unsigned short*	puIndices;
+			unsigned int			uiFirstVertex;			// In m_pVertices
+			unsigned int			uiNumVertices;
+			unsigned int			uiFirstTriangle;		// In m_pTriangles
+			unsigned int			uiNumTriangles;
+			};
+
+		struct Vertex
+			{
+			float				afPosition[4];				// Clip space
+			float				afVaryings[SOFT_MAX_VARYINGS];
+			};
+
+		// A set up triangle. Each plane is a, b and c of a * x + b * y + c at pixel centre x, y.
+		struct Triangle
+			{
+			float				aafEdge[3][3];				// Vertex i's barycentric over w. All three >= 0 inside.
+			float				afInvW[3];					// 1 / w: the sum of the edges
+			float				afDepth[3];					// NDC z, which is linear in screen space
+			float				aafVaryings[SOFT_MAX_VARYINGS][3];	// Each varying over w
+			unsigned int		uiTopLeft;					// A bit per edge
+			int					nX0, nY0, nX1, nY1;			// Pixels it may cover. Empty when culled.
+			unsigned int		uiDraw;
+			};
+
+		// Written by their own thread only, and padded so neighbours don't share a cache line
+		struct ThreadStats
+			{
+			double			dFragments;
+			char			aPad[64 - sizeof(double)];
+			};
+
+		CJobSystem*			m_pJobs;
+		const char*			m_pszPass;
+		SoftTexture*		m_pColour;
+		SoftTexture*		m_pDepth;
+		int					m_nWidth;
+		int					m_nHeight;
+		int					m_nTilesX;
+		int					m_nTilesY;
+
+		PixelRect			m_ClearRect;
+		bool				m_bClearColour;
+		bool				m_bClearDepth;
+		unsigned int		m_uiClearColour;
+		float				m_fClearDepth;
+
+		DrawCall*			m_pDraws;
+		unsigned int		m_uiNumDraws, m_uiMaxDraws;
+		unsigned char*		m_pucConstants;				// Each draw's copy of its constants
+		unsigned int		m_uiConstantBytes, m_uiMaxConstantBytes;
+		Vertex*				m_pVertices;
+		unsigned int		m_uiNumVertices, m_uiMaxVertices;
+		Triangle*			m_pTriangles;
+		unsigned int		m_uiNumTriangles, m_uiMaxTriangles;
+		unsigned int*		m_puBinned;					// Triangle indices, by tile then draw order
+		unsigned int		m_uiMaxBinned;
+		unsigned int*		m_puBinStart;				// Per tile, into m_puBinned
+		unsigned int*		m_puBinEnd;
+		unsigned int*		m_puTileJobs;				// Tiles with anything to do
+		unsigned int		m_uiNumTileJobs, m_uiMaxTiles;
+
+		SoftPassStats		m_aStats[SOFT_MAX_PASS_STATS];
+		unsigned int		m_uiNumStats;
+		ThreadStats			m_aThreadStats[JOB_MAX_THREADS];
+
+		static void VertexJob(void* pUserData, unsigned int uiBegin, unsigned int uiEnd, unsigned int uiThread);
+		static void SetupJob(void* pUserData, unsigned int uiBegin, unsigned int uiEnd, unsigned int uiThread);
+		static void TileJob(void* pUserData, unsigned int uiBegin, unsigned int uiEnd, unsigned int uiThread);
+		unsigned int FindDraw(unsigned int uiIndex, bool bTriangle) const;
+		void SetupTriangle(unsigned int uiTriangle, unsigned int uiDraw);
+		unsigned int Bin();
+		void RasterTile(unsigned int uiTile, unsigned int uiThread);
+		void RasterTriangle(const Triangle& Tri, int nX0, int nY0, int nX1, int nY1, unsigned int uiThread);
+		SoftPassStats& GetStats(const char* pszName);
+
+		CSoftRasterizer(const CSoftRasterizer&);
+		CSoftRasterizer& operator=(const CSoftRasterizer&);
+
+	public:
+		CSoftRasterizer();
+		~CSoftRasterizer()							{ Release(); }
+
+		void SetJobSystem(CJobSystem* pJobs)		{ m_pJobs = pJobs; }
+		void Release();
+
+		void BeginPass(const char* pszName, SoftTexture* pColour, SoftTexture* pDepth);
+		void Clear(const PixelRect& Rect, const float* pfColour, const float* pfDepth);
+		void Draw(const SoftProgram* pProgram, const void* pConstants, unsigned int uiConstantBytes, const SoftTexture* const* ppTextures, const SoftState& State,
+				  const void* pVertices, unsigned int uiStride, unsigned int uiNumVertices, const unsigned short* puIndices, unsigned int uiNumIndices);
+		void EndPass();
+
+		void ResetCounters()						{ m_uiNumStats = 0; }
+		unsigned int GetNumPassStats() const		{ return m_uiNumStats; }
+		const SoftPassStats& GetPassStats(unsigned int i) const	{ return m_aStats[i]; }
+	};
+
+
+// ------------------------------------- The effects, in C++. Each takes its uniforms from a constants struct.
+#define SOFT_MAX_TAPS			8			// BloomBlur's linear-sampled Gaussian taps, centre included
+
+struct SoftSimpleConstants
+	{
+	PVRTMat4				mxMVP;
+	CompactVertexFormat		Format;				// Only the position scale and bias. The depth stream's positions start each vertex.
+	};
+
+struct SoftStatueConstants
+	{
+	PVRTMat4				mxMVP;
+	PVRTMat4				mxModelView;
+	PVRTVec3				vLightPos;
+	float					fBloomMulti;		// StatueBloom1 only
+	PVRTVec3				vDiffuse;			// StatueShader's constants
+	PVRTVec3				vSpecular;
+	float					fShininess;
+	CompactVertexFormat		Format;
+	};
+
+struct SoftChurchConstants
+	{
+	PVRTMat4				mxModelView;
+	PVRTMat4				mxProjection;
+	PVRTMat4				mxTexProjection;	// USE_SHADOW_MAP
+	PVRTMat4				mxReflProjection;	// USE_REFLECTION
+	float					fAlpha;
+	bool					bShadow;
+	bool					bReflection;
+	CompactVertexFormat		Format;
+	};
+
+// The bloom pyramid's and the composite's screen aligned quads. Each vertex is an index into afCorners.
+struct SoftQuadConstants
+	{
+	float					aafCorners[4][4];	// x, y in NDC and u, v. Bottom left, bottom right, top left, top right.
+	float					afTexelOffset[2];
+	float					afTaps[SOFT_MAX_TAPS * 2];		// BloomBlur's Gaussian
+	};
+
+const unsigned char c_aucSoftQuadVertices[] = { 0, 1, 2, 3 };
+const unsigned short c_auSoftQuadIndices[] = { 0, 1, 2, 2, 1, 3 };
+
+enum enumSOFTPROGRAM
+	{
+	enumSOFTPROGRAM_Simple,
+	enumSOFTPROGRAM_Statue,
+	enumSOFTPROGRAM_Bloom1,
+	enumSOFTPROGRAM_Church,
+	enumSOFTPROGRAM_ChurchRefl,
+	enumSOFTPROGRAM_Floor,
+	enumSOFTPROGRAM_ScreenAlignedTex,
+	enumSOFTPROGRAM_BloomDown,
+	enumSOFTPROGRAM_BloomUp,
+	enumSOFTPROGRAM_BloomBlur,
+	enumSOFTPROGRAM_MAX,
+	};
+
+extern const SoftProgram c_SoftPrograms[enumSOFTPROGRAM_MAX];
+
+#endif // _SOFTRASTER_H_
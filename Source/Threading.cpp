@@ -0,0 +1,97 @@
+#include "Threading.h"
+
+// ---------------------------------------------------------------
+bool StartThread(ThreadHandle* pThread, PFNTHREADMAIN pfnMain, void* pUserData)
+	{
+#if defined(_WIN32)
+	*pThread = CreateThread(NULL, 0, pfnMain, pUserData, 0, NULL);
+	return *pThread != NULL;
+#else
+	return pthread_create(pThread, NULL, pfnMain, pUserData) == 0;
+#endif
+	}
+
+// ---------------------------------------------------------------
+void JoinThread(ThreadHandle Thread)
+	{
+#if defined(_WIN32)
+	WaitForSingleObject(Thread, INFINITE);
+	CloseHandle(Thread);
+#else
+	pthread_join(Thread, NULL);
+#endif
+	}
+
+// ---------------------------------------------------------------
+void YieldThread()
+	{
+#if defined(_WIN32)
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+	}
+
+// ---------------------------------------------------------------
+long AtomicAdd(volatile long* pnValue, long nDelta)
+	{
+#if defined(_WIN32)
+	return InterlockedExchangeAdd(pnValue, nDelta) + nDelta;
+#else
+	return __sync_add_and_fetch(pnValue, nDelta);
+#endif
+	}
+
+// ---------------------------------------------------------------
+unsigned int GetCPUCount()
+	{
+#if defined(_WIN32)
+	SYSTEM_INFO Info;
+	GetSystemInfo(&Info);
+	return Info.dwNumberOfProcessors;
+#else
+	long nCount = sysconf(_SC_NPROCESSORS_ONLN);
+	return nCount > 0 ? (unsigned int)nCount : 1;
+#endif
+	}
+
+#if defined(_WIN32)
+// ---------------------------------------------------------------
+CSemaphore::CSemaphore()						{ m_hSemaphore = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL); }
+CSemaphore::~CSemaphore()						{ CloseHandle(m_hSemaphore); }
+void CSemaphore::Post(unsigned int uiCount)		{ ReleaseSemaphore(m_hSemaphore, (LONG)uiCount, NULL); }
+void CSemaphore::Wait()							{ WaitForSingleObject(m_hSemaphore, INFINITE); }
+#else
+// ---------------------------------------------------------------
+CSemaphore::CSemaphore() : m_uiCount(0)
+	{
+	pthread_mutex_init(&m_Mutex, NULL);
+	pthread_cond_init(&m_Cond, NULL);
+	}
+
+// ---------------------------------------------------------------
+CSemaphore::~CSemaphore()
+	{
+	pthread_cond_destroy(&m_Cond);
+	pthread_mutex_destroy(&m_Mutex);
+	}
+
+// ---------------------------------------------------------------
+void CSemaphore::Post(unsigned int uiCount)
+	{
+	pthread_mutex_lock(&m_Mutex);
+	m_uiCount += uiCount;
+	pthread_cond_broadcast(&m_Cond);
+	pthread_mutex_unlock(&m_Mutex);
+	}
+
+// ---------------------------------------------------------------
+void CSemaphore::Wait()
+	{
+	pthread_mutex_lock(&m_Mutex);
+	while(m_uiCount == 0)
+		pthread_cond_wait(&m_Cond, &m_Mutex);
+	--m_uiCount;
+	pthread_mutex_unlock(&m_Mutex);
+	}
+#endif
@@ -0,0 +1,90 @@
+#ifndef _THREADING_H_
+#define _THREADING_H_
+
+#include "Common.h"
+
+// Minimal wrappers over Win32 and pthreads
+#if defined(_WIN32)
+typedef HANDLE				ThreadHandle;
+typedef LPTHREAD_START_ROUTINE	PFNTHREADMAIN;
+#define THREAD_MAIN(name)	DWORD WINAPI name(LPVOID pUserData)
+#define THREAD_RETURN		return 0
+#else
+typedef pthread_t			ThreadHandle;
+typedef void* (*PFNTHREADMAIN)(void*);
+#define THREAD_MAIN(name)	void* name(void* pUserData)
+#define THREAD_RETURN		return NULL
+#endif
+
+bool StartThread(ThreadHandle* pThread, PFNTHREADMAIN pfnMain, void* pUserData);
+void JoinThread(ThreadHandle Thread);
+
+// Gives up the rest of the thread's time slice
+void YieldThread();
+
+// Adds nDelta to *pnValue as one atomic operation, with a full barrier, and returns the new value
+long AtomicAdd(volatile long* pnValue, long nDelta);
+
+unsigned int GetCPUCount();
+
+class CMutex
+	{
+	private:
+#if defined(_WIN32)
+		CRITICAL_SECTION	m_Section;
+#else
+		pthread_mutex_t		m_Mutex;
+#endif
+
+		CMutex(const CMutex&);
+		CMutex& operator=(const CMutex&);
+
+	public:
+#if defined(_WIN32)
+		CMutex()			{ InitializeCriticalSection(&m_Section); }
+		~CMutex()			{ DeleteCriticalSection(&m_Section); }
+		void Lock()			{ EnterCriticalSection(&m_Section); }
+		void Unlock()		{ LeaveCriticalSection(&m_Section); }
+#else
+		CMutex()			{ pthread_mutex_init(&m_Mutex, NULL); }
+		~CMutex()			{ pthread_mutex_destroy(&m_Mutex); }
+		void Lock()			{ pthread_mutex_lock(&m_Mutex); }
+		void Unlock()		{ pthread_mutex_unlock(&m_Mutex); }
+#endif
+	};
+
+// Locks a CMutex for the lifetime of the scope
+class CMutexLock
+	{
+	private:
+		CMutex&				m_Mutex;
+
+	public:
+		CMutexLock(CMutex& Mutex) : m_Mutex(Mutex)	{ m_Mutex.Lock(); }
+		~CMutexLock()								{ m_Mutex.Unlock(); }
+	};
+
+// Counting semaphore
+class CSemaphore
+	{
+	private:
+#if defined(_WIN32)
+		HANDLE				m_hSemaphore;
+#else
+		pthread_mutex_t		m_Mutex;
+		pthread_cond_t		m_Cond;
+		unsigned int		m_uiCount;
+#endif
+
+		CSemaphore(const CSemaphore&);
+		CSemaphore& operator=(const CSemaphore&);
+
+	public:
+		CSemaphore();
+		~CSemaphore();
+
+		void Post(unsigned int uiCount = 1);
+		void Wait();
+	};
+
+#endif // _THREADING_H_